@@ -22,6 +22,7 @@
 #include <rabbit-std/sqstdmath.hpp>
 #include <rabbit-std/sqstdstring.hpp>
 #include <rabbit-std/sqstdaux.hpp>
+#include <rabbit-std/sqstdisolate.hpp>
 
 void PrintVersionInfos();
 
@@ -73,6 +74,7 @@ void PrintUsage()
 	fprintf(stderr,"usage: sq <options> <scriptpath [args]>.\n"
 		"Available options are:\n"
 		"   -d			  generates debug infos\n"
+		"   -s <snapshot>   restores a heap snapshot (see writesnapshottofile) before running\n"
 		"   -v			  displays version infos\n"
 		"   -h			  prints help\n");
 }
@@ -100,6 +102,23 @@ int getargs(rabbit::VirtualMachine* v,int argc, char* argv[],int64_t *retval)
 					sq_enabledebuginfo(v,1);
 					break;
 					break;
+				case 's':
+					if(arg+1 >= argc) {
+						PrintUsage();
+						*retval = -1;
+						return _ERROR;
+					}
+					arg++;
+					if(SQ_FAILED(rabbit::std::readsnapshotfromfile(v,argv[arg]))) {
+						const char *err;
+						sq_getlasterror(v);
+						if(SQ_SUCCEEDED(sq_getstring(v,-1,&err))) {
+							printf("error [%s]\n",err);
+						}
+						*retval = -2;
+						return _ERROR;
+					}
+					break;
 				case 'v':
 					PrintVersionInfos();
 					return _DONE;
@@ -182,6 +201,8 @@ void Interactive(rabbit::VirtualMachine* v)
 	sq_pushstring(v,"quit",-1);
 	sq_pushuserpointer(v,&done);
 	sq_newclosure(v,quit,1);
+	sq_setnativeclosurename(v,-1,"quit");
+	sq_bindnative(v,-1,"rabbit","quit");
 	sq_setparamscheck(v,1,NULL);
 	sq_newslot(v,-3,SQFalse);
 	sq_pop(v,1);
@@ -267,6 +288,7 @@ int main(int argc, char* argv[])
 	rabbit::std::register_systemlib(v);
 	rabbit::std::register_mathlib(v);
 	rabbit::std::register_stringlib(v);
+	rabbit::std::register_isolatelib(v);
 
 	//aux library
 	//sets error handlers
@@ -27,25 +27,31 @@ def get_version():
 
 def configure(target, my_module):
 	my_module.add_src_file([
+	    'rabbit/Allocator.cpp',
 	    'rabbit/Array.cpp',
 	    'rabbit/AutoDec.cpp',
+	    'rabbit/BytecodeImage.cpp',
 	    'rabbit/Class.cpp',
 	    'rabbit/ClassMember.cpp',
 	    'rabbit/Closure.cpp',
+	    'rabbit/Collectable.cpp',
 	    'rabbit/Compiler.cpp',
 	    'rabbit/Delegable.cpp',
 	    'rabbit/ExceptionTrap.cpp',
 	    'rabbit/FuncState.cpp',
 	    'rabbit/FunctionInfo.cpp',
 	    'rabbit/FunctionProto.cpp',
+	    'rabbit/GcStats.cpp',
 	    'rabbit/Generator.cpp',
 	    'rabbit/Hash.cpp',
+	    'rabbit/InlineCache.cpp',
 	    'rabbit/Instance.cpp',
 	    'rabbit/Instruction.cpp',
 	    'rabbit/Lexer.cpp',
 	    'rabbit/LineInfo.cpp',
 	    'rabbit/LocalVarInfo.cpp',
 	    'rabbit/MemberHandle.cpp',
+	    'rabbit/MemoryStats.cpp',
 	    'rabbit/MetaMethod.cpp',
 	    'rabbit/NativeClosure.cpp',
 	    'rabbit/Object.cpp',
@@ -57,13 +63,17 @@ def configure(target, my_module):
 	    'rabbit/RefCounted.cpp',
 	    'rabbit/RefTable.cpp',
 	    'rabbit/RegFunction.cpp',
+	    'rabbit/Shape.cpp',
 	    'rabbit/SharedState.cpp',
+	    'rabbit/Snapshot.cpp',
 	    'rabbit/StackInfos.cpp',
 	    'rabbit/String.cpp',
 	    'rabbit/StringTable.cpp',
+	    'rabbit/StructuredClone.cpp',
 	    'rabbit/Table.cpp',
 	    'rabbit/UserData.cpp',
 	    'rabbit/VirtualMachine.cpp',
+	    'rabbit/VirtualStack.cpp',
 	    'rabbit/WeakRef.cpp',
 	    'rabbit/sqapi.cpp',
 	    'rabbit/sqbaselib.cpp',
@@ -75,28 +85,35 @@ def configure(target, my_module):
 	    'z',
 	    'm',
 	    'c',
+	    'pthread',
 	    'etk-base',
 	    ])
 	my_module.add_header_file([
+	    'rabbit/Allocator.hpp',
 	    'rabbit/Array.hpp',
 	    'rabbit/AutoDec.hpp',
+	    'rabbit/BytecodeImage.hpp',
 	    'rabbit/Class.hpp',
 	    'rabbit/ClassMember.hpp',
 	    'rabbit/Closure.hpp',
+	    'rabbit/Collectable.hpp',
 	    'rabbit/Compiler.hpp',
 	    'rabbit/Delegable.hpp',
 	    'rabbit/ExceptionTrap.hpp',
 	    'rabbit/FuncState.hpp',
 	    'rabbit/FunctionInfo.hpp',
 	    'rabbit/FunctionProto.hpp',
+	    'rabbit/GcStats.hpp',
 	    'rabbit/Generator.hpp',
 	    'rabbit/Hash.hpp',
+	    'rabbit/InlineCache.hpp',
 	    'rabbit/Instance.hpp',
 	    'rabbit/Instruction.hpp',
 	    'rabbit/Lexer.hpp',
 	    'rabbit/LineInfo.hpp',
 	    'rabbit/LocalVarInfo.hpp',
 	    'rabbit/MemberHandle.hpp',
+	    'rabbit/MemoryStats.hpp',
 	    'rabbit/MetaMethod.hpp',
 	    'rabbit/NativeClosure.hpp',
 	    'rabbit/Object.hpp',
@@ -108,13 +125,17 @@ def configure(target, my_module):
 	    'rabbit/RefCounted.hpp',
 	    'rabbit/RefTable.hpp',
 	    'rabbit/RegFunction.hpp',
+	    'rabbit/Shape.hpp',
 	    'rabbit/SharedState.hpp',
+	    'rabbit/Snapshot.hpp',
 	    'rabbit/StackInfos.hpp',
 	    'rabbit/String.hpp',
 	    'rabbit/StringTable.hpp',
+	    'rabbit/StructuredClone.hpp',
 	    'rabbit/Table.hpp',
 	    'rabbit/UserData.hpp',
 	    'rabbit/VirtualMachine.hpp',
+	    'rabbit/VirtualStack.hpp',
 	    'rabbit/WeakRef.hpp',
 	    'rabbit/rabbit.hpp',
 	    'rabbit/sqconfig.hpp',
@@ -33,12 +33,14 @@ def configure(target, my_module):
 		'rabbit-std/sqstdsystem.cpp',
 		'rabbit-std/sqstdio.cpp',
 		'rabbit-std/sqstdblob.cpp',
+		'rabbit-std/sqstdisolate.cpp',
 		'rabbit-std/sqstdmath.cpp',
 		'rabbit-std/sqstdstring.cpp',
 		])
 	my_module.compile_version("c++", 2011)
 	my_module.add_depend([
-		'rabbit-core'
+		'rabbit-core',
+		'pthread',
 		])
 	my_module.add_header_file([
 		'rabbit-std/sqstdstring.hpp',
@@ -49,6 +51,7 @@ def configure(target, my_module):
 		'rabbit-std/sqstdstream.hpp',
 		'rabbit-std/sqstdio.hpp',
 		'rabbit-std/sqstdblob.hpp',
+		'rabbit-std/sqstdisolate.hpp',
 		])
 	return True
 
@@ -167,6 +167,72 @@ static int64_t _blob__cloned(rabbit::VirtualMachine* v)
 	return 0;
 }
 
+//structured clone (see sq_registercloneclass): a flag telling if the buffer was moved, the size, then the bytes or
+//the address of the moved buffer and its allocated size
+static rabbit::Result _blob_clonewrite(rabbit::UserPointer p, rabbit::Bool transfer, SQWRITEFUNC write, rabbit::UserPointer up)
+{
+	rabbit::std::Blob *self = (rabbit::std::Blob*)p;
+	if(!self || !self->IsValid())
+		return SQ_ERROR;
+	uint8_t moved = transfer ? 1 : 0;
+	int64_t size = self->Len();
+	if(write(up,&moved,sizeof(moved)) != sizeof(moved) || write(up,&size,sizeof(size)) != sizeof(size))
+		return SQ_ERROR;
+	if(moved) {
+		int64_t allocated;
+		unsigned char *buf = self->detach(allocated);
+		if(write(up,&buf,sizeof(buf)) != sizeof(buf) || write(up,&allocated,sizeof(allocated)) != sizeof(allocated))
+			return SQ_ERROR;
+	}
+	else if(size > 0 && write(up,self->getBuf(),size) != size)
+		return SQ_ERROR;
+	return SQ_OK;
+}
+
+static rabbit::Result _blob_cloneread(rabbit::VirtualMachine* v, int64_t idx, rabbit::Bool transfer, SQREADFUNC read, rabbit::UserPointer up)
+{
+	uint8_t moved;
+	int64_t size;
+	if(read(up,&moved,sizeof(moved)) != sizeof(moved) || read(up,&size,sizeof(size)) != sizeof(size) || size < 0)
+		return SQ_ERROR;
+	//an address is only valid in a stream written with transfer by this process
+	if(moved > 1 || (moved && !transfer))
+		return SQ_ERROR;
+	rabbit::std::Blob *b = NULL;
+	if(moved) {
+		unsigned char *buf;
+		int64_t allocated;
+		if(read(up,&buf,sizeof(buf)) != sizeof(buf) || read(up,&allocated,sizeof(allocated)) != sizeof(allocated) || allocated < size)
+			return SQ_ERROR;
+		b = new (rabbit::sq_malloc(sizeof(rabbit::std::Blob)))rabbit::std::Blob(0);
+		b->adopt(buf,size,allocated);
+	}
+	else {
+		//the buffer grows with the bytes actually read: a corrupted size does not allocate it at once
+		b = new (rabbit::sq_malloc(sizeof(rabbit::std::Blob)))rabbit::std::Blob(0);
+		int64_t done = 0;
+		while(done < size) {
+			int64_t n = size - done;
+			if(n > done + 4096)
+				n = done + 4096;
+			b->GrowBufOf(n);
+			if(read(up,(unsigned char *)b->getBuf() + done,n) != n) {
+				b->~Blob();
+				rabbit::sq_free(b,sizeof(rabbit::std::Blob));
+				return SQ_ERROR;
+			}
+			done += n;
+		}
+	}
+	if(SQ_FAILED(rabbit::sq_setinstanceup(v,idx,b))) {
+		b->~Blob();
+		rabbit::sq_free(b,sizeof(rabbit::std::Blob));
+		return SQ_ERROR;
+	}
+	rabbit::sq_setreleasehook(v,idx,_blob_releasehook);
+	return SQ_OK;
+}
+
 #define _DECL_BLOB_FUNC(name,nparams,typecheck) {#name,_blob_##name,nparams,typecheck}
 static const rabbit::RegFunction _blob_methods[] = {
 	_DECL_BLOB_FUNC(constructor,-1,"xn"),
@@ -278,6 +344,17 @@ rabbit::UserPointer rabbit::std::createblob(rabbit::VirtualMachine* v, int64_t s
 
 rabbit::Result rabbit::std::register_bloblib(rabbit::VirtualMachine* v)
 {
-	return declare_stream(v,"blob",(rabbit::UserPointer)SQSTD_BLOB_TYPE_TAG,"std_blob",_blob_methods,bloblib_funcs);
+	if(SQ_FAILED(declare_stream(v,"blob",(rabbit::UserPointer)SQSTD_BLOB_TYPE_TAG,"std_blob",_blob_methods,bloblib_funcs)))
+		return SQ_ERROR;
+	//the blobs can be cloned and transferred between shared states
+	rabbit::sq_pushregistrytable(v);
+	rabbit::sq_pushstring(v,"std_blob",-1);
+	rabbit::Result res = rabbit::sq_get(v,-2);
+	if(SQ_SUCCEEDED(res)) {
+		res = rabbit::sq_registercloneclass(v,-1,"blob",_blob_clonewrite,_blob_cloneread);
+		rabbit::sq_pop(v,1);
+	}
+	rabbit::sq_pop(v,1);
+	return res;
 }
 
@@ -104,6 +104,24 @@ struct Blob : public SQStream
 	int64_t Tell() { return _ptr; }
 	int64_t Len() { return _size; }
 	rabbit::UserPointer getBuf(){ return _buf; }
+	//give the buffer ('allocated' bytes from sq_malloc) to the caller, the blob is left empty
+	unsigned char *detach(int64_t &allocated) {
+		unsigned char *buf = _buf;
+		allocated = _allocated;
+		_buf = NULL;
+		_size = 0;
+		_allocated = 0;
+		_ptr = 0;
+		return buf;
+	}
+	//take the buffer returned by detach()
+	void adopt(unsigned char *buf, int64_t size, int64_t allocated) {
+		sq_free(_buf, _allocated);
+		_buf = buf;
+		_size = size;
+		_allocated = allocated;
+		_ptr = 0;
+	}
 private:
 	int64_t _size;
 	int64_t _allocated;
@@ -8,10 +8,20 @@
 
 #include <new>
 #include <stdio.h>
+#include <string.h>
 #include <rabbit/rabbit.hpp>
 #include <rabbit-std/sqstdio.hpp>
 #include <rabbit-std/sqstdstream.hpp>
 
+// the bytecode cache maps its images in memory when the system allows it (read in a buffer otherwise)
+#if defined(__unix__) || defined(__APPLE__)
+	#define SQSTD_USE_MMAP
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
 #define SQSTD_FILE_TYPE_TAG ((uint64_t)(SQSTD_STREAM_TYPE_TAG | 0x00000001))
 //basic API
 rabbit::std::SQFILE rabbit::std::fopen(const char *filename ,const char *mode)
@@ -303,6 +313,143 @@ int64_t file_write(rabbit::UserPointer file,rabbit::UserPointer p,int64_t size)
 	return rabbit::std::fwrite(p,1,size,(rabbit::std::SQFILE)file);
 }
 
+//64 bits FNV-1a of the source and of its name (kept in the debug infos of the image)
+static uint64_t _io_sourcehash(const char *source,int64_t size,const char *filename)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(int64_t iii=0; iii<size; ++iii) {
+		hash = (hash ^ (unsigned char)source[iii]) * 0x100000001b3ULL;
+	}
+	for(const char *it=filename; *it!='\0'; ++it) {
+		hash = (hash ^ (unsigned char)*it) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static int64_t _io_unmapfile(rabbit::UserPointer data,int64_t size)
+{
+#ifdef SQSTD_USE_MMAP
+	munmap(data,size);
+#else
+	rabbit::sq_free(data,size);
+#endif
+	return 0;
+}
+
+//map the file 'path' (read only), released by _io_unmapfile
+static bool _io_mapfile(const char *path,rabbit::UserPointer *data,int64_t *size)
+{
+#ifdef SQSTD_USE_MMAP
+	int fd = open(path,O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd,&st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void *ptr = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(ptr == MAP_FAILED) {
+		return false;
+	}
+	*data = ptr;
+	*size = st.st_size;
+	return true;
+#else
+	rabbit::std::SQFILE file = rabbit::std::fopen(path,"rb");
+	if(!file) {
+		return false;
+	}
+	rabbit::std::fseek(file,0,SQ_SEEK_END);
+	int64_t len = rabbit::std::ftell(file);
+	rabbit::std::fseek(file,0,SQ_SEEK_SET);
+	if(len <= 0) {
+		rabbit::std::fclose(file);
+		return false;
+	}
+	//8 bytes aligned, as the image requires
+	void *ptr = rabbit::sq_malloc(len);
+	if(rabbit::std::fread(ptr,1,len,file) != len) {
+		rabbit::sq_free(ptr,len);
+		rabbit::std::fclose(file);
+		return false;
+	}
+	rabbit::std::fclose(file);
+	*data = ptr;
+	*size = len;
+	return true;
+#endif
+}
+
+//directory of the bytecode cache (see setbytecodecache), NULL when disabled
+static const char *_io_bytecodecache(rabbit::VirtualMachine* v)
+{
+	const char *dir = NULL;
+	sq_pushregistrytable(v);
+	sq_pushstring(v,"std_bytecodecache",-1);
+	if(SQ_SUCCEEDED(sq_rawget(v,-2))) {
+		//the registry keeps the string alive
+		if(SQ_FAILED(sq_getstring(v,-1,&dir))) {
+			dir = NULL;
+		}
+		sq_pop(v,1);
+	}
+	sq_pop(v,1);
+	return dir;
+}
+
+//load the source through the bytecode cache 'cachedir': the image of the source is used when it exists,
+//otherwise the source is compiled and its image written in the cache for the next loads
+static rabbit::Result _io_loadcached(rabbit::VirtualMachine* v,const char *source,int64_t size,const char *filename,const char *cachedir,rabbit::Bool printerror)
+{
+	uint64_t hash = _io_sourcehash(source,size,filename);
+	char path[1024];
+	snprintf(path,sizeof(path),"%s/%016llx.rbi",cachedir,(unsigned long long)hash);
+	rabbit::UserPointer data;
+	int64_t datasize;
+	if(    _io_mapfile(path,&data,&datasize)
+	    && SQ_SUCCEEDED(sq_readimage(v,data,datasize,hash,_io_unmapfile))) {
+		return SQ_OK;
+	}
+	//missing, stale or invalid image: compile the source
+	if(SQ_FAILED(sq_compilebuffer(v,source,size,filename,printerror))) {
+		return SQ_ERROR;
+	}
+	//written aside then renamed: the concurrent loads never see a partial image
+	char tmppath[1100];
+#ifdef SQSTD_USE_MMAP
+	snprintf(tmppath,sizeof(tmppath),"%s.%d.tmp",path,(int)getpid());
+#else
+	snprintf(tmppath,sizeof(tmppath),"%s.tmp",path);
+#endif
+	rabbit::std::SQFILE out = rabbit::std::fopen(tmppath,"wb");
+	if(out) {
+		bool written = SQ_SUCCEEDED(sq_writeimage(v,file_write,out,hash));
+		rabbit::std::fclose(out);
+		if(!written || rename(tmppath,path) != 0) {
+			remove(tmppath);
+		}
+	}
+	//the cache is best effort, the compiled closure is on the stack anyway
+	return SQ_OK;
+}
+
+rabbit::Result rabbit::std::setbytecodecache(rabbit::VirtualMachine* v,const char *directory)
+{
+	sq_pushregistrytable(v);
+	sq_pushstring(v,"std_bytecodecache",-1);
+	if(directory) {
+		sq_pushstring(v,directory,-1);
+	} else {
+		sq_pushnull(v);
+	}
+	sq_newslot(v,-3,SQFalse);
+	sq_pop(v,1);
+	return SQ_OK;
+}
+
 rabbit::Result rabbit::std::loadfile(rabbit::VirtualMachine* v,const char *filename,rabbit::Bool printerror)
 {
 	SQFILE file = rabbit::std::fopen(filename,"rb");
@@ -317,6 +464,16 @@ rabbit::Result rabbit::std::loadfile(rabbit::VirtualMachine* v,const char *filen
 			//probably an empty file
 			us = 0;
 		}
+		if(us == SQ_BYTECODE_STREAM_TAG) {
+			//precompiled file (writeclosuretofile)
+			rabbit::std::fseek(file,0,SQ_SEEK_SET);
+			if(SQ_SUCCEEDED(sq_readclosure(v,file_read,file))) {
+				rabbit::std::fclose(file);
+				return SQ_OK;
+			}
+			rabbit::std::fclose(file);
+			return SQ_ERROR;
+		}
 		switch (us) {
 			//gotta swap the next 2 lines on BIG endian machines
 			case 0xFFFE:
@@ -342,6 +499,25 @@ rabbit::Result rabbit::std::loadfile(rabbit::VirtualMachine* v,const char *filen
 				break;
 				// ascii
 		}
+		rabbit::UserPointer data;
+		int64_t datasize;
+		int64_t start = rabbit::std::ftell(file);
+		if(    func == _io_file_lexfeed_PLAIN
+		    && _io_mapfile(filename,&data,&datasize)
+		    && datasize >= start) {
+			//the lexer scans the mapped source (after the byte order mark) in place
+			const char *source = (const char *)data + start;
+			const char *cachedir = _io_bytecodecache(v);
+			rabbit::Result res;
+			if(cachedir != NULL) {
+				res = _io_loadcached(v,source,datasize - start,filename,cachedir,printerror);
+			} else {
+				res = sq_compilebuffer(v,source,datasize - start,filename,printerror);
+			}
+			_io_unmapfile(data,datasize);
+			rabbit::std::fclose(file);
+			return res;
+		}
 		IOBuffer buffer;
 		buffer.ptr = 0;
 		buffer.size = 0;
@@ -373,6 +549,76 @@ rabbit::Result rabbit::std::dofile(rabbit::VirtualMachine* v,const char *filenam
 	return SQ_ERROR;
 }
 
+rabbit::Result rabbit::std::writeclosuretofile(rabbit::VirtualMachine* v,const char *filename)
+{
+	SQFILE file = rabbit::std::fopen(filename,"wb+");
+	if(!file) {
+		return sq_throwerror(v,"cannot open the file");
+	}
+	if(SQ_SUCCEEDED(sq_writeclosure(v,file_write,file))) {
+		rabbit::std::fclose(file);
+		return SQ_OK;
+	}
+	rabbit::std::fclose(file);
+	return SQ_ERROR; //forward the error
+}
+
+rabbit::Result rabbit::std::writesnapshottofile(rabbit::VirtualMachine* v,const char *filename)
+{
+	SQFILE file = rabbit::std::fopen(filename,"wb+");
+	if(!file) {
+		return sq_throwerror(v,"cannot open the file");
+	}
+	if(SQ_SUCCEEDED(sq_writesnapshot(v,file_write,file))) {
+		rabbit::std::fclose(file);
+		return SQ_OK;
+	}
+	rabbit::std::fclose(file);
+	return SQ_ERROR; //forward the error
+}
+
+rabbit::Result rabbit::std::readsnapshotfromfile(rabbit::VirtualMachine* v,const char *filename)
+{
+	SQFILE file = rabbit::std::fopen(filename,"rb");
+	if(!file) {
+		return sq_throwerror(v,"cannot open the file");
+	}
+	if(SQ_SUCCEEDED(sq_readsnapshot(v,file_read,file))) {
+		rabbit::std::fclose(file);
+		return SQ_OK;
+	}
+	rabbit::std::fclose(file);
+	return SQ_ERROR; //forward the error
+}
+
+rabbit::Result rabbit::std::writeclonetofile(rabbit::VirtualMachine* v,int64_t idx,const char *filename)
+{
+	SQFILE file = rabbit::std::fopen(filename,"wb+");
+	if(!file) {
+		return sq_throwerror(v,"cannot open the file");
+	}
+	if(SQ_SUCCEEDED(sq_writeclone(v,idx,SQFalse,file_write,file))) {
+		rabbit::std::fclose(file);
+		return SQ_OK;
+	}
+	rabbit::std::fclose(file);
+	return SQ_ERROR; //forward the error
+}
+
+rabbit::Result rabbit::std::readclonefromfile(rabbit::VirtualMachine* v,const char *filename)
+{
+	SQFILE file = rabbit::std::fopen(filename,"rb");
+	if(!file) {
+		return sq_throwerror(v,"cannot open the file");
+	}
+	if(SQ_SUCCEEDED(sq_readclone(v,SQFalse,file_read,file))) {
+		rabbit::std::fclose(file);
+		return SQ_OK;
+	}
+	rabbit::std::fclose(file);
+	return SQ_ERROR; //forward the error
+}
+
 int64_t _g_io_loadfile(rabbit::VirtualMachine* v)
 {
 	const char *filename;
@@ -400,10 +646,61 @@ int64_t _g_io_dofile(rabbit::VirtualMachine* v)
 	return SQ_ERROR; //propagates the error
 }
 
+int64_t _g_io_writeclosuretofile(rabbit::VirtualMachine* v)
+{
+	const char *filename;
+	sq_getstring(v,2,&filename);
+	if(SQ_SUCCEEDED(rabbit::std::writeclosuretofile(v,filename)))
+		return 1;
+	return SQ_ERROR; //propagates the error
+}
+
+int64_t _g_io_writesnapshottofile(rabbit::VirtualMachine* v)
+{
+	const char *filename;
+	sq_getstring(v,2,&filename);
+	if(SQ_SUCCEEDED(rabbit::std::writesnapshottofile(v,filename)))
+		return 0;
+	return SQ_ERROR; //propagates the error
+}
+
+int64_t _g_io_writeclonetofile(rabbit::VirtualMachine* v)
+{
+	const char *filename;
+	sq_getstring(v,2,&filename);
+	if(SQ_SUCCEEDED(rabbit::std::writeclonetofile(v,3,filename)))
+		return 0;
+	return SQ_ERROR; //propagates the error
+}
+
+int64_t _g_io_readclonefromfile(rabbit::VirtualMachine* v)
+{
+	const char *filename;
+	sq_getstring(v,2,&filename);
+	if(SQ_SUCCEEDED(rabbit::std::readclonefromfile(v,filename)))
+		return 1;
+	return SQ_ERROR; //propagates the error
+}
+
+int64_t _g_io_setbytecodecache(rabbit::VirtualMachine* v)
+{
+	const char *directory = NULL;
+	if(sq_gettype(v,2) == rabbit::OT_STRING) {
+		sq_getstring(v,2,&directory);
+	}
+	rabbit::std::setbytecodecache(v,directory);
+	return 0;
+}
+
 #define _DECL_GLOBALIO_FUNC(name,nparams,typecheck) {#name,_g_io_##name,nparams,typecheck}
 static const rabbit::RegFunction iolib_funcs[]={
 	_DECL_GLOBALIO_FUNC(loadfile,-2,".sb"),
 	_DECL_GLOBALIO_FUNC(dofile,-2,".sb"),
+	_DECL_GLOBALIO_FUNC(writeclosuretofile,3,".sc"),
+	_DECL_GLOBALIO_FUNC(setbytecodecache,2,".s|o"),
+	_DECL_GLOBALIO_FUNC(writesnapshottofile,2,".s"),
+	_DECL_GLOBALIO_FUNC(writeclonetofile,3,".s."),
+	_DECL_GLOBALIO_FUNC(readclonefromfile,2,".s"),
 	{NULL,(SQFUNCTION)0,0,NULL}
 };
 
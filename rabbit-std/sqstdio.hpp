@@ -42,7 +42,17 @@ rabbit::Result createfile(rabbit::VirtualMachine* v, SQFILE file,rabbit::Bool ow
 rabbit::Result getfile(rabbit::VirtualMachine* v, int64_t idx, SQFILE *file);
 
 //compiler helpers
+//loadfile compiles the source files and reads the precompiled ones (SQ_BYTECODE_STREAM_TAG)
 rabbit::Result loadfile(rabbit::VirtualMachine* v,const char *filename,rabbit::Bool printerror);
+rabbit::Result writeclosuretofile(rabbit::VirtualMachine* v,const char *filename);
+//directory where loadfile/dofile keep the bytecode images of the sources, by hash of their content (NULL: disabled)
+rabbit::Result setbytecodecache(rabbit::VirtualMachine* v,const char *directory);
+//heap snapshot of the VM (see sq_writesnapshot), the state that reads it must register the same libraries
+rabbit::Result writesnapshottofile(rabbit::VirtualMachine* v,const char *filename);
+rabbit::Result readsnapshotfromfile(rabbit::VirtualMachine* v,const char *filename);
+//structured clone of the value at 'idx' (see sq_writeclone), readclonefromfile pushes the value read
+rabbit::Result writeclonetofile(rabbit::VirtualMachine* v,int64_t idx,const char *filename);
+rabbit::Result readclonefromfile(rabbit::VirtualMachine* v,const char *filename);
 rabbit::Result dofile(rabbit::VirtualMachine* v,const char *filename,rabbit::Bool retval,rabbit::Bool printerror);
 
 rabbit::Result register_iolib(rabbit::VirtualMachine* v);
@@ -0,0 +1,515 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#include <new>
+#include <chrono>
+#include <rabbit/rabbit.hpp>
+#include <rabbit-std/sqstdisolate.hpp>
+#include <rabbit-std/sqstdblob.hpp>
+#include <rabbit-std/sqstdmath.hpp>
+#include <rabbit-std/sqstdstring.hpp>
+#include <rabbit-std/sqstdsystem.hpp>
+
+#ifndef SQ_ISOLATE_QUEUE_SIZE
+	#define SQ_ISOLATE_QUEUE_SIZE 1024
+#endif
+#define SQ_ISOLATE_MAX 256
+
+#define SQSTD_ISOLATEPOOL_TYPE_TAG ((uint64_t)0x80000100)
+
+namespace {
+	void isolatePrint(rabbit::VirtualMachine* SQ_UNUSED_ARG(v), const char *s, ...) {
+		va_list vl;
+		va_start(vl, s);
+		vfprintf(stdout, s, vl);
+		va_end(vl);
+	}
+	void isolateError(rabbit::VirtualMachine* SQ_UNUSED_ARG(v), const char *s, ...) {
+		va_list vl;
+		va_start(vl, s);
+		vfprintf(stderr, s, vl);
+		va_end(vl);
+	}
+	rabbit::Result defaultSetup(rabbit::VirtualMachine* v) {
+		rabbit::sq_setprintfunc(v, isolatePrint, isolateError);
+		rabbit::std::register_bloblib(v);
+		rabbit::std::register_systemlib(v);
+		rabbit::std::register_mathlib(v);
+		rabbit::std::register_stringlib(v);
+		return SQ_OK;
+	}
+	void setMessage(etk::Vector<char> &out, const char *message) {
+		out.resize(0);
+		for(const char *it=message; *it!='\0'; ++it) {
+			out.pushBack(*it);
+		}
+	}
+	//the last error of 'v' as a message
+	void lastMessage(rabbit::VirtualMachine* v, etk::Vector<char> &out) {
+		const char *message;
+		rabbit::sq_getlasterror(v);
+		if(SQ_FAILED(rabbit::sq_getstring(v, -1, &message))) {
+			message = "unknown error";
+		}
+		setMessage(out, message);
+		rabbit::sq_pop(v, 1);
+	}
+	//the last error of 'v' as a cloned string
+	void lastError(rabbit::VirtualMachine* v, rabbit::std::IsolateValue &out) {
+		rabbit::sq_getlasterror(v);
+		if(rabbit::sq_gettype(v, -1) != rabbit::OT_STRING) {
+			rabbit::sq_pop(v, 1);
+			rabbit::sq_pushstring(v, "unknown error", -1);
+		}
+		out.get(v, -1, false);
+		rabbit::sq_pop(v, 1);
+	}
+	int64_t cloneWrite(rabbit::UserPointer up, rabbit::UserPointer data, int64_t size) {
+		etk::Vector<uint8_t> *out = (etk::Vector<uint8_t> *)up;
+		uint64_t pos = out->size();
+		out->resize(pos + size);
+		memcpy(&(*out)[pos], data, size);
+		return size;
+	}
+	class CloneInput {
+		public:
+			const etk::Vector<uint8_t> *_data;
+			uint64_t _pos;
+	};
+	int64_t cloneRead(rabbit::UserPointer up, rabbit::UserPointer data, int64_t size) {
+		CloneInput *in = (CloneInput *)up;
+		if((uint64_t)size > in->_data->size() - in->_pos) {
+			return -1;
+		}
+		memcpy(data, &(*in->_data)[in->_pos], size);
+		in->_pos += size;
+		return size;
+	}
+}
+
+bool rabbit::std::IsolateValue::get(rabbit::VirtualMachine* v, int64_t idx, bool transfer) {
+	_clone.resize(0);
+	return SQ_SUCCEEDED(sq_writeclone(v, idx, transfer ? SQTrue : SQFalse, cloneWrite, &_clone));
+}
+
+bool rabbit::std::IsolateValue::push(rabbit::VirtualMachine* v) const {
+	CloneInput in;
+	in._data = &_clone;
+	in._pos = 0;
+	//the clones never leave the process
+	return SQ_SUCCEEDED(sq_readclone(v, SQTrue, cloneRead, &in));
+}
+
+rabbit::std::IsolateJob::IsolateJob() :
+  _entry(NULL),
+  _failed(false) {
+
+}
+
+rabbit::std::IsolatePool::IsolatePool(int64_t nbisolates) :
+  _image(NULL),
+  _imagesize(0),
+  _sourcehash(0),
+  _setup(NULL),
+  _nbisolates(nbisolates),
+  _threads(NULL),
+  _queue(NULL),
+  _queuemask(SQ_ISOLATE_QUEUE_SIZE - 1),
+  _enqueuepos(0),
+  _dequeuepos(0),
+  _pending(0),
+  _parked(0),
+  _stop(false),
+  _started(0) {
+	static_assert((SQ_ISOLATE_QUEUE_SIZE & (SQ_ISOLATE_QUEUE_SIZE - 1)) == 0, "SQ_ISOLATE_QUEUE_SIZE must be a power of 2");
+	_queue = (Slot *)sq_malloc(sizeof(Slot) * SQ_ISOLATE_QUEUE_SIZE);
+	for(uint64_t iii=0; iii<SQ_ISOLATE_QUEUE_SIZE; ++iii) {
+		new ((char*)&_queue[iii]) Slot();
+		_queue[iii]._sequence.store(iii, ::std::memory_order_relaxed);
+		_queue[iii]._job = NULL;
+	}
+}
+
+rabbit::std::IsolatePool::~IsolatePool() {
+	for(uint64_t iii=0; iii<SQ_ISOLATE_QUEUE_SIZE; ++iii) {
+		_queue[iii].~Slot();
+	}
+	sq_free(_queue, sizeof(Slot) * SQ_ISOLATE_QUEUE_SIZE);
+	if(_image != NULL) {
+		sq_free(_image, _imagesize);
+	}
+}
+
+rabbit::std::IsolatePool *rabbit::std::IsolatePool::create(const uint8_t *image, int64_t size, uint64_t sourcehash, int64_t nbisolates, SQISOLATESETUP setup, etk::Vector<char> *error) {
+	if(nbisolates < 1 || nbisolates > SQ_ISOLATE_MAX) {
+		if(error != NULL) {
+			setMessage(*error, "invalid number of isolates");
+		}
+		return NULL;
+	}
+	IsolatePool *pool = new (sq_malloc(sizeof(IsolatePool))) IsolatePool(nbisolates);
+	//8 bytes aligned, as the image requires
+	pool->_image = (uint8_t *)sq_malloc(size);
+	memcpy(pool->_image, image, size);
+	pool->_imagesize = size;
+	pool->_sourcehash = sourcehash;
+	pool->_setup = setup != NULL ? setup : defaultSetup;
+	pool->_threads = (::std::thread *)sq_malloc(sizeof(::std::thread) * nbisolates);
+	for(int64_t iii=0; iii<nbisolates; ++iii) {
+		new ((char*)&pool->_threads[iii]) ::std::thread(&IsolatePool::worker, pool);
+	}
+	bool failed;
+	{
+		::std::unique_lock<::std::mutex> lock(pool->_lock);
+		pool->_done.wait(lock, [pool]() { return pool->_started == pool->_nbisolates; });
+		failed = pool->_error.size() != 0;
+		if(failed && error != NULL) {
+			*error = pool->_error;
+		}
+	}
+	if(failed) {
+		pool->release();
+		return NULL;
+	}
+	return pool;
+}
+
+void rabbit::std::IsolatePool::release() {
+	_stop.store(true);
+	{
+		::std::lock_guard<::std::mutex> lock(_lock);
+		_wakeup.notify_all();
+	}
+	for(int64_t iii=0; iii<_nbisolates; ++iii) {
+		_threads[iii].join();
+		_threads[iii].~thread();
+	}
+	sq_free(_threads, sizeof(::std::thread) * _nbisolates);
+	this->~IsolatePool();
+	sq_free(this, sizeof(IsolatePool));
+}
+
+//bounded multi producer multi consumer queue: each slot carries the position it can be written (sequence == pos)
+//or read (sequence == pos + 1) at, the producers and the consumers only compete on their own position
+bool rabbit::std::IsolatePool::push(IsolateJob *job) {
+	uint64_t pos = _enqueuepos.load(::std::memory_order_relaxed);
+	for(;;) {
+		Slot &slot = _queue[pos & _queuemask];
+		int64_t diff = (int64_t)slot._sequence.load(::std::memory_order_acquire) - (int64_t)pos;
+		if(diff == 0) {
+			if(_enqueuepos.compare_exchange_weak(pos, pos + 1, ::std::memory_order_relaxed)) {
+				slot._job = job;
+				slot._sequence.store(pos + 1, ::std::memory_order_release);
+				return true;
+			}
+		} else if(diff < 0) {
+			//full
+			return false;
+		} else {
+			pos = _enqueuepos.load(::std::memory_order_relaxed);
+		}
+	}
+}
+
+bool rabbit::std::IsolatePool::pop(IsolateJob *&job) {
+	uint64_t pos = _dequeuepos.load(::std::memory_order_relaxed);
+	for(;;) {
+		Slot &slot = _queue[pos & _queuemask];
+		int64_t diff = (int64_t)slot._sequence.load(::std::memory_order_acquire) - (int64_t)(pos + 1);
+		if(diff == 0) {
+			if(_dequeuepos.compare_exchange_weak(pos, pos + 1, ::std::memory_order_relaxed)) {
+				job = slot._job;
+				slot._sequence.store(pos + _queuemask + 1, ::std::memory_order_release);
+				return true;
+			}
+		} else if(diff < 0) {
+			//empty
+			return false;
+		} else {
+			pos = _dequeuepos.load(::std::memory_order_relaxed);
+		}
+	}
+}
+
+void rabbit::std::IsolatePool::submit(IsolateJob *job) {
+	_pending.fetch_add(1);
+	while(!push(job)) {
+		::std::this_thread::yield();
+	}
+	//pairs with the one of worker(): either the isolate sees the job or this sees it parked
+	::std::atomic_thread_fence(::std::memory_order_seq_cst);
+	if(_parked.load() > 0) {
+		::std::lock_guard<::std::mutex> lock(_lock);
+		_wakeup.notify_one();
+	}
+}
+
+void rabbit::std::IsolatePool::wait() {
+	::std::unique_lock<::std::mutex> lock(_lock);
+	_done.wait(lock, [this]() { return _pending.load() == 0; });
+}
+
+bool rabbit::std::IsolatePool::startIsolate(rabbit::VirtualMachine* v) {
+	sq_pushroottable(v);
+	rabbit::Result res = _setup(v);
+	sq_settop(v, 0);
+	if(SQ_FAILED(res)) {
+		return false;
+	}
+	//no release hook: the image belongs to the pool
+	if(SQ_FAILED(sq_readimage(v, _image, _imagesize, _sourcehash, NULL))) {
+		return false;
+	}
+	sq_pushroottable(v);
+	res = sq_call(v, 1, SQFalse, SQTrue);
+	sq_settop(v, 0);
+	return SQ_SUCCEEDED(res);
+}
+
+void rabbit::std::IsolatePool::runJob(rabbit::VirtualMachine* v, IsolateJob *job) {
+	job->_failed = true;
+	//the argument is read first: a transferred one owns its native data
+	if(job->_arg.push(v)) {
+		sq_pushroottable(v);
+		sq_pushstring(v, job->_entry, -1);
+		if(SQ_FAILED(sq_get(v, -2))) {
+			sq_throwerror(v, "the entry function does not exist");
+		} else {
+			sq_pushroottable(v);
+			sq_push(v, 1);
+			//the values of the isolate are dropped: the result is transferred
+			if(    SQ_SUCCEEDED(sq_call(v, 2, SQTrue, SQTrue))
+			    && job->_result.get(v, -1, true)) {
+				job->_failed = false;
+			}
+		}
+	}
+	if(job->_failed) {
+		lastError(v, job->_result);
+	}
+	sq_settop(v, 0);
+}
+
+void rabbit::std::IsolatePool::worker() {
+	rabbit::VirtualMachine* v = sq_open();
+	{
+		bool ok = v != NULL && startIsolate(v);
+		::std::lock_guard<::std::mutex> lock(_lock);
+		if(!ok && _error.size() == 0) {
+			if(v == NULL) {
+				setMessage(_error, "cannot create the isolate");
+			} else {
+				lastMessage(v, _error);
+			}
+		}
+		_started++;
+		_done.notify_all();
+	}
+	for(;;) {
+		IsolateJob *job = NULL;
+		if(!pop(job)) {
+			::std::unique_lock<::std::mutex> lock(_lock);
+			_parked.fetch_add(1);
+			::std::atomic_thread_fence(::std::memory_order_seq_cst);
+			while(!pop(job) && !_stop.load()) {
+				_wakeup.wait(lock);
+			}
+			_parked.fetch_sub(1);
+			if(job == NULL) {
+				//stopped with an empty queue
+				break;
+			}
+		}
+		runJob(v, job);
+		if(_pending.fetch_sub(1) == 1) {
+			::std::lock_guard<::std::mutex> lock(_lock);
+			_done.notify_all();
+		}
+	}
+	if(v != NULL) {
+		sq_close(v);
+	}
+}
+
+//isolatepool class
+
+#define SETUP_ISOLATEPOOL(v) \
+	rabbit::std::IsolatePool *self = NULL; \
+	{ if(SQ_FAILED(rabbit::sq_getinstanceup(v,1,(rabbit::UserPointer*)&self,(rabbit::UserPointer)SQSTD_ISOLATEPOOL_TYPE_TAG)) || self == NULL) \
+		return rabbit::sq_throwerror(v,"invalid isolate pool"); }
+
+static int64_t _isolatepool_write(rabbit::UserPointer up, rabbit::UserPointer data, int64_t size)
+{
+	etk::Vector<uint8_t> *out = (etk::Vector<uint8_t> *)up;
+	for(int64_t iii=0; iii<size; ++iii) {
+		out->pushBack(((uint8_t *)data)[iii]);
+	}
+	return size;
+}
+
+static int64_t _isolatepool_releasehook(rabbit::UserPointer p, int64_t SQ_UNUSED_ARG(size))
+{
+	((rabbit::std::IsolatePool *)p)->release();
+	return 1;
+}
+
+static int64_t _isolatepool_constructor(rabbit::VirtualMachine* v)
+{
+	const char *source;
+	int64_t size;
+	int64_t nbisolates;
+	rabbit::sq_getstringandsize(v,2,&source,&size);
+	rabbit::sq_getinteger(v,3,&nbisolates);
+	//the image of the source compiled by the calling VM, given to every isolate
+	if(SQ_FAILED(rabbit::sq_compilebuffer(v,source,size,"isolate",SQTrue))) {
+		return SQ_ERROR;
+	}
+	etk::Vector<uint8_t> image;
+	rabbit::Result res = rabbit::sq_writeimage(v,_isolatepool_write,&image,0);
+	rabbit::sq_pop(v,1);
+	if(SQ_FAILED(res)) {
+		return SQ_ERROR;
+	}
+	etk::Vector<char> error;
+	rabbit::std::IsolatePool *pool = rabbit::std::IsolatePool::create(image.dataPointer(),image.size(),0,nbisolates,NULL,&error);
+	if(pool == NULL) {
+		error.pushBack('\0');
+		return rabbit::sq_throwerror(v,&error[0]);
+	}
+	rabbit::sq_setinstanceup(v,1,pool);
+	rabbit::sq_setreleasehook(v,1,_isolatepool_releasehook);
+	return 0;
+}
+
+static int64_t _isolatepool_run(rabbit::VirtualMachine* v)
+{
+	SETUP_ISOLATEPOOL(v);
+	const char *entry;
+	rabbit::sq_getstring(v,2,&entry);
+	int64_t count = rabbit::sq_getsize(v,3);
+	rabbit::Bool transfer = SQFalse;
+	if(rabbit::sq_gettop(v) > 3) {
+		rabbit::sq_getbool(v,4,&transfer);
+	}
+	rabbit::std::IsolateJob *jobs = (rabbit::std::IsolateJob *)rabbit::sq_malloc(sizeof(rabbit::std::IsolateJob) * count);
+	for(int64_t iii=0; iii<count; ++iii) {
+		new ((char*)&jobs[iii]) rabbit::std::IsolateJob();
+		jobs[iii]._entry = entry;
+	}
+	int64_t failed = -1;
+	for(int64_t iii=0; iii<count && failed < 0; ++iii) {
+		rabbit::sq_pushinteger(v,iii);
+		rabbit::sq_get(v,3);
+		if(!jobs[iii]._arg.get(v,-1,transfer?true:false)) {
+			failed = iii;
+		}
+		rabbit::sq_pop(v,1);
+	}
+	rabbit::Result res = 1;
+	rabbit::Object error;
+	rabbit::sq_resetobject(&error);
+	if(failed >= 0) {
+		//the clones already written are read back and dropped, the blobs they moved are freed
+		rabbit::sq_getlasterror(v);
+		rabbit::sq_getstackobj(v,-1,&error);
+		rabbit::sq_addref(v,&error);
+		rabbit::sq_pop(v,1);
+		for(int64_t iii=0; iii<failed; ++iii) {
+			if(jobs[iii]._arg.push(v)) {
+				rabbit::sq_pop(v,1);
+			}
+		}
+		res = SQ_ERROR;
+	} else {
+		::std::chrono::steady_clock::time_point start = ::std::chrono::steady_clock::now();
+		for(int64_t iii=0; iii<count; ++iii) {
+			self->submit(&jobs[iii]);
+		}
+		self->wait();
+		float_t elapsed = ::std::chrono::duration_cast<::std::chrono::duration<float_t> >(::std::chrono::steady_clock::now() - start).count();
+		rabbit::sq_pushstring(v,"_elapsed",-1);
+		rabbit::sq_pushfloat(v,elapsed);
+		rabbit::sq_set(v,1);
+		//every result is read (they own the blobs they moved), the first error is raised
+		rabbit::sq_newarray(v,0);
+		for(int64_t iii=0; iii<count; ++iii) {
+			bool ok = jobs[iii]._result.push(v);
+			if(ok && !jobs[iii]._failed) {
+				rabbit::sq_arrayappend(v,-2);
+				continue;
+			}
+			if(!ok) {
+				rabbit::sq_getlasterror(v);
+			}
+			if(res == 1) {
+				rabbit::sq_getstackobj(v,-1,&error);
+				rabbit::sq_addref(v,&error);
+				res = SQ_ERROR;
+			}
+			rabbit::sq_pop(v,1);
+		}
+	}
+	if(SQ_FAILED(res)) {
+		rabbit::sq_pushobject(v,error);
+		rabbit::sq_release(v,&error);
+		rabbit::sq_throwobject(v);
+	}
+	for(int64_t iii=0; iii<count; ++iii) {
+		jobs[iii].~IsolateJob();
+	}
+	rabbit::sq_free(jobs,sizeof(rabbit::std::IsolateJob) * count);
+	return res;
+}
+
+static int64_t _isolatepool_size(rabbit::VirtualMachine* v)
+{
+	SETUP_ISOLATEPOOL(v);
+	rabbit::sq_pushinteger(v,self->size());
+	return 1;
+}
+
+static int64_t _isolatepool_elapsed(rabbit::VirtualMachine* v)
+{
+	rabbit::sq_pushstring(v,"_elapsed",-1);
+	rabbit::sq_get(v,1);
+	return 1;
+}
+
+#define _DECL_ISOLATEPOOL_FUNC(name,nparams,typecheck) {#name,_isolatepool_##name,nparams,typecheck}
+static const rabbit::RegFunction _isolatepool_methods[] = {
+	_DECL_ISOLATEPOOL_FUNC(constructor,3,"xsn"),
+	_DECL_ISOLATEPOOL_FUNC(run,-3,"xsab"),
+	_DECL_ISOLATEPOOL_FUNC(size,1,"x"),
+	_DECL_ISOLATEPOOL_FUNC(elapsed,1,"x"),
+	{NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_ISOLATEPOOL_FUNC
+
+rabbit::Result rabbit::std::register_isolatelib(rabbit::VirtualMachine* v)
+{
+	sq_pushstring(v,"isolatepool",-1);
+	sq_newclass(v,SQFalse);
+	sq_settypetag(v,-1,(rabbit::UserPointer)SQSTD_ISOLATEPOOL_TYPE_TAG);
+	sq_pushstring(v,"_elapsed",-1);
+	sq_pushfloat(v,0);
+	sq_newslot(v,-3,SQFalse);
+	int64_t i = 0;
+	while(_isolatepool_methods[i].name != 0) {
+		const rabbit::RegFunction &f = _isolatepool_methods[i];
+		sq_pushstring(v,f.name,-1);
+		sq_newclosure(v,f.f,0);
+		sq_setparamscheck(v,f.nparamscheck,f.typemask);
+		sq_setnativeclosurename(v,-1,f.name);
+		if(SQ_FAILED(sq_bindnative(v,-1,"isolatepool",f.name))) {
+			return SQ_ERROR;
+		}
+		sq_newslot(v,-3,SQFalse);
+		i++;
+	}
+	sq_newslot(v,-3,SQFalse);
+	return SQ_OK;
+}
@@ -0,0 +1,109 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <etk/Vector.hpp>
+#include <rabbit/rabbit.hpp>
+
+namespace rabbit {
+	namespace std {
+		/**
+		 * @brief Value given to an isolate or returned by it. The objects belong to the heap of one shared state,
+		 * the value goes from one isolate to another as a structured clone (see sq_writeclone).
+		 */
+		class IsolateValue {
+			public:
+				//clone the value at 'idx' of the stack of 'v', 'transfer' moves the native data of the blobs;
+				//false with the error set in 'v' when the value can not be cloned
+				bool get(rabbit::VirtualMachine* v, int64_t idx, bool transfer);
+				//push the value read from the clone, false with the error set in 'v' when it can not be read.
+				//a transferred value must be pushed exactly once, it owns the moved native data
+				bool push(rabbit::VirtualMachine* v) const;
+				etk::Vector<uint8_t> _clone;
+		};
+		/**
+		 * @brief Call of a function of the program image by the first idle isolate.
+		 */
+		class IsolateJob {
+			public:
+				IsolateJob();
+				const char *_entry; //!< name of the function in the root table of the isolate, valid until the job is done
+				IsolateValue _arg; //!< only parameter of the function
+				IsolateValue _result; //!< value returned by the function (transferred), the error message when _failed is set
+				bool _failed;
+		};
+		//prepare the VM of an isolate (libraries, print functions...) before it runs the image, the root table is pushed
+		typedef rabbit::Result (*SQISOLATESETUP)(rabbit::VirtualMachine* v);
+		/**
+		 * @brief Pool of isolates: one shared state per worker thread, never touched by another thread (the reference
+		 * counts and the string table of a shared state are not synchronized).
+		 * The isolates share the bytecode image of one program (see sq_writeimage): its instructions, line infos and
+		 * default parameters are read in place by all of them, each one only builds the literals and runs the main
+		 * function of the image once to fill its root table. The jobs go to the idle isolates through a bounded lock
+		 * free queue, the threads only sleep on a condition when the queue is empty.
+		 */
+		class IsolatePool {
+			private:
+				class Slot {
+					public:
+						::std::atomic<uint64_t> _sequence;
+						IsolateJob *_job;
+				};
+				IsolatePool(int64_t nbisolates);
+				~IsolatePool();
+				bool push(IsolateJob *job);
+				bool pop(IsolateJob *&job);
+				void worker();
+				bool startIsolate(rabbit::VirtualMachine* v);
+				void runJob(rabbit::VirtualMachine* v, IsolateJob *job);
+			public:
+				//start 'nbisolates' isolates on a copy of 'image' ('size' bytes written by sq_writeimage with
+				//'sourcehash'), 'setup' NULL registers the blob, math, string and system libraries.
+				//NULL when an isolate can not run the image, 'error' receives the message
+				static IsolatePool *create(const uint8_t *image, int64_t size, uint64_t sourcehash, int64_t nbisolates, SQISOLATESETUP setup, etk::Vector<char> *error);
+				//stop the isolates once the queued jobs are done and free the pool
+				void release();
+				//queue 'job' for the next idle isolate, yields while the queue is full
+				void submit(IsolateJob *job);
+				//wait until every submitted job is done
+				void wait();
+				int64_t size() const {
+					return _nbisolates;
+				}
+			private:
+				uint8_t *_image; //!< shared read only by the isolates
+				int64_t _imagesize;
+				uint64_t _sourcehash;
+				SQISOLATESETUP _setup;
+				int64_t _nbisolates;
+				::std::thread *_threads;
+				Slot *_queue;
+				uint64_t _queuemask;
+				::std::atomic<uint64_t> _enqueuepos;
+				::std::atomic<uint64_t> _dequeuepos;
+				::std::atomic<int64_t> _pending; //!< jobs submitted and not done
+				::std::atomic<int64_t> _parked; //!< isolates sleeping on _wakeup
+				::std::atomic<bool> _stop;
+				::std::mutex _lock;
+				::std::condition_variable _wakeup; //!< a job was queued or the pool stops
+				::std::condition_variable _done; //!< _pending reached 0 or an isolate started
+				int64_t _started; //!< isolates ready or failed (under _lock)
+				etk::Vector<char> _error; //!< first startup error (under _lock)
+		};
+
+		//class 'isolatepool(source, nbisolates)': run(entry, args[, transfer]) calls 'entry' of the compiled source once
+		//per element of 'args' on the isolates and returns the results, elapsed() gives the wall time of the last run.
+		//the arguments and the results are structured clones, 'transfer' moves the blobs of the arguments instead of
+		//copying them (they are left empty)
+		rabbit::Result register_isolatelib(rabbit::VirtualMachine* v);
+	}
+}
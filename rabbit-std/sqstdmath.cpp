@@ -101,6 +101,9 @@ rabbit::Result rabbit::std::register_mathlib(rabbit::VirtualMachine* v)
 		sq_newclosure(v,mathlib_funcs[i].f,0);
 		sq_setparamscheck(v,mathlib_funcs[i].nparamscheck,mathlib_funcs[i].typemask);
 		sq_setnativeclosurename(v,-1,mathlib_funcs[i].name);
+		if(SQ_FAILED(sq_bindnative(v,-1,"mathlib",mathlib_funcs[i].name))) {
+			return SQ_ERROR;
+		}
 		sq_newslot(v,-3,SQFalse);
 		i++;
 	}
@@ -273,6 +273,8 @@ void init_streamclass(rabbit::VirtualMachine* v)
 			sq_pushstring(v,f.name,-1);
 			sq_newclosure(v,f.f,0);
 			sq_setparamscheck(v,f.nparamscheck,f.typemask);
+			sq_setnativeclosurename(v,-1,f.name);
+			sq_bindnative(v,-1,"stream",f.name);
 			sq_newslot(v,-3,SQFalse);
 			i++;
 		}
@@ -310,6 +312,10 @@ rabbit::Result rabbit::std::declare_stream(rabbit::VirtualMachine* v,const char*
 			sq_newclosure(v,f.f,0);
 			sq_setparamscheck(v,f.nparamscheck,f.typemask);
 			sq_setnativeclosurename(v,-1,f.name);
+			if(SQ_FAILED(sq_bindnative(v,-1,name,f.name))) {
+				sq_settop(v,top);
+				return SQ_ERROR;
+			}
 			sq_newslot(v,-3,SQFalse);
 			i++;
 		}
@@ -324,6 +330,10 @@ rabbit::Result rabbit::std::declare_stream(rabbit::VirtualMachine* v,const char*
 			sq_newclosure(v,f.f,0);
 			sq_setparamscheck(v,f.nparamscheck,f.typemask);
 			sq_setnativeclosurename(v,-1,f.name);
+			if(SQ_FAILED(sq_bindnative(v,-1,reg_name,f.name))) {
+				sq_settop(v,top);
+				return SQ_ERROR;
+			}
 			sq_newslot(v,-3,SQFalse);
 			i++;
 		}
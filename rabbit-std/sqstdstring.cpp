@@ -504,6 +504,9 @@ int64_t rabbit::std::register_stringlib(rabbit::VirtualMachine* v)
 		sq_newclosure(v,f.f,0);
 		sq_setparamscheck(v,f.nparamscheck,f.typemask);
 		sq_setnativeclosurename(v,-1,f.name);
+		if(SQ_FAILED(sq_bindnative(v,-1,"regexp",f.name))) {
+			return SQ_ERROR;
+		}
 		sq_newslot(v,-3,SQFalse);
 		i++;
 	}
@@ -516,6 +519,9 @@ int64_t rabbit::std::register_stringlib(rabbit::VirtualMachine* v)
 		sq_newclosure(v,stringlib_funcs[i].f,0);
 		sq_setparamscheck(v,stringlib_funcs[i].nparamscheck,stringlib_funcs[i].typemask);
 		sq_setnativeclosurename(v,-1,stringlib_funcs[i].name);
+		if(SQ_FAILED(sq_bindnative(v,-1,"stringlib",stringlib_funcs[i].name))) {
+			return SQ_ERROR;
+		}
 		sq_newslot(v,-3,SQFalse);
 		i++;
 	}
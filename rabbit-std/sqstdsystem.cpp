@@ -133,6 +133,9 @@ int64_t rabbit::std::register_systemlib(rabbit::VirtualMachine* v)
 		sq_newclosure(v,systemlib_funcs[i].f,0);
 		sq_setparamscheck(v,systemlib_funcs[i].nparamscheck,systemlib_funcs[i].typemask);
 		sq_setnativeclosurename(v,-1,systemlib_funcs[i].name);
+		if(SQ_FAILED(sq_bindnative(v,-1,"systemlib",systemlib_funcs[i].name))) {
+			return SQ_ERROR;
+		}
 		sq_newslot(v,-3,SQFalse);
 		i++;
 	}
@@ -0,0 +1,259 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+
+#include <rabbit/Allocator.hpp>
+#include <rabbit/sqconfig.hpp>
+#include <rabbit/squtils.hpp>
+#include <mutex>
+
+#ifndef SQ_POOL_GRANULARITY
+	#define SQ_POOL_GRANULARITY 16
+#endif
+#ifndef SQ_POOL_MAX_SIZE
+	#define SQ_POOL_MAX_SIZE 256
+#endif
+#ifndef SQ_POOL_SLAB_SIZE
+	#define SQ_POOL_SLAB_SIZE (64*1024)
+#endif
+#define SQ_POOL_NB_CLASS (SQ_POOL_MAX_SIZE/SQ_POOL_GRANULARITY)
+
+namespace {
+	class DefaultAllocator : public rabbit::Allocator {
+		public:
+			void* malloc(uint64_t size) override {
+				return sq_vm_malloc(size);
+			}
+			void* realloc(void* p, uint64_t oldsize, uint64_t size) override {
+				return sq_vm_realloc(p, oldsize, size);
+			}
+			void free(void* p, uint64_t size) override {
+				sq_vm_free(p, size);
+			}
+	};
+	
+	class FreeBlock {
+		public:
+			FreeBlock *_next;
+	};
+	
+	//free lists given back by the threads that ended
+	class PoolDepot {
+		public:
+			std::mutex _lock;
+			FreeBlock *_lists[SQ_POOL_NB_CLASS];
+			PoolDepot() {
+				memset(_lists, 0, sizeof(_lists));
+			}
+	};
+	PoolDepot& getDepot() {
+		static PoolDepot s_depot;
+		return s_depot;
+	}
+	
+	class PoolCache {
+		public:
+			FreeBlock *_lists[SQ_POOL_NB_CLASS];
+			PoolCache() {
+				memset(_lists, 0, sizeof(_lists));
+			}
+			~PoolCache() {
+				PoolDepot &depot = getDepot();
+				std::lock_guard<std::mutex> lock(depot._lock);
+				for(int64_t iii=0; iii<SQ_POOL_NB_CLASS; ++iii) {
+					while(_lists[iii] != NULL) {
+						FreeBlock *b = _lists[iii];
+						_lists[iii] = b->_next;
+						b->_next = depot._lists[iii];
+						depot._lists[iii] = b;
+					}
+				}
+			}
+			//the list of the class is empty: take the depot one or cut a new slab
+			FreeBlock* refill(uint64_t cls) {
+				PoolDepot &depot = getDepot();
+				{
+					std::lock_guard<std::mutex> lock(depot._lock);
+					if(depot._lists[cls] != NULL) {
+						_lists[cls] = depot._lists[cls];
+						depot._lists[cls] = NULL;
+						return _lists[cls];
+					}
+				}
+				uint64_t bsize = (cls+1)*SQ_POOL_GRANULARITY;
+				char *slab = (char*)sq_vm_malloc(SQ_POOL_SLAB_SIZE);
+				if(slab == NULL) {
+					return NULL;
+				}
+				for(uint64_t off = 0; off + bsize <= SQ_POOL_SLAB_SIZE; off += bsize) {
+					FreeBlock *b = (FreeBlock*)(slab + off);
+					b->_next = _lists[cls];
+					_lists[cls] = b;
+				}
+				return _lists[cls];
+			}
+	};
+	thread_local PoolCache t_cache;
+	
+	uint64_t poolClass(uint64_t size) {
+		return size == 0 ? 0 : (size-1)/SQ_POOL_GRANULARITY;
+	}
+}
+
+void* rabbit::PoolAllocator::malloc(uint64_t size) {
+	if(size > SQ_POOL_MAX_SIZE) {
+		return sq_vm_malloc(size);
+	}
+	uint64_t cls = poolClass(size);
+	FreeBlock *b = t_cache._lists[cls];
+	if(b == NULL) {
+		b = t_cache.refill(cls);
+		if(b == NULL) {
+			return NULL;
+		}
+	}
+	t_cache._lists[cls] = b->_next;
+	return b;
+}
+
+void* rabbit::PoolAllocator::realloc(void* p, uint64_t oldsize, uint64_t size) {
+	if(p == NULL) {
+		return malloc(size);
+	}
+	if(    oldsize > SQ_POOL_MAX_SIZE
+	    && size > SQ_POOL_MAX_SIZE) {
+		return sq_vm_realloc(p, oldsize, size);
+	}
+	if(    oldsize <= SQ_POOL_MAX_SIZE
+	    && size <= SQ_POOL_MAX_SIZE
+	    && poolClass(oldsize) == poolClass(size)) {
+		return p;
+	}
+	void *np = malloc(size);
+	if(np != NULL) {
+		memcpy(np, p, oldsize < size ? oldsize : size);
+		free(p, oldsize);
+	}
+	return np;
+}
+
+void rabbit::PoolAllocator::free(void* p, uint64_t size) {
+	if(p == NULL) {
+		return;
+	}
+	if(size > SQ_POOL_MAX_SIZE) {
+		sq_vm_free(p, size);
+		return;
+	}
+	uint64_t cls = poolClass(size);
+	FreeBlock *b = (FreeBlock*)p;
+	b->_next = t_cache._lists[cls];
+	t_cache._lists[cls] = b;
+}
+
+rabbit::Allocator* rabbit::Allocator::getDefault() {
+	#ifdef SQ_NO_POOL_ALLOCATOR
+		static DefaultAllocator s_allocator;
+	#else
+		static rabbit::PoolAllocator s_allocator;
+	#endif
+	return &s_allocator;
+}
+
+#define SQ_ARENA_HEADER sq_aligning(sizeof(Block))
+
+rabbit::ArenaAllocator::ArenaAllocator(uint64_t blocksize) :
+  _blocks(NULL),
+  _blocksize(blocksize),
+  _allocated(0),
+  _reserved(0) {
+	
+}
+
+rabbit::ArenaAllocator::~ArenaAllocator() {
+	release();
+}
+
+void rabbit::ArenaAllocator::release() {
+	while(_blocks) {
+		Block *b = _blocks;
+		_blocks = b->_next;
+		sq_vm_free(b, SQ_ARENA_HEADER + b->_size);
+	}
+	_allocated = 0;
+	_reserved = 0;
+}
+
+void* rabbit::ArenaAllocator::malloc(uint64_t size) {
+	size = sq_aligning(size);
+	if(    _blocks == NULL
+	    || _blocks->_used + size > _blocks->_size) {
+		//big allocations get their own block, behind the current one so it stays in use
+		uint64_t bsize = size > _blocksize ? size : _blocksize;
+		Block *b = (Block*)sq_vm_malloc(SQ_ARENA_HEADER + bsize);
+		if(b == NULL) {
+			return NULL;
+		}
+		b->_size = bsize;
+		b->_used = 0;
+		if(    _blocks != NULL
+		    && size > _blocksize) {
+			b->_next = _blocks->_next;
+			_blocks->_next = b;
+		} else {
+			b->_next = _blocks;
+			_blocks = b;
+		}
+		_reserved += bsize;
+		b->_used = size;
+		_allocated += size;
+		return (char*)b + SQ_ARENA_HEADER;
+	}
+	void *p = (char*)_blocks + SQ_ARENA_HEADER + _blocks->_used;
+	_blocks->_used += size;
+	_allocated += size;
+	return p;
+}
+
+void* rabbit::ArenaAllocator::lastAllocation(uint64_t size) const {
+	if(_blocks == NULL || _blocks->_used < size) {
+		return NULL;
+	}
+	return (char*)_blocks + SQ_ARENA_HEADER + _blocks->_used - size;
+}
+
+void* rabbit::ArenaAllocator::realloc(void* p, uint64_t oldsize, uint64_t size) {
+	if(p == NULL) {
+		return malloc(size);
+	}
+	oldsize = sq_aligning(oldsize);
+	uint64_t newsize = sq_aligning(size);
+	//the last allocation grows or shrinks in place
+	if(    p == lastAllocation(oldsize)
+	    && _blocks->_used - oldsize + newsize <= _blocks->_size) {
+		_blocks->_used = _blocks->_used - oldsize + newsize;
+		_allocated = _allocated - oldsize + newsize;
+		return p;
+	}
+	if(newsize <= oldsize) {
+		return p;
+	}
+	void *np = malloc(size);
+	if(np != NULL) {
+		memcpy(np, p, oldsize);
+	}
+	return np;
+}
+
+void rabbit::ArenaAllocator::free(void* p, uint64_t size) {
+	size = sq_aligning(size);
+	if(    p != NULL
+	    && p == lastAllocation(size)) {
+		_blocks->_used -= size;
+		_allocated -= size;
+	}
+}
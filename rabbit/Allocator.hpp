@@ -0,0 +1,87 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <etk/types.hpp>
+
+namespace rabbit {
+	/**
+	 * @brief Memory provider of a shared state (see sq_open): the objects (closures, instances, tables, arrays...),
+	 * the table nodes, the strings and the string table, the shapes, the ref table, the scratch pad and the compiler
+	 * states of this state are allocated through it.
+	 * @note It does not see the etk::Vector buffers (VM stacks and call stacks, array storage, class members, function
+	 * prototypes under compilation, native closure outers...): they are allocated by etk's own allocator, which has no
+	 * per instance hook. A memory limit or an arena only covers the blocks listed above.
+	 */
+	class Allocator {
+		public:
+			virtual ~Allocator() {}
+			virtual void* malloc(uint64_t size) = 0;
+			//'p' can be NULL (then 'oldsize' is 0)
+			virtual void* realloc(void* p, uint64_t oldsize, uint64_t size) = 0;
+			virtual void free(void* p, uint64_t size) = 0;
+			//allocator used when sq_open() does not receive one: the PoolAllocator (sq_vm_malloc/sq_vm_realloc/sq_vm_free
+			//when SQ_NO_POOL_ALLOCATOR is defined)
+			static rabbit::Allocator* getDefault();
+	};
+	/**
+	 * @brief Size class pool for the small fixed size blocks (closures, instances, strings, table nodes, weak references...).
+	 * Blocks up to SQ_POOL_MAX_SIZE bytes are rounded to a multiple of SQ_POOL_GRANULARITY and taken from a free list
+	 * per size class, the lists are thread local (no lock) and refilled by slabs of SQ_POOL_SLAB_SIZE bytes.
+	 * The free blocks of a thread that ends go to a depot shared by the other threads, the slabs are never given
+	 * back to the system. Bigger blocks use sq_vm_malloc/sq_vm_realloc/sq_vm_free.
+	 * All the instances share the same pool.
+	 */
+	class PoolAllocator : public rabbit::Allocator {
+		public:
+			void* malloc(uint64_t size) override;
+			void* realloc(void* p, uint64_t oldsize, uint64_t size) override;
+			void free(void* p, uint64_t size) override;
+	};
+	/**
+	 * @brief Bump allocator: memory is taken in big blocks and given back all at once.
+	 * free() only recovers the last allocation, all the blocks are released by release() or the destructor,
+	 * so the blocks of a whole VM (leaked objects included) are recovered without walking its objects.
+	 * The etk::Vector buffers are not in the arena (see rabbit::Allocator): sq_close() must still run before
+	 * release() so the objects free them.
+	 * Usage:
+	 *    rabbit::ArenaAllocator arena;
+	 *    rabbit::VirtualMachine* v = rabbit::sq_open(&arena);
+	 *    ...
+	 *    rabbit::sq_close(v);
+	 *    arena.release();
+	 */
+	class ArenaAllocator : public rabbit::Allocator {
+		private:
+			class Block {
+				public:
+					Block *_next;
+					uint64_t _size; //!< usable size after the header
+					uint64_t _used;
+			};
+			Block *_blocks; //!< current block first
+			uint64_t _blocksize;
+			uint64_t _allocated; //!< bytes given to the user (not recovered by free())
+			uint64_t _reserved; //!< bytes of all the blocks
+			void* lastAllocation(uint64_t size) const;
+		public:
+			ArenaAllocator(uint64_t blocksize = 64*1024);
+			~ArenaAllocator();
+			void* malloc(uint64_t size) override;
+			void* realloc(void* p, uint64_t oldsize, uint64_t size) override;
+			void free(void* p, uint64_t size) override;
+			//give back all the blocks, every pointer of the arena becomes invalid
+			void release();
+			uint64_t getAllocated() const {
+				return _allocated;
+			}
+			uint64_t getReserved() const {
+				return _reserved;
+			}
+	};
+}
@@ -8,6 +8,7 @@
 #include <rabbit/Array.hpp>
 #include <rabbit/squtils.hpp>
 #include <rabbit/WeakRef.hpp>
+#include <rabbit/SharedState.hpp>
 
 
 
@@ -21,21 +22,38 @@ void rabbit::Array::extend(const rabbit::Array *a){
 	}
 }
 
-rabbit::Array::Array(rabbit::SharedState* _ss, int64_t _nsize) {
+rabbit::Array::Array(rabbit::SharedState* _ss, int64_t _nsize) :
+	rabbit::Collectable(_ss),
+	m_accounted(0) {
 	m_data.resize(_nsize);
+	updateAccounting();
 }
 rabbit::Array::~Array() {
 	// TODO: Clean DATA ...
+	_sharedstate->memAccount(rabbit::MEM_ARRAY, -m_accounted);
+}
+void rabbit::Array::updateAccounting() {
+	int64_t accounted = m_data.allocatedSize() * sizeof(rabbit::ObjectPtr);
+	if (accounted != m_accounted) {
+		_sharedstate->memAccount(rabbit::MEM_ARRAY, accounted - m_accounted);
+		m_accounted = accounted;
+	}
 }
 // TODO : remove this ETK_ALLOC can do it natively ...
 rabbit::Array* rabbit::Array::create(rabbit::SharedState* _ss,
                      int64_t _ninitialsize) {
-	Array *newarray=(Array*)SQ_MALLOC(sizeof(Array));
+	Array *newarray=(Array*)SQ_MALLOC(_ss, rabbit::MEM_ARRAY, sizeof(Array));
 	new ((char*)newarray) Array(_ss, _ninitialsize);
 	return newarray;
 }
+void rabbit::Array::mark(rabbit::Collectable **_chain) {
+	for (size_t iii=0; iii<m_data.size(); ++iii) {
+		rabbit::SharedState::markObject(m_data[iii], _chain);
+	}
+}
 void rabbit::Array::finalize() {
 	m_data.resize(0);
+	updateAccounting();
 }
 bool rabbit::Array::get(const int64_t _nidx, rabbit::ObjectPtr& _val) const {
 	if(    _nidx >= 0
@@ -69,8 +87,9 @@ int64_t rabbit::Array::next(const rabbit::ObjectPtr& _refpos,
 	return -1;
 }
 rabbit::Array* rabbit::Array::clone() const {
-	Array *anew = create(NULL,0);
+	Array *anew = create(_sharedstate,0);
 	anew->m_data = m_data;
+	anew->updateAccounting();
 	return anew;
 }
 int64_t rabbit::Array::size() const {
@@ -84,12 +103,15 @@ void rabbit::Array::resize(int64_t _size,
             rabbit::ObjectPtr& _fill) {
 	m_data.resize(_size, _fill);
 	shrinkIfNeeded();
+	updateAccounting();
 }
 void rabbit::Array::reserve(int64_t _size) {
 	m_data.reserve(_size);
+	updateAccounting();
 }
 void rabbit::Array::append(const rabbit::Object& _o) {
 	m_data.pushBack(_o);
+	updateAccounting();
 }
 
 rabbit::ObjectPtr& rabbit::Array::top(){
@@ -98,6 +120,7 @@ rabbit::ObjectPtr& rabbit::Array::top(){
 void rabbit::Array::pop() {
 	m_data.popBack();
 	shrinkIfNeeded();
+	updateAccounting();
 }
 bool rabbit::Array::insert(int64_t _idx,const rabbit::Object& _val) {
 	if(    _idx < 0
@@ -105,6 +128,7 @@ bool rabbit::Array::insert(int64_t _idx,const rabbit::Object& _val) {
 		return false;
 	}
 	m_data.insert(_idx, _val);
+	updateAccounting();
 	return true;
 }
 void rabbit::Array::shrinkIfNeeded() {
@@ -123,10 +147,11 @@ bool rabbit::Array::remove(int64_t _idx) {
 	}
 	m_data.remove(_idx);
 	shrinkIfNeeded();
+	updateAccounting();
 	return true;
 }
 void rabbit::Array::release() {
-	sq_delete(this, Array);
+	sq_delete(_sharedstate, rabbit::MEM_ARRAY, this, Array);
 }
 rabbit::ObjectPtr& rabbit::Array::operator[] (const size_t _pos) {
 	return m_data[_pos];
@@ -7,13 +7,13 @@
  */
 #pragma once
 
-#include <rabbit/RefCounted.hpp>
+#include <rabbit/Collectable.hpp>
 #include <rabbit/ObjectPtr.hpp>
 #include <etk/Vector.hpp>
 
 namespace rabbit {
 	class SharedState;
-	class Array : public rabbit::RefCounted {
+	class Array : public rabbit::Collectable {
 		private:
 			Array(rabbit::SharedState* _ss,
 			      int64_t _nsize);
@@ -22,7 +22,11 @@ namespace rabbit {
 			// TODO : remove this ETK_ALLOC can do it natively ...
 			static Array* create(rabbit::SharedState* _ss,
 			                     int64_t _ninitialsize);
+			void mark(rabbit::Collectable **chain);
 			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_ARRAY;
+			}
 			bool get(const int64_t _nidx,
 			         rabbit::ObjectPtr& _val) const;
 			bool set(const int64_t _nidx,const rabbit::ObjectPtr& _val) const;
@@ -46,7 +50,10 @@ namespace rabbit {
 			rabbit::ObjectPtr& operator[] (const size_t _pos);
 			const rabbit::ObjectPtr& operator[] (const size_t _pos) const;
 		private:
+			//report the size change of m_data to the memory accounting of the shared state
+			void updateAccounting();
 			mutable etk::Vector<rabbit::ObjectPtr> m_data;
+			int64_t m_accounted; //!< bytes of the storage of m_data (its capacity) accounted in MEM_ARRAY
 	};
 }
 
@@ -0,0 +1,445 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#include <rabbit/BytecodeImage.hpp>
+#include <rabbit/FunctionProto.hpp>
+#include <rabbit/Closure.hpp>
+#include <rabbit/VirtualMachine.hpp>
+#include <rabbit/SharedState.hpp>
+#include <rabbit/String.hpp>
+#include <rabbit/Table.hpp>
+#include <rabbit/squtils.hpp>
+#include <etk/Vector.hpp>
+#include <string.h>
+
+namespace {
+	// layout of an image: all the offsets are relative to the start of the image and 8 bytes aligned,
+	// the nested functions are always stored after their parent.
+	struct ImageHeader {
+		uint32_t tag; //!< SQ_BYTECODE_IMAGE_TAG
+		uint32_t version; //!< SQ_CLOSURESTREAM_VERSION
+		uint32_t opcodes; //!< SQ_OPCODE_COUNT
+		uint32_t sizes; //!< see imageSizes()
+		uint64_t sourcehash;
+		uint64_t size; //!< size of the whole image
+		uint64_t strings; //!< offset of the ImageString table
+		uint64_t nstrings;
+		uint64_t main; //!< offset of the ImageFunction of the main function
+	};
+	struct ImageString {
+		uint64_t offset; //!< characters, followed by a '\0'
+		uint64_t len;
+	};
+	struct ImageValue {
+		uint32_t type; //!< rabbit::ObjectType
+		uint32_t pad;
+		uint64_t payload; //!< integer, bits of the float or index of the string
+	};
+	struct ImageOuter {
+		uint64_t type;
+		ImageValue src;
+		ImageValue name;
+	};
+	struct ImageLocal {
+		ImageValue name;
+		uint64_t pos;
+		uint64_t start_op;
+		uint64_t end_op;
+	};
+	struct ImageFunction {
+		ImageValue sourcename;
+		ImageValue name;
+		int64_t stacksize;
+		int64_t varparams;
+		int64_t bgenerator;
+		int64_t ninstructions;
+		int64_t nliterals;
+		int64_t nparameters;
+		int64_t nfunctions;
+		int64_t noutervalues;
+		int64_t nlineinfos;
+		int64_t nlocalvarinfos;
+		int64_t ndefaultparams;
+		int64_t ninlinecaches;
+		uint64_t instructions; //!< rabbit::Instruction[ninstructions], used in place
+		uint64_t lineinfos; //!< rabbit::LineInfo[nlineinfos], used in place
+		uint64_t defaultparams; //!< int64_t[ndefaultparams], used in place
+		uint64_t literals; //!< ImageValue[nliterals]
+		uint64_t parameters; //!< ImageValue[nparameters]
+		uint64_t functions; //!< uint64_t[nfunctions], offsets of the ImageFunction
+		uint64_t outervalues; //!< ImageOuter[noutervalues]
+		uint64_t localvarinfos; //!< ImageLocal[nlocalvarinfos]
+	};
+
+	uint32_t imageSizes() {
+		return    sizeof(rabbit::Instruction)
+		       | (sizeof(int64_t) << 8)
+		       | (sizeof(float_t) << 16)
+		       | (sizeof(rabbit::LineInfo) << 24);
+	}
+
+	class ImageWriter {
+		public:
+			ImageWriter(rabbit::VirtualMachine *v) :
+			  _vm(v) {
+				_index = rabbit::Table::create(v->_sharedstate, 0);
+			}
+			//reserve 'size' bytes (zeroed) at the end of the image, return their offset
+			uint64_t alloc(uint64_t size) {
+				uint64_t offset = _buffer.size();
+				_buffer.resize(offset + ((size + 7) & ~7ULL), 0);
+				return offset;
+			}
+			uint64_t copy(const void *data, uint64_t size) {
+				uint64_t offset = alloc(size);
+				if(size) {
+					memcpy(&_buffer[offset], data, size);
+				}
+				return offset;
+			}
+			void store(uint64_t offset, const void *data, uint64_t size) {
+				memcpy(&_buffer[offset], data, size);
+			}
+			bool value(const rabbit::ObjectPtr &o, ImageValue &out) {
+				out.type = (uint32_t)o.getType();
+				out.pad = 0;
+				out.payload = 0;
+				switch(o.getType()) {
+					case rabbit::OT_STRING:
+						{
+							rabbit::ObjectPtr idx;
+							if(!_index.toTable()->get(o, idx)) {
+								idx = (int64_t)_strings.size();
+								_index.toTable()->newSlot(o, idx);
+								_strings.pushBack(o);
+							}
+							out.payload = (uint64_t)idx.toInteger();
+						}
+						break;
+					case rabbit::OT_BOOL:
+						out.payload = o.toBoolean() ? 1 : 0;
+						break;
+					case rabbit::OT_INTEGER:
+						out.payload = (uint64_t)o.toInteger();
+						break;
+					case rabbit::OT_FLOAT:
+						{
+							float_t val = o.toFloat();
+							memcpy(&out.payload, &val, sizeof(float_t));
+						}
+						break;
+					case rabbit::OT_NULL:
+						break;
+					default:
+						_vm->raise_error("cannot serialize a %s",getTypeName(o));
+						return false;
+				}
+				return true;
+			}
+			bool values(const rabbit::ObjectPtr *objs, int64_t count, uint64_t &offset) {
+				offset = alloc(count * sizeof(ImageValue));
+				for(int64_t i = 0; i < count; i++) {
+					ImageValue val;
+					_CHECK_IO(value(objs[i], val));
+					store(offset + i * sizeof(ImageValue), &val, sizeof(val));
+				}
+				return true;
+			}
+			bool function(rabbit::FunctionProto *f, uint64_t &offset) {
+				ImageFunction fn;
+				memset(&fn, 0, sizeof(fn));
+				offset = alloc(sizeof(ImageFunction));
+				_CHECK_IO(value(f->_sourcename, fn.sourcename));
+				_CHECK_IO(value(f->_name, fn.name));
+				fn.stacksize = f->_stacksize;
+				fn.varparams = f->_varparams;
+				fn.bgenerator = f->_bgenerator;
+				fn.ninstructions = f->_ninstructions;
+				fn.nliterals = f->_nliterals;
+				fn.nparameters = f->_nparameters;
+				fn.nfunctions = f->_nfunctions;
+				fn.noutervalues = f->_noutervalues;
+				fn.nlineinfos = f->_nlineinfos;
+				fn.nlocalvarinfos = f->_nlocalvarinfos;
+				fn.ndefaultparams = f->_ndefaultparams;
+				fn.ninlinecaches = f->_ninlinecaches;
+				//the inline cache slots (_arg3 of _OP_GETK/_OP_PREPCALLK) are kept, the caches start empty at load
+				f->dequicken();
+				fn.instructions = copy(f->_instructions, f->_ninstructions * sizeof(rabbit::Instruction));
+				fn.lineinfos = copy(f->_lineinfos, f->_nlineinfos * sizeof(rabbit::LineInfo));
+				fn.defaultparams = copy(f->_defaultparams, f->_ndefaultparams * sizeof(int64_t));
+				_CHECK_IO(values(f->_literals, f->_nliterals, fn.literals));
+				_CHECK_IO(values(f->_parameters, f->_nparameters, fn.parameters));
+				fn.outervalues = alloc(f->_noutervalues * sizeof(ImageOuter));
+				for(int64_t i = 0; i < f->_noutervalues; i++) {
+					ImageOuter outer;
+					outer.type = f->_outervalues[i]._type;
+					_CHECK_IO(value(f->_outervalues[i]._src, outer.src));
+					_CHECK_IO(value(f->_outervalues[i]._name, outer.name));
+					store(fn.outervalues + i * sizeof(ImageOuter), &outer, sizeof(outer));
+				}
+				fn.localvarinfos = alloc(f->_nlocalvarinfos * sizeof(ImageLocal));
+				for(int64_t i = 0; i < f->_nlocalvarinfos; i++) {
+					rabbit::LocalVarInfo &lvi = f->_localvarinfos[i];
+					ImageLocal local;
+					_CHECK_IO(value(lvi._name, local.name));
+					local.pos = lvi._pos;
+					local.start_op = lvi._start_op;
+					local.end_op = lvi._end_op;
+					store(fn.localvarinfos + i * sizeof(ImageLocal), &local, sizeof(local));
+				}
+				fn.functions = alloc(f->_nfunctions * sizeof(uint64_t));
+				for(int64_t i = 0; i < f->_nfunctions; i++) {
+					uint64_t child;
+					_CHECK_IO(function(f->_functions[i].toFunctionProto(), child));
+					store(fn.functions + i * sizeof(uint64_t), &child, sizeof(child));
+				}
+				store(offset, &fn, sizeof(fn));
+				return true;
+			}
+			bool strings(ImageHeader &header) {
+				header.nstrings = _strings.size();
+				header.strings = alloc(_strings.size() * sizeof(ImageString));
+				for(size_t i = 0; i < _strings.size(); i++) {
+					ImageString str;
+					str.len = _strings[i].toString()->_len;
+					str.offset = alloc(str.len + 1);
+					store(str.offset, _strings[i].getStringValue(), str.len);
+					store(header.strings + i * sizeof(ImageString), &str, sizeof(str));
+				}
+				return true;
+			}
+			rabbit::VirtualMachine *_vm;
+			etk::Vector<uint8_t> _buffer;
+			rabbit::ObjectPtr _index; //!< string -> index in _strings
+			etk::Vector<rabbit::ObjectPtr> _strings;
+	};
+
+	class ImageReader {
+		public:
+			ImageReader(rabbit::VirtualMachine *v, rabbit::BytecodeImage *image) :
+			  _vm(v),
+			  _image(image),
+			  _nstrings(0),
+			  _stringtable(NULL) {
+
+			}
+			bool error() {
+				_vm->raise_error("invalid or corrupted bytecode image");
+				return false;
+			}
+			//'count' elements of 'size' bytes at 'offset' are in the image
+			bool inImage(uint64_t offset, int64_t count, uint64_t size) const {
+				uint64_t total = _image->_size;
+				return    (offset & 7) == 0
+				       && count >= 0
+				       && offset <= total
+				       && (size == 0 || (uint64_t)count <= (total - offset) / size);
+			}
+			const uint8_t *at(uint64_t offset) const {
+				return _image->_data + offset;
+			}
+			bool value(const ImageValue &val, rabbit::ObjectPtr &o) {
+				switch((rabbit::ObjectType)val.type) {
+					case rabbit::OT_STRING:
+						if(val.payload >= _nstrings) {
+							return error();
+						}
+						//interned on the first use only
+						if(_strings[val.payload].isNull() == true) {
+							ImageString str;
+							memcpy(&str, _stringtable + val.payload, sizeof(str));
+							if(    !inImage(str.offset, str.len, 1)
+							    || str.len >= (uint64_t)_image->_size - str.offset) {
+								return error();
+							}
+							_strings[val.payload] = rabbit::String::create(_vm->_sharedstate, (const char *)at(str.offset), str.len);
+						}
+						o = _strings[val.payload];
+						break;
+					case rabbit::OT_INTEGER:
+						o = (int64_t)val.payload;
+						//the SQ_TAGGED_OBJECT layout stores 56 bits integers
+						if(o.toInteger() != (int64_t)val.payload) {
+							_vm->raise_error("integer literal %lld out of range", (long long)val.payload);
+							return false;
+						}
+						break;
+					case rabbit::OT_BOOL:
+						o = val.payload != 0;
+						break;
+					case rabbit::OT_FLOAT:
+						{
+							float_t fval;
+							memcpy(&fval, &val.payload, sizeof(float_t));
+							o = fval;
+						}
+						break;
+					case rabbit::OT_NULL:
+						o.Null();
+						break;
+					default:
+						return error();
+				}
+				return true;
+			}
+			bool values(uint64_t offset, int64_t count, rabbit::ObjectPtr *out) {
+				if(!inImage(offset, count, sizeof(ImageValue))) {
+					return error();
+				}
+				for(int64_t i = 0; i < count; i++) {
+					ImageValue val;
+					memcpy(&val, at(offset + i * sizeof(ImageValue)), sizeof(val));
+					_CHECK_IO(value(val, out[i]));
+				}
+				return true;
+			}
+			bool function(uint64_t offset, rabbit::ObjectPtr &ret) {
+				if(!inImage(offset, 1, sizeof(ImageFunction))) {
+					return error();
+				}
+				ImageFunction fn;
+				memcpy(&fn, at(offset), sizeof(fn));
+				//every count is checked against the image before the function is allocated with them
+				if(    !inImage(fn.instructions, fn.ninstructions, sizeof(rabbit::Instruction))
+				    || !inImage(fn.literals, fn.nliterals, sizeof(ImageValue))
+				    || !inImage(fn.parameters, fn.nparameters, sizeof(ImageValue))
+				    || !inImage(fn.lineinfos, fn.nlineinfos, sizeof(rabbit::LineInfo))
+				    || !inImage(fn.defaultparams, fn.ndefaultparams, sizeof(int64_t))
+				    || !inImage(fn.functions, fn.nfunctions, sizeof(uint64_t))
+				    || !inImage(fn.outervalues, fn.noutervalues, sizeof(ImageOuter))
+				    || !inImage(fn.localvarinfos, fn.nlocalvarinfos, sizeof(ImageLocal))
+				    || fn.ninstructions < 1
+				    || fn.nlineinfos < 1
+				    || fn.ninlinecaches < 0
+				    || fn.ninlinecaches > SQ_NO_INLINE_CACHE) {
+					return error();
+				}
+				rabbit::FunctionProto *f = rabbit::FunctionProto::create(_vm->_sharedstate, fn.ninstructions,
+					fn.nliterals, fn.nparameters, fn.nfunctions, fn.noutervalues,
+					fn.nlineinfos, fn.nlocalvarinfos, fn.ndefaultparams, fn.ninlinecaches, _image);
+				rabbit::ObjectPtr proto = f; //gets a ref in case of failure
+				f->_instructions = (rabbit::Instruction *)at(fn.instructions);
+				f->_lineinfos = (rabbit::LineInfo *)at(fn.lineinfos);
+				f->_defaultparams = (int64_t *)at(fn.defaultparams);
+				_CHECK_IO(value(fn.sourcename, f->_sourcename));
+				_CHECK_IO(value(fn.name, f->_name));
+				f->_stacksize = fn.stacksize;
+				f->_varparams = fn.varparams;
+				f->_bgenerator = fn.bgenerator != 0;
+				_CHECK_IO(values(fn.literals, fn.nliterals, f->_literals));
+				_CHECK_IO(values(fn.parameters, fn.nparameters, f->_parameters));
+				for(int64_t i = 0; i < fn.noutervalues; i++) {
+					ImageOuter outer;
+					rabbit::ObjectPtr src, name;
+					memcpy(&outer, at(fn.outervalues + i * sizeof(ImageOuter)), sizeof(outer));
+					_CHECK_IO(value(outer.src, src));
+					_CHECK_IO(value(outer.name, name));
+					f->_outervalues[i] = rabbit::OuterVar(name, src, (rabbit::OuterType)outer.type);
+				}
+				for(int64_t i = 0; i < fn.nlocalvarinfos; i++) {
+					ImageLocal local;
+					memcpy(&local, at(fn.localvarinfos + i * sizeof(ImageLocal)), sizeof(local));
+					rabbit::LocalVarInfo &lvi = f->_localvarinfos[i];
+					_CHECK_IO(value(local.name, lvi._name));
+					lvi._pos = local.pos;
+					lvi._start_op = local.start_op;
+					lvi._end_op = local.end_op;
+				}
+				for(int64_t i = 0; i < fn.nfunctions; i++) {
+					uint64_t child;
+					memcpy(&child, at(fn.functions + i * sizeof(uint64_t)), sizeof(child));
+					//the nested functions follow their parent: a corrupted image can not loop
+					if(child <= offset) {
+						return error();
+					}
+					_CHECK_IO(function(child, f->_functions[i]));
+				}
+				_CHECK_IO(f->checkInstructions(_vm));
+				ret = proto;
+				return true;
+			}
+			bool load(uint64_t sourcehash, rabbit::ObjectPtr &ret) {
+				ImageHeader header;
+				if(_image->_size < (int64_t)sizeof(header)) {
+					return error();
+				}
+				memcpy(&header, at(0), sizeof(header));
+				if(    header.tag != (uint32_t)SQ_BYTECODE_IMAGE_TAG
+				    || header.version != SQ_CLOSURESTREAM_VERSION
+				    || header.opcodes != SQ_OPCODE_COUNT
+				    || header.sizes != imageSizes()
+				    || header.size != (uint64_t)_image->_size) {
+					return error();
+				}
+				if(header.sourcehash != sourcehash) {
+					_vm->raise_error("stale bytecode image (the source changed)");
+					return false;
+				}
+				if(!inImage(header.strings, header.nstrings, sizeof(ImageString))) {
+					return error();
+				}
+				_nstrings = header.nstrings;
+				_stringtable = (const ImageString *)at(header.strings);
+				_strings.resize(_nstrings);
+				return function(header.main, ret);
+			}
+			rabbit::VirtualMachine *_vm;
+			rabbit::BytecodeImage *_image;
+			uint64_t _nstrings;
+			const ImageString *_stringtable;
+			etk::Vector<rabbit::ObjectPtr> _strings; //!< interned strings of the image (null: not used yet)
+	};
+}
+
+rabbit::BytecodeImage::BytecodeImage(rabbit::SharedState *ss, const uint8_t *data, int64_t size, SQRELEASEHOOK hook) :
+  _sharedstate(ss),
+  _data(data),
+  _size(size),
+  _releasehook(hook) {
+
+}
+
+rabbit::BytecodeImage *rabbit::BytecodeImage::create(rabbit::SharedState *ss, const uint8_t *data, int64_t size, SQRELEASEHOOK hook) {
+	rabbit::BytecodeImage *image = (rabbit::BytecodeImage*)SQ_MALLOC(ss, rabbit::MEM_OTHER, sizeof(rabbit::BytecodeImage));
+	new ((char*)image) rabbit::BytecodeImage(ss, data, size, hook);
+	return image;
+}
+
+void rabbit::BytecodeImage::release() {
+	rabbit::SharedState *ss = _sharedstate;
+	SQRELEASEHOOK hook = _releasehook;
+	rabbit::UserPointer data = (rabbit::UserPointer)_data;
+	int64_t size = _size;
+	this->~BytecodeImage();
+	SQ_FREE(ss, rabbit::MEM_OTHER, this, sizeof(rabbit::BytecodeImage));
+	if(hook) {
+		hook(data, size);
+	}
+}
+
+bool rabbit::BytecodeImage::load(rabbit::VirtualMachine *v, uint64_t sourcehash, rabbit::ObjectPtr &ret) {
+	ImageReader reader(v, this);
+	return reader.load(sourcehash, ret);
+}
+
+bool rabbit::BytecodeImage::write(rabbit::VirtualMachine *v, rabbit::FunctionProto *func, uint64_t sourcehash, SQWRITEFUNC write, rabbit::UserPointer up) {
+	ImageWriter writer(v);
+	ImageHeader header;
+	memset(&header, 0, sizeof(header));
+	writer.alloc(sizeof(header));
+	header.tag = SQ_BYTECODE_IMAGE_TAG;
+	header.version = SQ_CLOSURESTREAM_VERSION;
+	header.opcodes = SQ_OPCODE_COUNT;
+	header.sizes = imageSizes();
+	header.sourcehash = sourcehash;
+	_CHECK_IO(writer.function(func, header.main));
+	_CHECK_IO(writer.strings(header));
+	header.size = writer._buffer.size();
+	writer.store(0, &header, sizeof(header));
+	return safeWrite(v, write, up, &writer._buffer[0], writer._buffer.size());
+}
@@ -0,0 +1,44 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <etk/types.hpp>
+#include <rabbit/RefCounted.hpp>
+#include <rabbit/ObjectPtr.hpp>
+#include <rabbit/rabbit.hpp>
+
+// first 4 bytes of a bytecode image (see sq_writeimage)
+#define SQ_BYTECODE_IMAGE_TAG (('R'<<24)|('B'<<16)|('I'<<8)|('M'))
+
+namespace rabbit {
+	class SharedState;
+	class FunctionProto;
+	/**
+	 * @brief Memory block holding a bytecode image, usually a read only file mapping.
+	 * Unlike the closure streams (sq_readclosure) the image is used in place: the loaded functions read their
+	 * instructions, line infos and default parameters from it and only their literals are built (the strings
+	 * are interned once per image, when a function refers to them).
+	 * Each loaded function holds a reference, the block is given back to its release hook with the last one.
+	 */
+	class BytecodeImage : public rabbit::RefCounted {
+		private:
+			BytecodeImage(rabbit::SharedState *ss, const uint8_t *data, int64_t size, SQRELEASEHOOK hook);
+		public:
+			static BytecodeImage *create(rabbit::SharedState *ss, const uint8_t *data, int64_t size, SQRELEASEHOOK hook);
+			void release();
+			//build the functions of the image, 'ret' receives the main one.
+			//'sourcehash' must match the one given to write(), a stale image is refused
+			bool load(rabbit::VirtualMachine *v, uint64_t sourcehash, rabbit::ObjectPtr &ret);
+			//image of 'func' and of its nested functions
+			static bool write(rabbit::VirtualMachine *v, rabbit::FunctionProto *func, uint64_t sourcehash, SQWRITEFUNC write, rabbit::UserPointer up);
+			rabbit::SharedState *_sharedstate;
+			const uint8_t *_data;
+			int64_t _size;
+			SQRELEASEHOOK _releasehook; //!< called with (_data, _size) when the image is not used anymore
+	};
+}
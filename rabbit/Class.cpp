@@ -15,13 +15,15 @@
 #include <rabbit/WeakRef.hpp>
 #include <rabbit/Closure.hpp>
 
-rabbit::Class::Class(rabbit::SharedState *ss, rabbit::Class *base) {
+rabbit::Class::Class(rabbit::SharedState *ss, rabbit::Class *base) :
+	rabbit::Collectable(ss) {
 	_base = base;
 	_typetag = 0;
 	_hook = NULL;
 	_udsize = 0;
 	_locked = false;
 	_constructoridx = -1;
+	_cachetag = ss->newCacheTag();
 	if(_base) {
 		_constructoridx = _base->_constructoridx;
 		_udsize = _base->_udsize;
@@ -29,11 +31,31 @@ rabbit::Class::Class(rabbit::SharedState *ss, rabbit::Class *base) {
 		_methods = base->_methods;
 		_COPY_VECTOR(_metamethods,base->_metamethods, rabbit::MT_LAST);
 		__ObjaddRef(_base);
+		_sharedstate->gcBarrier(_base);
 	}
 	_members = base?base->_members->clone() : rabbit::Table::create(ss,0);
 	__ObjaddRef(_members);
 }
 
+void rabbit::Class::mark(rabbit::Collectable **chain) {
+	_members->setReachable(chain);
+	if(_base) {
+		_base->setReachable(chain);
+	}
+	rabbit::SharedState::markObject(_attributes, chain);
+	for(uint64_t i = 0; i < _defaultvalues.size(); i++) {
+		rabbit::SharedState::markObject(_defaultvalues[i].val, chain);
+		rabbit::SharedState::markObject(_defaultvalues[i].attrs, chain);
+	}
+	for(uint64_t j = 0; j < _methods.size(); j++) {
+		rabbit::SharedState::markObject(_methods[j].val, chain);
+		rabbit::SharedState::markObject(_methods[j].attrs, chain);
+	}
+	for(uint64_t k = 0; k < rabbit::MT_LAST; k++) {
+		rabbit::SharedState::markObject(_metamethods[k], chain);
+	}
+}
+
 void rabbit::Class::finalize() {
 	_attributes.Null();
 	_NULL_SQOBJECT_VECTOR(_defaultvalues,_defaultvalues.size());
@@ -50,7 +72,7 @@ rabbit::Class::~Class() {
 }
 
 rabbit::Class* rabbit::Class::create(rabbit::SharedState *ss, Class *base) {
-	rabbit::Class *newclass = (Class *)SQ_MALLOC(sizeof(Class));
+	rabbit::Class *newclass = (Class *)SQ_MALLOC(ss, rabbit::MEM_CLASS, sizeof(Class));
 	new ((char*)newclass) Class(ss, base);
 	return newclass;
 }
@@ -87,7 +109,7 @@ void rabbit::Class::release() {
 	if (_hook) {
 		_hook(_typetag,0);
 	}
-	sq_delete(this, Class);
+	sq_delete(_sharedstate, rabbit::MEM_CLASS, this, Class);
 }
 
 bool rabbit::Class::newSlot(rabbit::SharedState *ss,const rabbit::ObjectPtr &key,const rabbit::ObjectPtr &val,bool bstatic) {
@@ -116,6 +138,7 @@ bool rabbit::Class::newSlot(rabbit::SharedState *ss,const rabbit::ObjectPtr &key
 				theval = const_cast<rabbit::Closure*>(val.toClosure())->clone();
 				theval.toClosure()->_base = _base;
 				__ObjaddRef(_base); //ref for the closure
+				_sharedstate->gcBarrier(_base);
 			}
 			if(temp.isNull() == true) {
 				bool isconstructor;
@@ -127,6 +150,7 @@ bool rabbit::Class::newSlot(rabbit::SharedState *ss,const rabbit::ObjectPtr &key
 				m.val = theval;
 				_members->newSlot(key,rabbit::ObjectPtr(_make_method_idx(_methods.size())));
 				_methods.pushBack(m);
+				_cachetag = ss->newCacheTag();
 			} else {
 				_methods[_member_idx(temp)].val = theval;
 			}
@@ -137,6 +161,7 @@ bool rabbit::Class::newSlot(rabbit::SharedState *ss,const rabbit::ObjectPtr &key
 	m.val = val;
 	_members->newSlot(key,rabbit::ObjectPtr(_make_field_idx(_defaultvalues.size())));
 	_defaultvalues.pushBack(m);
+	_cachetag = ss->newCacheTag();
 	return true;
 }
 
@@ -144,7 +169,7 @@ rabbit::Instance *rabbit::Class::createInstance() {
 	if(!_locked) {
 		lock();
 	}
-	return rabbit::Instance::create(NULL,this);
+	return rabbit::Instance::create(_sharedstate,this);
 }
 
 int64_t rabbit::Class::next(const rabbit::ObjectPtr &refpos, rabbit::ObjectPtr &outkey, rabbit::ObjectPtr &outval) {
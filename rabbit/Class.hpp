@@ -16,7 +16,7 @@
 #include <rabbit/ClassMember.hpp>
 
 namespace rabbit {
-	class Class : public rabbit::RefCounted {
+	class Class : public rabbit::Collectable {
 		public:
 			Class(rabbit::SharedState *ss,rabbit::Class *base);
 		public:
@@ -29,7 +29,11 @@ namespace rabbit {
 			bool getAttributes(const rabbit::ObjectPtr &key,rabbit::ObjectPtr &outval);
 			void lock();
 			void release();
+			void mark(rabbit::Collectable **chain);
 			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_CLASS;
+			}
 			int64_t next(const rabbit::ObjectPtr &refpos, rabbit::ObjectPtr &outkey, rabbit::ObjectPtr &outval);
 			rabbit::Instance *createInstance();
 			rabbit::Table *_members;
@@ -43,6 +47,7 @@ namespace rabbit {
 			bool _locked;
 			int64_t _constructoridx;
 			int64_t _udsize;
+			uint64_t _cachetag; //!< identify the current member layout for the inline caches, changed by each new member
 	};
 	#define calcinstancesize(_theclass_) \
 		(_theclass_->_udsize + sq_aligning(sizeof(rabbit::Instance) +  (sizeof(rabbit::ObjectPtr)*(_theclass_->_defaultvalues.size()>0?_theclass_->_defaultvalues.size()-1:0))))
@@ -29,15 +29,17 @@ rabbit::Closure::~Closure() {
 	__Objrelease(_base);
 }
 
-rabbit::Closure::Closure(rabbit::SharedState *ss,rabbit::FunctionProto *func){
+rabbit::Closure::Closure(rabbit::SharedState *ss,rabbit::FunctionProto *func) :
+	rabbit::Collectable(ss) {
 	_function = func;
 	__ObjaddRef(_function); _base = NULL;
+	_sharedstate->gcBarrier(_function);
 	_env = NULL;
 	_root=NULL;
 }
 rabbit::Closure *rabbit::Closure::create(rabbit::SharedState *ss,rabbit::FunctionProto *func,rabbit::WeakRef *root){
 	int64_t size = _CALC_CLOSURE_SIZE(func);
-	rabbit::Closure *nc=(rabbit::Closure*)SQ_MALLOC(size);
+	rabbit::Closure *nc=(rabbit::Closure*)SQ_MALLOC(ss, rabbit::MEM_CLOSURE, size);
 	new ((char*)nc) rabbit::Closure(ss,func);
 	nc->_outervalues = (rabbit::ObjectPtr *)(nc + 1);
 	nc->_defaultparams = &nc->_outervalues[func->_noutervalues];
@@ -54,8 +56,29 @@ void rabbit::Closure::release(){
 	_DESTRUCT_VECTOR(ObjectPtr,f->_noutervalues,_outervalues);
 	_DESTRUCT_VECTOR(ObjectPtr,f->_ndefaultparams,_defaultparams);
 	__Objrelease(_function);
+	rabbit::SharedState *ss = _sharedstate;
 	this->~Closure();
-	sq_vm_free(this,size);
+	SQ_FREE(ss, rabbit::MEM_CLOSURE, this, size);
+}
+
+void rabbit::Closure::mark(rabbit::Collectable **chain) {
+	if(_base) {
+		_base->setReachable(chain);
+	}
+	rabbit::FunctionProto *f = _function;
+	f->setReachable(chain);
+	for(int64_t i = 0; i < f->_noutervalues; i++) {
+		rabbit::SharedState::markObject(_outervalues[i], chain);
+	}
+	for(int64_t i = 0; i < f->_ndefaultparams; i++) {
+		rabbit::SharedState::markObject(_defaultparams[i], chain);
+	}
+}
+
+void rabbit::Closure::finalize() {
+	rabbit::FunctionProto *f = _function;
+	_NULL_SQOBJECT_VECTOR(_outervalues,f->_noutervalues);
+	_NULL_SQOBJECT_VECTOR(_defaultparams,f->_ndefaultparams);
 }
 
 void rabbit::Closure::setRoot(rabbit::WeakRef *r) {
@@ -66,7 +89,7 @@ void rabbit::Closure::setRoot(rabbit::WeakRef *r) {
 
 rabbit::Closure* rabbit::Closure::clone() {
 	rabbit::FunctionProto *f = _function;
-	rabbit::Closure * ret = rabbit::Closure::create(NULL,f,_root);
+	rabbit::Closure * ret = rabbit::Closure::create(_sharedstate,f,_root);
 	ret->_env = _env;
 	if(ret->_env) {
 		__ObjaddRef(ret->_env);
@@ -76,3 +99,186 @@ rabbit::Closure* rabbit::Closure::clone() {
 	return ret;
 }
 
+
+bool rabbit::safeWrite(rabbit::VirtualMachine* v,SQWRITEFUNC write,rabbit::UserPointer up,rabbit::UserPointer dest,int64_t size)
+{
+	if(write(up,dest,size) != size) {
+		v->raise_error("io error (write function failure)");
+		return false;
+	}
+	return true;
+}
+
+bool rabbit::safeRead(rabbit::VirtualMachine* v,SQREADFUNC read,rabbit::UserPointer up,rabbit::UserPointer dest,int64_t size)
+{
+	if(size && read(up,dest,size) != size) {
+		v->raise_error("io error, read function failure, the origin stream could be corrupted/truncated");
+		return false;
+	}
+	return true;
+}
+
+bool rabbit::writeTag(rabbit::VirtualMachine* v,SQWRITEFUNC write,rabbit::UserPointer up,uint32_t tag)
+{
+	return safeWrite(v,write,up,&tag,sizeof(tag));
+}
+
+bool rabbit::checkTag(rabbit::VirtualMachine* v,SQREADFUNC read,rabbit::UserPointer up,uint32_t tag)
+{
+	uint32_t t;
+	_CHECK_IO(safeRead(v,read,up,&t,sizeof(t)));
+	if(t != tag){
+		v->raise_error("invalid or corrupted closure stream");
+		return false;
+	}
+	return true;
+}
+
+bool rabbit::writeObject(rabbit::VirtualMachine* v,rabbit::UserPointer up,SQWRITEFUNC write,const rabbit::ObjectPtr &o)
+{
+	uint32_t type = (uint32_t)o.getType();
+	_CHECK_IO(safeWrite(v,write,up,&type,sizeof(type)));
+	switch(o.getType()){
+		case rabbit::OT_STRING:
+			{
+				int64_t len = o.toString()->_len;
+				_CHECK_IO(safeWrite(v,write,up,&len,sizeof(int64_t)));
+				_CHECK_IO(safeWrite(v,write,up,(rabbit::UserPointer)o.getStringValue(),sq_rsl(len)));
+			}
+			break;
+		case rabbit::OT_BOOL:
+			{
+				int64_t val = o.toBoolean() ? 1 : 0;
+				_CHECK_IO(safeWrite(v,write,up,&val,sizeof(int64_t)));
+			}
+			break;
+		case rabbit::OT_INTEGER:
+			{
+				int64_t val = o.toInteger();
+				_CHECK_IO(safeWrite(v,write,up,&val,sizeof(int64_t)));
+			}
+			break;
+		case rabbit::OT_FLOAT:
+			{
+				float_t val = o.toFloat();
+				_CHECK_IO(safeWrite(v,write,up,&val,sizeof(float_t)));
+			}
+			break;
+		case rabbit::OT_NULL:
+			break;
+		default:
+			v->raise_error("cannot serialize a %s",getTypeName(o));
+			return false;
+	}
+	return true;
+}
+
+bool rabbit::readString(rabbit::VirtualMachine* v,rabbit::UserPointer up,SQREADFUNC read,int64_t len,rabbit::ObjectPtr &o)
+{
+	//read by growing chunks: a corrupted length ends on the end of the stream
+	const char *pad = "";
+	int64_t done = 0;
+	while(done < len) {
+		int64_t chunk = len - done;
+		if(chunk > done + 4096) {
+			chunk = done + 4096;
+		}
+		char *buffer = v->_sharedstate->getScratchPad(sq_rsl(done + chunk)+1);
+		_CHECK_IO(safeRead(v,read,up,buffer + sq_rsl(done),sq_rsl(chunk)));
+		pad = buffer;
+		done += chunk;
+	}
+	o = rabbit::String::create(v->_sharedstate,pad,len);
+	return true;
+}
+
+bool rabbit::readObject(rabbit::VirtualMachine* v,rabbit::UserPointer up,SQREADFUNC read,rabbit::ObjectPtr &o)
+{
+	uint32_t type;
+	_CHECK_IO(safeRead(v,read,up,&type,sizeof(type)));
+	switch((rabbit::ObjectType)type){
+		case rabbit::OT_STRING:
+			{
+				int64_t len;
+				_CHECK_IO(safeRead(v,read,up,&len,sizeof(int64_t)));
+				if(len < 0) {
+					v->raise_error("invalid or corrupted closure stream");
+					return false;
+				}
+				_CHECK_IO(rabbit::readString(v,up,read,len,o));
+			}
+			break;
+		case rabbit::OT_INTEGER:
+			{
+				int64_t val;
+				_CHECK_IO(safeRead(v,read,up,&val,sizeof(int64_t)));
+				o = val;
+				//the SQ_TAGGED_OBJECT layout stores 56 bits integers
+				if(o.toInteger() != val) {
+					v->raise_error("integer literal %lld out of range", (long long)val);
+					return false;
+				}
+			}
+			break;
+		case rabbit::OT_BOOL:
+			{
+				int64_t val;
+				_CHECK_IO(safeRead(v,read,up,&val,sizeof(int64_t)));
+				if(val != 0 && val != 1) {
+					v->raise_error("invalid or corrupted closure stream");
+					return false;
+				}
+				o = val != 0;
+			}
+			break;
+		case rabbit::OT_FLOAT:
+			{
+				float_t val;
+				_CHECK_IO(safeRead(v,read,up,&val,sizeof(float_t)));
+				o = val;
+			}
+			break;
+		case rabbit::OT_NULL:
+			o.Null();
+			break;
+		default:
+			v->raise_error("cannot serialize a %s",IdType2Name((rabbit::ObjectType)type));
+			return false;
+	}
+	return true;
+}
+
+bool rabbit::Closure::save(rabbit::VirtualMachine *v,rabbit::UserPointer up,SQWRITEFUNC write)
+{
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_HEAD));
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_VERSION));
+	_CHECK_IO(writeTag(v,write,up,SQ_OPCODE_COUNT));
+	_CHECK_IO(writeTag(v,write,up,sizeof(char)));
+	_CHECK_IO(writeTag(v,write,up,sizeof(int64_t)));
+	_CHECK_IO(writeTag(v,write,up,sizeof(float_t)));
+	_CHECK_IO(writeTag(v,write,up,sizeof(rabbit::Instruction)));
+	_CHECK_IO(_function->save(v,up,write));
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_TAIL));
+	return true;
+}
+
+bool rabbit::Closure::load(rabbit::VirtualMachine *v,rabbit::UserPointer up,SQREADFUNC read,rabbit::ObjectPtr &ret)
+{
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_HEAD));
+	uint32_t version;
+	_CHECK_IO(safeRead(v,read,up,&version,sizeof(version)));
+	if(version != SQ_CLOSURESTREAM_VERSION) {
+		v->raise_error("bytecode stream version %d, expected %d", (int)version, (int)SQ_CLOSURESTREAM_VERSION);
+		return false;
+	}
+	_CHECK_IO(checkTag(v,read,up,SQ_OPCODE_COUNT));
+	_CHECK_IO(checkTag(v,read,up,sizeof(char)));
+	_CHECK_IO(checkTag(v,read,up,sizeof(int64_t)));
+	_CHECK_IO(checkTag(v,read,up,sizeof(float_t)));
+	_CHECK_IO(checkTag(v,read,up,sizeof(rabbit::Instruction)));
+	rabbit::ObjectPtr func;
+	_CHECK_IO(rabbit::FunctionProto::load(v,up,read,func));
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_TAIL));
+	ret = rabbit::Closure::create(v->_sharedstate,func.toFunctionProto(),v->_roottable.toTable()->getWeakRef(v->_sharedstate, rabbit::OT_TABLE));
+	return true;
+}
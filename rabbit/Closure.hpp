@@ -7,7 +7,7 @@
  */
 #pragma once
 
-#include <rabbit/RefCounted.hpp>
+#include <rabbit/Collectable.hpp>
 #include <rabbit/sqconfig.hpp>
 #include <rabbit/rabbit.hpp>
 #include <rabbit/squtils.hpp>
@@ -23,15 +23,23 @@ namespace rabbit {
 	
 	#define _CALC_CLOSURE_SIZE(func) (sizeof(rabbit::Closure) + (func->_noutervalues*sizeof(rabbit::ObjectPtr)) + (func->_ndefaultparams*sizeof(rabbit::ObjectPtr)))
 	
-	class Closure : public rabbit::RefCounted {
+	class Closure : public rabbit::Collectable {
 		private:
 			Closure(rabbit::SharedState *ss,rabbit::FunctionProto *func);
 		public:
 			static Closure *create(rabbit::SharedState *ss,rabbit::FunctionProto *func,rabbit::WeakRef *root);
+			//bytecode stream of the function of the closure (see sq_writeclosure / sq_readclosure)
+			bool save(rabbit::VirtualMachine *v,rabbit::UserPointer up,SQWRITEFUNC write);
+			static bool load(rabbit::VirtualMachine *v,rabbit::UserPointer up,SQREADFUNC read,rabbit::ObjectPtr &ret);
 			void release();
 			void setRoot(rabbit::WeakRef *r);
 			Closure *clone();
 			~Closure();
+			void mark(rabbit::Collectable **chain);
+			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_CLOSURE;
+			}
 		
 			rabbit::WeakRef *_env;
 			rabbit::WeakRef *_root;
@@ -40,9 +48,19 @@ namespace rabbit {
 			rabbit::ObjectPtr *_outervalues;
 			rabbit::ObjectPtr *_defaultparams;
 	};
-
+	//bytecode stream helpers: raise an error in the VM and return false on failure
+	bool safeWrite(rabbit::VirtualMachine* v,SQWRITEFUNC write,rabbit::UserPointer up,rabbit::UserPointer dest,int64_t size);
+	bool safeRead(rabbit::VirtualMachine* v,SQREADFUNC read,rabbit::UserPointer up,rabbit::UserPointer dest,int64_t size);
+	bool writeTag(rabbit::VirtualMachine* v,SQWRITEFUNC write,rabbit::UserPointer up,uint32_t tag);
+	bool checkTag(rabbit::VirtualMachine* v,SQREADFUNC read,rabbit::UserPointer up,uint32_t tag);
+	bool writeObject(rabbit::VirtualMachine* v,rabbit::UserPointer up,SQWRITEFUNC write,const rabbit::ObjectPtr &o);
+	bool readObject(rabbit::VirtualMachine* v,rabbit::UserPointer up,SQREADFUNC read,rabbit::ObjectPtr &o);
+	//string of 'len' characters (length already read and checked by the caller)
+	bool readString(rabbit::VirtualMachine* v,rabbit::UserPointer up,SQREADFUNC read,int64_t len,rabbit::ObjectPtr &o);
 }
 #define _CHECK_IO(exp)  { if(!exp)return false; }
 #define SQ_CLOSURESTREAM_HEAD (('S'<<24)|('Q'<<16)|('I'<<8)|('R'))
 #define SQ_CLOSURESTREAM_PART (('P'<<24)|('A'<<16)|('R'<<8)|('T'))
 #define SQ_CLOSURESTREAM_TAIL (('T'<<24)|('A'<<16)|('I'<<8)|('L'))
+//format of the bytecode streams, to increment on every change of the instructions semantic or of the stream layout
+#define SQ_CLOSURESTREAM_VERSION 1
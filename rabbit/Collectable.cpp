@@ -0,0 +1,77 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#include <rabbit/Collectable.hpp>
+#include <rabbit/SharedState.hpp>
+#include <rabbit/WeakRef.hpp>
+
+rabbit::Collectable::Collectable(rabbit::SharedState *ss) {
+	_sharedstate = ss;
+	_gcnext = NULL;
+	_gcprev = NULL;
+	//allocated black: a collection in progress can not free an object it has not seen
+	_gcmark = _sharedstate->_gc_epoch;
+	if(_sharedstate->_gc_state == rabbit::SharedState::GC_PAUSE) {
+		addToChain(&_sharedstate->_gc_chain, this);
+	} else {
+		addToChain(&_sharedstate->_gc_marked, this);
+	}
+}
+
+rabbit::Collectable::~Collectable() {
+	if(    _gcprev == NULL
+	    && _sharedstate->_gc_marked == this) {
+		removeFromChain(&_sharedstate->_gc_marked, this);
+	} else {
+		removeFromChain(&_sharedstate->_gc_chain, this);
+	}
+}
+
+bool rabbit::Collectable::isMarked() const {
+	return _gcmark == _sharedstate->_gc_epoch;
+}
+
+void rabbit::Collectable::setReachable(rabbit::Collectable **chain) {
+	if(isMarked() == true) {
+		return;
+	}
+	_gcmark = _sharedstate->_gc_epoch;
+	removeFromChain(&_sharedstate->_gc_chain, this);
+	addToChain(chain, this);
+	//the gray list keeps the object alive until its references are marked
+	refCountIncrement();
+	_sharedstate->_gc_gray.pushBack(this);
+}
+
+void rabbit::Collectable::clearWeakRef() {
+	if(_weakref) {
+		_weakref->_obj.setNull();
+		_weakref = NULL;
+	}
+}
+
+void rabbit::Collectable::addToChain(rabbit::Collectable **chain, rabbit::Collectable *c) {
+	c->_gcnext = *chain;
+	c->_gcprev = NULL;
+	if(*chain) {
+		(*chain)->_gcprev = c;
+	}
+	*chain = c;
+}
+
+void rabbit::Collectable::removeFromChain(rabbit::Collectable **chain, rabbit::Collectable *c) {
+	if(c->_gcprev) {
+		c->_gcprev->_gcnext = c->_gcnext;
+	} else {
+		*chain = c->_gcnext;
+	}
+	if(c->_gcnext) {
+		c->_gcnext->_gcprev = c->_gcprev;
+	}
+	c->_gcnext = NULL;
+	c->_gcprev = NULL;
+}
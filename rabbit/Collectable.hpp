@@ -0,0 +1,45 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <etk/types.hpp>
+#include <rabbit/RefCounted.hpp>
+#include <rabbit/ObjectType.hpp>
+
+namespace rabbit {
+	class SharedState;
+	/**
+	 * @brief Object that can be part of a reference cycle.
+	 * All the collectables of a shared state are linked in SharedState::_gc_chain. During a collection cycle
+	 * the reachable ones are moved in SharedState::_gc_marked and what is left in _gc_chain is finalized.
+	 * An object is marked (black or gray) when _gcmark is equal to SharedState::_gc_epoch, flipping the epoch
+	 * at the start of a cycle unmarks all the objects at once.
+	 */
+	class Collectable : public rabbit::RefCounted {
+		public:
+			Collectable(rabbit::SharedState *ss);
+			virtual ~Collectable();
+			//mark all the objects referenced by this one (see SharedState::markObject)
+			virtual void mark(rabbit::Collectable **chain) = 0;
+			//release all the references to other objects, used to break the unreachable cycles
+			virtual void finalize() = 0;
+			virtual rabbit::ObjectType getType() = 0;
+			//flag the object as reachable, move it in 'chain' and queue it for the mark of its references
+			void setReachable(rabbit::Collectable **chain);
+			bool isMarked() const;
+			//detach the weak reference of an unreachable object, it can not be resurrected by the script anymore
+			void clearWeakRef();
+			static void addToChain(rabbit::Collectable **chain, rabbit::Collectable *c);
+			static void removeFromChain(rabbit::Collectable **chain, rabbit::Collectable *c);
+			
+			rabbit::Collectable *_gcnext;
+			rabbit::Collectable *_gcprev;
+			rabbit::SharedState *_sharedstate;
+			uint8_t _gcmark;
+	};
+}
@@ -48,6 +48,21 @@ struct SQScope {
 	int64_t stacksize;
 };
 
+/* state of the function before a block that is compiled only to be discarded (branch of a constant condition) */
+struct SQDeadCode {
+	int64_t ninstructions;
+	int64_t nlineinfos;
+	int64_t nlocalvarinfos;
+	int64_t nfunctions;
+	int64_t nbreaks;
+	int64_t ncontinues;
+	int64_t lastline;
+	int64_t returnexp;
+	int64_t constpos;
+	int64_t consttarget;
+	rabbit::ObjectPtr constvalue;
+};
+
 #define BEGIN_SCOPE() SQScope __oldscope__ = _scope; \
 					 _scope.outers = _fs->_outers; \
 					 _scope.stacksize = _fs->getStacksize();
@@ -96,6 +111,22 @@ public:
 		_scope.outers = 0;
 		_scope.stacksize = 0;
 		_compilererror[0] = '\0';
+		_constpos = -1;
+		_consttarget = -1;
+		_constfs = NULL;
+	}
+	Compiler(rabbit::VirtualMachine *v, const char *buf, int64_t size, const char* sourcename, bool raiseerror, bool lineinfo)
+	{
+		_vm=v;
+		_lex.init(_get_shared_state(v), buf, size,Throwerror,this);
+		_sourcename = rabbit::String::create(_get_shared_state(v), sourcename);
+		_lineinfo = lineinfo;_raiseerror = raiseerror;
+		_scope.outers = 0;
+		_scope.stacksize = 0;
+		_compilererror[0] = '\0';
+		_constpos = -1;
+		_consttarget = -1;
+		_constfs = NULL;
 	}
 	static void Throwerror(void *ud, const char *s) {
 		rabbit::Compiler *c = (rabbit::Compiler *)ud;
@@ -146,10 +177,10 @@ public:
 		switch(tok)
 		{
 		case TK_IDENTIFIER:
-			ret = _fs->createString(_lex._svalue);
+			ret = _fs->createString(_lex._svalue,_lex._slen);
 			break;
 		case TK_STRING_LITERAL:
-			ret = _fs->createString(_lex._svalue,_lex._longstr.size()-1);
+			ret = _fs->createString(_lex._svalue,_lex._slen);
 			break;
 		case TK_INTEGER:
 			ret = rabbit::ObjectPtr(_lex._nvalue);
@@ -227,6 +258,7 @@ public:
 	}
 	void Statement(bool closeframe = true)
 	{
+		_constpos = -1;
 		_fs->addLineInfos(_lex._currentline, _lineinfo);
 		switch(_token){
 		case ';':  Lex();				  break;
@@ -445,10 +477,23 @@ public:
 				EmitCompoundArith(op, ds, pos);
 				break;
 			}
+			_constpos = -1;
 			}
 			break;
 		case '?': {
 			Lex();
+			rabbit::ObjectPtr cond;
+			if(IsConstantExp(cond)) {
+				//constant condition: only the selected expression is kept
+				RemoveConstantExp();
+				_fs->popTarget();
+				bool first = !rabbit::VirtualMachine::IsFalse(cond);
+				int64_t trg = _fs->pushTarget();
+				ConditionalExp(trg, first);
+				Expect(':');
+				ConditionalExp(trg, !first);
+				break;
+			}
 			_fs->addInstruction(_OP_JZ, _fs->popTarget());
 			int64_t jzpos = _fs->getCurrentPos();
 			int64_t trg = _fs->pushTarget();
@@ -465,11 +510,35 @@ public:
 			_fs->setIntructionParam(jmppos, 1, _fs->getCurrentPos() - jmppos);
 			_fs->setIntructionParam(jzpos, 1, endfirstexp - jzpos + 1);
 			_fs->snoozeOpt();
+			_constpos = -1;
 			}
 			break;
 		}
 		_es = es;
 	}
+	//one of the expressions of a conditional with a constant condition, 'keep' false when it is not selected
+	void ConditionalExp(int64_t trg, bool keep)
+	{
+		if(keep == false) {
+			SQDeadCode dead;
+			BeginDeadCode(dead);
+			Expression();
+			_fs->popTarget();
+			EndDeadCode(dead);
+			return;
+		}
+		Expression();
+		rabbit::ObjectPtr value;
+		if(IsConstantExp(value)) {
+			RemoveConstantExp();
+			_fs->popTarget();
+			EmitLoadConstant(value, trg);
+			return;
+		}
+		int64_t exp = _fs->popTarget();
+		if(trg != exp) _fs->addInstruction(_OP_MOVE, trg, exp);
+		_constpos = -1;
+	}
 	template<typename T> void INVOKE_EXP(T f)
 	{
 		SQExpState es = _es;
@@ -481,8 +550,22 @@ public:
 	}
 	template<typename T> void BIN_EXP(SQOpcode op, T f,int64_t op3 = 0)
 	{
+		rabbit::ObjectPtr o1, o2, res;
+		bool fold = IsConstantExp(o1);
+		int64_t pos = _fs->getCurrentPos();
 		Lex();
 		INVOKE_EXP(f);
+		//the right operand is one constant load, after the left one (or merged with it in a _OP_DLOAD)
+		fold = fold && _fs->getCurrentPos() <= pos + 1 && IsConstantExp(o2) && FoldBinaryOp(op, op3, o1, o2, res);
+		if(fold) {
+			RemoveConstantExp();
+			_fs->popTarget();
+			RemoveConstantExp();
+			_fs->popTarget();
+			EmitLoadConstant(res, _fs->pushTarget());
+			_es.etype = EXPR;
+			return;
+		}
 		int64_t op1 = _fs->popTarget();int64_t op2 = _fs->popTarget();
 		_fs->addInstruction(op, _fs->pushTarget(), op1, op2, op3);
 		_es.etype = EXPR;
@@ -502,6 +585,7 @@ public:
 			if(trg != second_exp) _fs->addInstruction(_OP_MOVE, trg, second_exp);
 			_fs->snoozeOpt();
 			_fs->setIntructionParam(jpos, 1, (_fs->getCurrentPos() - jpos));
+			_constpos = -1;
 			_es.etype = EXPR;
 			break;
 		}else return;
@@ -522,6 +606,7 @@ public:
 			if(trg != second_exp) _fs->addInstruction(_OP_MOVE, trg, second_exp);
 			_fs->snoozeOpt();
 			_fs->setIntructionParam(jpos, 1, (_fs->getCurrentPos() - jpos));
+			_constpos = -1;
 			_es.etype = EXPR;
 			break;
 			}
@@ -736,7 +821,7 @@ public:
 		switch(_token)
 		{
 		case TK_STRING_LITERAL:
-			_fs->addInstruction(_OP_LOAD, _fs->pushTarget(), _fs->getConstant(_fs->createString(_lex._svalue,_lex._longstr.size()-1)));
+			EmitLoadConstant(_fs->createString(_lex._svalue,_lex._slen), -1);
 			Lex();
 			break;
 		case TK_BASE:
@@ -753,7 +838,7 @@ public:
 				rabbit::Object constant;
 
 				switch(_token) {
-					case TK_IDENTIFIER:  id = _fs->createString(_lex._svalue);	   break;
+					case TK_IDENTIFIER:  id = _fs->createString(_lex._svalue,_lex._slen);	   break;
 					case TK_THIS:		id = _fs->createString("this",4);		break;
 					case TK_CONSTRUCTOR: id = _fs->createString("constructor",11); break;
 				}
@@ -796,22 +881,7 @@ public:
 						constval = constant;
 					}
 					_es.epos = _fs->pushTarget();
-
-					/* generate direct or literal function depending on size */
-					switch(constval.getType()) {
-						case rabbit::OT_INTEGER:
-							EmitloadConstInt(constval.toInteger(),_es.epos);
-							break;
-						case rabbit::OT_FLOAT:
-							EmitloadConstFloat(constval.toFloat(),_es.epos);
-							break;
-						case rabbit::OT_BOOL:
-							_fs->addInstruction(_OP_LOADBOOL, _es.epos, constval.toInteger());
-							break;
-						default:
-							_fs->addInstruction(_OP_LOAD,_es.epos,_fs->getConstant(constval));
-							break;
-					}
+					EmitLoadConstant(constval, _es.epos);
 					_es.etype = EXPR;
 				}
 				else {
@@ -839,13 +909,13 @@ public:
 			return _es.epos;
 			break;
 		case TK_NULL:
-			_fs->addInstruction(_OP_LOADNULLS, _fs->pushTarget(),1);
+			EmitLoadConstant(rabbit::ObjectPtr(), -1);
 			Lex();
 			break;
-		case TK_INTEGER: EmitloadConstInt(_lex._nvalue,-1); Lex();  break;
-		case TK_FLOAT: EmitloadConstFloat(_lex._fvalue,-1); Lex(); break;
+		case TK_INTEGER: EmitLoadConstant(rabbit::ObjectPtr(_lex._nvalue),-1); Lex();  break;
+		case TK_FLOAT: EmitLoadConstant(rabbit::ObjectPtr(_lex._fvalue),-1); Lex(); break;
 		case TK_TRUE: case TK_FALSE:
-			_fs->addInstruction(_OP_LOADBOOL, _fs->pushTarget(),_token == TK_TRUE?1:0);
+			EmitLoadConstant(rabbit::ObjectPtr(_token == TK_TRUE), -1);
 			Lex();
 			break;
 		case '[': {
@@ -874,15 +944,15 @@ public:
 		case '-':
 			Lex();
 			switch(_token) {
-			case TK_INTEGER: EmitloadConstInt(-_lex._nvalue,-1); Lex(); break;
-			case TK_FLOAT: EmitloadConstFloat(-_lex._fvalue,-1); Lex(); break;
+			case TK_INTEGER: EmitLoadConstant(rabbit::ObjectPtr(-_lex._nvalue),-1); Lex(); break;
+			case TK_FLOAT: EmitLoadConstant(rabbit::ObjectPtr(-_lex._fvalue),-1); Lex(); break;
 			default: UnaryOP(_OP_NEG);
 			}
 			break;
 		case '!': Lex(); UnaryOP(_OP_NOT); break;
 		case '~':
 			Lex();
-			if(_token == TK_INTEGER)  { EmitloadConstInt(~_lex._nvalue,-1); Lex(); break; }
+			if(_token == TK_INTEGER)  { EmitLoadConstant(rabbit::ObjectPtr(~_lex._nvalue),-1); Lex(); break; }
 			UnaryOP(_OP_BWNOT);
 			break;
 		case TK_TYPEOF : Lex() ;UnaryOP(_OP_TYPEOF); break;
@@ -894,8 +964,8 @@ public:
 		case TK_DELETE : DeleteExpr(); break;
 		case '(': Lex(); CommaExpr(); Expect(')');
 			break;
-		case TK___LINE__: EmitloadConstInt(_lex._currentline,-1); Lex(); break;
-		case TK___FILE__: _fs->addInstruction(_OP_LOAD, _fs->pushTarget(), _fs->getConstant(_sourcename)); Lex(); break;
+		case TK___LINE__: EmitLoadConstant(rabbit::ObjectPtr(_lex._currentline),-1); Lex(); break;
+		case TK___FILE__: EmitLoadConstant(_sourcename,-1); Lex(); break;
 		default: error("expression expected");
 		}
 		_es.etype = EXPR;
@@ -906,7 +976,7 @@ public:
 		if(target < 0) {
 			target = _fs->pushTarget();
 		}
-		if(value <= INT64_MAX && value > INT64_MIN) { //does it fit in 32 bits?
+		if(value <= INT32_MAX && value >= INT32_MIN) { //does it fit in 32 bits?
 			_fs->addInstruction(_OP_LOADINT, target,value);
 		}
 		else {
@@ -928,9 +998,205 @@ public:
 	void UnaryOP(SQOpcode op)
 	{
 		PrefixedExpr();
+		rabbit::ObjectPtr o, res;
+		if(IsConstantExp(o) && FoldUnaryOp(op, o, res)) {
+			RemoveConstantExp();
+			_fs->popTarget();
+			EmitLoadConstant(res, _fs->pushTarget());
+			return;
+		}
 		int64_t src = _fs->popTarget();
 		_fs->addInstruction(op, _fs->pushTarget(), src);
 	}
+	//load a literal or the value of a constant, integer, float, bool, null and string values are recorded as
+	//constant expressions that the operators and the conditions can fold
+	void EmitLoadConstant(const rabbit::ObjectPtr &value, int64_t target)
+	{
+		if(target < 0) {
+			target = _fs->pushTarget();
+		}
+		switch(value.getType()) {
+			case rabbit::OT_INTEGER:
+				EmitloadConstInt(value.toInteger(), target);
+				break;
+			case rabbit::OT_FLOAT:
+				EmitloadConstFloat(value.toFloat(), target);
+				break;
+			case rabbit::OT_BOOL:
+				_fs->addInstruction(_OP_LOADBOOL, target, value.toInteger());
+				break;
+			case rabbit::OT_NULL:
+				_fs->addInstruction(_OP_LOADNULLS, target, 1);
+				break;
+			default:
+				_fs->addInstruction(_OP_LOAD, target, _fs->getConstant(value));
+				break;
+		}
+		_constpos = -1;
+		switch(value.getType()) {
+			case rabbit::OT_INTEGER: case rabbit::OT_FLOAT: case rabbit::OT_BOOL: case rabbit::OT_NULL: case rabbit::OT_STRING:
+				_constvalue = value;
+				_constpos = _fs->getCurrentPos();
+				_consttarget = target;
+				_constfs = _fs;
+				break;
+			default:
+				break;
+		}
+	}
+	//true when the expression just compiled is a constant: its value is loaded in a temporary by the last
+	//instruction (alone or as the second load of a _OP_DLOAD)
+	bool IsConstantExp(rabbit::ObjectPtr &value)
+	{
+		if(    _constpos < 0
+		    || _constfs != _fs
+		    || _constpos != _fs->getCurrentPos()
+		    || _fs->_targetstack.size() == 0) {
+			return false;
+		}
+		int64_t trg = _fs->topTarget();
+		if(trg != _consttarget || _fs->isLocal(trg)) {
+			return false;
+		}
+		rabbit::Instruction &i = _fs->getInstruction(_constpos);
+		switch(i.op) {
+			case _OP_LOADINT: case _OP_LOADFLOAT: case _OP_LOADBOOL: case _OP_LOAD:
+				if(i._arg0 != trg) return false;
+				break;
+			case _OP_LOADNULLS:
+				if(i._arg0 != trg || i._arg1 != 1) return false;
+				break;
+			case _OP_DLOAD:
+				if(i._arg2 != trg) return false;
+				break;
+			default:
+				return false;
+		}
+		value = _constvalue;
+		return true;
+	}
+	//remove the load of the constant expression found by IsConstantExp() (its target stays on the stack), the
+	//instruction before it may be a MOVE whose target is still read: nothing may be merged with it
+	void RemoveConstantExp()
+	{
+		rabbit::Instruction &i = _fs->getInstruction(_fs->getCurrentPos());
+		if(i.op == _OP_DLOAD) {
+			i.op = _OP_LOAD;
+			i._arg2 = 0;
+			i._arg3 = 0;
+		}
+		else {
+			_fs->popInstructions(1);
+		}
+		_constpos = -1;
+		_fs->snoozeOpt();
+	}
+	//evaluate a binary operator on two constants with the code of the virtual machine. false when it is left
+	//to the run time: other types, errors (division by zero) or metamethods
+	bool FoldBinaryOp(SQOpcode op, int64_t op3, const rabbit::ObjectPtr &o1, const rabbit::ObjectPtr &o2, rabbit::ObjectPtr &res)
+	{
+		int64_t tmask = o1.getType() | o2.getType();
+		bool numeric = (tmask == rabbit::OT_INTEGER || tmask == rabbit::OT_FLOAT || tmask == (rabbit::OT_INTEGER|rabbit::OT_FLOAT));
+		switch(op) {
+			case _OP_DIV:
+			case _OP_MOD:
+				if(    tmask == rabbit::OT_INTEGER
+				    && (    o2.toInteger() == 0
+				         || (o2.toInteger() == -1 && o1.toInteger() == INT64_MIN))) {
+					return false;
+				}
+				//fallthrough
+			case _OP_ADD:
+			case _OP_SUB:
+			case _OP_MUL: {
+				int64_t arith = op == _OP_ADD ? '+' : op == _OP_SUB ? '-' : op == _OP_MUL ? '*' : op == _OP_DIV ? '/' : '%';
+				if(numeric == false) {
+					//string concatenation with a string, a number or a bool
+					if(    op != _OP_ADD
+					    || (o1.isString() == false && o2.isString() == false)
+					    || (tmask & ~(rabbit::OT_STRING|rabbit::OT_INTEGER|rabbit::OT_FLOAT|rabbit::OT_BOOL)) != 0) {
+						return false;
+					}
+				}
+				if(_vm->ARITH_OP(arith, res, o1, o2) == false) {
+					return false;
+				}
+				//a NaN can not be a key of the literals
+				return res.isFloat() == false || res.toFloat() == res.toFloat();
+			}
+			case _OP_BITW:
+				return tmask == rabbit::OT_INTEGER && _vm->BW_OP(op3, res, o1, o2);
+			case _OP_CMP:
+				if(numeric == false && tmask != rabbit::OT_STRING) {
+					return false;
+				}
+				return _vm->CMP_OP((CmpOP)op3, o1, o2, res);
+			case _OP_EQ:
+			case _OP_NE: {
+				bool eq;
+				if(rabbit::VirtualMachine::isEqual(o1, o2, eq) == false) {
+					return false;
+				}
+				res = (op == _OP_EQ) == eq;
+				return true;
+			}
+			default:
+				return false;
+		}
+	}
+	bool FoldUnaryOp(SQOpcode op, rabbit::ObjectPtr &o, rabbit::ObjectPtr &res)
+	{
+		switch(op) {
+			case _OP_NEG:
+				return (o.isInteger() || o.isFloat()) && _vm->NEG_OP(res, o);
+			case _OP_NOT:
+				res = rabbit::VirtualMachine::IsFalse(o);
+				return true;
+			case _OP_BWNOT:
+				if(o.isInteger() == false) {
+					return false;
+				}
+				res = int64_t(~o.toInteger());
+				return true;
+			default:
+				return false;
+		}
+	}
+	//compile a block or an expression that is dropped: its instructions, line infos, functions and jumps
+	//(break, continue) are removed by EndDeadCode()
+	void BeginDeadCode(SQDeadCode &dead)
+	{
+		//the dropped code may not be merged with the instruction before it
+		_fs->snoozeOpt();
+		dead.ninstructions = _fs->_instructions.size();
+		dead.nlineinfos = _fs->_lineinfos.size();
+		dead.nlocalvarinfos = _fs->_localvarinfos.size();
+		dead.nfunctions = _fs->_functions.size();
+		dead.nbreaks = _fs->_unresolvedbreaks.size();
+		dead.ncontinues = _fs->_unresolvedcontinues.size();
+		dead.lastline = _fs->_lastline;
+		dead.returnexp = _fs->_returnexp;
+		dead.constpos = _constfs == _fs ? _constpos : -1;
+		dead.consttarget = _consttarget;
+		dead.constvalue = _constvalue;
+	}
+	void EndDeadCode(SQDeadCode &dead)
+	{
+		_fs->popInstructions(_fs->_instructions.size() - dead.ninstructions);
+		while((int64_t)_fs->_lineinfos.size() > dead.nlineinfos) _fs->_lineinfos.popBack();
+		while((int64_t)_fs->_localvarinfos.size() > dead.nlocalvarinfos) _fs->_localvarinfos.popBack();
+		while((int64_t)_fs->_functions.size() > dead.nfunctions) _fs->_functions.popBack();
+		while((int64_t)_fs->_unresolvedbreaks.size() > dead.nbreaks) _fs->_unresolvedbreaks.popBack();
+		while((int64_t)_fs->_unresolvedcontinues.size() > dead.ncontinues) _fs->_unresolvedcontinues.popBack();
+		_fs->_lastline = dead.lastline;
+		_fs->_returnexp = dead.returnexp;
+		_constpos = dead.constpos;
+		_consttarget = dead.consttarget;
+		_constvalue = dead.constvalue;
+		_constfs = _fs;
+		//nothing may be merged with the instruction before the dropped code
+		_fs->snoozeOpt();
+	}
 	bool Needget()
 	{
 		switch(_token) {
@@ -1014,6 +1280,7 @@ public:
 					Expect(':'); Expression();
 					break;
 				}
+				//fallthrough
 			default :
 				_fs->addInstruction(_OP_LOAD, _fs->pushTarget(), _fs->getConstant(Expect(TK_IDENTIFIER)));
 				Expect('='); Expression();
@@ -1091,11 +1358,35 @@ public:
 			//END_SCOPE();
 		}
 	}
+	void ConstantIfBlock(bool keep)
+	{
+		if(keep == true) {
+			IfBlock();
+			return;
+		}
+		SQDeadCode dead;
+		BeginDeadCode(dead);
+		IfBlock();
+		EndDeadCode(dead);
+	}
 	void IfStatement()
 	{
 		int64_t jmppos;
 		bool haselse = false;
 		Lex(); Expect('('); CommaExpr(); Expect(')');
+		rabbit::ObjectPtr cond;
+		if(IsConstantExp(cond)) {
+			//constant condition (if(DEBUG) with a const DEBUG): the other branch is not generated
+			RemoveConstantExp();
+			_fs->popTarget();
+			bool taken = !rabbit::VirtualMachine::IsFalse(cond);
+			ConstantIfBlock(taken);
+			if(_token == TK_ELSE) {
+				Lex();
+				ConstantIfBlock(!taken);
+			}
+			return;
+		}
 		_fs->addInstruction(_OP_JZ, _fs->popTarget());
 		int64_t jnepos = _fs->getCurrentPos();
 
@@ -1195,20 +1486,90 @@ public:
 				exp.pushBack(_fs->getInstruction(expstart + i));
 			_fs->popInstructions(expsize);
 		}
+		int64_t counter = 0, limit = 0, forflags = 0;
+		bool counted = jzpos > 0 && CountedLoop(jmppos, jzpos, exp, counter, limit, forflags);
+		if(counted) {
+			//the condition is tested by _OP_FORPREP then by _OP_FORLOOP after the step of the counter
+			_fs->popInstructions(1);
+			if(jzpos == jmppos + 2) {
+				//the constant limit is loaded once in a stack slot kept until the end of the scope of the loop,
+				//unnamed: it is not a local of the debug infos
+				_fs->allocStackPos();
+			}
+			_fs->addInstruction(_OP_FORPREP, counter, 0, limit, forflags);
+			jzpos = _fs->getCurrentPos();
+		}
 		BEGIN_BREAKBLE_BLOCK()
 		Statement();
 		int64_t continuetrg = _fs->getCurrentPos();
-		if(expsize > 0) {
-			for(int64_t i = 0; i < expsize; i++)
-				_fs->addInstruction(exp[i]);
+		if(counted) {
+			_fs->addInstruction(_OP_FORLOOP, counter, jzpos - _fs->getCurrentPos() - 1, limit, forflags);
+		} else {
+			if(expsize > 0) {
+				for(int64_t i = 0; i < expsize; i++)
+					_fs->addInstruction(exp[i]);
+			}
+			_fs->addInstruction(_OP_JMP, 0, jmppos - _fs->getCurrentPos() - 1, 0);
 		}
-		_fs->addInstruction(_OP_JMP, 0, jmppos - _fs->getCurrentPos() - 1, 0);
 		if(jzpos>  0) _fs->setIntructionParam(jzpos, 1, _fs->getCurrentPos() - jzpos);
 		
 		END_BREAKBLE_BLOCK(continuetrg);
 
 		END_SCOPE();
 	}
+	// 'for(...; i cmp limit; i += step)' with the local variable i, a local or constant limit and a constant integer
+	// step (-8..7): gives the operands of _OP_FORPREP/_OP_FORLOOP. 'jmppos' and 'jzpos' delimit the code of the
+	// condition, 'exp' is the code of the step.
+	bool CountedLoop(int64_t jmppos, int64_t jzpos, const etk::Vector<rabbit::Instruction> &exp, int64_t &counter, int64_t &limit, int64_t &flags)
+	{
+		const rabbit::Instruction &cond = _fs->getInstruction(jzpos);
+		if(    cond.op != _OP_JCMP
+		    || cond._arg3 == CMP_3W
+		    || _fs->isLocal(cond._arg2) == false
+		    || cond._arg0 == cond._arg2) {
+			return false;
+		}
+		counter = cond._arg2;
+		limit = cond._arg0;
+		if(jzpos == jmppos + 2) {
+			//constant limit loaded in the first free stack position
+			const rabbit::Instruction &load = _fs->getInstruction(jmppos + 1);
+			if(    (load.op != _OP_LOADINT && load.op != _OP_LOADFLOAT && load.op != _OP_LOAD)
+			    || load._arg0 != limit
+			    || limit != _fs->getStacksize()) {
+				return false;
+			}
+		} else if(jzpos != jmppos + 1 || _fs->isLocal(limit) == false) {
+			return false;
+		}
+		int64_t step = 0;
+		flags = cond._arg3;
+		if(    exp.size() == 1
+		    && (exp[0].op == _OP_INCL || exp[0].op == _OP_PINCL)
+		    && exp[0]._arg1 == counter) {
+			//i++, ++i, i--, --i
+			step = (signed char)exp[0]._arg3;
+		} else if(    exp.size() == 2
+		           && exp[0].op == _OP_LOADINT
+		           && (exp[1].op == _OP_ADD || exp[1].op == _OP_SUB)
+		           && exp[1]._arg0 == counter
+		           && exp[1]._arg2 == counter
+		           && exp[1]._arg1 == exp[0]._arg0
+		           && exp[0]._arg0 != counter) {
+			//i += k, i -= k
+			step = exp[0]._arg1;
+			if(exp[1].op == _OP_SUB) {
+				flags |= SQ_FORLOOP_SUB;
+			}
+		} else {
+			return false;
+		}
+		if(step < -8 || step > 7) {
+			return false;
+		}
+		flags |= (step & 0x0F) << 4;
+		return true;
+	}
 	void ForEachStatement()
 	{
 		rabbit::Object idxname, valname;
@@ -1348,35 +1709,30 @@ public:
 	rabbit::Object ExpectScalar()
 	{
 		rabbit::Object val;
-		val._type = rabbit::OT_NULL; val._unVal.nInteger = 0; //shut up GCC 4.x
+		val.setNull(); //shut up GCC 4.x
 		switch(_token) {
 			case TK_INTEGER:
-				val._type = rabbit::OT_INTEGER;
-				val._unVal.nInteger = _lex._nvalue;
+				val.setInteger(_lex._nvalue);
 				break;
 			case TK_FLOAT:
-				val._type = rabbit::OT_FLOAT;
-				val._unVal.fFloat = _lex._fvalue;
+				val.setFloat(_lex._fvalue);
 				break;
 			case TK_STRING_LITERAL:
-				val = _fs->createString(_lex._svalue,_lex._longstr.size()-1);
+				val = _fs->createString(_lex._svalue,_lex._slen);
 				break;
 			case TK_TRUE:
 			case TK_FALSE:
-				val._type = rabbit::OT_BOOL;
-				val._unVal.nInteger = _token == TK_TRUE ? 1 : 0;
+				val.setBoolean(_token == TK_TRUE);
 				break;
 			case '-':
 				Lex();
 				switch(_token)
 				{
 				case TK_INTEGER:
-					val._type = rabbit::OT_INTEGER;
-					val._unVal.nInteger = -_lex._nvalue;
+					val.setInteger(-_lex._nvalue);
 				break;
 				case TK_FLOAT:
-					val._type = rabbit::OT_FLOAT;
-					val._unVal.fFloat = -_lex._fvalue;
+					val.setFloat(-_lex._fvalue);
 				break;
 				default:
 					error("scalar expected : integer, float");
@@ -1404,8 +1760,7 @@ public:
 				val = ExpectScalar();
 			}
 			else {
-				val._type = rabbit::OT_INTEGER;
-				val._unVal.nInteger = nval++;
+				val.setInteger(nval++);
 			}
 			table.toTable()->newSlot(rabbit::ObjectPtr(key),rabbit::ObjectPtr(val));
 			if(_token == ',') Lex();
@@ -1609,6 +1964,10 @@ private:
 	char _compilererror[MAX_COMPILER_ERROR_LEN];
 	jmp_buf _errorjmp;
 	rabbit::VirtualMachine *_vm;
+	rabbit::ObjectPtr _constvalue; //!< value of the last constant expression (see EmitLoadConstant)
+	int64_t _constpos; //!< position of its load instruction, -1 when there is none
+	int64_t _consttarget; //!< stack position it is loaded in
+	FuncState *_constfs; //!< function it is loaded in
 };
 }
 
@@ -1618,4 +1977,10 @@ bool rabbit::compile(rabbit::VirtualMachine *vm,SQLEXREADFUNC rg, rabbit::UserPo
 	return p.compile(out);
 }
 
+bool rabbit::compile(rabbit::VirtualMachine *vm,const char *buf, int64_t size, const char *sourcename, rabbit::ObjectPtr &out, bool raiseerror, bool lineinfo)
+{
+	rabbit::Compiler p(vm, buf, size, sourcename, raiseerror, lineinfo);
+	return p.compile(out);
+}
+
 #endif
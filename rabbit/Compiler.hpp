@@ -84,5 +84,7 @@ namespace rabbit {
 	
 	typedef void(*compilererrorFunc)(void *ud, const char *s);
 	bool compile(rabbit::VirtualMachine *vm, SQLEXREADFUNC rg, rabbit::UserPointer up, const char *sourcename, rabbit::ObjectPtr &out, bool raiseerror, bool lineinfo);
+	//the source is scanned in place, it must stay valid during the compilation
+	bool compile(rabbit::VirtualMachine *vm, const char *buf, int64_t size, const char *sourcename, rabbit::ObjectPtr &out, bool raiseerror, bool lineinfo);
 
 }
\ No newline at end of file
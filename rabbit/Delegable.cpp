@@ -13,6 +13,11 @@
 #include <rabbit/SharedState.hpp>
 
 
+rabbit::Delegable::Delegable(rabbit::SharedState *ss) :
+	rabbit::Collectable(ss) {
+	_delegate = NULL;
+}
+
 bool rabbit::Delegable::getMetaMethod(rabbit::VirtualMachine *v,rabbit::MetaMethod mm,rabbit::ObjectPtr &res) const {
 	if(_delegate) {
 		return _delegate->get((*_get_shared_state(v)->_metamethods)[mm],res);
@@ -34,6 +39,7 @@ bool rabbit::Delegable::setDelegate(rabbit::Table *mt) {
 	}
 	if (mt) {
 		__ObjaddRef(mt);
+		_sharedstate->gcBarrier(mt);
 	}
 	__Objrelease(_delegate);
 	_delegate = mt;
@@ -8,15 +8,16 @@
 #pragma once
 
 #include <etk/types.hpp>
-#include <rabbit/RefCounted.hpp>
+#include <rabbit/Collectable.hpp>
 #include <rabbit/MetaMethod.hpp>
 #include <rabbit/ObjectPtr.hpp>
 
 namespace rabbit {
 	class Table;
 	class VirtualMachine;
-	class Delegable : public rabbit::RefCounted {
+	class Delegable : public rabbit::Collectable {
 		public:
+			Delegable(rabbit::SharedState *ss);
 			bool setDelegate(rabbit::Table *m);
 		public:
 			virtual bool getMetaMethod(rabbit::VirtualMachine *v, rabbit::MetaMethod mm, rabbit::ObjectPtr& res) const;
@@ -7,26 +7,11 @@
  */
 #include <rabbit/Compiler.hpp>
 #include <rabbit/FuncState.hpp>
-
-#ifndef NO_COMPILER
-#include <rabbit/Compiler.hpp>
-
-#include <rabbit/FunctionProto.hpp>
 #include <rabbit/Instruction.hpp>
-#include <rabbit/String.hpp>
-#include <rabbit/Class.hpp>
-#include <rabbit/Table.hpp>
-#include <rabbit/SharedState.hpp>
-
-
-
 #include <rabbit/sqopcodes.hpp>
-#include <rabbit/squtils.hpp>
+#include <string.h>
 
-#define UINT_MINUS_ONE (0xFFFFFFFFFFFFFFFF)
-
-
-#ifdef _DEBUG_DUMP
+// names of the opcodes (bytecode dump, opcode statistics of SQ_PROFILE_OPCODES)
 rabbit::InstructionDesc g_InstrDesc[]={
 	{"_OP_LINE"},
 	{"_OP_LOAD"},
@@ -89,8 +74,45 @@ rabbit::InstructionDesc g_InstrDesc[]={
 	{"_OP_NEWSLOTA"},
 	{"_OP_GETBASE"},
 	{"_OP_CLOSE"},
+	{"_OP_ADDINT"},
+	{"_OP_SUBINT"},
+	{"_OP_JCMPK"},
+	{"_OP_GETGET"},
+	{"_OP_FORPREP"},
+	{"_OP_FORLOOP"},
+	{"_OP_ADDI"},
+	{"_OP_ADDF"},
+	{"_OP_ADDS"},
+	{"_OP_SUBI"},
+	{"_OP_SUBF"},
+	{"_OP_MULI"},
+	{"_OP_MULF"},
+	{"_OP_DIVF"},
+	{"_OP_JCMPI"},
+	{"_OP_JCMPF"},
+	{"_OP_EQI"},
+	{"_OP_NEI"},
 };
-#endif
+static_assert(sizeof(g_InstrDesc)/sizeof(g_InstrDesc[0]) == SQ_OPCODE_COUNT, "g_InstrDesc does not cover all opcodes");
+
+#ifndef NO_COMPILER
+#include <rabbit/Compiler.hpp>
+
+#include <rabbit/FunctionProto.hpp>
+#include <rabbit/Instruction.hpp>
+#include <rabbit/String.hpp>
+#include <rabbit/Class.hpp>
+#include <rabbit/Table.hpp>
+#include <rabbit/SharedState.hpp>
+
+
+
+#include <rabbit/sqopcodes.hpp>
+#include <rabbit/squtils.hpp>
+
+#define UINT_MINUS_ONE (0xFFFFFFFFFFFFFFFF)
+
+
 
 
 void rabbit::FuncState::addInstruction(SQOpcode _op,int64_t arg0,int64_t arg1,int64_t arg2,int64_t arg3){
@@ -626,10 +648,362 @@ rabbit::Object rabbit::FuncState::createTable()
 	return nt;
 }
 
+namespace {
+	// instructions with a relative jump in _arg1
+	bool isJump(const rabbit::Instruction &inst) {
+		switch(inst.op) {
+			case _OP_JMP: case _OP_JZ: case _OP_JCMP: case _OP_JCMPK: case _OP_AND: case _OP_OR:
+			case _OP_FOREACH: case _OP_POSTFOREACH: case _OP_PUSHTRAP: case _OP_FORPREP: case _OP_FORLOOP:
+				return true;
+			default:
+				return false;
+		}
+	}
+	int64_t jumpTarget(const rabbit::Instruction &inst, int64_t pos) {
+		//_OP_POSTFOREACH jumps of _arg1 - 1 (see VirtualMachine::execute)
+		return inst.op == _OP_POSTFOREACH ? pos + inst._arg1 : pos + 1 + inst._arg1;
+	}
+	void setJumpTarget(rabbit::Instruction &inst, int64_t pos, int64_t target) {
+		inst._arg1 = (int32_t)(inst.op == _OP_POSTFOREACH ? target - pos : target - pos - 1);
+	}
+	// instructions that only write their result in _arg0, the existing MOVE rule of addInstruction plus _OP_GETK
+	bool isRetargetable(const rabbit::Instruction &inst) {
+		switch(inst.op) {
+			case _OP_GET: case _OP_GETK: case _OP_ADD: case _OP_SUB: case _OP_MUL: case _OP_DIV: case _OP_MOD: case _OP_BITW:
+			case _OP_LOADINT: case _OP_LOADFLOAT: case _OP_LOADBOOL: case _OP_LOAD:
+			case _OP_ADDINT: case _OP_SUBINT: case _OP_GETGET:
+				return inst._arg0 != 0xFF;
+			default:
+				return false;
+		}
+	}
+	// stack slots that hold a local variable at the position of the peephole pass, built once from the debug
+	// infos of the function: the starts and the ends of the locals are bucketed by instruction and applied when
+	// the pass reaches them
+	class LiveLocals {
+		public:
+			LiveLocals(const etk::Vector<rabbit::LocalVarInfo> &infos, int64_t size);
+			//move to 'pos', the positions are visited in increasing order
+			void advance(int64_t pos);
+			bool isLive(int64_t stkpos) const;
+		private:
+			etk::Vector<int64_t> _live; //!< number of locals live in each stack slot
+			etk::Vector<int64_t> _first; //!< first change of each position in _changes (size + 1 entries and the end)
+			etk::Vector<int64_t> _changes; //!< slot + 1 for a local that starts, -(slot + 1) for one that ended
+			int64_t _pos; //!< next position to apply
+	};
+}
+
+LiveLocals::LiveLocals(const etk::Vector<rabbit::LocalVarInfo> &infos, int64_t size) :
+  _pos(0) {
+	int64_t nslots = 0;
+	_first.resize(size + 2, 0);
+	for(uint64_t i = 0; i < infos.size(); i++) {
+		const rabbit::LocalVarInfo &lvi = infos[i];
+		if((int64_t)lvi._start_op >= size || lvi._end_op < lvi._start_op) {
+			continue;
+		}
+		int64_t end = (int64_t)lvi._end_op >= size ? size - 1 : (int64_t)lvi._end_op;
+		_first[lvi._start_op + 1]++;
+		_first[end + 2]++;
+		if((int64_t)lvi._pos >= nslots) {
+			nslots = lvi._pos + 1;
+		}
+	}
+	_live.resize(nslots, 0);
+	for(int64_t pos = 1; pos < size + 2; pos++) {
+		_first[pos] += _first[pos - 1];
+	}
+	_changes.resize(_first[size + 1], 0);
+	etk::Vector<int64_t> next = _first;
+	for(uint64_t i = 0; i < infos.size(); i++) {
+		const rabbit::LocalVarInfo &lvi = infos[i];
+		if((int64_t)lvi._start_op >= size || lvi._end_op < lvi._start_op) {
+			continue;
+		}
+		int64_t end = (int64_t)lvi._end_op >= size ? size - 1 : (int64_t)lvi._end_op;
+		_changes[next[lvi._start_op]++] = lvi._pos + 1;
+		_changes[next[end + 1]++] = -(int64_t)(lvi._pos + 1);
+	}
+}
+
+void LiveLocals::advance(int64_t pos) {
+	for(; _pos <= pos && _pos + 1 < (int64_t)_first.size(); _pos++) {
+		for(int64_t i = _first[_pos]; i < _first[_pos + 1]; i++) {
+			int64_t change = _changes[i];
+			if(change > 0) {
+				_live[change - 1]++;
+			} else {
+				_live[-change - 1]--;
+			}
+		}
+	}
+}
+
+bool LiveLocals::isLive(int64_t stkpos) const {
+	return stkpos >= 0 && stkpos < (int64_t)_live.size() && _live[stkpos] > 0;
+}
+
+int64_t rabbit::FuncState::getLoadedLiteral(const rabbit::Instruction &inst)
+{
+	switch(inst.op) {
+		case _OP_LOADINT:
+			return getNumericConstant((int64_t)inst._arg1);
+		case _OP_LOADFLOAT: {
+			float_t value;
+			memcpy(&value, &inst._arg1, sizeof(float_t));
+			return getNumericConstant(value);
+			}
+		case _OP_LOAD:
+			return inst._arg1;
+		default:
+			return -1;
+	}
+}
+
+void rabbit::FuncState::optimize()
+{
+	int64_t size = _instructions.size();
+	if(size == 0) {
+		return;
+	}
+	//jump threading: a jump to an unconditional jump goes directly to its target. Only the jumps that are already
+	//backward (or _OP_JMP) may end before themselves: the loops are interrupted on those (see SQ_SAFE_POINT)
+	for(int64_t pos = 0; pos < size; pos++) {
+		rabbit::Instruction &inst = _instructions[pos];
+		switch(inst.op) {
+			case _OP_JMP: case _OP_JZ: case _OP_JCMP: case _OP_AND: case _OP_OR: case _OP_FORPREP: case _OP_FORLOOP: {
+				int64_t target = jumpTarget(inst, pos);
+				bool backward = inst.op == _OP_JMP || target <= pos;
+				for(int64_t hops = 0; hops < 16; hops++) {
+					if(    target < 0
+					    || target >= size
+					    || _instructions[target].op != _OP_JMP
+					    || target == pos) {
+						break;
+					}
+					int64_t next = jumpTarget(_instructions[target], target);
+					if(    next == target
+					    || (next <= pos && !backward)) {
+						break;
+					}
+					target = next;
+				}
+				setJumpTarget(inst, pos, target);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+	//the instructions that are jumped to can not be merged with the previous one
+	etk::Vector<bool> istarget;
+	istarget.resize(size + 1, false);
+	for(int64_t pos = 0; pos < size; pos++) {
+		rabbit::Instruction &inst = _instructions[pos];
+		if(isJump(inst)) {
+			int64_t target = jumpTarget(inst, pos);
+			if(target >= 0 && target <= size) {
+				istarget[target] = true;
+			}
+			//_OP_FOREACH continues after its _OP_POSTFOREACH
+			if(inst.op == _OP_FOREACH && pos + 2 <= size) {
+				istarget[pos + 2] = true;
+			}
+		}
+	}
+	//peephole over the instruction pairs, 'remap' receives the new position of each instruction
+	etk::Vector<int64_t> remap;
+	remap.resize(size + 1, 0);
+	etk::Vector<rabbit::Instruction> code;
+	bool fuse = _sharedstate->_superinstructions;
+	int64_t lastpos = -1; //position of the last instruction of 'code' before the pass
+	LiveLocals locals(_localvarinfos, size);
+	for(int64_t pos = 0; pos < size; pos++) {
+		rabbit::Instruction inst = _instructions[pos];
+		locals.advance(pos);
+		remap[pos] = code.size();
+		if(inst.op == _OP_JMP && inst._arg1 == 0) {
+			//jump to the next instruction
+			continue;
+		}
+		if(inst.op == _OP_MOVE && inst._arg0 == inst._arg1) {
+			continue;
+		}
+		if(code.size() == 0 || istarget[pos] == true) {
+			code.pushBack(inst);
+			lastpos = pos;
+			continue;
+		}
+		rabbit::Instruction &pi = code[code.size()-1];
+		switch(inst.op) {
+			case _OP_MOVE:
+				//copy back of the previous move
+				if(    (pi.op == _OP_MOVE && pi._arg0 == inst._arg1 && pi._arg1 == inst._arg0)
+				    || (pi.op == _OP_DMOVE && pi._arg2 == inst._arg1 && pi._arg3 == inst._arg0)) {
+					continue;
+				}
+				//result of a temporary (not a local variable) moved to its destination: the result is written there
+				if(    isRetargetable(pi)
+				    && pi._arg0 == inst._arg1
+				    && locals.isLive(inst._arg1) == false) {
+					pi._arg0 = inst._arg0;
+					continue;
+				}
+				if(pi.op == _OP_MOVE && inst._arg1 < 0xFF) {
+					pi.op = _OP_DMOVE;
+					pi._arg2 = inst._arg0;
+					pi._arg3 = (unsigned char)inst._arg1;
+					continue;
+				}
+				break;
+			case _OP_DMOVE:
+				if(inst._arg0 == inst._arg3 && inst._arg2 == inst._arg1) {
+					//a = b; b = a
+					inst.op = _OP_MOVE;
+					inst._arg2 = 0;
+					inst._arg3 = 0;
+				}
+				break;
+			case _OP_LOAD:
+				if(pi.op == _OP_LOAD && inst._arg1 < 256) {
+					pi.op = _OP_DLOAD;
+					pi._arg2 = inst._arg0;
+					pi._arg3 = (unsigned char)inst._arg1;
+					continue;
+				}
+				break;
+			case _OP_LOADNULLS:
+				if(pi.op == _OP_LOADNULLS && pi._arg0 + pi._arg1 == inst._arg0) {
+					pi._arg1 = pi._arg1 + inst._arg1;
+					continue;
+				}
+				break;
+			// superinstructions: the temporary written by the first instruction is only read by the second one
+			case _OP_ADD:
+			case _OP_SUB:
+				//x + k, x - k
+				if(    fuse
+				    && pi.op == _OP_LOADINT
+				    && inst._arg1 == pi._arg0
+				    && inst._arg2 != pi._arg0
+				    && locals.isLive(pi._arg0) == false) {
+					pi = rabbit::Instruction(inst.op == _OP_ADD ? _OP_ADDINT : _OP_SUBINT, inst._arg0, pi._arg1, inst._arg2);
+					continue;
+				}
+				break;
+			case _OP_JCMP:
+				//comparison with a constant
+				if(    fuse
+				    && pi._arg0 == inst._arg0
+				    && inst._arg2 != inst._arg0
+				    && locals.isLive(pi._arg0) == false) {
+					int64_t literal = getLoadedLiteral(pi);
+					if(literal >= 0 && literal < 256) {
+						int64_t target = jumpTarget(inst, pos);
+						pi = rabbit::Instruction(_OP_JCMPK, literal, 0, inst._arg2, inst._arg3);
+						//relative to the position of the first instruction until the relocation
+						setJumpTarget(pi, lastpos, target);
+						continue;
+					}
+				}
+				break;
+			case _OP_EQ:
+			case _OP_NE:
+				//comparison with a constant: literal operand of _OP_EQ/_OP_NE
+				if(    fuse
+				    && inst._arg3 == 0
+				    && (inst._arg1 == pi._arg0) != (inst._arg2 == pi._arg0)
+				    && locals.isLive(pi._arg0) == false) {
+					int64_t literal = getLoadedLiteral(pi);
+					if(literal >= 0) {
+						if(inst._arg2 == pi._arg0) {
+							inst._arg2 = (unsigned char)inst._arg1;
+						}
+						inst._arg1 = (int32_t)literal;
+						inst._arg3 = 1;
+						pi = inst;
+						continue;
+					}
+				}
+				break;
+			case _OP_GET:
+				//a[i][j]
+				if(    fuse
+				    && pi.op == _OP_GET
+				    && inst._arg1 == pi._arg0
+				    && inst._arg2 != pi._arg0
+				    && pi._arg1 < 256
+				    && pi._arg0 != 0
+				    && inst._arg0 != 0
+				    && locals.isLive(pi._arg0) == false) {
+					pi = rabbit::Instruction(_OP_GETGET, inst._arg0, pi._arg1, pi._arg2, inst._arg2);
+					continue;
+				}
+				break;
+			default:
+				break;
+		}
+		code.pushBack(inst);
+		lastpos = pos;
+	}
+	remap[size] = code.size();
+	if((int64_t)code.size() == size) {
+		return;
+	}
+	//relocation of the jumps and of the debug infos
+	int64_t newpos = 0;
+	for(int64_t pos = 0; pos < size; pos++) {
+		if(remap[pos] != newpos || remap[pos + 1] == newpos) {
+			continue;
+		}
+		rabbit::Instruction &inst = code[newpos];
+		if(isJump(inst)) {
+			int64_t target = jumpTarget(inst, pos);
+			if(target < 0) target = 0;
+			if(target > size) target = size;
+			setJumpTarget(inst, newpos, remap[target]);
+		}
+		newpos++;
+	}
+	for(uint64_t i = 0; i < _lineinfos.size(); i++) {
+		int64_t op = _lineinfos[i]._op;
+		_lineinfos[i]._op = remap[op < 0 ? 0 : (op > size ? size : op)];
+	}
+	for(uint64_t i = 0; i < _localvarinfos.size(); i++) {
+		rabbit::LocalVarInfo &lvi = _localvarinfos[i];
+		int64_t start = (int64_t)lvi._start_op;
+		int64_t end = (int64_t)lvi._end_op;
+		lvi._start_op = remap[start < 0 ? 0 : (start > size ? size : start)];
+		end = end < 0 ? 0 : (end >= size ? size - 1 : end);
+		//last instruction kept at or before the old end
+		lvi._end_op = remap[end + 1] - 1;
+	}
+	_instructions = code;
+}
+
 rabbit::FunctionProto* rabbit::FuncState::buildProto() {
+	if(_sharedstate->_optimizebytecode) {
+		optimize();
+	}
+	// give a member lookup cache slot to each _OP_GETK/_OP_PREPCALLK, the slot is stored in _arg3
+	// (unused by _OP_GETK, always _arg0+1 for _OP_PREPCALLK: 'this' is right after the closure)
+	int64_t ninlinecaches = 0;
+	for(uint64_t ni = 0; ni < _instructions.size(); ni++) {
+		rabbit::Instruction &inst = _instructions[ni];
+		if(inst.op == _OP_GETK || inst.op == _OP_PREPCALLK) {
+			assert(inst.op != _OP_PREPCALLK || inst._arg3 == inst._arg0+1);
+			if(ninlinecaches < SQ_NO_INLINE_CACHE) {
+				inst._arg3 = (unsigned char)ninlinecaches++;
+			} else {
+				inst._arg3 = SQ_NO_INLINE_CACHE;
+			}
+		}
+	}
 	rabbit::FunctionProto *f=rabbit::FunctionProto::create(_ss,_instructions.size(),
 		_nliterals,_parameters.size(),_functions.size(),_outervalues.size(),
-		_lineinfos.size(),_localvarinfos.size(),_defaultparams.size());
+		_lineinfos.size(),_localvarinfos.size(),_defaultparams.size(),
+		ninlinecaches);
 
 	rabbit::ObjectPtr refidx,key,val;
 	int64_t idx;
@@ -660,7 +1034,7 @@ rabbit::FunctionProto* rabbit::FuncState::buildProto() {
 
 rabbit::FuncState *rabbit::FuncState::pushChildState(rabbit::SharedState *ss)
 {
-	FuncState *child = (rabbit::FuncState *)sq_malloc(sizeof(rabbit::FuncState));
+	FuncState *child = (rabbit::FuncState *)SQ_MALLOC(ss, rabbit::MEM_OTHER, sizeof(rabbit::FuncState));
 	new ((char*)child) FuncState(ss,this,_errfunc,_errtarget);
 	_childstates.pushBack(child);
 	return child;
@@ -668,7 +1042,7 @@ rabbit::FuncState *rabbit::FuncState::pushChildState(rabbit::SharedState *ss)
 
 void rabbit::FuncState::popChildState() {
 	FuncState *child = _childstates.back();
-	sq_delete(child, FuncState);
+	sq_delete(_sharedstate, rabbit::MEM_OTHER, child, FuncState);
 	_childstates.popBack();
 }
 
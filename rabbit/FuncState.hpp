@@ -49,6 +49,8 @@ namespace rabbit {
 			int64_t calcStackFramesize();
 			void addLineInfos(int64_t line,bool lineop,bool force=false);
 			rabbit::FunctionProto *buildProto();
+			//peephole pass over the finished instructions (see SharedState::_optimizebytecode)
+			void optimize();
 			int64_t allocStackPos();
 			int64_t pushTarget(int64_t n=-1);
 			int64_t popTarget();
@@ -56,6 +58,8 @@ namespace rabbit {
 			int64_t getUpTarget(int64_t n);
 			void discardTarget();
 			bool isLocal(uint64_t stkpos);
+			//literal index of the constant loaded by 'inst' (added to the literals if needed), -1 when it is not a load
+			int64_t getLoadedLiteral(const rabbit::Instruction &inst);
 			rabbit::Object createString(const char *s,int64_t len = -1);
 			rabbit::Object createTable();
 			bool isConstant(const rabbit::Object &name,rabbit::Object &e);
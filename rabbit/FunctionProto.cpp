@@ -15,6 +15,9 @@
 
 #include <rabbit/String.hpp>
 #include <rabbit/VirtualMachine.hpp>
+#include <rabbit/SharedState.hpp>
+#include <rabbit/BytecodeImage.hpp>
+#include <string.h>
 
 
 
@@ -23,14 +26,24 @@
 rabbit::FunctionProto* rabbit::FunctionProto::create(rabbit::SharedState *ss,int64_t ninstructions,
 	int64_t nliterals,int64_t nparameters,
 	int64_t nfunctions,int64_t noutervalues,
-	int64_t nlineinfos,int64_t nlocalvarinfos,int64_t ndefaultparams)
+	int64_t nlineinfos,int64_t nlocalvarinfos,int64_t ndefaultparams,
+	int64_t ninlinecaches,rabbit::BytecodeImage *image)
 {
 	rabbit::FunctionProto *f;
 	//I compact the whole class and members in a single memory allocation
-	f = (rabbit::FunctionProto *)sq_vm_malloc(_FUNC_SIZE(ninstructions,nliterals,nparameters,nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams));
+	//(except the parts read from the image)
+	if(image) {
+		f = (rabbit::FunctionProto *)SQ_MALLOC(ss, rabbit::MEM_FUNCPROTO, _FUNC_SIZE(0,nliterals,nparameters,nfunctions,noutervalues,0,nlocalvarinfos,0,ninlinecaches));
+	} else {
+		f = (rabbit::FunctionProto *)SQ_MALLOC(ss, rabbit::MEM_FUNCPROTO, _FUNC_SIZE(ninstructions,nliterals,nparameters,nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams,ninlinecaches));
+	}
 	new ((char*)f) rabbit::FunctionProto(ss);
+	f->_image = image;
+	if(image) {
+		__ObjaddRef(image);
+	}
 	f->_ninstructions = ninstructions;
-	f->_literals = (rabbit::ObjectPtr*)&f->_instructions[ninstructions];
+	f->_literals = (rabbit::ObjectPtr*)(f + 1);
 	f->_nliterals = nliterals;
 	f->_parameters = (rabbit::ObjectPtr*)&f->_literals[nliterals];
 	f->_nparameters = nparameters;
@@ -40,10 +53,22 @@ rabbit::FunctionProto* rabbit::FunctionProto::create(rabbit::SharedState *ss,int
 	f->_noutervalues = noutervalues;
 	f->_lineinfos = (rabbit::LineInfo *)&f->_outervalues[noutervalues];
 	f->_nlineinfos = nlineinfos;
-	f->_localvarinfos = (rabbit::LocalVarInfo *)&f->_lineinfos[nlineinfos];
+	f->_localvarinfos = (rabbit::LocalVarInfo *)&f->_lineinfos[image?0:nlineinfos];
 	f->_nlocalvarinfos = nlocalvarinfos;
 	f->_defaultparams = (int64_t *)&f->_localvarinfos[nlocalvarinfos];
 	f->_ndefaultparams = ndefaultparams;
+	f->_inlinecaches = (rabbit::InlineCache *)&f->_defaultparams[image?0:ndefaultparams];
+	f->_ninlinecaches = ninlinecaches;
+	f->_instructions = (rabbit::Instruction *)&f->_inlinecaches[ninlinecaches];
+	if(image) {
+		//set by the image loader
+		f->_lineinfos = NULL;
+		f->_defaultparams = NULL;
+		f->_instructions = NULL;
+	}
+	for(int64_t n = 0; n < ninlinecaches; n++) {
+		f->_inlinecaches[n].reset();
+	}
 
 	_CONSTRUCT_VECTOR(ObjectPtr, f->_nliterals, f->_literals);
 	_CONSTRUCT_VECTOR(ObjectPtr, f->_nparameters, f->_parameters);
@@ -60,9 +85,427 @@ void rabbit::FunctionProto::release(){
 	_DESTRUCT_VECTOR(OuterVar,_noutervalues,_outervalues);
 	//_DESTRUCT_VECTOR(rabbit::LineInfo,_nlineinfos,_lineinfos); //not required are 2 integers
 	_DESTRUCT_VECTOR(LocalVarInfo,_nlocalvarinfos,_localvarinfos);
-	int64_t size = _FUNC_SIZE(_ninstructions,_nliterals,_nparameters,_nfunctions,_noutervalues,_nlineinfos,_nlocalvarinfos,_ndefaultparams);
+	int64_t size;
+	if(_image) {
+		size = _FUNC_SIZE(0,_nliterals,_nparameters,_nfunctions,_noutervalues,0,_nlocalvarinfos,0,_ninlinecaches);
+	} else {
+		size = _FUNC_SIZE(_ninstructions,_nliterals,_nparameters,_nfunctions,_noutervalues,_nlineinfos,_nlocalvarinfos,_ndefaultparams,_ninlinecaches);
+	}
+	rabbit::SharedState *ss = _sharedstate;
+	rabbit::BytecodeImage *image = _image;
 	this->~FunctionProto();
-	sq_vm_free(this,size);
+	SQ_FREE(ss, rabbit::MEM_FUNCPROTO, this, size);
+	//the image can be unmapped once its last function is released
+	__Objrelease(image);
+}
+
+bool rabbit::FunctionProto::save(rabbit::VirtualMachine *v,rabbit::UserPointer up,SQWRITEFUNC write)
+{
+	int64_t i,nliterals = _nliterals,nparameters = _nparameters;
+	int64_t noutervalues = _noutervalues,nlocalvarinfos = _nlocalvarinfos;
+	int64_t nlineinfos=_nlineinfos,ninstructions = _ninstructions,nfunctions=_nfunctions;
+	int64_t ndefaultparams = _ndefaultparams,ninlinecaches = _ninlinecaches;
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(writeObject(v,up,write,_sourcename));
+	_CHECK_IO(writeObject(v,up,write,_name));
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(safeWrite(v,write,up,&nliterals,sizeof(nliterals)));
+	_CHECK_IO(safeWrite(v,write,up,&nparameters,sizeof(nparameters)));
+	_CHECK_IO(safeWrite(v,write,up,&noutervalues,sizeof(noutervalues)));
+	_CHECK_IO(safeWrite(v,write,up,&nlocalvarinfos,sizeof(nlocalvarinfos)));
+	_CHECK_IO(safeWrite(v,write,up,&nlineinfos,sizeof(nlineinfos)));
+	_CHECK_IO(safeWrite(v,write,up,&ndefaultparams,sizeof(ndefaultparams)));
+	_CHECK_IO(safeWrite(v,write,up,&ninstructions,sizeof(ninstructions)));
+	_CHECK_IO(safeWrite(v,write,up,&nfunctions,sizeof(nfunctions)));
+	_CHECK_IO(safeWrite(v,write,up,&ninlinecaches,sizeof(ninlinecaches)));
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_PART));
+	for(i=0;i<nliterals;i++){
+		_CHECK_IO(writeObject(v,up,write,_literals[i]));
+	}
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_PART));
+	for(i=0;i<nparameters;i++){
+		_CHECK_IO(writeObject(v,up,write,_parameters[i]));
+	}
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_PART));
+	for(i=0;i<noutervalues;i++){
+		uint64_t type = _outervalues[i]._type;
+		_CHECK_IO(safeWrite(v,write,up,&type,sizeof(uint64_t)));
+		_CHECK_IO(writeObject(v,up,write,_outervalues[i]._src));
+		_CHECK_IO(writeObject(v,up,write,_outervalues[i]._name));
+	}
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_PART));
+	for(i=0;i<nlocalvarinfos;i++){
+		rabbit::LocalVarInfo &lvi=_localvarinfos[i];
+		_CHECK_IO(writeObject(v,up,write,lvi._name));
+		_CHECK_IO(safeWrite(v,write,up,&lvi._pos,sizeof(uint64_t)));
+		_CHECK_IO(safeWrite(v,write,up,&lvi._start_op,sizeof(uint64_t)));
+		_CHECK_IO(safeWrite(v,write,up,&lvi._end_op,sizeof(uint64_t)));
+	}
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(safeWrite(v,write,up,_lineinfos,sizeof(rabbit::LineInfo)*nlineinfos));
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(safeWrite(v,write,up,_defaultparams,sizeof(int64_t)*ndefaultparams));
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_PART));
+	//the inline cache slots (_arg3 of _OP_GETK/_OP_PREPCALLK) are kept, the caches start empty at load
+	dequicken();
+	_CHECK_IO(safeWrite(v,write,up,_instructions,sizeof(rabbit::Instruction)*ninstructions));
+	_CHECK_IO(writeTag(v,write,up,SQ_CLOSURESTREAM_PART));
+	for(i=0;i<nfunctions;i++){
+		_CHECK_IO(_functions[i].toFunctionProto()->save(v,up,write));
+	}
+	_CHECK_IO(safeWrite(v,write,up,&_stacksize,sizeof(_stacksize)));
+	_CHECK_IO(safeWrite(v,write,up,&_bgenerator,sizeof(_bgenerator)));
+	_CHECK_IO(safeWrite(v,write,up,&_varparams,sizeof(_varparams)));
+	return true;
+}
+
+namespace {
+	//'count' elements of a closure stream: the buffer grows with the data really read, so a corrupted count ends on
+	//the end of the stream instead of a huge allocation
+	template<class TYPE>
+	bool readArray(rabbit::VirtualMachine *v, SQREADFUNC read, rabbit::UserPointer up, int64_t count, etk::Vector<TYPE> &out) {
+		out.clear();
+		while((int64_t)out.size() < count) {
+			int64_t done = out.size();
+			int64_t chunk = count - done;
+			if(chunk > done + 1024) {
+				chunk = done + 1024;
+			}
+			out.resize(done + chunk);
+			_CHECK_IO(safeRead(v, read, up, &out[done], sizeof(TYPE) * chunk));
+		}
+		return true;
+	}
+	bool readObjects(rabbit::VirtualMachine *v, SQREADFUNC read, rabbit::UserPointer up, int64_t count, etk::Vector<rabbit::ObjectPtr> &out) {
+		rabbit::ObjectPtr o;
+		for(int64_t i = 0; i < count; i++) {
+			_CHECK_IO(readObject(v, up, read, o));
+			out.pushBack(o);
+		}
+		return true;
+	}
+}
+
+bool rabbit::FunctionProto::load(rabbit::VirtualMachine *v,rabbit::UserPointer up,SQREADFUNC read,rabbit::ObjectPtr &ret)
+{
+	int64_t i, nliterals,nparameters;
+	int64_t noutervalues ,nlocalvarinfos ;
+	int64_t nlineinfos,ninstructions ,nfunctions,ndefaultparams,ninlinecaches;
+	rabbit::ObjectPtr sourcename, name;
+	rabbit::ObjectPtr o;
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(readObject(v, up, read, sourcename));
+	_CHECK_IO(readObject(v, up, read, name));
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(safeRead(v,read, up, &nliterals, sizeof(nliterals)));
+	_CHECK_IO(safeRead(v,read, up, &nparameters, sizeof(nparameters)));
+	_CHECK_IO(safeRead(v,read, up, &noutervalues, sizeof(noutervalues)));
+	_CHECK_IO(safeRead(v,read, up, &nlocalvarinfos, sizeof(nlocalvarinfos)));
+	_CHECK_IO(safeRead(v,read, up, &nlineinfos, sizeof(nlineinfos)));
+	_CHECK_IO(safeRead(v,read, up, &ndefaultparams, sizeof(ndefaultparams)));
+	_CHECK_IO(safeRead(v,read, up, &ninstructions, sizeof(ninstructions)));
+	_CHECK_IO(safeRead(v,read, up, &nfunctions, sizeof(nfunctions)));
+	_CHECK_IO(safeRead(v,read, up, &ninlinecaches, sizeof(ninlinecaches)));
+	if(    nliterals < 0 || nparameters < 0 || noutervalues < 0
+	    || nlocalvarinfos < 0 || nlineinfos < 1 || ndefaultparams < 0
+	    || ninstructions < 1 || nfunctions < 0
+	    || ninlinecaches < 0 || ninlinecaches > SQ_NO_INLINE_CACHE) {
+		v->raise_error("invalid or corrupted closure stream");
+		return false;
+	}
+	//the parts are read before the function is allocated with their sizes
+	etk::Vector<rabbit::ObjectPtr> literals, parameters, functions;
+	etk::Vector<rabbit::OuterVar> outervalues;
+	etk::Vector<rabbit::LocalVarInfo> localvarinfos;
+	etk::Vector<rabbit::LineInfo> lineinfos;
+	etk::Vector<int64_t> defaultparams;
+	etk::Vector<rabbit::Instruction> instructions;
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(readObjects(v, read, up, nliterals, literals));
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(readObjects(v, read, up, nparameters, parameters));
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_PART));
+	for(i = 0; i < noutervalues; i++){
+		uint64_t type;
+		rabbit::ObjectPtr outname;
+		_CHECK_IO(safeRead(v,read, up, &type, sizeof(uint64_t)));
+		_CHECK_IO(readObject(v, up, read, o));
+		_CHECK_IO(readObject(v, up, read, outname));
+		outervalues.pushBack(rabbit::OuterVar(outname,o, (rabbit::OuterType)type));
+	}
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_PART));
+	for(i = 0; i < nlocalvarinfos; i++){
+		rabbit::LocalVarInfo lvi;
+		_CHECK_IO(readObject(v, up, read, lvi._name));
+		_CHECK_IO(safeRead(v,read, up, &lvi._pos, sizeof(uint64_t)));
+		_CHECK_IO(safeRead(v,read, up, &lvi._start_op, sizeof(uint64_t)));
+		_CHECK_IO(safeRead(v,read, up, &lvi._end_op, sizeof(uint64_t)));
+		localvarinfos.pushBack(lvi);
+	}
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(readArray(v, read, up, nlineinfos, lineinfos));
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(readArray(v, read, up, ndefaultparams, defaultparams));
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_PART));
+	_CHECK_IO(readArray(v, read, up, ninstructions, instructions));
+	_CHECK_IO(checkTag(v,read,up,SQ_CLOSURESTREAM_PART));
+	for(i = 0; i < nfunctions; i++){
+		_CHECK_IO(rabbit::FunctionProto::load(v, up, read, o));
+		functions.pushBack(o);
+	}
+	rabbit::FunctionProto *f = rabbit::FunctionProto::create(v->_sharedstate,ninstructions,nliterals,nparameters,
+			nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams,ninlinecaches);
+	rabbit::ObjectPtr proto = f; //gets a ref in case of failure
+	f->_sourcename = sourcename;
+	f->_name = name;
+	for(i = 0; i < nliterals; i++) {
+		f->_literals[i] = literals[i];
+	}
+	for(i = 0; i < nparameters; i++) {
+		f->_parameters[i] = parameters[i];
+	}
+	for(i = 0; i < noutervalues; i++) {
+		f->_outervalues[i] = outervalues[i];
+	}
+	for(i = 0; i < nlocalvarinfos; i++) {
+		f->_localvarinfos[i] = localvarinfos[i];
+	}
+	for(i = 0; i < nfunctions; i++) {
+		f->_functions[i] = functions[i];
+	}
+	memcpy(f->_lineinfos, &lineinfos[0], sizeof(rabbit::LineInfo)*nlineinfos);
+	if(ndefaultparams != 0) {
+		memcpy(f->_defaultparams, &defaultparams[0], sizeof(int64_t)*ndefaultparams);
+	}
+	memcpy(f->_instructions, &instructions[0], sizeof(rabbit::Instruction)*ninstructions);
+	_CHECK_IO(safeRead(v,read, up, &f->_stacksize, sizeof(f->_stacksize)));
+	_CHECK_IO(safeRead(v,read, up, &f->_bgenerator, sizeof(f->_bgenerator)));
+	_CHECK_IO(safeRead(v,read, up, &f->_varparams, sizeof(f->_varparams)));
+	//the operands refer to the stack size, the literals and the nested functions
+	_CHECK_IO(f->checkInstructions(v));
+	ret = f;
+	return true;
+}
+
+namespace {
+	//operands of the instructions of a loaded function (see FunctionProto::checkInstructions)
+	bool isRegister(const rabbit::FunctionProto *f, int64_t reg) {
+		return reg >= 0 && reg < f->_stacksize;
+	}
+	//register, or 0xFF when the instruction has no target
+	bool isTarget(const rabbit::FunctionProto *f, int64_t reg) {
+		return reg == 0xFF || isRegister(f, reg);
+	}
+	bool isLiteral(const rabbit::FunctionProto *f, int64_t idx) {
+		return idx >= 0 && idx < f->_nliterals;
+	}
+	//'offset' is relative to the instruction after 'pos' (the VM moved the ip before the jump)
+	bool isJump(const rabbit::FunctionProto *f, int64_t pos, int64_t offset) {
+		return pos + 1 + offset >= 0 && pos + 1 + offset < f->_ninstructions;
+	}
+	//registers of the parent read by _OP_CLOSURE (the outers and the default parameters of 'child')
+	bool checkClosure(const rabbit::FunctionProto *f, const rabbit::FunctionProto *child) {
+		for(int64_t i = 0; i < child->_noutervalues; i++) {
+			const rabbit::OuterVar &outer = child->_outervalues[i];
+			if(outer._src.isInteger() == false) {
+				return false;
+			}
+			if(    (outer._type == rabbit::otLOCAL && !isRegister(f, outer._src.toInteger()))
+			    || (    outer._type == rabbit::otOUTER
+			         && (outer._src.toInteger() < 0 || outer._src.toInteger() >= f->_noutervalues))
+			    || (outer._type != rabbit::otLOCAL && outer._type != rabbit::otOUTER)) {
+				return false;
+			}
+		}
+		for(int64_t i = 0; i < child->_ndefaultparams; i++) {
+			if(!isRegister(f, child->_defaultparams[i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+	bool checkOperands(const rabbit::FunctionProto *f, int64_t pos) {
+		const rabbit::Instruction &inst = f->_instructions[pos];
+		int64_t arg0 = inst._arg0;
+		int64_t arg1 = inst._arg1;
+		int64_t arg2 = inst._arg2;
+		int64_t arg3 = inst._arg3;
+		switch(inst.op) {
+			case _OP_LINE:
+			case _OP_POPTRAP:
+				return true;
+			case _OP_LOAD:
+				return isRegister(f, arg0) && isLiteral(f, arg1);
+			case _OP_LOADINT:
+			case _OP_LOADFLOAT:
+			case _OP_LOADBOOL:
+			case _OP_LOADROOT:
+			case _OP_GETBASE:
+			case _OP_THROW:
+				return isRegister(f, arg0);
+			case _OP_DLOAD:
+				return isRegister(f, arg0) && isLiteral(f, arg1) && isRegister(f, arg2) && isLiteral(f, arg3);
+			case _OP_TAILCALL:
+			case _OP_CALL:
+				//the arguments are the arg3 registers from arg2
+				return    isTarget(f, arg0) && isRegister(f, arg1)
+				       && isRegister(f, arg2) && arg2 + arg3 <= f->_stacksize;
+			case _OP_PREPCALL:
+			case _OP_GETGET:
+			case _OP_DMOVE:
+				return isRegister(f, arg0) && isRegister(f, arg1) && isRegister(f, arg2) && isRegister(f, arg3);
+			case _OP_PREPCALLK:
+				//'this' goes in arg0+1, arg3 is the inline cache slot
+				return isRegister(f, arg0 + 1) && isLiteral(f, arg1) && isRegister(f, arg2);
+			case _OP_GETK:
+				return isRegister(f, arg0) && isLiteral(f, arg1) && isRegister(f, arg2);
+			case _OP_MOVE:
+			case _OP_NEG:
+			case _OP_NOT:
+			case _OP_BWNOT:
+			case _OP_CLONE:
+			case _OP_TYPEOF:
+			case _OP_RESUME:
+				return isRegister(f, arg0) && isRegister(f, arg1);
+			case _OP_NEWSLOT:
+			case _OP_SET:
+				return isTarget(f, arg0) && isRegister(f, arg1) && isRegister(f, arg2) && isRegister(f, arg3);
+			case _OP_DELETE:
+			case _OP_GET:
+			case _OP_ADD:
+			case _OP_SUB:
+			case _OP_MUL:
+			case _OP_DIV:
+			case _OP_MOD:
+			case _OP_BITW:
+			case _OP_INC:
+			case _OP_PINC:
+			case _OP_CMP:
+			case _OP_EXISTS:
+			case _OP_INSTANCEOF:
+				return isRegister(f, arg0) && isRegister(f, arg1) && isRegister(f, arg2);
+			case _OP_EQ:
+			case _OP_NE:
+				//arg3: arg1 is a literal instead of a register
+				return    isRegister(f, arg0) && isRegister(f, arg2)
+				       && (arg3 != 0 ? isLiteral(f, arg1) : isRegister(f, arg1));
+			case _OP_ADDINT:
+			case _OP_SUBINT:
+				return isRegister(f, arg0) && isRegister(f, arg2);
+			case _OP_RETURN:
+				return arg0 == 0xFF || isRegister(f, arg1);
+			case _OP_LOADNULLS:
+				return isRegister(f, arg0) && arg1 >= 0 && arg0 + arg1 <= f->_stacksize;
+			case _OP_JMP:
+				return isJump(f, pos, arg1);
+			case _OP_JZ:
+				return isRegister(f, arg0) && isJump(f, pos, arg1);
+			case _OP_JCMP:
+			case _OP_FORPREP:
+			case _OP_FORLOOP:
+				return isRegister(f, arg0) && isRegister(f, arg2) && isJump(f, pos, arg1);
+			case _OP_JCMPK:
+				return isLiteral(f, arg0) && isRegister(f, arg2) && isJump(f, pos, arg1);
+			case _OP_AND:
+			case _OP_OR:
+				return isRegister(f, arg0) && isRegister(f, arg2) && isJump(f, pos, arg1);
+			case _OP_GETOUTER:
+				return isRegister(f, arg0) && arg1 >= 0 && arg1 < f->_noutervalues;
+			case _OP_SETOUTER:
+				return isTarget(f, arg0) && arg1 >= 0 && arg1 < f->_noutervalues && isRegister(f, arg2);
+			case _OP_NEWOBJ:
+				switch(arg3) {
+					case NOT_TABLE:
+					case NOT_ARRAY:
+						return isRegister(f, arg0) && arg1 >= 0;
+					case NOT_CLASS:
+						//arg1: base class (-1 when none), arg2: attributes
+						return isRegister(f, arg0) && (arg1 == -1 || isRegister(f, arg1)) && isTarget(f, arg2);
+					default:
+						return false;
+				}
+			case _OP_APPENDARRAY:
+				switch(arg2) {
+					case AAT_STACK:
+						return isRegister(f, arg0) && isRegister(f, arg1);
+					case AAT_LITERAL:
+						return isRegister(f, arg0) && isLiteral(f, arg1);
+					case AAT_INT:
+					case AAT_FLOAT:
+					case AAT_BOOL:
+						return isRegister(f, arg0);
+					default:
+						return false;
+				}
+			case _OP_COMPARITH:
+				//arg1: self register in the high 16 bits, value register in the low ones
+				return    isRegister(f, arg0) && isRegister(f, arg2)
+				       && isRegister(f, ((uint32_t)arg1) >> 16) && isRegister(f, arg1 & 0x0000FFFF);
+			case _OP_INCL:
+				return isRegister(f, arg1);
+			case _OP_PINCL:
+				return isRegister(f, arg0) && isRegister(f, arg1);
+			case _OP_CLOSURE:
+				return    isRegister(f, arg0) && arg1 >= 0 && arg1 < f->_nfunctions
+				       && checkClosure(f, f->_functions[arg1].toFunctionProto());
+			case _OP_YIELD:
+				//arg2: number of slots kept by the generator
+				return    (arg0 == 0xFF || isRegister(f, arg1))
+				       && (arg1 == 0xFF || isRegister(f, arg1))
+				       && arg2 <= f->_stacksize;
+			case _OP_FOREACH:
+				//key, value and iterator in arg2, arg2+1, arg2+2
+				return isRegister(f, arg0) && isRegister(f, arg2 + 2) && isJump(f, pos, arg1);
+			case _OP_POSTFOREACH:
+				return isRegister(f, arg0) && isJump(f, pos, arg1 - 1);
+			case _OP_PUSHTRAP:
+				return isRegister(f, arg0) && isJump(f, pos, arg1);
+			case _OP_NEWSLOTA:
+				//the attributes are in arg2-1
+				return    isRegister(f, arg1) && isRegister(f, arg2) && isRegister(f, arg3)
+				       && ((arg0 & NEW_SLOT_ATTRIBUTES_FLAG) == 0 || isRegister(f, arg2 - 1));
+			case _OP_CLOSE:
+				//only the address of the slot is taken
+				return arg1 >= 0 && arg1 <= f->_stacksize;
+			default:
+				//the quickened opcodes are never saved
+				return false;
+		}
+	}
+}
+
+bool rabbit::FunctionProto::checkInstructions(rabbit::VirtualMachine *v)
+{
+	bool valid =    _stacksize >= 0
+	             && _stacksize <= MAX_FUNC_STACKSIZE
+	             && _nparameters <= _stacksize
+	             && _ndefaultparams <= _nparameters;
+	for(int64_t i = 0; valid && i < _nlocalvarinfos; i++) {
+		valid = isRegister(this, _localvarinfos[i]._pos);
+	}
+	for(int64_t i = 0; valid && i < _ninstructions; i++) {
+		rabbit::Instruction &inst = _instructions[i];
+		valid =    checkOperands(this, i)
+		        && (    (inst.op != _OP_GETK && inst.op != _OP_PREPCALLK)
+		             || inst._arg3 < _ninlinecaches
+		             || inst._arg3 == SQ_NO_INLINE_CACHE);
+	}
+	if(valid == false) {
+		v->raise_error("invalid or corrupted closure stream");
+		return false;
+	}
+	return true;
+}
+
+void rabbit::FunctionProto::dequicken()
+{
+	for(int64_t i = 0; i < _ninstructions; i++) {
+		SQOpcode op = sq_basicopcode((SQOpcode)_instructions[i].op);
+		//only the quickened ones are written: the instructions of an image are read only (and never quickened)
+		if(op != _instructions[i].op) {
+			_instructions[i].op = (unsigned char)op;
+		}
+	}
 }
 
 const char* rabbit::FunctionProto::getLocal(rabbit::VirtualMachine *vm,uint64_t stackbase,uint64_t nseq,uint64_t nop)
@@ -122,12 +565,28 @@ int64_t rabbit::FunctionProto::getLine(rabbit::Instruction *curr)
 
 
 
-rabbit::FunctionProto::FunctionProto(rabbit::SharedState *ss)
+rabbit::FunctionProto::FunctionProto(rabbit::SharedState *ss) :
+	rabbit::Collectable(ss)
 {
 	_stacksize=0;
 	_bgenerator=false;
 }
 
+void rabbit::FunctionProto::mark(rabbit::Collectable **chain)
+{
+	for(int64_t i = 0; i < _nliterals; i++) {
+		rabbit::SharedState::markObject(_literals[i], chain);
+	}
+	for(int64_t k = 0; k < _nfunctions; k++) {
+		rabbit::SharedState::markObject(_functions[k], chain);
+	}
+}
+
+void rabbit::FunctionProto::finalize()
+{
+	_NULL_SQOBJECT_VECTOR(_literals,_nliterals);
+}
+
 rabbit::FunctionProto::~FunctionProto()
 {
 }
@@ -10,20 +10,23 @@
 #include <rabbit/LineInfo.hpp>
 #include <rabbit/OuterVar.hpp>
 #include <rabbit/Instruction.hpp>
-#include <rabbit/RefCounted.hpp>
+#include <rabbit/InlineCache.hpp>
+#include <rabbit/Collectable.hpp>
 #include <rabbit/rabbit.hpp>
 
 
 namespace rabbit {
+	class BytecodeImage;
 	
-	#define _FUNC_SIZE(ni,nl,nparams,nfuncs,nouters,nlineinf,localinf,defparams) (sizeof(rabbit::FunctionProto) \
-			+((ni-1)*sizeof(rabbit::Instruction))+(nl*sizeof(rabbit::ObjectPtr)) \
+	#define _FUNC_SIZE(ni,nl,nparams,nfuncs,nouters,nlineinf,localinf,defparams,ncaches) (sizeof(rabbit::FunctionProto) \
+			+(ni*sizeof(rabbit::Instruction))+(nl*sizeof(rabbit::ObjectPtr)) \
 			+(nparams*sizeof(rabbit::ObjectPtr))+(nfuncs*sizeof(rabbit::ObjectPtr)) \
 			+(nouters*sizeof(rabbit::OuterVar))+(nlineinf*sizeof(rabbit::LineInfo)) \
-			+(localinf*sizeof(rabbit::LocalVarInfo))+(defparams*sizeof(int64_t)))
+			+(localinf*sizeof(rabbit::LocalVarInfo))+(defparams*sizeof(int64_t)) \
+			+(ncaches*sizeof(rabbit::InlineCache)))
 	
 	
-	class FunctionProto : public rabbit::RefCounted {
+	class FunctionProto : public rabbit::Collectable {
 		private:
 			FunctionProto(rabbit::SharedState *ss);
 			~FunctionProto();
@@ -32,8 +35,21 @@ namespace rabbit {
 			static FunctionProto *create(rabbit::SharedState *ss,int64_t ninstructions,
 				int64_t nliterals,int64_t nparameters,
 				int64_t nfunctions,int64_t noutervalues,
-				int64_t nlineinfos,int64_t nlocalvarinfos,int64_t ndefaultparams);
+				int64_t nlineinfos,int64_t nlocalvarinfos,int64_t ndefaultparams,
+				int64_t ninlinecaches,rabbit::BytecodeImage *image=NULL);
 			void release();
+			//check the opcodes and their operands (registers, literals, jumps, outers, nested functions, inline cache
+			//slots) of a loaded function, once its stack size, literals and nested functions are set
+			bool checkInstructions(rabbit::VirtualMachine *v);
+			//put back the generic opcodes in place of the quickened ones (before a save)
+			void dequicken();
+			bool save(rabbit::VirtualMachine *v,rabbit::UserPointer up,SQWRITEFUNC write);
+			static bool load(rabbit::VirtualMachine *v,rabbit::UserPointer up,SQREADFUNC read,rabbit::ObjectPtr &ret);
+			void mark(rabbit::Collectable **chain);
+			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_FUNCPROTO;
+			}
 		
 			const char* getLocal(rabbit::VirtualMachine *v,uint64_t stackbase,uint64_t nseq,uint64_t nop);
 			int64_t getLine(rabbit::Instruction *curr);
@@ -64,8 +80,15 @@ namespace rabbit {
 			int64_t _ndefaultparams;
 			int64_t *_defaultparams;
 		
+			int64_t _ninlinecaches;
+			rabbit::InlineCache *_inlinecaches;
+		
 			int64_t _ninstructions;
-			rabbit::Instruction _instructions[1];
+			rabbit::Instruction *_instructions;
+			
+			//when set, _instructions, _lineinfos and _defaultparams are read in place from this image
+			//instead of the memory block of the function (see BytecodeImage)
+			rabbit::BytecodeImage *_image;
 	};
 
 }
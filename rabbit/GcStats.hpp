@@ -0,0 +1,27 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <etk/types.hpp>
+
+namespace rabbit {
+	/**
+	 * @brief Pause statistics of the cycle collector (durations in microseconds).
+	 * Each call of the collector (incremental step or full collection) is one pause.
+	 */
+	class GcStats {
+		public:
+			int64_t cycles; //!< number of completed collection cycles
+			int64_t steps; //!< number of pauses
+			int64_t lastpause; //!< duration of the last pause
+			int64_t maxpause; //!< longest pause
+			int64_t totalpause; //!< time spent in the collector
+			int64_t lastcollected; //!< unreachable objects found by the last completed cycle
+			int64_t totalcollected; //!< unreachable objects found since the creation of the VM
+	};
+}
@@ -8,11 +8,18 @@
 #include <rabbit/Generator.hpp>
 #include <rabbit/WeakRef.hpp>
 #include <rabbit/squtils.hpp>
-
-
-
-
-
+#include <rabbit/SharedState.hpp>
+
+namespace {
+	// the frame is moved slot by slot between the stack of the VM and the one of the generator: the slots are
+	// swapped, the reference counts do not change and the source slot is left null. This only reduces the cost of
+	// the copies, yield and resume are still O(frame size): the generator does not run on a stack of its own, every
+	// frame lives in the single VirtualMachine::_stack
+	void moveSlot(rabbit::ObjectPtr &dst, rabbit::ObjectPtr &src) {
+		dst.swap(src);
+		src.Null();
+	}
+}
 
 bool rabbit::Generator::yield(rabbit::VirtualMachine *v,int64_t target)
 {
@@ -29,14 +36,19 @@ bool rabbit::Generator::yield(rabbit::VirtualMachine *v,int64_t target)
 	_stack.resize(size);
 	rabbit::Object _this = v->_stack[v->_stackbase];
 	if (_this.isRefCounted() == true) {
-		_stack[0] = rabbit::ObjectPtr(_this.toRefCounted()->getWeakRef(_this.getType()));
+		_stack[0] = rabbit::ObjectPtr(_this.toRefCounted()->getWeakRef(_sharedstate, _this.getType()));
 	} else {
 		_stack[0] = _this;
 	}
+	v->_stack[v->_stackbase].Null();
 	for(int64_t n =1; n<target; n++) {
-		_stack[n] = v->_stack[v->_stackbase+n];
+		moveSlot(_stack[n], v->_stack[v->_stackbase+n]);
+		//the references leave the stack (marked again at the end of the cycle) for the generator
+		if(_stack[n].isCollectable() == true) {
+			_sharedstate->gcBarrier(static_cast<rabbit::Collectable*>(_stack[n].toRefCounted()));
+		}
 	}
-	for(int64_t j =0; j < size; j++)
+	for(int64_t j =target; j < size; j++)
 	{
 		v->_stack[v->_stackbase+j].Null();
 	}
@@ -90,8 +102,7 @@ bool rabbit::Generator::resume(rabbit::VirtualMachine *v,rabbit::ObjectPtr &dest
 		v->_stack[v->_stackbase] = _this;
 	}
 	for(int64_t n = 1; n<size; n++) {
-		v->_stack[v->_stackbase+n] = _stack[n];
-		_stack[n].Null();
+		moveSlot(v->_stack[v->_stackbase+n], _stack[n]);
 	}
 	_state=eRunning;
 	if (v->_debughook) {
@@ -100,14 +111,15 @@ bool rabbit::Generator::resume(rabbit::VirtualMachine *v,rabbit::ObjectPtr &dest
 	return true;
 }
 
-rabbit::Generator::Generator(rabbit::SharedState *ss,rabbit::Closure *closure) {
+rabbit::Generator::Generator(rabbit::SharedState *ss,rabbit::Closure *closure) :
+	rabbit::Collectable(ss) {
 	_closure = closure;
 	_state = eRunning;
 	_ci._generator = NULL;
 }
 
 rabbit::Generator *rabbit::Generator::create(rabbit::SharedState *ss,rabbit::Closure *closure) {
-	rabbit::Generator *nc=(rabbit::Generator*)SQ_MALLOC(sizeof(rabbit::Generator));
+	rabbit::Generator *nc=(rabbit::Generator*)SQ_MALLOC(ss, rabbit::MEM_GENERATOR, sizeof(rabbit::Generator));
 	new ((char*)nc) rabbit::Generator(ss,closure);
 	return nc;
 }
@@ -122,7 +134,19 @@ void rabbit::Generator::kill() {
 	_closure.Null();
 }
 
+void rabbit::Generator::mark(rabbit::Collectable **chain) {
+	for(uint64_t i = 0; i < _stack.size(); i++) {
+		rabbit::SharedState::markObject(_stack[i], chain);
+	}
+	rabbit::SharedState::markObject(_closure, chain);
+}
+
+void rabbit::Generator::finalize() {
+	_stack.resize(0);
+	_closure.Null();
+}
+
 void rabbit::Generator::release() {
-	sq_delete(this,Generator);
+	sq_delete(_sharedstate, rabbit::MEM_GENERATOR, this, Generator);
 }
 
@@ -11,13 +11,13 @@
 #include <rabbit/LineInfo.hpp>
 #include <rabbit/OuterVar.hpp>
 #include <rabbit/Instruction.hpp>
-#include <rabbit/RefCounted.hpp>
+#include <rabbit/Collectable.hpp>
 #include <rabbit/rabbit.hpp>
 #include <etk/Vector.hpp>
 #include <rabbit/VirtualMachine.hpp>
 
 namespace rabbit {
-	class Generator : public rabbit::RefCounted {
+	class Generator : public rabbit::Collectable {
 		public:
 			enum GeneratorState{eRunning,eSuspended,eDead};
 		private:
@@ -27,8 +27,15 @@ namespace rabbit {
 			~Generator();
 			void kill();
 			void release();
+			void mark(rabbit::Collectable **chain);
+			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_GENERATOR;
+			}
 		
+			//move the frame from the stack of the VM to _stack (linear in the frame size)
 			bool yield(rabbit::VirtualMachine *v,int64_t target);
+			//move _stack back on the stack of the VM (linear in the frame size)
 			bool resume(rabbit::VirtualMachine *v,rabbit::ObjectPtr &dest);
 			rabbit::ObjectPtr _closure;
 			etk::Vector<rabbit::ObjectPtr> _stack;
@@ -0,0 +1,26 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#include <rabbit/InlineCache.hpp>
+
+void rabbit::InlineCache::reset() {
+	for(int64_t iii=0;iii<SQ_INLINE_CACHE_WAYS;++iii) {
+		// 0 is never given as a cache tag
+		_tag[iii] = 0;
+		_member[iii] = 0;
+	}
+}
+
+void rabbit::InlineCache::add(uint64_t tag, int64_t member) {
+	// the most recent receiver goes first, the oldest one is dropped
+	for(int64_t iii=SQ_INLINE_CACHE_WAYS-1;iii>0;--iii) {
+		_tag[iii] = _tag[iii-1];
+		_member[iii] = _member[iii-1];
+	}
+	_tag[0] = tag;
+	_member[0] = member;
+}
@@ -0,0 +1,41 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <etk/types.hpp>
+
+// number of receiver classes remembered by one call site (1 = monomorphic)
+#ifndef SQ_INLINE_CACHE_WAYS
+	#define SQ_INLINE_CACHE_WAYS 2
+#endif
+// value of the _arg3 of _OP_GETK/_OP_PREPCALLK when the site has no cache slot
+#define SQ_NO_INLINE_CACHE 0xFF
+
+namespace rabbit {
+	/**
+	 * Member lookup cache of one _OP_GETK/_OP_PREPCALLK site.
+	 * The key is the cache tag of the receiver class (see Class::_cachetag), the value is
+	 * the raw member index stored in Class::_members (MEMBER_TYPE_FIELD/METHOD | index).
+	 */
+	class InlineCache {
+		public:
+			uint64_t _tag[SQ_INLINE_CACHE_WAYS];
+			int64_t _member[SQ_INLINE_CACHE_WAYS];
+			void reset();
+			void add(uint64_t tag, int64_t member);
+			bool find(uint64_t tag, int64_t &member) const {
+				for(int64_t iii=0;iii<SQ_INLINE_CACHE_WAYS;++iii) {
+					if (_tag[iii] == tag) {
+						member = _member[iii];
+						return true;
+					}
+				}
+				return false;
+			}
+	};
+}
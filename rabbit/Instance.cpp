@@ -24,10 +24,12 @@ void rabbit::Instance::init(rabbit::SharedState *ss) {
 	_userpointer = NULL;
 	_hook = NULL;
 	__ObjaddRef(_class);
+	_sharedstate->gcBarrier(_class);
 	_delegate = _class->_members;
 }
 
-rabbit::Instance::Instance(rabbit::SharedState *ss, rabbit::Class *c, int64_t memsize) {
+rabbit::Instance::Instance(rabbit::SharedState *ss, rabbit::Class *c, int64_t memsize) :
+	rabbit::Delegable(ss) {
 	_memsize = memsize;
 	_class = c;
 	uint64_t nvalues = _class->_defaultvalues.size();
@@ -37,7 +39,8 @@ rabbit::Instance::Instance(rabbit::SharedState *ss, rabbit::Class *c, int64_t me
 	init(ss);
 }
 
-rabbit::Instance::Instance(rabbit::SharedState *ss, rabbit::Instance *i, int64_t memsize) {
+rabbit::Instance::Instance(rabbit::SharedState *ss, rabbit::Instance *i, int64_t memsize) :
+	rabbit::Delegable(ss) {
 	_memsize = memsize;
 	_class = i->_class;
 	uint64_t nvalues = _class->_defaultvalues.size();
@@ -47,6 +50,17 @@ rabbit::Instance::Instance(rabbit::SharedState *ss, rabbit::Instance *i, int64_t
 	init(ss);
 }
 
+void rabbit::Instance::mark(rabbit::Collectable **chain) {
+	if(_class == NULL) {
+		return;
+	}
+	_class->setReachable(chain);
+	uint64_t nvalues = _class->_defaultvalues.size();
+	for(uint64_t i = 0; i < nvalues; i++) {
+		rabbit::SharedState::markObject(_values[i], chain);
+	}
+}
+
 void rabbit::Instance::finalize() {
 	uint64_t nvalues = _class->_defaultvalues.size();
 	__Objrelease(_class);
@@ -80,7 +94,7 @@ bool rabbit::Instance::instanceOf(rabbit::Class *trg) {
 
 rabbit::Instance* rabbit::Instance::create(rabbit::SharedState *ss,rabbit::Class *theclass) {
 	int64_t size = calcinstancesize(theclass);
-	Instance *newinst = (Instance *)SQ_MALLOC(size);
+	Instance *newinst = (Instance *)SQ_MALLOC(ss, rabbit::MEM_INSTANCE, size);
 	new ((char*)newinst) Instance(ss, theclass,size);
 	if(theclass->_udsize) {
 		newinst->_userpointer = ((unsigned char *)newinst) + (size - theclass->_udsize);
@@ -90,7 +104,7 @@ rabbit::Instance* rabbit::Instance::create(rabbit::SharedState *ss,rabbit::Class
 
 rabbit::Instance* rabbit::Instance::clone(rabbit::SharedState *ss) {
 	int64_t size = calcinstancesize(_class);
-	Instance *newinst = (Instance *)SQ_MALLOC(size);
+	Instance *newinst = (Instance *)SQ_MALLOC(ss, rabbit::MEM_INSTANCE, size);
 	new ((char*)newinst) Instance(ss, this,size);
 	if(_class->_udsize) {
 		newinst->_userpointer = ((unsigned char *)newinst) + (size - _class->_udsize);
@@ -130,7 +144,8 @@ void rabbit::Instance::release() {
 		return;
 	}
 	int64_t size = _memsize;
+	rabbit::SharedState *ss = _sharedstate;
 	this->~Instance();
-	SQ_FREE(this, size);
+	SQ_FREE(ss, rabbit::MEM_INSTANCE, this, size);
 }
 
@@ -33,7 +33,11 @@ namespace rabbit {
 			bool get(const rabbit::ObjectPtr &key,rabbit::ObjectPtr &val);
 			bool set(const rabbit::ObjectPtr &key,const rabbit::ObjectPtr &val);
 			void release();
+			void mark(rabbit::Collectable **chain);
 			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_INSTANCE;
+			}
 			bool instanceOf(rabbit::Class *trg);
 			bool getMetaMethod(rabbit::VirtualMachine *v,rabbit::MetaMethod mm,rabbit::ObjectPtr &res);
 			
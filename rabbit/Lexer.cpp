@@ -9,6 +9,7 @@
 #include <rabbit/Table.hpp>
 #include <rabbit/String.hpp>
 #include <rabbit/sqconfig.hpp>
+#include <string.h>
 
 
 #define CUR_CHAR (_currdata)
@@ -18,62 +19,98 @@
 #define INIT_TEMP_STRING() { _longstr.resize(0);}
 #define APPEND_CHAR(c) { _longstr.pushBack(c);}
 #define TERMINATE_BUFFER() {_longstr.pushBack('\0');}
-#define ADD_KEYWORD(key,id) _keywords->newSlot( rabbit::String::create(ss, #key) ,int64_t(id))
 
-rabbit::Lexer::Lexer(){}
-rabbit::Lexer::~Lexer()
-{
-	_keywords->release();
+// keywords of the language, (name, token)
+#define SQ_KEYWORDS(KEYWORD) \
+	KEYWORD(while, TK_WHILE) \
+	KEYWORD(do, TK_DO) \
+	KEYWORD(if, TK_IF) \
+	KEYWORD(else, TK_ELSE) \
+	KEYWORD(break, TK_BREAK) \
+	KEYWORD(continue, TK_CONTINUE) \
+	KEYWORD(return, TK_RETURN) \
+	KEYWORD(null, TK_NULL) \
+	KEYWORD(function, TK_FUNCTION) \
+	KEYWORD(local, TK_LOCAL) \
+	KEYWORD(for, TK_FOR) \
+	KEYWORD(foreach, TK_FOREACH) \
+	KEYWORD(in, TK_IN) \
+	KEYWORD(typeof, TK_TYPEOF) \
+	KEYWORD(base, TK_BASE) \
+	KEYWORD(delete, TK_DELETE) \
+	KEYWORD(try, TK_TRY) \
+	KEYWORD(catch, TK_CATCH) \
+	KEYWORD(throw, TK_THROW) \
+	KEYWORD(clone, TK_CLONE) \
+	KEYWORD(yield, TK_YIELD) \
+	KEYWORD(resume, TK_RESUME) \
+	KEYWORD(switch, TK_SWITCH) \
+	KEYWORD(case, TK_CASE) \
+	KEYWORD(default, TK_DEFAULT) \
+	KEYWORD(this, TK_THIS) \
+	KEYWORD(class, TK_CLASS) \
+	KEYWORD(extends, TK_EXTENDS) \
+	KEYWORD(constructor, TK_CONSTRUCTOR) \
+	KEYWORD(instanceof, TK_INSTANCEOF) \
+	KEYWORD(true, TK_TRUE) \
+	KEYWORD(false, TK_FALSE) \
+	KEYWORD(static, TK_STATIC) \
+	KEYWORD(enum, TK_ENUM) \
+	KEYWORD(const, TK_CONST) \
+	KEYWORD(__LINE__, TK___LINE__) \
+	KEYWORD(__FILE__, TK___FILE__) \
+	KEYWORD(rawcall, TK_RAWCALL)
+
+namespace {
+	// FNV-1a of the 'len' first characters of 's', evaluated at compile time for the keywords
+	constexpr uint32_t keywordHash(const char *s, int64_t len, uint32_t h = 2166136261u) {
+		return len == 0 ? h : keywordHash(s + 1, len - 1, (h ^ uint8_t(*s)) * 16777619u);
+	}
+	// same hash at run time (no recursion on long identifiers)
+	inline uint32_t identifierHash(const char *s, int64_t len) {
+		uint32_t h = 2166136261u;
+		for(int64_t i = 0; i < len; ++i) {
+			h = (h ^ uint8_t(s[i])) * 16777619u;
+		}
+		return h;
+	}
+	struct Keyword {
+		const char *name;
+		int64_t token;
+	};
+	#define SQ_KEYWORD_ENTRY(key, id) { #key, id },
+	const Keyword s_keywords[] = { SQ_KEYWORDS(SQ_KEYWORD_ENTRY) };
+	#undef SQ_KEYWORD_ENTRY
 }
 
+rabbit::Lexer::Lexer(){}
+rabbit::Lexer::~Lexer(){}
+
 void rabbit::Lexer::init(rabbit::SharedState *ss, SQLEXREADFUNC rg, rabbit::UserPointer up,compilererrorFunc efunc,void *ed)
 {
 	_errfunc = efunc;
 	_errtarget = ed;
 	_sharedstate = ss;
-	_keywords = rabbit::Table::create(ss, 37);
-	ADD_KEYWORD(while, TK_WHILE);
-	ADD_KEYWORD(do, TK_DO);
-	ADD_KEYWORD(if, TK_IF);
-	ADD_KEYWORD(else, TK_ELSE);
-	ADD_KEYWORD(break, TK_BREAK);
-	ADD_KEYWORD(continue, TK_CONTINUE);
-	ADD_KEYWORD(return, TK_RETURN);
-	ADD_KEYWORD(null, TK_NULL);
-	ADD_KEYWORD(function, TK_FUNCTION);
-	ADD_KEYWORD(local, TK_LOCAL);
-	ADD_KEYWORD(for, TK_FOR);
-	ADD_KEYWORD(foreach, TK_FOREACH);
-	ADD_KEYWORD(in, TK_IN);
-	ADD_KEYWORD(typeof, TK_TYPEOF);
-	ADD_KEYWORD(base, TK_BASE);
-	ADD_KEYWORD(delete, TK_DELETE);
-	ADD_KEYWORD(try, TK_TRY);
-	ADD_KEYWORD(catch, TK_CATCH);
-	ADD_KEYWORD(throw, TK_THROW);
-	ADD_KEYWORD(clone, TK_CLONE);
-	ADD_KEYWORD(yield, TK_YIELD);
-	ADD_KEYWORD(resume, TK_RESUME);
-	ADD_KEYWORD(switch, TK_SWITCH);
-	ADD_KEYWORD(case, TK_CASE);
-	ADD_KEYWORD(default, TK_DEFAULT);
-	ADD_KEYWORD(this, TK_THIS);
-	ADD_KEYWORD(class,TK_CLASS);
-	ADD_KEYWORD(extends,TK_EXTENDS);
-	ADD_KEYWORD(constructor,TK_CONSTRUCTOR);
-	ADD_KEYWORD(instanceof,TK_INSTANCEOF);
-	ADD_KEYWORD(true,TK_TRUE);
-	ADD_KEYWORD(false,TK_FALSE);
-	ADD_KEYWORD(static,TK_STATIC);
-	ADD_KEYWORD(enum,TK_ENUM);
-	ADD_KEYWORD(const,TK_CONST);
-	ADD_KEYWORD(__LINE__,TK___LINE__);
-	ADD_KEYWORD(__FILE__,TK___FILE__);
-	ADD_KEYWORD(rawcall, TK_RAWCALL);
-
-
 	_readf = rg;
 	_up = up;
+	_bufpos = NULL;
+	_bufend = NULL;
+	_lasttokenline = _currentline = 1;
+	_currentcolumn = 0;
+	_prevtoken = -1;
+	_reached_eof = SQFalse;
+	next();
+}
+
+void rabbit::Lexer::init(rabbit::SharedState *ss, const char *buf, int64_t size, compilererrorFunc efunc, void *ed)
+{
+	_errfunc = efunc;
+	_errtarget = ed;
+	_sharedstate = ss;
+	_readf = NULL;
+	_up = NULL;
+	_bufpos = buf;
+	_bufend = buf + size;
 	_lasttokenline = _currentline = 1;
 	_currentcolumn = 0;
 	_prevtoken = -1;
@@ -88,6 +125,17 @@ void rabbit::Lexer::error(const char *err)
 
 void rabbit::Lexer::next()
 {
+	if(_bufpos != NULL) {
+		//a '\0' ends the source, as with the read functions
+		if(    _bufpos < _bufend
+		    && *_bufpos != 0) {
+			_currdata = (Lexchar)*_bufpos++;
+			return;
+		}
+		_currdata = RABBIT_EOB;
+		_reached_eof = SQTrue;
+		return;
+	}
 	int64_t t = _readf(_up);
 	if(t > UINT8_MAX) error("Invalid character");
 	if(t != 0) {
@@ -100,12 +148,10 @@ void rabbit::Lexer::next()
 
 const char *rabbit::Lexer::tok2Str(int64_t tok)
 {
-	rabbit::ObjectPtr itr, key, val;
-	int64_t nitr;
-	while((nitr = _keywords->next(false,itr, key, val)) != -1) {
-		itr = (int64_t)nitr;
-		if(((int64_t)val.toInteger()) == tok)
-			return key.getStringValue();
+	for(size_t i = 0; i < sizeof(s_keywords)/sizeof(s_keywords[0]); ++i) {
+		if(s_keywords[i].token == tok) {
+			return s_keywords[i].name;
+		}
 	}
 	return NULL;
 }
@@ -284,10 +330,17 @@ int64_t rabbit::Lexer::Lex()
 
 int64_t rabbit::Lexer::getIDType(const char *s,int64_t len)
 {
-	rabbit::ObjectPtr t;
-	if(_keywords->getStr(s,len, t)) {
-		return int64_t(t.toInteger());
+	// the keywords are a perfect hash checked by the compiler: two keywords with the same hash would be two
+	// identical case labels. an identifier is classified with one hash, one jump and at most one memcmp
+	#define SQ_KEYWORD_CASE(key, id) \
+		case keywordHash(#key, sizeof(#key) - 1): \
+			return (len == sizeof(#key) - 1 && memcmp(s, #key, sizeof(#key) - 1) == 0) ? id : TK_IDENTIFIER;
+	switch(identifierHash(s, len)) {
+		SQ_KEYWORDS(SQ_KEYWORD_CASE)
+		default:
+			break;
 	}
+	#undef SQ_KEYWORD_CASE
 	return TK_IDENTIFIER;
 }
 
@@ -334,6 +387,34 @@ int64_t rabbit::Lexer::processStringHexEscape(char *dest, int64_t maxdigits)
 
 int64_t rabbit::Lexer::readString(int64_t ndelim,bool verbatim)
 {
+	if(    _bufpos != NULL
+	    && ndelim == '"') {
+		//the string is used in place when it has no escape sequence
+		const char *it = _bufpos;
+		int64_t nlines = 0;
+		while(    it < _bufend
+		       && *it != '"'
+		       && *it != '\0'
+		       && (verbatim || (*it != '\\' && *it != '\n'))) {
+			if(*it == '\n') {
+				nlines++;
+			}
+			it++;
+		}
+		if(    it < _bufend
+		    && *it == '"'
+		    && (    !verbatim
+		         || it + 1 >= _bufend
+		         || it[1] != '"')) {
+			_svalue = _bufpos;
+			_slen = it - _bufpos;
+			_currentline += nlines;
+			_currentcolumn += _slen + 1;
+			_bufpos = it + 1;
+			NEXT();
+			return TK_STRING_LITERAL;
+		}
+	}
 	INIT_TEMP_STRING();
 	NEXT();
 	if(IS_EOB()) return -1;
@@ -413,6 +494,7 @@ int64_t rabbit::Lexer::readString(int64_t ndelim,bool verbatim)
 		return TK_INTEGER;
 	}
 	_svalue = &_longstr[0];
+	_slen = len;
 	return TK_STRING_LITERAL;
 }
 
@@ -427,13 +509,19 @@ void LexHexadecimal(const char *s,uint64_t *res)
 	}
 }
 
-void LexInteger(const char *s,uint64_t *res)
+//false when the value does not fit in 64 bits
+bool LexInteger(const char *s,uint64_t *res)
 {
 	*res = 0;
 	while(*s != 0)
 	{
-		*res = (*res)*10+((*s++)-'0');
+		uint64_t digit = (*s++)-'0';
+		if(*res > (UINT64_MAX - digit) / 10) {
+			return false;
+		}
+		*res = (*res)*10+digit;
 	}
+	return true;
 }
 
 int64_t scisodigit(int64_t c) { return c >= '0' && c <= '7'; }
@@ -509,21 +597,46 @@ int64_t rabbit::Lexer::readNumber()
 		_fvalue = (float_t)strtod(&_longstr[0],&sTemp);
 		return TK_FLOAT;
 	case TINT:
-		LexInteger(&_longstr[0],(uint64_t *)&_nvalue);
-		return TK_INTEGER;
+		//the decimal literals that wrap around to a negative value are only kept when the integers have 64 bits
+		if(    LexInteger(&_longstr[0],(uint64_t *)&_nvalue) == false
+		    || (_nvalue < 0 && rabbit::Object::integerFits(INT64_MIN) == false)) {
+			error("integer literal out of range");
+		}
+		break;
 	case THEX:
 		LexHexadecimal(&_longstr[0],(uint64_t *)&_nvalue);
-		return TK_INTEGER;
+		break;
 	case TOCTAL:
 		LexOctal(&_longstr[0],(uint64_t *)&_nvalue);
-		return TK_INTEGER;
+		break;
+	default:
+		return 0;
 	}
-	return 0;
+	//the SQ_TAGGED_OBJECT layout stores 56 bits integers
+	if(rabbit::Object::integerFits(_nvalue) == false) {
+		error("integer literal out of range");
+	}
+	return TK_INTEGER;
 }
 
 int64_t rabbit::Lexer::readId()
 {
 	int64_t res;
+	if(_bufpos != NULL) {
+		//the identifier is used in place
+		const char *start = _bufpos - 1;
+		int64_t len = 0;
+		do {
+			len++;
+			NEXT();
+		} while(isalnum(CUR_CHAR) || CUR_CHAR == '_');
+		res = getIDType(start,len);
+		if(res == TK_IDENTIFIER || res == TK_CONSTRUCTOR) {
+			_svalue = start;
+			_slen = len;
+		}
+		return res;
+	}
 	INIT_TEMP_STRING();
 	do {
 		APPEND_CHAR(CUR_CHAR);
@@ -533,6 +646,7 @@ int64_t rabbit::Lexer::readId()
 	res = getIDType(&_longstr[0],_longstr.size() - 1);
 	if(res == TK_IDENTIFIER || res == TK_CONSTRUCTOR) {
 		_svalue = &_longstr[0];
+		_slen = _longstr.size() - 1;
 	}
 	return res;
 }
@@ -22,6 +22,8 @@ namespace rabbit {
 			Lexer();
 			~Lexer();
 			void init(SharedState *ss,SQLEXREADFUNC rg,UserPointer up,compilererrorFunc efunc,void *ed);
+			//scan the source in place: the identifiers and the string literals without escape point in 'buf'
+			void init(SharedState *ss,const char *buf,int64_t size,compilererrorFunc efunc,void *ed);
 			void error(const char *err);
 			int64_t Lex();
 			const char *tok2Str(int64_t tok);
@@ -36,18 +38,20 @@ namespace rabbit {
 			int64_t addUTF8(uint64_t ch);
 			int64_t processStringHexEscape(char *dest, int64_t maxdigits);
 			int64_t _curtoken;
-			Table *_keywords;
 			Bool _reached_eof;
 		public:
 			int64_t _prevtoken;
 			int64_t _currentline;
 			int64_t _lasttokenline;
 			int64_t _currentcolumn;
-			const char *_svalue;
+			const char *_svalue; //!< not always '\0' terminated, it can point in the source buffer
+			int64_t _slen; //!< length of _svalue
 			int64_t _nvalue;
 			float_t _fvalue;
 			SQLEXREADFUNC _readf;
 			UserPointer _up;
+			const char *_bufpos; //!< next character of the source buffer (NULL when the source is read through _readf)
+			const char *_bufend;
 			Lexchar _currdata;
 			SharedState *_sharedstate;
 			etk::Vector<char> _longstr;
@@ -18,12 +18,8 @@ namespace rabbit {
 	class LocalVarInfo {
 		public:
 			LocalVarInfo():_start_op(0),_end_op(0),_pos(0){}
-			LocalVarInfo(const LocalVarInfo &lvi) {
-				_name=lvi._name;
-				_start_op=lvi._start_op;
-				_end_op=lvi._end_op;
-				_pos=lvi._pos;
-			}
+			LocalVarInfo(const LocalVarInfo &lvi) = default;
+			LocalVarInfo& operator=(const LocalVarInfo &lvi) = default;
 			rabbit::ObjectPtr _name;
 			uint64_t _start_op;
 			uint64_t _end_op;
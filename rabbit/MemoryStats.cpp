@@ -0,0 +1,44 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+
+#include <rabbit/MemoryStats.hpp>
+
+const char* rabbit::memoryTypeName(rabbit::MemoryType _type) {
+	switch(_type) {
+		case rabbit::MEM_STRING:
+			return "string";
+		case rabbit::MEM_TABLE:
+			return "table";
+		case rabbit::MEM_ARRAY:
+			return "array";
+		case rabbit::MEM_CLOSURE:
+			return "closure";
+		case rabbit::MEM_NATIVECLOSURE:
+			return "nativeclosure";
+		case rabbit::MEM_INSTANCE:
+			return "instance";
+		case rabbit::MEM_CLASS:
+			return "class";
+		case rabbit::MEM_USERDATA:
+			return "userdata";
+		case rabbit::MEM_GENERATOR:
+			return "generator";
+		case rabbit::MEM_THREAD:
+			return "thread";
+		case rabbit::MEM_FUNCPROTO:
+			return "funcproto";
+		case rabbit::MEM_OUTER:
+			return "outer";
+		case rabbit::MEM_WEAKREF:
+			return "weakref";
+		case rabbit::MEM_OTHER:
+			return "other";
+		default:
+			return NULL;
+	}
+}
@@ -0,0 +1,44 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <etk/types.hpp>
+
+namespace rabbit {
+	//category of the memory allocated by a shared state (see SQ_MALLOC)
+	enum MemoryType {
+		MEM_STRING = 0,
+		MEM_TABLE, //!< tables, their nodes and the shapes
+		MEM_ARRAY,
+		MEM_CLOSURE,
+		MEM_NATIVECLOSURE,
+		MEM_INSTANCE,
+		MEM_CLASS,
+		MEM_USERDATA,
+		MEM_GENERATOR,
+		MEM_THREAD, //!< virtual machines and their stacks
+		MEM_FUNCPROTO,
+		MEM_OUTER,
+		MEM_WEAKREF,
+		MEM_OTHER, //!< shared state internals, compiler, scratch pad
+		MEM_LAST
+	};
+	const char* memoryTypeName(rabbit::MemoryType _type);
+	/**
+	 * @brief Memory used by a shared state, in bytes.
+	 * The storage of the arrays is counted by its capacity and the VM stacks by their committed pages.
+	 */
+	class MemoryStats {
+		public:
+			int64_t used; //!< currently allocated
+			int64_t peak; //!< maximum of 'used'
+			int64_t limit; //!< 0: no limit (see sq_setmemorylimit)
+			int64_t typeused[rabbit::MEM_LAST];
+			int64_t typepeak[rabbit::MEM_LAST];
+	};
+}
@@ -9,15 +9,17 @@
 #include <etk/Allocator.hpp>
 
 #include <rabbit/WeakRef.hpp>
+#include <rabbit/SharedState.hpp>
 
-rabbit::NativeClosure::NativeClosure(rabbit::SharedState *ss,SQFUNCTION func) {
+rabbit::NativeClosure::NativeClosure(rabbit::SharedState *ss,SQFUNCTION func) :
+	rabbit::Collectable(ss) {
 	_function=func;
 	_env = NULL;
 }
 
 rabbit::NativeClosure* rabbit::NativeClosure::create(rabbit::SharedState *ss,SQFUNCTION func,int64_t nouters) {
 	int64_t size = _CALC_NATVIVECLOSURE_SIZE(nouters);
-	rabbit::NativeClosure *nc=(rabbit::NativeClosure*)SQ_MALLOC(size);
+	rabbit::NativeClosure *nc=(rabbit::NativeClosure*)SQ_MALLOC(ss, rabbit::MEM_NATIVECLOSURE, size);
 	new ((char*)nc) rabbit::NativeClosure(ss,func);
 	nc->_outervalues = (rabbit::ObjectPtr *)(nc + 1);
 	nc->_noutervalues = nouters;
@@ -26,7 +28,7 @@ rabbit::NativeClosure* rabbit::NativeClosure::create(rabbit::SharedState *ss,SQF
 }
 
 rabbit::NativeClosure* rabbit::NativeClosure::clone() {
-	rabbit::NativeClosure * ret = rabbit::NativeClosure::create(NULL,_function,_noutervalues);
+	rabbit::NativeClosure * ret = rabbit::NativeClosure::create(_sharedstate,_function,_noutervalues);
 	ret->_env = _env;
 	if(ret->_env) __ObjaddRef(ret->_env);
 	ret->_name = _name;
@@ -36,6 +38,16 @@ rabbit::NativeClosure* rabbit::NativeClosure::clone() {
 	return ret;
 }
 
+void rabbit::NativeClosure::mark(rabbit::Collectable **chain) {
+	for(uint64_t i = 0; i < _noutervalues; i++) {
+		rabbit::SharedState::markObject(_outervalues[i], chain);
+	}
+}
+
+void rabbit::NativeClosure::finalize() {
+	_NULL_SQOBJECT_VECTOR(_outervalues,_noutervalues);
+}
+
 rabbit::NativeClosure::~NativeClosure() {
 	__Objrelease(_env);
 }
@@ -43,6 +55,7 @@ rabbit::NativeClosure::~NativeClosure() {
 void rabbit::NativeClosure::release(){
 	int64_t size = _CALC_NATVIVECLOSURE_SIZE(_noutervalues);
 	_DESTRUCT_VECTOR(ObjectPtr,_noutervalues,_outervalues);
+	rabbit::SharedState *ss = _sharedstate;
 	this->~NativeClosure();
-	sq_free(this,size);
+	SQ_FREE(ss, rabbit::MEM_NATIVECLOSURE, this, size);
 }
\ No newline at end of file
@@ -9,7 +9,7 @@
 
 #include <etk/types.hpp>
 #include <etk/Vector.hpp>
-#include <rabbit/RefCounted.hpp>
+#include <rabbit/Collectable.hpp>
 #include <rabbit/ObjectPtr.hpp>
 #include <rabbit/squtils.hpp>
 #include <rabbit/rabbit.hpp>
@@ -20,7 +20,7 @@ namespace rabbit {
 	class SharedState;
 	class WeakRef;
 	#define _CALC_NATVIVECLOSURE_SIZE(noutervalues) (sizeof(rabbit::NativeClosure) + (noutervalues*sizeof(rabbit::ObjectPtr)))
-	class NativeClosure : public rabbit::RefCounted {
+	class NativeClosure : public rabbit::Collectable {
 		private:
 			NativeClosure(rabbit::SharedState *ss,SQFUNCTION func);
 		public:
@@ -28,6 +28,11 @@ namespace rabbit {
 			rabbit::NativeClosure *clone();
 			~NativeClosure();
 			void release();
+			void mark(rabbit::Collectable **chain);
+			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_NATIVECLOSURE;
+			}
 		
 			int64_t _nparamscheck;
 			etk::Vector<int64_t> _typecheck;
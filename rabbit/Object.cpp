@@ -11,13 +11,39 @@
 #include <rabbit/WeakRef.hpp>
 #include <rabbit/squtils.hpp>
 #include <rabbit/UserData.hpp>
+#include <rabbit/SharedState.hpp>
+
+#ifdef SQ_TAGGED_OBJECT
+static_assert(sizeof(rabbit::Object) == sizeof(uint64_t), "tagged object must fit in 64 bits");
+
+const rabbit::ObjectType rabbit::Object::s_tagToType[32] = {
+	rabbit::OT_NULL,
+	rabbit::OT_INTEGER,
+	rabbit::OT_FLOAT,
+	rabbit::OT_BOOL,
+	rabbit::OT_STRING,
+	rabbit::OT_TABLE,
+	rabbit::OT_ARRAY,
+	rabbit::OT_USERDATA,
+	rabbit::OT_CLOSURE,
+	rabbit::OT_NATIVECLOSURE,
+	rabbit::OT_GENERATOR,
+	rabbit::OT_USERPOINTER,
+	rabbit::OT_THREAD,
+	rabbit::OT_FUNCPROTO,
+	rabbit::OT_CLASS,
+	rabbit::OT_INSTANCE,
+	rabbit::OT_WEAKREF,
+	rabbit::OT_OUTER
+};
+#endif
 
 const char* rabbit::Object::getStringValue() const {
-	return (const char*)&_unVal.pString->_val[0];
+	return (const char*)&toString()->_val[0];
 }
 
 char* rabbit::Object::getStringValue() {
-	return (char*)&_unVal.pString->_val[0];
+	return (char*)&toString()->_val[0];
 }
 
 
@@ -29,24 +55,16 @@ rabbit::Object rabbit::Object::getRealObject() const {
 }
 
 rabbit::UserPointer rabbit::Object::getUserDataValue() const {
-	return (rabbit::UserPointer)sq_aligning(_unVal.pUserData + 1);
-}
-
-void rabbit::Object::addRef() {
-	if ((_type&SQOBJECT_REF_COUNTED) != 0) {
-		_unVal.pRefCounted->refCountIncrement();
-	}
+	return (rabbit::UserPointer)sq_aligning(toUserData() + 1);
 }
 
-void rabbit::Object::releaseRef() {
-	if (    (_type&SQOBJECT_REF_COUNTED) != 0
-	     && (_unVal.pRefCounted->refCountDecrement()==0)) {
-		_unVal.pRefCounted->release();
-	}
-	_type = rabbit::OT_NULL;
-	_unVal.raw = 0;
+#ifdef SQ_TAGGED_OBJECT
+void rabbit::Object::swap(rabbit::Object& _obj) {
+	uint64_t tmp = _bits;
+	_bits = _obj._bits;
+	_obj._bits = tmp;
 }
-
+#else
 void rabbit::Object::swap(rabbit::Object& _obj) {
 	rabbit::ObjectType tOldType = _type;
 	rabbit::ObjectValue unOldVal = _unVal;
@@ -55,5 +73,23 @@ void rabbit::Object::swap(rabbit::Object& _obj) {
 	_obj._type = tOldType;
 	_obj._unVal = unOldVal;
 }
+#endif
 
+void rabbit::Object::addRef() {
+	if (isRefCounted() == true) {
+		toRefCounted()->refCountIncrement();
+		// write barrier of the incremental collector: every new reference is a potential store in a black object
+		if (isCollectable() == true) {
+			rabbit::Collectable *c = static_cast<rabbit::Collectable*>(toRefCounted());
+			c->_sharedstate->gcBarrier(c);
+		}
+	}
+}
 
+void rabbit::Object::releaseRef() {
+	if (    isRefCounted() == true
+	     && toRefCounted()->refCountDecrement() == 0) {
+		toRefCounted()->release();
+	}
+	setNull();
+}
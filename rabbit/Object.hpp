@@ -12,139 +12,153 @@
 #include <rabbit/ObjectValue.hpp>
 
 namespace rabbit {
+	#ifdef SQ_TAGGED_OBJECT
+		// packed layout: [63..56] type tag (bit index of the _RT_* value), [55..0] payload
+		#define SQ_OBJECT_TAG_SHIFT 56
+		#define SQ_OBJECT_PAYLOAD_MASK 0x00FFFFFFFFFFFFFFULL
+		// tag mask of the types that hold a given property (bit n <=> _RT_* == 1<<n)
+		#define SQ_OBJECT_TAGS_REF_COUNTED 0x3F7F0ULL
+		#define SQ_OBJECT_TAGS_NUMERIC     0x00006ULL
+		#define SQ_OBJECT_TAGS_DELEGABLE   0x080A0ULL
+		#define SQ_OBJECT_TAGS_CANBEFALSE  0x0000FULL
+		#define SQ_OBJECT_TAGS_COLLECTABLE 0x2F7E0ULL
+		#define RABBIT_OBJECT_ACCESSOR(_func,_class,_sym) \
+			_class* _func() { \
+				return (_class*)getPayloadPointer(); \
+			} \
+			const _class* _func() const { \
+				return (const _class*)getPayloadPointer(); \
+			}
+	#else
+		#define RABBIT_OBJECT_ACCESSOR(_func,_class,_sym) \
+			_class*& _func() { \
+				return _unVal._sym; \
+			} \
+			const _class* _func() const { \
+				return _unVal._sym; \
+			}
+	#endif
+	
 	class Object {
 		public:
-			rabbit::ObjectType _type;
-			rabbit::ObjectValue _unVal;
+		#ifdef SQ_TAGGED_OBJECT
+			uint64_t _bits;
 			
-			int64_t& toInteger() {
-				return _unVal.nInteger;
+			static const rabbit::ObjectType s_tagToType[32];
+			static constexpr uint64_t typeToTag(uint32_t _rt, uint64_t _tag=0) {
+				return (_rt & 1) != 0 || _rt == 0 ? _tag : typeToTag(_rt >> 1, _tag + 1);
 			}
-			int64_t toInteger() const {
-				return _unVal.nInteger;
+			uint64_t getTag() const {
+				return _bits >> SQ_OBJECT_TAG_SHIFT;
 			}
-			float_t& toFloat() {
-				return _unVal.fFloat;
+			bool isType(rabbit::ObjectType _value) const {
+				return getTag() == typeToTag(_value & _RT_MASK);
 			}
-			float_t toFloat() const {
-				return _unVal.fFloat;
+			void* getPayloadPointer() const {
+				return (void*)(uintptr_t)(_bits & SQ_OBJECT_PAYLOAD_MASK);
 			}
-			int64_t toIntegerValue() const {
-				if (isInteger() == true){
-					return _unVal.nInteger;
-				}
-				if (isFloat() == true){
-					return _unVal.fFloat;
-				}
-				return 0;
+			void setPayload(rabbit::ObjectType _value, uint64_t _payload) {
+				_bits = (typeToTag(_value & _RT_MASK) << SQ_OBJECT_TAG_SHIFT) | (_payload & SQ_OBJECT_PAYLOAD_MASK);
 			}
-			float_t toFloatValue() const {
-				if (isFloat() == true){
-					return _unVal.fFloat;
-				}
-				if (isInteger() == true){
-					return _unVal.nInteger;
-				}
-				return 0.0f;
+			
+			int64_t toInteger() const {
+				// sign extension of the 56 bits payload
+				return int64_t(_bits << (64-SQ_OBJECT_TAG_SHIFT)) >> (64-SQ_OBJECT_TAG_SHIFT);
 			}
-			rabbit::String*& toString() {
-				return _unVal.pString;
+			bool toBoolean() const {
+				return (_bits & SQ_OBJECT_PAYLOAD_MASK) != 0;
 			}
-			const rabbit::String* toString() const {
-				return _unVal.pString;
+			// true when '_value' is stored without loss (SQ_INTEGER_MIN..SQ_INTEGER_MAX)
+			static constexpr bool integerFits(int64_t _value) {
+				return (int64_t(uint64_t(_value) << (64-SQ_OBJECT_TAG_SHIFT)) >> (64-SQ_OBJECT_TAG_SHIFT)) == _value;
 			}
-			const char* getStringValue() const;
-			char* getStringValue();
-			rabbit::Table*& toTable() {
-				return _unVal.pTable;
+			float_t toFloat() const {
+				union {
+					uint32_t bits;
+					float_t value;
+				} tmp;
+				tmp.bits = uint32_t(_bits);
+				return tmp.value;
 			}
-			const rabbit::Table* toTable() const {
-				return _unVal.pTable;
+			rabbit::UserPointer toUserPointer() const {
+				return getPayloadPointer();
 			}
-			rabbit::Array*& toArray() {
-				return _unVal.pArray;
+			uint64_t toRaw() const {
+				return _bits & SQ_OBJECT_PAYLOAD_MASK;
 			}
-			const rabbit::Array* toArray() const {
-				return _unVal.pArray;
+			bool isRefCounted() const {
+				return ((SQ_OBJECT_TAGS_REF_COUNTED >> getTag()) & 1) != 0;
+			}
+			bool isNumeric() const {
+				return ((SQ_OBJECT_TAGS_NUMERIC >> getTag()) & 1) != 0;
 			}
-			rabbit::FunctionProto*& toFunctionProto() {
-				return _unVal.pFunctionProto;
+			bool canBeFalse() const {
+				return ((SQ_OBJECT_TAGS_CANBEFALSE >> getTag()) & 1) != 0;
 			}
-			const rabbit::FunctionProto* toFunctionProto() const {
-				return _unVal.pFunctionProto;
+			bool isDelegable() const {
+				return ((SQ_OBJECT_TAGS_DELEGABLE >> getTag()) & 1) != 0;
 			}
-			rabbit::Closure*& toClosure() {
-				return _unVal.pClosure;
+			bool isCollectable() const {
+				return ((SQ_OBJECT_TAGS_COLLECTABLE >> getTag()) & 1) != 0;
 			}
-			const rabbit::Closure* toClosure() const {
-				return _unVal.pClosure;
+			rabbit::ObjectType getType() const {
+				return s_tagToType[getTag()];
 			}
-			rabbit::Outer*& toOuter() {
-				return _unVal.pOuter;
+			// raw setters: the reference count of the previous and the new value is not modified
+			void setNull() {
+				_bits = 0;
 			}
-			const rabbit::Outer* toOuter() const {
-				return _unVal.pOuter;
+			void setInteger(int64_t _value) {
+				// the value is truncated to the 56 bits of the payload
+				setPayload(rabbit::OT_INTEGER, uint64_t(_value));
 			}
-			rabbit::Generator*& toGenerator() {
-				return _unVal.pGenerator;
+			void setFloat(float_t _value) {
+				union {
+					uint32_t bits;
+					float_t value;
+				} tmp;
+				tmp.value = _value;
+				setPayload(rabbit::OT_FLOAT, tmp.bits);
 			}
-			const rabbit::Generator* toGenerator() const {
-				return _unVal.pGenerator;
+			void setBoolean(bool _value) {
+				setPayload(rabbit::OT_BOOL, _value?1:0);
 			}
-			rabbit::NativeClosure*& toNativeClosure() {
-				return _unVal.pNativeClosure;
+			void setPointer(rabbit::ObjectType _value, void* _ptr) {
+				// user space addresses never use the tag byte
+				assert((uint64_t(uintptr_t(_ptr)) & ~SQ_OBJECT_PAYLOAD_MASK) == 0);
+				setPayload(_value, uint64_t(uintptr_t(_ptr)));
 			}
-			const rabbit::NativeClosure* toNativeClosure() const {
-				return _unVal.pNativeClosure;
+		#else
+			rabbit::ObjectType _type;
+			rabbit::ObjectValue _unVal;
+			
+			bool isType(rabbit::ObjectType _value) const {
+				return _type == _value;
 			}
-			rabbit::Class*& toClass() {
-				return _unVal.pClass;
+			int64_t& toInteger() {
+				return _unVal.nInteger;
 			}
-			const rabbit::Class* toClass() const {
-				return _unVal.pClass;
+			int64_t toInteger() const {
+				return _unVal.nInteger;
 			}
-			rabbit::Instance*& toInstance() {
-				return _unVal.pInstance;
+			bool toBoolean() const {
+				return _unVal.nInteger != 0;
 			}
-			const rabbit::Instance* toInstance() const {
-				return _unVal.pInstance;
+			static constexpr bool integerFits(int64_t) {
+				return true;
 			}
-			rabbit::Delegable*& toDelegable() {
-				return _unVal.pDelegable;
+			float_t& toFloat() {
+				return _unVal.fFloat;
 			}
-			const rabbit::Delegable* toDelegable() const {
-				return _unVal.pDelegable;
+			float_t toFloat() const {
+				return _unVal.fFloat;
 			}
 			rabbit::UserPointer& toUserPointer() {
 				return _unVal.pUserPointer;
 			}
-			const rabbit::UserPointer toUserPointer() const {
+			rabbit::UserPointer toUserPointer() const {
 				return _unVal.pUserPointer;
 			}
-			rabbit::WeakRef*& toWeakRef() {
-				return _unVal.pWeakRef;
-			}
-			const rabbit::WeakRef* toWeakRef() const {
-				return _unVal.pWeakRef;
-			}
-			rabbit::VirtualMachine*& toVirtualMachine() {
-				return _unVal.pThread;
-			}
-			const rabbit::VirtualMachine* toVirtualMachine() const {
-				return _unVal.pThread;
-			}
-			rabbit::RefCounted*& toRefCounted() {
-				return _unVal.pRefCounted;
-			}
-			const rabbit::RefCounted* toRefCounted() const {
-				return _unVal.pRefCounted;
-			}
-			rabbit::UserData*& toUserData() {
-				return _unVal.pUserData;
-			}
-			const rabbit::UserData* toUserData() const {
-				return _unVal.pUserData;
-			}
 			uint64_t& toRaw() {
 				return _unVal.raw;
 			}
@@ -163,66 +177,129 @@ namespace rabbit {
 			bool isDelegable() const {
 				return (_type & SQOBJECT_DELEGABLE) != 0;
 			}
+			// ref counted objects that derive from rabbit::Collectable (all but strings and weak references)
+			bool isCollectable() const {
+				return (_type & SQOBJECT_REF_COUNTED) != 0
+				    && (_type & (_RT_STRING|_RT_WEAKREF)) == 0;
+			}
+			rabbit::ObjectType getType() const {
+				return _type;
+			}
+			// raw setters: the reference count of the previous and the new value is not modified
+			void setNull() {
+				_type = rabbit::OT_NULL;
+				_unVal.raw = 0;
+			}
+			void setInteger(int64_t _value) {
+				_type = rabbit::OT_INTEGER;
+				_unVal.nInteger = _value;
+			}
+			void setFloat(float_t _value) {
+				_unVal.raw = 0;
+				_type = rabbit::OT_FLOAT;
+				_unVal.fFloat = _value;
+			}
+			void setBoolean(bool _value) {
+				_type = rabbit::OT_BOOL;
+				_unVal.nInteger = _value?1:0;
+			}
+			void setPointer(rabbit::ObjectType _value, void* _ptr) {
+				_unVal.raw = 0;
+				_type = _value;
+				_unVal.pUserPointer = _ptr;
+			}
+		#endif
+			int64_t toIntegerValue() const {
+				if (isInteger() == true){
+					return toInteger();
+				}
+				if (isFloat() == true){
+					return toFloat();
+				}
+				return 0;
+			}
+			float_t toFloatValue() const {
+				if (isFloat() == true){
+					return toFloat();
+				}
+				if (isInteger() == true){
+					return toInteger();
+				}
+				return 0.0f;
+			}
+			const char* getStringValue() const;
+			char* getStringValue();
+			RABBIT_OBJECT_ACCESSOR(toString, rabbit::String, pString)
+			RABBIT_OBJECT_ACCESSOR(toTable, rabbit::Table, pTable)
+			RABBIT_OBJECT_ACCESSOR(toArray, rabbit::Array, pArray)
+			RABBIT_OBJECT_ACCESSOR(toFunctionProto, rabbit::FunctionProto, pFunctionProto)
+			RABBIT_OBJECT_ACCESSOR(toClosure, rabbit::Closure, pClosure)
+			RABBIT_OBJECT_ACCESSOR(toOuter, rabbit::Outer, pOuter)
+			RABBIT_OBJECT_ACCESSOR(toGenerator, rabbit::Generator, pGenerator)
+			RABBIT_OBJECT_ACCESSOR(toNativeClosure, rabbit::NativeClosure, pNativeClosure)
+			RABBIT_OBJECT_ACCESSOR(toClass, rabbit::Class, pClass)
+			RABBIT_OBJECT_ACCESSOR(toInstance, rabbit::Instance, pInstance)
+			RABBIT_OBJECT_ACCESSOR(toDelegable, rabbit::Delegable, pDelegable)
+			RABBIT_OBJECT_ACCESSOR(toWeakRef, rabbit::WeakRef, pWeakRef)
+			RABBIT_OBJECT_ACCESSOR(toVirtualMachine, rabbit::VirtualMachine, pThread)
+			RABBIT_OBJECT_ACCESSOR(toRefCounted, rabbit::RefCounted, pRefCounted)
+			RABBIT_OBJECT_ACCESSOR(toUserData, rabbit::UserData, pUserData)
 			bool isTable() const {
-				return _type == rabbit::OT_TABLE;
+				return isType(rabbit::OT_TABLE);
 			}
 			bool isArray() const {
-				return _type == rabbit::OT_ARRAY;
+				return isType(rabbit::OT_ARRAY);
 			}
 			bool isFunctionProto() const {
-				return _type == rabbit::OT_FUNCPROTO;
+				return isType(rabbit::OT_FUNCPROTO);
 			}
 			bool isClosure() const {
-				return _type == rabbit::OT_CLOSURE;
+				return isType(rabbit::OT_CLOSURE);
 			}
 			bool isGenerator() const {
-				return _type == rabbit::OT_GENERATOR;
+				return isType(rabbit::OT_GENERATOR);
 			}
 			bool isNativeClosure() const {
-				return _type == rabbit::OT_NATIVECLOSURE;
+				return isType(rabbit::OT_NATIVECLOSURE);
 			}
 			bool isString() const {
-				return _type == rabbit::OT_STRING;
+				return isType(rabbit::OT_STRING);
 			}
 			bool isInteger() const {
-				return _type == rabbit::OT_INTEGER;
+				return isType(rabbit::OT_INTEGER);
 			}
 			bool isFloat() const {
-				return _type == rabbit::OT_FLOAT;
+				return isType(rabbit::OT_FLOAT);
 			}
 			bool isUserPointer() const {
-				return _type == rabbit::OT_USERPOINTER;
+				return isType(rabbit::OT_USERPOINTER);
 			}
 			bool isUserData() const {
-				return _type == rabbit::OT_USERDATA;
+				return isType(rabbit::OT_USERDATA);
 			}
 			bool isVirtualMachine() const {
-				return _type == rabbit::OT_THREAD;
+				return isType(rabbit::OT_THREAD);
 			}
 			bool isNull() const {
-				return _type == rabbit::OT_NULL;
+				return isType(rabbit::OT_NULL);
 			}
 			bool isClass() const {
-				return _type == rabbit::OT_CLASS;
+				return isType(rabbit::OT_CLASS);
 			}
 			bool isInstance() const {
-				return _type == rabbit::OT_INSTANCE;
+				return isType(rabbit::OT_INSTANCE);
 			}
 			bool isBoolean() const {
-				return _type == rabbit::OT_BOOL;
+				return isType(rabbit::OT_BOOL);
 			}
 			bool isWeakRef() const {
-				return _type == rabbit::OT_WEAKREF;
-			}
-			rabbit::ObjectType getType() const {
-				return _type;
+				return isType(rabbit::OT_WEAKREF);
 			}
 			rabbit::ObjectType getTypeRaw() const {
-				return rabbit::ObjectType(_type&_RT_MASK);
+				return rabbit::ObjectType(getType()&_RT_MASK);
 			}
 			rabbit::Object getRealObject() const;
 			rabbit::UserPointer getUserDataValue() const;
-			
 			void addRef();
 			void releaseRef();
 			void swap(rabbit::Object& _obj);
@@ -12,10 +12,8 @@
 #define RABBIT_OBJ_REF_TYPE_INSTANCIATE(type, _class, sym) \
 	rabbit::ObjectPtr::ObjectPtr(_class * x) \
 	{ \
-		_unVal.raw = 0; \
-		_type=type; \
-		_unVal.sym = x; \
-		assert(_unVal.pTable); \
+		assert(x); \
+		setPointer(type, x); \
 		addRef(); \
 	} \
 	rabbit::ObjectPtr& rabbit::ObjectPtr::operator=(_class *x) \
@@ -25,12 +23,10 @@
 		return *this; \
 	}
 
-#define RABBIT_SCALAR_TYPE_INSTANCIATE(type,_class,sym) \
+#define RABBIT_SCALAR_TYPE_INSTANCIATE(type,_class,setter) \
 	rabbit::ObjectPtr::ObjectPtr(_class x) \
 	{ \
-		_unVal.raw = 0; \
-		_type=type; \
-		_unVal.sym = x; \
+		setter; \
 	} \
 	rabbit::ObjectPtr& rabbit::ObjectPtr::operator=(_class x) \
 	{  \
@@ -54,51 +50,38 @@ RABBIT_OBJ_REF_TYPE_INSTANCIATE(rabbit::OT_WEAKREF, rabbit::WeakRef, pWeakRef)
 RABBIT_OBJ_REF_TYPE_INSTANCIATE(rabbit::OT_THREAD, rabbit::VirtualMachine, pThread)
 RABBIT_OBJ_REF_TYPE_INSTANCIATE(rabbit::OT_FUNCPROTO, rabbit::FunctionProto, pFunctionProto)
 
-RABBIT_SCALAR_TYPE_INSTANCIATE(rabbit::OT_INTEGER, int64_t, nInteger)
-RABBIT_SCALAR_TYPE_INSTANCIATE(rabbit::OT_FLOAT, float_t, fFloat)
-RABBIT_SCALAR_TYPE_INSTANCIATE(rabbit::OT_USERPOINTER, rabbit::UserPointer, pUserPointer)
+RABBIT_SCALAR_TYPE_INSTANCIATE(rabbit::OT_INTEGER, int64_t, setInteger(x))
+RABBIT_SCALAR_TYPE_INSTANCIATE(rabbit::OT_FLOAT, float_t, setFloat(x))
+RABBIT_SCALAR_TYPE_INSTANCIATE(rabbit::OT_USERPOINTER, rabbit::UserPointer, setPointer(rabbit::OT_USERPOINTER, x))
 
 
 
 rabbit::ObjectPtr::ObjectPtr() {
-	_unVal.raw = 0;
-	_type = rabbit::OT_NULL;
-	_unVal.pUserPointer = NULL;
+	setNull();
 }
 
-rabbit::ObjectPtr::ObjectPtr(const rabbit::ObjectPtr& _obj) {
-	_type = _obj._type;
-	_unVal = _obj._unVal;
+rabbit::ObjectPtr::ObjectPtr(const rabbit::ObjectPtr& _obj) :
+	rabbit::Object(_obj) {
 	addRef();
 }
 
-rabbit::ObjectPtr::ObjectPtr(const rabbit::Object& _obj) {
-	_type = _obj._type;
-	_unVal = _obj._unVal;
+rabbit::ObjectPtr::ObjectPtr(const rabbit::Object& _obj) :
+	rabbit::Object(_obj) {
 	addRef();
 }
 
 rabbit::ObjectPtr::ObjectPtr(bool _value) {
-	_unVal.raw = 0;
-	_type = rabbit::OT_BOOL;
-	_unVal.nInteger = _value?1:0;
+	setBoolean(_value);
 }
 
 rabbit::ObjectPtr& rabbit::ObjectPtr::operator=(bool _value) {
 	releaseRef();
-	_unVal.raw = 0;
-	_type = rabbit::OT_BOOL;
-	_unVal.nInteger = _value?1:0;
+	setBoolean(_value);
 	return *this;
 }
 
 void rabbit::ObjectPtr::swap(rabbit::ObjectPtr& _obj) {
-	rabbit::ObjectType tOldType = _type;
-	rabbit::ObjectValue unOldVal = _unVal;
-	_type = _obj._type;
-	_unVal = _obj._unVal;
-	_obj._type = tOldType;
-	_obj._unVal = unOldVal;
+	rabbit::Object::swap(_obj);
 }
 
 rabbit::ObjectPtr::~ObjectPtr() {
@@ -8,24 +8,36 @@
 #include <rabbit/Outer.hpp>
 #include <etk/Allocator.hpp>
 #include <rabbit/squtils.hpp>
+#include <rabbit/SharedState.hpp>
 
 
-rabbit::Outer::Outer(rabbit::SharedState *ss, rabbit::ObjectPtr *outer){
+rabbit::Outer::Outer(rabbit::SharedState *ss, rabbit::ObjectPtr *outer) :
+	rabbit::Collectable(ss) {
 	_valptr = outer;
 	_next = NULL;
 }
 
 rabbit::Outer* rabbit::Outer::create(rabbit::SharedState *ss, rabbit::ObjectPtr *outer) {
-	rabbit::Outer *nc  = (rabbit::Outer*)SQ_MALLOC(sizeof(rabbit::Outer));
+	rabbit::Outer *nc  = (rabbit::Outer*)SQ_MALLOC(ss, rabbit::MEM_OUTER, sizeof(rabbit::Outer));
 	new ((char*)nc) rabbit::Outer(ss, outer);
 	return nc;
 }
 
+void rabbit::Outer::mark(rabbit::Collectable **chain) {
+	//an open outer points in the stack of a VM, the stack is marked by the VM itself
+	rabbit::SharedState::markObject(_value, chain);
+}
+
+void rabbit::Outer::finalize() {
+	_value.Null();
+}
+
 rabbit::Outer::~Outer() {
 	
 }
 
 void rabbit::Outer::release() {
+	rabbit::SharedState *ss = _sharedstate;
 	this->~Outer();
-	sq_vm_free(this,sizeof(rabbit::Outer));
+	SQ_FREE(ss, rabbit::MEM_OUTER, this, sizeof(rabbit::Outer));
 }
\ No newline at end of file
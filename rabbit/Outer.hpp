@@ -8,19 +8,24 @@
 #pragma once
 
 #include <etk/types.hpp>
-#include <rabbit/RefCounted.hpp>
+#include <rabbit/Collectable.hpp>
 #include <rabbit/ObjectPtr.hpp>
 
 
 namespace rabbit {
 	class SharedState;
-	class Outer : public rabbit::RefCounted {
+	class Outer : public rabbit::Collectable {
 		private:
 			Outer(rabbit::SharedState *ss, rabbit::ObjectPtr *outer);
 		public:
 			static rabbit::Outer *create(rabbit::SharedState *ss, rabbit::ObjectPtr *outer);
 			~Outer();
 			void release();
+			void mark(rabbit::Collectable **chain);
+			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_OUTER;
+			}
 			rabbit::ObjectPtr *_valptr; /* pointer to value on stack, or _value below */
 			int64_t	_idx; /* idx in stack array, for relocation */
 			rabbit::ObjectPtr _value; /* value of outer after stack frame is closed */
@@ -25,11 +25,8 @@ namespace rabbit {
 				_src=src;
 				_type=t;
 			}
-			OuterVar(const OuterVar &ov) {
-				_type=ov._type;
-				_src=ov._src;
-				_name=ov._name;
-			}
+			OuterVar(const OuterVar &ov) = default;
+			OuterVar& operator=(const OuterVar &ov) = default;
 			rabbit::OuterType _type;
 			rabbit::ObjectPtr _name;
 			rabbit::ObjectPtr _src;
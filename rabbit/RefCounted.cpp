@@ -10,22 +10,21 @@
 #include <rabbit/WeakRef.hpp>
 #include <rabbit/rabbit.hpp>
 #include <rabbit/squtils.hpp>
+#include <rabbit/SharedState.hpp>
 #include <etk/Allocator.hpp>
 
-rabbit::WeakRef * rabbit::RefCounted::getWeakRef(rabbit::ObjectType type) {
+rabbit::WeakRef * rabbit::RefCounted::getWeakRef(rabbit::SharedState *ss, rabbit::ObjectType type) {
 	if(!_weakref) {
-		sq_new(_weakref, WeakRef);
-		_weakref->_obj._unVal.raw = 0; //clean the whole union
-		_weakref->_obj._type = type;
-		_weakref->_obj._unVal.pRefCounted = this;
+		sq_new(ss, rabbit::MEM_WEAKREF, _weakref, WeakRef);
+		_weakref->_sharedstate = ss;
+		_weakref->_obj.setPointer(type, this);
 	}
 	return _weakref;
 }
 
 rabbit::RefCounted::~RefCounted() {
 	if(_weakref) {
-		_weakref->_obj._type = rabbit::OT_NULL;
-		_weakref->_obj._unVal.pRefCounted = NULL;
+		_weakref->_obj.setNull();
 	}
 }
 
@@ -37,6 +36,6 @@ int64_t rabbit::RefCounted::refCountDecrement() {
 	return --_uiRef;
 }
 
-int64_t rabbit::RefCounted::refCountget() {
+int64_t rabbit::RefCounted::refCountget() const {
 	return _uiRef;
 }
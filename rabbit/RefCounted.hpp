@@ -12,6 +12,7 @@
 
 namespace rabbit {
 	class WeakRef;
+	class SharedState;
 	class RefCounted {
 		protected:
 			int64_t _uiRef = 0;
@@ -19,11 +20,11 @@ namespace rabbit {
 		public:
 			RefCounted() {}
 			virtual ~RefCounted();
-			WeakRef *getWeakRef(rabbit::ObjectType _type);
+			WeakRef *getWeakRef(rabbit::SharedState *_ss, rabbit::ObjectType _type);
 			virtual void release() = 0;
 			void refCountIncrement();
 			int64_t refCountDecrement();
-			int64_t refCountget();
+			int64_t refCountget() const;
 			friend WeakRef;
 	};
 	#define __Objrelease(obj) { \
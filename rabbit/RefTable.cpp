@@ -7,15 +7,26 @@
  */
 #include <rabbit/RefTable.hpp>
 #include <rabbit/Table.hpp>
+#include <rabbit/SharedState.hpp>
 
 #include <rabbit/squtils.hpp>
 #include <etk/Allocator.hpp>
 
-rabbit::RefTable::RefTable()
+rabbit::RefTable::RefTable(rabbit::SharedState *ss)
 {
+	_sharedstate = ss;
 	allocNodes(4);
 }
 
+void rabbit::RefTable::mark(rabbit::Collectable **chain)
+{
+	RefNode *nodes = _nodes;
+	for(uint64_t n = 0; n < _numofslots; n++) {
+		rabbit::SharedState::markObject(nodes->obj, chain);
+		nodes++;
+	}
+}
+
 void rabbit::RefTable::finalize()
 {
 	RefNode *nodes = _nodes;
@@ -27,7 +38,7 @@ void rabbit::RefTable::finalize()
 
 rabbit::RefTable::~RefTable()
 {
-	SQ_FREE(_buckets,(_numofslots * sizeof(RefNode *)) + (_numofslots * sizeof(RefNode)));
+	SQ_FREE(_sharedstate, rabbit::MEM_OTHER, _buckets,(_numofslots * sizeof(RefNode *)) + (_numofslots * sizeof(RefNode)));
 }
 
 
@@ -96,7 +107,7 @@ void rabbit::RefTable::resize(uint64_t size)
 		t++;
 	}
 	assert(nfound == oldnumofslots);
-	SQ_FREE(oldbucks,(oldnumofslots * sizeof(RefNode *)) + (oldnumofslots * sizeof(RefNode)));
+	SQ_FREE(_sharedstate, rabbit::MEM_OTHER, oldbucks,(oldnumofslots * sizeof(RefNode *)) + (oldnumofslots * sizeof(RefNode)));
 }
 
 rabbit::RefTable::RefNode* rabbit::RefTable::add(rabbit::Hash mainpos, rabbit::Object &obj)
@@ -139,7 +150,7 @@ void rabbit::RefTable::allocNodes(uint64_t size)
 {
 	RefNode **bucks;
 	RefNode *nodes;
-	bucks = (RefNode **)SQ_MALLOC((size * sizeof(RefNode *)) + (size * sizeof(RefNode)));
+	bucks = (RefNode **)SQ_MALLOC(_sharedstate, rabbit::MEM_OTHER, (size * sizeof(RefNode *)) + (size * sizeof(RefNode)));
 	nodes = (RefNode *)&bucks[size];
 	RefNode *temp = nodes;
 	uint64_t n;
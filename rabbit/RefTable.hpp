@@ -13,6 +13,7 @@
 #include <rabbit/Hash.hpp>
 
 namespace rabbit {
+	class Collectable;
 	class RefTable {
 		public:
 			class RefNode {
@@ -21,12 +22,13 @@ namespace rabbit {
 					uint64_t refs;
 					struct RefNode *next;
 			};
-			RefTable();
+			RefTable(rabbit::SharedState *ss);
 			~RefTable();
 			void addRef(rabbit::Object &obj);
 			rabbit::Bool release(rabbit::Object &obj);
 			uint64_t getRefCount(rabbit::Object &obj);
 			void finalize();
+			void mark(rabbit::Collectable **chain);
 		private:
 			RefNode *get(rabbit::Object &obj,rabbit::Hash &mainpos,RefNode **prev,bool add);
 			RefNode *add(rabbit::Hash mainpos,rabbit::Object &obj);
@@ -37,6 +39,7 @@ namespace rabbit {
 			RefNode *_nodes;
 			RefNode *_freelist;
 			RefNode **_buckets;
+			rabbit::SharedState *_sharedstate;
 	};
 }
 
@@ -0,0 +1,75 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#include <rabbit/Shape.hpp>
+#include <rabbit/SharedState.hpp>
+#include <rabbit/squtils.hpp>
+#include <etk/Allocator.hpp>
+
+rabbit::Shape::Shape(rabbit::SharedState *ss, rabbit::Shape *parent, const rabbit::ObjectPtr &key) {
+	_sharedstate = ss;
+	_parent = parent;
+	_cachetag = ss->newCacheTag();
+	_nkeys = 0;
+	_keys = NULL;
+	if(_parent) {
+		__ObjaddRef(_parent);
+		_nkeys = _parent->_nkeys + 1;
+		_keys = (rabbit::ObjectPtr *)SQ_MALLOC(ss, rabbit::MEM_TABLE, _nkeys * sizeof(rabbit::ObjectPtr));
+		_CONSTRUCT_VECTOR(rabbit::ObjectPtr, _nkeys, _keys);
+		_COPY_VECTOR(_keys, _parent->_keys, _parent->_nkeys);
+		_keys[_nkeys-1] = key;
+	}
+}
+
+rabbit::Shape::~Shape() {
+	if(_keys) {
+		_DESTRUCT_VECTOR(ObjectPtr, _nkeys, _keys);
+		SQ_FREE(_sharedstate, rabbit::MEM_TABLE, _keys, _nkeys * sizeof(rabbit::ObjectPtr));
+	}
+	if(_parent) {
+		for(size_t iii=0;iii<_parent->_transitions.size();++iii) {
+			if(_parent->_transitions[iii] == this) {
+				_parent->_transitions.remove(iii);
+				break;
+			}
+		}
+		__Objrelease(_parent);
+	}
+}
+
+rabbit::Shape* rabbit::Shape::createRoot(rabbit::SharedState *ss) {
+	rabbit::Shape *shape = (rabbit::Shape *)SQ_MALLOC(ss, rabbit::MEM_TABLE, sizeof(rabbit::Shape));
+	new ((char*)shape) rabbit::Shape(ss, NULL, rabbit::ObjectPtr());
+	return shape;
+}
+
+rabbit::Shape* rabbit::Shape::addKey(const rabbit::ObjectPtr &key) {
+	for(size_t iii=0;iii<_transitions.size();++iii) {
+		rabbit::Shape *child = _transitions[iii];
+		if(    child->_keys[_nkeys].toRaw() == key.toRaw()
+		    && child->_keys[_nkeys].getType() == key.getType()) {
+			return child;
+		}
+	}
+	rabbit::Shape *child = (rabbit::Shape *)SQ_MALLOC(_sharedstate, rabbit::MEM_TABLE, sizeof(rabbit::Shape));
+	new ((char*)child) rabbit::Shape(_sharedstate, this, key);
+	_transitions.pushBack(child);
+	return child;
+}
+
+rabbit::Shape* rabbit::Shape::getRoot() {
+	rabbit::Shape *shape = this;
+	while(shape->_parent != NULL) {
+		shape = shape->_parent;
+	}
+	return shape;
+}
+
+void rabbit::Shape::release() {
+	sq_delete(_sharedstate, rabbit::MEM_TABLE, this, Shape);
+}
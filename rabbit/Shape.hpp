@@ -0,0 +1,54 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <etk/types.hpp>
+#include <etk/Vector.hpp>
+#include <rabbit/RefCounted.hpp>
+#include <rabbit/ObjectPtr.hpp>
+
+// maximum number of keys of a table stored with a shape, bigger tables use the hash layout
+#ifndef SQ_SHAPE_MAX_KEYS
+	#define SQ_SHAPE_MAX_KEYS 16
+#endif
+
+namespace rabbit {
+	class SharedState;
+	/**
+	 * Immutable key layout shared by the tables built with the same sequence of string keys
+	 * (hidden class). The shapes of a SharedState form a transition tree from an empty root:
+	 * a child holds a reference on its parent, the parent only keeps a weak list of its children.
+	 */
+	class Shape : public rabbit::RefCounted {
+		private:
+			Shape(rabbit::SharedState *ss, rabbit::Shape *parent, const rabbit::ObjectPtr &key);
+		public:
+			static rabbit::Shape* createRoot(rabbit::SharedState *ss);
+			~Shape();
+			//returns the shape with 'key' appended (not referenced), the key must be a string
+			rabbit::Shape* addKey(const rabbit::ObjectPtr &key);
+			//returns the slot index of 'key' or -1
+			int64_t find(const rabbit::ObjectPtr &key) const {
+				for(int64_t iii=0;iii<_nkeys;++iii) {
+					if(    _keys[iii].toRaw() == key.toRaw()
+					    && _keys[iii].getType() == key.getType()) {
+						return iii;
+					}
+				}
+				return -1;
+			}
+			rabbit::Shape* getRoot();
+			void release();
+			rabbit::SharedState *_sharedstate;
+			rabbit::Shape *_parent;
+			etk::Vector<rabbit::Shape*> _transitions;
+			uint64_t _cachetag;
+			int64_t _nkeys;
+			rabbit::ObjectPtr *_keys; //!< keys of all the slots, in insertion order
+	};
+}
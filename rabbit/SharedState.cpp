@@ -7,13 +7,20 @@
  */
 #include <rabbit/SharedState.hpp>
 #include <rabbit/Table.hpp>
+#include <rabbit/Shape.hpp>
 #include <rabbit/String.hpp>
 #include <rabbit/StringTable.hpp>
 #include <rabbit/RegFunction.hpp>
 #include <rabbit/NativeClosure.hpp>
 #include <rabbit/VirtualMachine.hpp>
+#include <rabbit/Collectable.hpp>
+#include <rabbit/Array.hpp>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-static rabbit::Table *createDefaultDelegate(rabbit::SharedState *ss,const rabbit::RegFunction *funcz)
+static rabbit::Table *createDefaultDelegate(rabbit::SharedState *ss,const char *scope,const rabbit::RegFunction *funcz)
 {
 	int64_t i=0;
 	rabbit::Table *t=rabbit::Table::create(ss,0);
@@ -21,6 +28,8 @@ static rabbit::Table *createDefaultDelegate(rabbit::SharedState *ss,const rabbit
 		rabbit::NativeClosure *nc = rabbit::NativeClosure::create(ss,funcz[i].f,0);
 		nc->_nparamscheck = funcz[i].nparamscheck;
 		nc->_name = rabbit::String::create(ss,funcz[i].name);
+		if(!ss->bindNative(scope,funcz[i].name,funcz[i].f))
+			return NULL;
 		if(funcz[i].typemask && !rabbit::compileTypemask(nc->_typecheck,funcz[i].typemask))
 			return NULL;
 		t->newSlot(rabbit::String::create(ss,funcz[i].name),nc);
@@ -31,15 +40,302 @@ static rabbit::Table *createDefaultDelegate(rabbit::SharedState *ss,const rabbit
 
 
 
-rabbit::SharedState::SharedState()
-{
+rabbit::SharedState::SharedState(rabbit::Allocator *alloc) :
+  _alloc(alloc),
+  _mem_stats(),
+  _mem_exceeded(false),
+  _mem_threshold(0),
+  _refs_table(this) {
 	_compilererrorhandler = NULL;
 	_printfunc = NULL;
 	_errorfunc = NULL;
 	_debuginfo = false;
+	_optimizebytecode = true;
+	_superinstructions = false;
+#ifdef SQ_PROFILE_OPCODES
+	memset(_opcodecounts, 0, sizeof(_opcodecounts));
+	memset(_opcodepairs, 0, sizeof(_opcodepairs));
+	_opcodeprev = NULL;
+#endif
 	_notifyallexceptions = false;
 	_foreignptr = NULL;
 	_releasehook = NULL;
+	_cachetag = 0;
+	_rootshape = NULL;
+	_gc_chain = NULL;
+	_gc_marked = NULL;
+	_gc_state = GC_PAUSE;
+	_gc_epoch = 0;
+	memset(&_gc_stats, 0, sizeof(_gc_stats));
+}
+
+void rabbit::SharedState::memExhausted(rabbit::MemoryType type, uint64_t size) {
+	fprintf(stderr, "rabbit: out of memory (%llu bytes of %s requested, %lld in use)\n",
+	        (unsigned long long)size, rabbit::memoryTypeName(type), (long long)_mem_stats.used);
+	abort();
+}
+
+void rabbit::SharedState::markObject(const rabbit::Object &o, rabbit::Collectable **chain) {
+	switch(o.getType()) {
+		case rabbit::OT_TABLE:
+		case rabbit::OT_ARRAY:
+		case rabbit::OT_USERDATA:
+		case rabbit::OT_CLOSURE:
+		case rabbit::OT_NATIVECLOSURE:
+		case rabbit::OT_GENERATOR:
+		case rabbit::OT_THREAD:
+		case rabbit::OT_FUNCPROTO:
+		case rabbit::OT_CLASS:
+		case rabbit::OT_INSTANCE:
+		case rabbit::OT_OUTER:
+			((rabbit::Collectable*)o.toRefCounted())->setReachable(chain);
+			break;
+		default:
+			//strings and weak references can not hold a cycle
+			break;
+	}
+}
+
+void rabbit::SharedState::gcStart(rabbit::VirtualMachine *vm) {
+	//all the objects of the previous cycle become white
+	_gc_epoch ^= 1;
+	_gc_marked = NULL;
+	_gc_state = GC_PROPAGATE;
+	markObject(_root_vm, &_gc_marked);
+	vm->setReachable(&_gc_marked);
+	_refs_table.mark(&_gc_marked);
+	markObject(_registry, &_gc_marked);
+	markObject(_consts, &_gc_marked);
+	markObject(_natives, &_gc_marked);
+	markObject(_cloneclasses, &_gc_marked);
+	markObject(_metamethodsmap, &_gc_marked);
+	markObject(_table_default_delegate, &_gc_marked);
+	markObject(_array_default_delegate, &_gc_marked);
+	markObject(_string_default_delegate, &_gc_marked);
+	markObject(_number_default_delegate, &_gc_marked);
+	markObject(_generator_default_delegate, &_gc_marked);
+	markObject(_thread_default_delegate, &_gc_marked);
+	markObject(_closure_default_delegate, &_gc_marked);
+	markObject(_class_default_delegate, &_gc_marked);
+	markObject(_instance_default_delegate, &_gc_marked);
+	markObject(_weakref_default_delegate, &_gc_marked);
+}
+
+void rabbit::SharedState::gcPropagate() {
+	//iterative propagation: no recursion on long linked structures
+	rabbit::Collectable *c = _gc_gray.back();
+	_gc_gray.popBack();
+	c->mark(&_gc_marked);
+	if(c->refCountDecrement() == 0) {
+		c->release();
+	}
+}
+
+void rabbit::SharedState::gcAtomic(rabbit::VirtualMachine *vm) {
+	//the stacks and the ref table of the running VMs are marked again before the cycle is closed
+	_root_vm.toVirtualMachine()->mark(&_gc_marked);
+	if(vm != _root_vm.toVirtualMachine()) {
+		vm->mark(&_gc_marked);
+	}
+	_refs_table.mark(&_gc_marked);
+	while(_gc_gray.size() != 0) {
+		gcPropagate();
+	}
+}
+
+void rabbit::SharedState::gcSweep() {
+	//the object is kept alive (and black) while it releases its references
+	rabbit::Collectable *c = _gc_chain;
+	rabbit::Collectable::removeFromChain(&_gc_chain, c);
+	c->_gcmark = _gc_epoch;
+	rabbit::Collectable::addToChain(&_gc_marked, c);
+	c->refCountIncrement();
+	c->finalize();
+	if(c->refCountDecrement() == 0) {
+		c->release();
+	}
+}
+
+void rabbit::SharedState::gcCancel() {
+	while(_gc_gray.size() != 0) {
+		rabbit::Collectable *c = _gc_gray.back();
+		_gc_gray.popBack();
+		if(c->refCountDecrement() == 0) {
+			c->release();
+		}
+	}
+	while(_gc_marked) {
+		rabbit::Collectable *c = _gc_marked;
+		rabbit::Collectable::removeFromChain(&_gc_marked, c);
+		c->_gcmark = _gc_epoch;
+		rabbit::Collectable::addToChain(&_gc_chain, c);
+	}
+	for(rabbit::Collectable *t = _gc_chain; t != NULL; t = t->_gcnext) {
+		t->_gcmark = _gc_epoch;
+	}
+	_gc_state = GC_PAUSE;
+}
+
+bool rabbit::SharedState::gcStep(rabbit::VirtualMachine *vm, int64_t budget_us) {
+	//the clock is read every SQ_GC_STEP_UNIT objects
+	const int64_t SQ_GC_STEP_UNIT = 32;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point deadline = start + std::chrono::microseconds(budget_us);
+	bool completed = false;
+	int64_t work = 0;
+	if(_gc_state == GC_PAUSE) {
+		gcStart(vm);
+	}
+	while(completed == false) {
+		if(_gc_state == GC_PROPAGATE) {
+			if(_gc_gray.size() != 0) {
+				gcPropagate();
+			} else {
+				gcAtomic(vm);
+				//nothing can reference the white objects anymore: count them and cut their weak references
+				int64_t n = 0;
+				for(rabbit::Collectable *t = _gc_chain; t != NULL; t = t->_gcnext) {
+					t->clearWeakRef();
+					n++;
+				}
+				_gc_stats.lastcollected = n;
+				_gc_stats.totalcollected += n;
+				_gc_state = GC_SWEEP;
+			}
+		} else if(_gc_chain != NULL) {
+			gcSweep();
+		} else {
+			_gc_chain = _gc_marked;
+			_gc_marked = NULL;
+			_gc_state = GC_PAUSE;
+			_gc_stats.cycles++;
+			completed = true;
+		}
+		work++;
+		if(    budget_us >= 0
+		    && (work % SQ_GC_STEP_UNIT) == 0
+		    && std::chrono::steady_clock::now() >= deadline) {
+			break;
+		}
+	}
+	int64_t pause = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	_gc_stats.steps++;
+	_gc_stats.lastpause = pause;
+	_gc_stats.totalpause += pause;
+	if(pause > _gc_stats.maxpause) {
+		_gc_stats.maxpause = pause;
+	}
+	return completed;
+}
+
+void rabbit::SharedState::finalizeChain() {
+	rabbit::Collectable *t = _gc_chain;
+	rabbit::Collectable *nx = NULL;
+	if(t) {
+		//keep the current and the next object alive while the references are released
+		t->refCountIncrement();
+		while(t) {
+			t->finalize();
+			nx = t->_gcnext;
+			if(nx) {
+				nx->refCountIncrement();
+			}
+			if(t->refCountDecrement() == 0) {
+				t->release();
+			}
+			t = nx;
+		}
+	}
+}
+
+int64_t rabbit::SharedState::collectGarbage(rabbit::VirtualMachine *vm) {
+	//end the incremental cycle in progress, it may have missed the objects released after its start
+	if(_gc_state != GC_PAUSE) {
+		gcStep(vm, -1);
+	}
+	gcStep(vm, -1);
+	return _gc_stats.lastcollected;
+}
+
+int64_t rabbit::SharedState::resurrectUnreachable(rabbit::VirtualMachine *vm) {
+	int64_t n = 0;
+	if(_gc_state != GC_PAUSE) {
+		gcStep(vm, -1);
+	}
+	gcStart(vm);
+	gcAtomic(vm);
+	//the marked objects become the chain, the new objects (the array) are added in it
+	_gc_state = GC_PAUSE;
+	rabbit::Collectable *resurrected = _gc_chain;
+	_gc_chain = _gc_marked;
+	_gc_marked = NULL;
+	rabbit::ObjectPtr ret;
+	if(resurrected) {
+		rabbit::Array *arr = rabbit::Array::create(this, 0);
+		ret = arr;
+		rabbit::Collectable *t = resurrected;
+		rabbit::Collectable *rlast = NULL;
+		while(t) {
+			rlast = t;
+			t->_gcmark = _gc_epoch;
+			rabbit::ObjectType type = t->getType();
+			//prototypes and outers are internal objects, they can not be given to a script
+			if(    type != rabbit::OT_FUNCPROTO
+			    && type != rabbit::OT_OUTER) {
+				rabbit::Object sqo;
+				sqo.setPointer(type, t);
+				arr->append(sqo);
+			}
+			t = t->_gcnext;
+			n++;
+		}
+		//put them back in the chain, now they are referenced by the array
+		rlast->_gcnext = _gc_chain;
+		if(_gc_chain) {
+			_gc_chain->_gcprev = rlast;
+		}
+		_gc_chain = resurrected;
+	}
+	vm->push(ret);
+	return n;
+}
+
+bool rabbit::SharedState::bindNative(const char *scope, const char *name, SQFUNCTION func) {
+	rabbit::Table *natives = _natives.toTable();
+	rabbit::ObjectPtr fkey((rabbit::UserPointer)func);
+	int64_t size = strlen(scope) + strlen(name) + 2;
+	char *buf = getScratchPad(size);
+	snprintf(buf, size, "%s.%s", scope, name);
+	rabbit::ObjectPtr key = rabbit::String::create(this, buf);
+	rabbit::ObjectPtr other;
+	if(natives->get(key, other)) {
+		return other.toUserPointer() == (rabbit::UserPointer)func;
+	}
+	natives->newSlot(key, fkey);
+	//the first key stays the one written in the snapshots
+	if(natives->get(fkey, other) == false) {
+		natives->newSlot(fkey, key);
+	}
+	return true;
+}
+
+bool rabbit::SharedState::getNativeName(SQFUNCTION func, rabbit::ObjectPtr &name) {
+	return _natives.toTable()->get(rabbit::ObjectPtr((rabbit::UserPointer)func), name);
+}
+
+SQFUNCTION rabbit::SharedState::getNative(const rabbit::ObjectPtr &name) {
+	rabbit::ObjectPtr func;
+	if(    name.isString() == false
+	    || _natives.toTable()->get(name, func) == false) {
+		return NULL;
+	}
+	return (SQFUNCTION)func.toUserPointer();
+}
+
+uint64_t rabbit::SharedState::newCacheTag() {
+	// tags go by 2: 'tag' identifies the instances of a class layout and 'tag+1' the class itself
+	_cachetag += 2;
+	return _cachetag;
 }
 
 #define newsysstring(s) {   \
@@ -97,11 +393,13 @@ void rabbit::SharedState::init()
 {
 	_scratchpad=NULL;
 	_scratchpadsize=0;
-	_stringtable = (rabbit::StringTable*)SQ_MALLOC(sizeof(rabbit::StringTable));
+	_stringtable = (rabbit::StringTable*)SQ_MALLOC(this, rabbit::MEM_OTHER, sizeof(rabbit::StringTable));
 	new ((char*)_stringtable) rabbit::StringTable(this);
-	sq_new(_metamethods,etk::Vector<rabbit::ObjectPtr>);
-	sq_new(_systemstrings,etk::Vector<rabbit::ObjectPtr>);
-	sq_new(_types,etk::Vector<rabbit::ObjectPtr>);
+	sq_new(this, rabbit::MEM_OTHER, _metamethods,etk::Vector<rabbit::ObjectPtr>);
+	sq_new(this, rabbit::MEM_OTHER, _systemstrings,etk::Vector<rabbit::ObjectPtr>);
+	sq_new(this, rabbit::MEM_OTHER, _types,etk::Vector<rabbit::ObjectPtr>);
+	_rootshape = rabbit::Shape::createRoot(this);
+	__ObjaddRef(_rootshape);
 	_metamethodsmap = rabbit::Table::create(this,rabbit::MT_LAST-1);
 	//adding type strings to avoid memory trashing
 	//types names
@@ -143,20 +441,24 @@ void rabbit::SharedState::init()
 	_constructoridx = rabbit::String::create(this,"constructor");
 	_registry = rabbit::Table::create(this,0);
 	_consts = rabbit::Table::create(this,0);
-	_table_default_delegate = createDefaultDelegate(this,_table_default_delegate_funcz);
-	_array_default_delegate = createDefaultDelegate(this,_array_default_delegate_funcz);
-	_string_default_delegate = createDefaultDelegate(this,_string_default_delegate_funcz);
-	_number_default_delegate = createDefaultDelegate(this,_number_default_delegate_funcz);
-	_closure_default_delegate = createDefaultDelegate(this,_closure_default_delegate_funcz);
-	_generator_default_delegate = createDefaultDelegate(this,_generator_default_delegate_funcz);
-	_thread_default_delegate = createDefaultDelegate(this,_thread_default_delegate_funcz);
-	_class_default_delegate = createDefaultDelegate(this,_class_default_delegate_funcz);
-	_instance_default_delegate = createDefaultDelegate(this,_instance_default_delegate_funcz);
-	_weakref_default_delegate = createDefaultDelegate(this,_weakref_default_delegate_funcz);
+	_natives = rabbit::Table::create(this,0);
+	_cloneclasses = rabbit::Table::create(this,0);
+	_table_default_delegate = createDefaultDelegate(this,"table",_table_default_delegate_funcz);
+	_array_default_delegate = createDefaultDelegate(this,"array",_array_default_delegate_funcz);
+	_string_default_delegate = createDefaultDelegate(this,"string",_string_default_delegate_funcz);
+	_number_default_delegate = createDefaultDelegate(this,"number",_number_default_delegate_funcz);
+	_closure_default_delegate = createDefaultDelegate(this,"closure",_closure_default_delegate_funcz);
+	_generator_default_delegate = createDefaultDelegate(this,"generator",_generator_default_delegate_funcz);
+	_thread_default_delegate = createDefaultDelegate(this,"thread",_thread_default_delegate_funcz);
+	_class_default_delegate = createDefaultDelegate(this,"class",_class_default_delegate_funcz);
+	_instance_default_delegate = createDefaultDelegate(this,"instance",_instance_default_delegate_funcz);
+	_weakref_default_delegate = createDefaultDelegate(this,"weakref",_weakref_default_delegate_funcz);
 }
 
 rabbit::SharedState::~SharedState()
 {
+	//an incremental collection in progress is abandoned
+	gcCancel();
 	if(_releasehook) {
 		_releasehook(_foreignptr,0);
 		_releasehook = NULL;
@@ -164,9 +466,13 @@ rabbit::SharedState::~SharedState()
 	_constructoridx.Null();
 	_registry.toTable()->finalize();
 	_consts.toTable()->finalize();
+	_natives.toTable()->finalize();
+	_cloneclasses.toTable()->finalize();
 	_metamethodsmap.toTable()->finalize();
 	_registry.Null();
 	_consts.Null();
+	_natives.Null();
+	_cloneclasses.Null();
 	_metamethodsmap.Null();
 	while(!_systemstrings->empty()) {
 		_systemstrings->back().Null();
@@ -185,12 +491,20 @@ rabbit::SharedState::~SharedState()
 	_instance_default_delegate.Null();
 	_weakref_default_delegate.Null();
 	_refs_table.finalize();
+	//break the cycles still alive
+	finalizeChain();
+	assert(_gc_chain == NULL);
+	while(_gc_chain) {
+		_gc_chain->refCountIncrement();
+		_gc_chain->release();
+	}
+	__Objrelease(_rootshape);
 	using tmpType = etk::Vector<rabbit::ObjectPtr>;
-	sq_delete(_types, tmpType);
-	sq_delete(_systemstrings, tmpType);
-	sq_delete(_metamethods, tmpType);
-	sq_delete(_stringtable, StringTable);
-	if(_scratchpad)SQ_FREE(_scratchpad,_scratchpadsize);
+	sq_delete(this, rabbit::MEM_OTHER, _types, tmpType);
+	sq_delete(this, rabbit::MEM_OTHER, _systemstrings, tmpType);
+	sq_delete(this, rabbit::MEM_OTHER, _metamethods, tmpType);
+	sq_delete(this, rabbit::MEM_OTHER, _stringtable, StringTable);
+	if(_scratchpad)SQ_FREE(this, rabbit::MEM_OTHER, _scratchpad,_scratchpadsize);
 }
 
 
@@ -211,11 +525,11 @@ char* rabbit::SharedState::getScratchPad(int64_t size) {
 	if(size>0) {
 		if(_scratchpadsize < size) {
 			newsize = size + (size>>1);
-			_scratchpad = (char *)SQ_REALLOC(_scratchpad,_scratchpadsize,newsize);
+			_scratchpad = (char *)SQ_REALLOC(this, rabbit::MEM_OTHER, _scratchpad,_scratchpadsize,newsize);
 			_scratchpadsize = newsize;
 		} else if(_scratchpadsize >= (size<<5)) {
 			newsize = _scratchpadsize >> 1;
-			_scratchpad = (char *)SQ_REALLOC(_scratchpad,_scratchpadsize,newsize);
+			_scratchpad = (char *)SQ_REALLOC(this, rabbit::MEM_OTHER, _scratchpad,_scratchpadsize,newsize);
 			_scratchpadsize = newsize;
 		}
 	}
@@ -12,18 +12,118 @@
 #include <rabbit/sqconfig.hpp>
 #include <rabbit/RefTable.hpp>
 #include <rabbit/rabbit.hpp>
+#include <rabbit/Collectable.hpp>
+#include <rabbit/GcStats.hpp>
+#include <rabbit/Allocator.hpp>
+#include <rabbit/MemoryStats.hpp>
+#include <rabbit/sqopcodes.hpp>
+#include <rabbit/Instruction.hpp>
 
 namespace rabbit {
 	class StringTable;
 	class RegFunction;
+	class Shape;
 	class SharedState {
 		public:
-			SharedState();
+			//state of the incremental cycle collector
+			enum gcState {
+				GC_PAUSE, //!< no collection in progress
+				GC_PROPAGATE, //!< marking of the reachable objects, the write barrier is active
+				GC_SWEEP //!< finalization of the unreachable objects left in _gc_chain
+			};
+			SharedState(rabbit::Allocator *alloc);
 			~SharedState();
 			void init();
 		public:
 			char* getScratchPad(int64_t size);
+			uint64_t newCacheTag();
 			int64_t getMetaMethodIdxByName(const rabbit::ObjectPtr &name);
+			//registered native functions (see sq_bindnative), the heap snapshots refer to them by their key "scope.name".
+			//a function registered with several keys is written with the first one, all of them are found by getNative().
+			//false when the key is already given to another function
+			bool bindNative(const char *scope, const char *name, SQFUNCTION func);
+			bool getNativeName(SQFUNCTION func, rabbit::ObjectPtr &name);
+			SQFUNCTION getNative(const rabbit::ObjectPtr &name);
+			rabbit::Allocator *_alloc; //!< memory of the objects of this state, not the etk::Vector buffers (declared before _refs_table that allocates in its constructor)
+			rabbit::MemoryStats _mem_stats;
+			bool _mem_exceeded; //!< an allocation crossed _mem_threshold, the VM raises an error at its next check
+			int64_t _mem_threshold; //!< _mem_stats.limit, plus a reserve for the error handlers once the limit error is raised
+			//accounted allocations (see SQ_MALLOC)
+			void memAccount(rabbit::MemoryType type, int64_t delta) {
+				_mem_stats.used += delta;
+				_mem_stats.typeused[type] += delta;
+				if(delta > 0) {
+					if(_mem_stats.used > _mem_stats.peak) {
+						_mem_stats.peak = _mem_stats.used;
+					}
+					if(_mem_stats.typeused[type] > _mem_stats.typepeak[type]) {
+						_mem_stats.typepeak[type] = _mem_stats.typeused[type];
+					}
+					if(    _mem_stats.limit != 0
+					    && _mem_stats.used > _mem_threshold) {
+						_mem_exceeded = true;
+					}
+				} else if(    _mem_threshold != _mem_stats.limit
+				           && _mem_stats.used <= _mem_stats.limit - (_mem_stats.limit >> 3)) {
+					_mem_threshold = _mem_stats.limit;
+				}
+			}
+			//the bytes are accounted once the allocator succeeded, a failure is fatal (see memExhausted)
+			void* memAlloc(rabbit::MemoryType type, uint64_t size) {
+				void *p = _alloc->malloc(size);
+				if(    p == NULL
+				    && size != 0) {
+					memExhausted(type, size);
+				}
+				memAccount(type, size);
+				return p;
+			}
+			void* memRealloc(rabbit::MemoryType type, void *p, uint64_t oldsize, uint64_t size) {
+				void *np = _alloc->realloc(p, oldsize, size);
+				if(    np == NULL
+				    && size != 0) {
+					memExhausted(type, size);
+				}
+				memAccount(type, (int64_t)size - (int64_t)oldsize);
+				return np;
+			}
+			//the allocator can not give 'size' bytes: the callers construct the objects in place and have no error path,
+			//the failure is reported on stderr and the process is aborted
+			[[noreturn]] void memExhausted(rabbit::MemoryType type, uint64_t size);
+			void memFree(rabbit::MemoryType type, void *p, uint64_t size) {
+				memAccount(type, -(int64_t)size);
+				_alloc->free(p, size);
+			}
+			//safe point of the VM: true when the memory limit is still crossed since the last allocation that exceeded it.
+			//the scripts get an extra eighth of the limit to handle the error, until the usage is an eighth under the limit
+			bool memLimitReached() {
+				_mem_exceeded = false;
+				if(    _mem_stats.limit == 0
+				    || _mem_stats.used <= _mem_threshold) {
+					return false;
+				}
+				_mem_threshold = _mem_stats.limit + (_mem_stats.limit >> 3);
+				return true;
+			}
+			//false when 'size' more bytes would cross the memory limit
+			bool memAvailable(int64_t size) const {
+				return    _mem_stats.limit == 0
+				       || _mem_stats.used + size <= _mem_threshold;
+			}
+			//cycle collector: return the number of unreachable objects (collected or resurrected)
+			int64_t collectGarbage(rabbit::VirtualMachine *vm);
+			int64_t resurrectUnreachable(rabbit::VirtualMachine *vm);
+			//incremental collection: work for about 'budget_us' microseconds (a negative budget completes the cycle)
+			//return true when a cycle is completed
+			bool gcStep(rabbit::VirtualMachine *vm, int64_t budget_us);
+			//a reference to 'c' is stored: during the mark it can not stay white (Dijkstra insertion barrier)
+			void gcBarrier(rabbit::Collectable *c) {
+				if(    _gc_state == GC_PROPAGATE
+				    && c->_gcmark != _gc_epoch) {
+					c->setReachable(&_gc_marked);
+				}
+			}
+			static void markObject(const rabbit::Object &o, rabbit::Collectable **chain);
 			etk::Vector<rabbit::ObjectPtr> *_metamethods;
 			rabbit::ObjectPtr _metamethodsmap;
 			etk::Vector<rabbit::ObjectPtr> *_systemstrings;
@@ -32,6 +132,8 @@ namespace rabbit {
 			RefTable _refs_table;
 			rabbit::ObjectPtr _registry;
 			rabbit::ObjectPtr _consts;
+			rabbit::ObjectPtr _natives; //!< name -> function (as a user pointer) and function -> name, see bindNative()
+			rabbit::ObjectPtr _cloneclasses; //!< name -> [class, write hook, read hook] and class -> name, see sq_registercloneclass()
 			rabbit::ObjectPtr _constructoridx;
 			rabbit::ObjectPtr _root_vm;
 			rabbit::ObjectPtr _table_default_delegate;
@@ -59,10 +161,31 @@ namespace rabbit {
 			SQPRINTFUNCTION _printfunc;
 			SQPRINTFUNCTION _errorfunc;
 			bool _debuginfo;
+			bool _optimizebytecode; //!< run the peephole pass of FuncState::optimize on the compiled functions
+			bool _superinstructions; //!< let the peephole pass fuse the frequent instruction pairs (off by default)
+#ifdef SQ_PROFILE_OPCODES
+			uint64_t _opcodecounts[SQ_OPCODE_COUNT]; //!< number of executions of each opcode
+			uint64_t _opcodepairs[SQ_OPCODE_COUNT][SQ_OPCODE_COUNT]; //!< number of executions of an instruction right after the previous one of the function
+			const rabbit::Instruction *_opcodeprev; //!< last executed instruction
+#endif
 			bool _notifyallexceptions;
 			rabbit::UserPointer _foreignptr;
 			SQRELEASEHOOK _releasehook;
+			uint64_t _cachetag; //!< last tag given to a class layout (inline caches)
+			rabbit::Shape *_rootshape; //!< empty shape, root of the table shape transitions
+			rabbit::Collectable *_gc_chain; //!< all the objects that can be part of a reference cycle (not marked yet during a cycle)
+			rabbit::Collectable *_gc_marked; //!< objects marked or created during the current cycle
+			etk::Vector<rabbit::Collectable*> _gc_gray; //!< reachable objects whose references are not marked yet (one reference held)
+			gcState _gc_state;
+			uint8_t _gc_epoch; //!< value of Collectable::_gcmark for the marked objects
+			rabbit::GcStats _gc_stats;
 		private:
+			void gcStart(rabbit::VirtualMachine *vm);
+			void gcPropagate();
+			void gcAtomic(rabbit::VirtualMachine *vm);
+			void gcSweep();
+			void gcCancel();
+			void finalizeChain();
 			char *_scratchpad;
 			int64_t _scratchpadsize;
 	};
@@ -0,0 +1,835 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#include <rabbit/Snapshot.hpp>
+#include <rabbit/VirtualMachine.hpp>
+#include <rabbit/SharedState.hpp>
+#include <rabbit/FunctionProto.hpp>
+#include <rabbit/Closure.hpp>
+#include <rabbit/NativeClosure.hpp>
+#include <rabbit/Outer.hpp>
+#include <rabbit/Table.hpp>
+#include <rabbit/Array.hpp>
+#include <rabbit/Class.hpp>
+#include <rabbit/Instance.hpp>
+#include <rabbit/String.hpp>
+#include <rabbit/WeakRef.hpp>
+#include <rabbit/squtils.hpp>
+#include <rabbit/sqopcodes.hpp>
+#include <etk/Vector.hpp>
+
+namespace {
+	// layout of a snapshot: header, number of objects, the creation data of each object (the objects needed to create
+	// another one come first), the content of each object, then the root table, the registry and the const table.
+	enum SnapshotValue {
+		SNAPSHOT_SCALAR, //!< null, bool, integer or float (see rabbit::writeObject)
+		SNAPSHOT_STRING, //!< first use of a string: length and characters
+		SNAPSHOT_STRINGREF, //!< index of a string already read
+		SNAPSHOT_OBJECT, //!< index of an object
+		SNAPSHOT_WEAKREF, //!< weak reference, followed by its target
+		SNAPSHOT_EXTERN //!< object of the host (user data, instance holding native data), by its key in the root table or the registry
+	};
+	enum SnapshotExtern {
+		SNAPSHOT_EXTERN_ROOT,
+		SNAPSHOT_EXTERN_REGISTRY
+	};
+
+	// the counts read before their elements only preallocate up to this number of elements, the containers grow while
+	// the elements are read: a corrupted count ends on the end of the stream instead of a huge allocation
+	const int64_t s_maxPrealloc = 4096;
+	// largest number of fields of a class (index part of the member values, see _member_idx)
+	const int64_t s_maxFields = 0x00FFFFFF + 1;
+
+	class SnapshotWriter {
+		public:
+			SnapshotWriter(rabbit::VirtualMachine *v, SQWRITEFUNC write, rabbit::UserPointer up) :
+			  _vm(v),
+			  _write(write),
+			  _up(up),
+			  _collect(true),
+			  _nstrings(0),
+			  _nprotos(0) {
+				_index = rabbit::Table::create(v->_sharedstate, 0);
+				_strings = rabbit::Table::create(v->_sharedstate, 0);
+				_protos = rabbit::Table::create(v->_sharedstate, 0);
+			}
+			bool run(const rabbit::ObjectPtr *roots, int64_t nroots) {
+				//first pass: number the objects
+				for(int64_t i = 0; i < nroots; i++) {
+					_CHECK_IO(value(roots[i]));
+				}
+				for(uint64_t i = 0; i < _objects.size(); i++) {
+					rabbit::ObjectPtr o = _objects[i];
+					_CHECK_IO(content(o));
+				}
+				_collect = false;
+				_CHECK_IO(rabbit::writeTag(_vm, _write, _up, SQ_SNAPSHOT_TAG));
+				_CHECK_IO(rabbit::writeTag(_vm, _write, _up, SQ_SNAPSHOT_VERSION));
+				_CHECK_IO(rabbit::writeTag(_vm, _write, _up, SQ_CLOSURESTREAM_VERSION));
+				_CHECK_IO(rabbit::writeTag(_vm, _write, _up, SQ_OPCODE_COUNT));
+				_CHECK_IO(rabbit::writeTag(_vm, _write, _up, sizeof(char)));
+				_CHECK_IO(rabbit::writeTag(_vm, _write, _up, sizeof(int64_t)));
+				_CHECK_IO(rabbit::writeTag(_vm, _write, _up, sizeof(float_t)));
+				_CHECK_IO(rabbit::writeTag(_vm, _write, _up, sizeof(rabbit::Instruction)));
+				_CHECK_IO(integer((int64_t)_objects.size()));
+				for(uint64_t i = 0; i < _objects.size(); i++) {
+					_CHECK_IO(declare(_objects[i]));
+				}
+				for(uint64_t i = 0; i < _objects.size(); i++) {
+					_CHECK_IO(content(_objects[i]));
+				}
+				for(int64_t i = 0; i < nroots; i++) {
+					_CHECK_IO(value(roots[i]));
+				}
+				_CHECK_IO(rabbit::writeTag(_vm, _write, _up, SQ_SNAPSHOT_TAIL));
+				return true;
+			}
+		private:
+			//the first pass only walks the references
+			bool raw(const void *data, int64_t size) {
+				return    _collect
+				       || rabbit::safeWrite(_vm, _write, _up, (rabbit::UserPointer)data, size);
+			}
+			bool integer(int64_t val) {
+				return raw(&val, sizeof(val));
+			}
+			bool kind(SnapshotValue k) {
+				uint8_t val = (uint8_t)k;
+				return raw(&val, sizeof(val));
+			}
+			int64_t index(const rabbit::ObjectPtr &o) {
+				rabbit::ObjectPtr idx;
+				_index.toTable()->get(o, idx);
+				return idx.toInteger();
+			}
+			//number 'o' after the objects needed to create it
+			bool add(rabbit::ObjectPtr o) {
+				rabbit::ObjectPtr idx;
+				if(_index.toTable()->get(o, idx)) {
+					return true;
+				}
+				switch(o.getType()) {
+					case rabbit::OT_CLASS:
+						if(o.toClass()->_hook) {
+							_vm->raise_error("cannot snapshot a class with a release hook");
+							return false;
+						}
+						if(o.toClass()->_base) {
+							_CHECK_IO(add(rabbit::ObjectPtr(o.toClass()->_base)));
+						}
+						break;
+					case rabbit::OT_INSTANCE:
+						_CHECK_IO(add(rabbit::ObjectPtr(o.toInstance()->_class)));
+						break;
+					case rabbit::OT_NATIVECLOSURE:
+						{
+							rabbit::NativeClosure *nc = o.toNativeClosure();
+							rabbit::ObjectPtr name;
+							if(!_vm->_sharedstate->getNativeName(nc->_function, name)) {
+								_vm->raise_error("cannot snapshot the native closure '%s', its function has no registered key (see sq_bindnative)",
+								                 nc->_name.isString()?nc->_name.getStringValue():"unknown");
+								return false;
+							}
+						}
+						break;
+					default:
+						break;
+				}
+				_index.toTable()->newSlot(o, (int64_t)_objects.size());
+				_objects.pushBack(o);
+				return true;
+			}
+			//user data and instances of native classes are not written, they are found again by their key
+			bool isExtern(rabbit::ObjectPtr o) {
+				if(o.isUserData()) {
+					return true;
+				}
+				if(o.isInstance()) {
+					rabbit::Instance *inst = o.toInstance();
+					return    inst->_userpointer != NULL
+					       || inst->_hook != NULL
+					       || inst->_class->_udsize != 0;
+				}
+				return false;
+			}
+			bool externKey(const rabbit::ObjectPtr &table, const rabbit::ObjectPtr &o, rabbit::ObjectPtr &outkey) {
+				rabbit::ObjectPtr refpos, key, val;
+				int64_t idx;
+				while((idx = table.toTable()->next(false, refpos, key, val)) != -1) {
+					if(    val.getType() == o.getType()
+					    && val.toRefCounted() == o.toRefCounted()) {
+						outkey = key;
+						return true;
+					}
+					refpos = idx;
+				}
+				return false;
+			}
+			bool writeExtern(const rabbit::ObjectPtr &o) {
+				rabbit::ObjectPtr key;
+				int64_t where = SNAPSHOT_EXTERN_ROOT;
+				if(!externKey(_vm->_roottable, o, key)) {
+					where = SNAPSHOT_EXTERN_REGISTRY;
+					if(!externKey(_vm->_sharedstate->_registry, o, key)) {
+						_vm->raise_error("cannot snapshot the native data of a %s that is not in the root table or the registry", getTypeName(o));
+						return false;
+					}
+				}
+				_CHECK_IO(kind(SNAPSHOT_EXTERN));
+				_CHECK_IO(integer(where));
+				return value(key);
+			}
+			bool value(const rabbit::ObjectPtr &o) {
+				switch(o.getType()) {
+					case rabbit::OT_NULL:
+					case rabbit::OT_BOOL:
+					case rabbit::OT_INTEGER:
+					case rabbit::OT_FLOAT:
+						if(_collect) {
+							return true;
+						}
+						_CHECK_IO(kind(SNAPSHOT_SCALAR));
+						return rabbit::writeObject(_vm, _up, _write, o);
+					case rabbit::OT_STRING:
+						{
+							if(_collect) {
+								return true;
+							}
+							rabbit::ObjectPtr idx;
+							if(_strings.toTable()->get(o, idx)) {
+								_CHECK_IO(kind(SNAPSHOT_STRINGREF));
+								return integer(idx.toInteger());
+							}
+							_strings.toTable()->newSlot(o, _nstrings++);
+							_CHECK_IO(kind(SNAPSHOT_STRING));
+							_CHECK_IO(integer(o.toString()->_len));
+							return raw(o.getStringValue(), o.toString()->_len);
+						}
+					case rabbit::OT_WEAKREF:
+						_CHECK_IO(kind(SNAPSHOT_WEAKREF));
+						return value(o.toWeakRef()->_obj);
+					case rabbit::OT_USERDATA:
+					case rabbit::OT_INSTANCE:
+						if(isExtern(o)) {
+							return writeExtern(o);
+						}
+						//fallthrough
+					case rabbit::OT_TABLE:
+					case rabbit::OT_ARRAY:
+					case rabbit::OT_CLASS:
+					case rabbit::OT_CLOSURE:
+					case rabbit::OT_NATIVECLOSURE:
+					case rabbit::OT_OUTER:
+						if(_collect) {
+							return add(o);
+						}
+						_CHECK_IO(kind(SNAPSHOT_OBJECT));
+						return integer(index(o));
+					default:
+						_vm->raise_error("cannot snapshot a %s", getTypeName(o));
+						return false;
+				}
+			}
+			bool weak(rabbit::WeakRef *w) {
+				if(w == NULL) {
+					return value(rabbit::ObjectPtr());
+				}
+				return value(rabbit::ObjectPtr(w));
+			}
+			bool proto(rabbit::FunctionProto *f) {
+				rabbit::ObjectPtr key(f);
+				rabbit::ObjectPtr idx;
+				if(_protos.toTable()->get(key, idx)) {
+					return integer(idx.toInteger());
+				}
+				_protos.toTable()->newSlot(key, _nprotos);
+				_CHECK_IO(integer(_nprotos++));
+				return f->save(_vm, _up, _write);
+			}
+			bool members(const etk::Vector<rabbit::ClassMember> &vec, uint64_t n) {
+				for(uint64_t i = 0; i < n; i++) {
+					_CHECK_IO(value(vec[i].val));
+					_CHECK_IO(value(vec[i].attrs));
+				}
+				return true;
+			}
+			//data needed to create the object (second pass only)
+			bool declare(rabbit::ObjectPtr o) {
+				uint32_t type = (uint32_t)o.getType();
+				_CHECK_IO(raw(&type, sizeof(type)));
+				switch(o.getType()) {
+					case rabbit::OT_TABLE:
+						_CHECK_IO(integer(o.toTable()->isShaped()));
+						return integer(o.toTable()->countUsed());
+					case rabbit::OT_ARRAY:
+						return integer(o.toArray()->size());
+					case rabbit::OT_CLASS:
+						{
+							rabbit::Class *c = o.toClass();
+							int64_t base = -1;
+							if(c->_base) {
+								base = index(rabbit::ObjectPtr(c->_base));
+							}
+							_CHECK_IO(integer(base));
+							return integer(c->_defaultvalues.size());
+						}
+					case rabbit::OT_INSTANCE:
+						return integer(index(rabbit::ObjectPtr(o.toInstance()->_class)));
+					case rabbit::OT_CLOSURE:
+						return proto(o.toClosure()->_function);
+					case rabbit::OT_NATIVECLOSURE:
+						{
+							rabbit::NativeClosure *nc = o.toNativeClosure();
+							rabbit::ObjectPtr name;
+							_vm->_sharedstate->getNativeName(nc->_function, name);
+							_CHECK_IO(value(name));
+							return integer(nc->_noutervalues);
+						}
+					default:
+						return true;
+				}
+			}
+			//references held by the object
+			bool content(rabbit::ObjectPtr o) {
+				switch(o.getType()) {
+					case rabbit::OT_TABLE:
+						{
+							rabbit::Table *t = o.toTable();
+							rabbit::ObjectPtr delegate;
+							if(t->_delegate) {
+								delegate = t->_delegate;
+							}
+							_CHECK_IO(value(delegate));
+							_CHECK_IO(integer(t->countUsed()));
+							rabbit::ObjectPtr refpos, key, val;
+							int64_t idx;
+							while((idx = t->next(true, refpos, key, val)) != -1) {
+								_CHECK_IO(value(key));
+								_CHECK_IO(value(val));
+								refpos = idx;
+							}
+						}
+						break;
+					case rabbit::OT_ARRAY:
+						{
+							rabbit::Array *a = o.toArray();
+							for(int64_t i = 0; i < a->size(); i++) {
+								_CHECK_IO(value((*a)[i]));
+							}
+						}
+						break;
+					case rabbit::OT_CLASS:
+						{
+							rabbit::Class *c = o.toClass();
+							_CHECK_IO(integer(c->_members->countUsed()));
+							rabbit::ObjectPtr refpos, key, val;
+							int64_t idx;
+							while((idx = c->_members->next(false, refpos, key, val)) != -1) {
+								_CHECK_IO(value(key));
+								_CHECK_IO(integer(val.toInteger()));
+								refpos = idx;
+							}
+							_CHECK_IO(members(c->_defaultvalues, c->_defaultvalues.size()));
+							_CHECK_IO(integer(c->_methods.size()));
+							_CHECK_IO(members(c->_methods, c->_methods.size()));
+							for(int64_t i = 0; i < rabbit::MT_LAST; i++) {
+								_CHECK_IO(value(c->_metamethods[i]));
+							}
+							_CHECK_IO(value(c->_attributes));
+							//the type tags are identifiers chosen by the host (see sq_settypetag)
+							_CHECK_IO(integer((int64_t)(intptr_t)c->_typetag));
+							_CHECK_IO(integer(c->_locked));
+							_CHECK_IO(integer(c->_constructoridx));
+							_CHECK_IO(integer(c->_udsize));
+						}
+						break;
+					case rabbit::OT_INSTANCE:
+						{
+							rabbit::Instance *inst = o.toInstance();
+							for(uint64_t i = 0; i < inst->_class->_defaultvalues.size(); i++) {
+								_CHECK_IO(value(inst->_values[i]));
+							}
+						}
+						break;
+					case rabbit::OT_CLOSURE:
+						{
+							rabbit::Closure *c = o.toClosure();
+							_CHECK_IO(weak(c->_env));
+							_CHECK_IO(weak(c->_root));
+							rabbit::ObjectPtr base;
+							if(c->_base) {
+								base = c->_base;
+							}
+							_CHECK_IO(value(base));
+							for(int64_t i = 0; i < c->_function->_noutervalues; i++) {
+								_CHECK_IO(value(c->_outervalues[i]));
+							}
+							for(int64_t i = 0; i < c->_function->_ndefaultparams; i++) {
+								_CHECK_IO(value(c->_defaultparams[i]));
+							}
+						}
+						break;
+					case rabbit::OT_NATIVECLOSURE:
+						{
+							rabbit::NativeClosure *nc = o.toNativeClosure();
+							_CHECK_IO(integer(nc->_nparamscheck));
+							_CHECK_IO(integer(nc->_typecheck.size()));
+							for(uint64_t i = 0; i < nc->_typecheck.size(); i++) {
+								_CHECK_IO(integer(nc->_typecheck[i]));
+							}
+							_CHECK_IO(weak(nc->_env));
+							_CHECK_IO(value(nc->_name));
+							for(uint64_t i = 0; i < nc->_noutervalues; i++) {
+								_CHECK_IO(value(nc->_outervalues[i]));
+							}
+						}
+						break;
+					case rabbit::OT_OUTER:
+						//an open outer gives the current value of its local
+						_CHECK_IO(value(*o.toOuter()->_valptr));
+						break;
+					default:
+						break;
+				}
+				return true;
+			}
+			rabbit::VirtualMachine *_vm;
+			SQWRITEFUNC _write;
+			rabbit::UserPointer _up;
+			bool _collect; //!< first pass: number the objects without writing
+			etk::Vector<rabbit::ObjectPtr> _objects;
+			rabbit::ObjectPtr _index; //!< object -> index in _objects
+			rabbit::ObjectPtr _strings; //!< string -> index
+			int64_t _nstrings;
+			rabbit::ObjectPtr _protos; //!< function proto -> index
+			int64_t _nprotos;
+	};
+
+	class SnapshotReader {
+		public:
+			SnapshotReader(rabbit::VirtualMachine *v, SQREADFUNC read, rabbit::UserPointer up) :
+			  _vm(v),
+			  _ss(v->_sharedstate),
+			  _read(read),
+			  _up(up) {
+
+			}
+			bool run() {
+				_CHECK_IO(rabbit::checkTag(_vm, _read, _up, SQ_SNAPSHOT_TAG));
+				uint32_t version;
+				_CHECK_IO(rabbit::safeRead(_vm, _read, _up, &version, sizeof(version)));
+				if(version != SQ_SNAPSHOT_VERSION) {
+					_vm->raise_error("snapshot version %d, expected %d", (int)version, (int)SQ_SNAPSHOT_VERSION);
+					return false;
+				}
+				_CHECK_IO(rabbit::safeRead(_vm, _read, _up, &version, sizeof(version)));
+				if(version != SQ_CLOSURESTREAM_VERSION) {
+					_vm->raise_error("bytecode stream version %d, expected %d", (int)version, (int)SQ_CLOSURESTREAM_VERSION);
+					return false;
+				}
+				_CHECK_IO(rabbit::checkTag(_vm, _read, _up, SQ_OPCODE_COUNT));
+				_CHECK_IO(rabbit::checkTag(_vm, _read, _up, sizeof(char)));
+				_CHECK_IO(rabbit::checkTag(_vm, _read, _up, sizeof(int64_t)));
+				_CHECK_IO(rabbit::checkTag(_vm, _read, _up, sizeof(float_t)));
+				_CHECK_IO(rabbit::checkTag(_vm, _read, _up, sizeof(rabbit::Instruction)));
+				int64_t nobjects;
+				_CHECK_IO(count(nobjects));
+				for(int64_t i = 0; i < nobjects; i++) {
+					rabbit::ObjectPtr o;
+					int64_t size = 0;
+					_CHECK_IO(declare(o, size));
+					_objects.pushBack(o);
+					_sizes.pushBack(size);
+				}
+				for(int64_t i = 0; i < nobjects; i++) {
+					_CHECK_IO(content(_objects[i], _sizes[i]));
+				}
+				rabbit::ObjectPtr root, registry, consts;
+				_CHECK_IO(value(root));
+				_CHECK_IO(value(registry));
+				_CHECK_IO(value(consts));
+				if(    !root.isTable()
+				    || !registry.isTable()
+				    || !consts.isTable()) {
+					return corrupted();
+				}
+				_CHECK_IO(rabbit::checkTag(_vm, _read, _up, SQ_SNAPSHOT_TAIL));
+				_vm->_roottable = root;
+				_ss->_registry = registry;
+				_ss->_consts = consts;
+				return true;
+			}
+		private:
+			bool corrupted() {
+				_vm->raise_error("invalid or corrupted snapshot");
+				return false;
+			}
+			bool integer(int64_t &val) {
+				return rabbit::safeRead(_vm, _read, _up, &val, sizeof(val));
+			}
+			bool count(int64_t &val) {
+				_CHECK_IO(integer(val));
+				if(val < 0) {
+					return corrupted();
+				}
+				return true;
+			}
+			bool value(rabbit::ObjectPtr &o) {
+				uint8_t k;
+				_CHECK_IO(rabbit::safeRead(_vm, _read, _up, &k, sizeof(k)));
+				switch(k) {
+					case SNAPSHOT_SCALAR:
+						_CHECK_IO(rabbit::readObject(_vm, _up, _read, o));
+						if(o.isString()) {
+							return corrupted();
+						}
+						return true;
+					case SNAPSHOT_STRING:
+						{
+							int64_t len;
+							_CHECK_IO(count(len));
+							_CHECK_IO(rabbit::readString(_vm, _up, _read, len, o));
+							_strings.pushBack(o);
+						}
+						return true;
+					case SNAPSHOT_STRINGREF:
+						{
+							int64_t idx;
+							_CHECK_IO(integer(idx));
+							if(idx < 0 || idx >= (int64_t)_strings.size()) {
+								return corrupted();
+							}
+							o = _strings[idx];
+						}
+						return true;
+					case SNAPSHOT_OBJECT:
+						{
+							int64_t idx;
+							_CHECK_IO(integer(idx));
+							if(idx < 0 || idx >= (int64_t)_objects.size()) {
+								return corrupted();
+							}
+							o = _objects[idx];
+						}
+						return true;
+					case SNAPSHOT_WEAKREF:
+						_CHECK_IO(value(o));
+						if(o.isRefCounted()) {
+							o = o.toRefCounted()->getWeakRef(_ss, o.getType());
+						}
+						return true;
+					case SNAPSHOT_EXTERN:
+						{
+							int64_t where;
+							rabbit::ObjectPtr key;
+							_CHECK_IO(integer(where));
+							_CHECK_IO(value(key));
+							rabbit::ObjectPtr table = where == SNAPSHOT_EXTERN_ROOT?_vm->_roottable:_ss->_registry;
+							if(    key.isNull()
+							    || !table.toTable()->get(key, o)) {
+								_vm->raise_error("the native object '%s' of the snapshot does not exist", key.isString()?key.getStringValue():"?");
+								return false;
+							}
+						}
+						return true;
+					default:
+						return corrupted();
+				}
+			}
+			bool typed(rabbit::ObjectPtr &o, rabbit::ObjectType type) {
+				_CHECK_IO(value(o));
+				if(o.getType() != type) {
+					return corrupted();
+				}
+				return true;
+			}
+			//weak reference or null
+			bool weak(rabbit::ObjectPtr &o) {
+				_CHECK_IO(value(o));
+				if(    !o.isNull()
+				    && !o.isWeakRef()) {
+					return corrupted();
+				}
+				return true;
+			}
+			bool env(rabbit::WeakRef *&env) {
+				rabbit::ObjectPtr o;
+				_CHECK_IO(weak(o));
+				rabbit::WeakRef *w = o.isNull()?NULL:o.toWeakRef();
+				if(w) {
+					__ObjaddRef(w);
+				}
+				__Objrelease(env);
+				env = w;
+				return true;
+			}
+			bool declared(int64_t idx, rabbit::ObjectType type, rabbit::ObjectPtr &o) {
+				if(    idx < 0
+				    || idx >= (int64_t)_objects.size()
+				    || _objects[idx].getType() != type) {
+					return corrupted();
+				}
+				o = _objects[idx];
+				return true;
+			}
+			bool members(etk::Vector<rabbit::ClassMember> &vec) {
+				for(uint64_t i = 0; i < vec.size(); i++) {
+					_CHECK_IO(value(vec[i].val));
+					_CHECK_IO(value(vec[i].attrs));
+				}
+				return true;
+			}
+			//'size' receives the number of elements of an array, they are appended by content()
+			bool declare(rabbit::ObjectPtr &o, int64_t &size) {
+				uint32_t type;
+				_CHECK_IO(rabbit::safeRead(_vm, _read, _up, &type, sizeof(type)));
+				switch((rabbit::ObjectType)type) {
+					case rabbit::OT_TABLE:
+						{
+							int64_t shaped;
+							_CHECK_IO(integer(shaped));
+							_CHECK_IO(count(size));
+							if(size > s_maxPrealloc) {
+								size = s_maxPrealloc;
+							}
+							o = shaped?rabbit::Table::createShaped(_ss, size):rabbit::Table::create(_ss, size);
+							size = 0;
+						}
+						return true;
+					case rabbit::OT_ARRAY:
+						{
+							_CHECK_IO(count(size));
+							o = rabbit::Array::create(_ss, 0);
+						}
+						return true;
+					case rabbit::OT_CLASS:
+						{
+							int64_t base, nfields;
+							rabbit::ObjectPtr baseclass;
+							_CHECK_IO(integer(base));
+							if(base != -1) {
+								_CHECK_IO(declared(base, rabbit::OT_CLASS, baseclass));
+							}
+							_CHECK_IO(count(nfields));
+							if(nfields > s_maxFields) {
+								return corrupted();
+							}
+							rabbit::Class *c = rabbit::Class::create(_ss, base != -1?baseclass.toClass():NULL);
+							o = c;
+							//the instances are created before the content of their class is read
+							c->_defaultvalues.resize(nfields);
+						}
+						return true;
+					case rabbit::OT_INSTANCE:
+						{
+							int64_t cls;
+							rabbit::ObjectPtr theclass;
+							_CHECK_IO(integer(cls));
+							_CHECK_IO(declared(cls, rabbit::OT_CLASS, theclass));
+							o = rabbit::Instance::create(_ss, theclass.toClass());
+						}
+						return true;
+					case rabbit::OT_CLOSURE:
+						{
+							int64_t idx;
+							_CHECK_IO(integer(idx));
+							if(idx == (int64_t)_protos.size()) {
+								rabbit::ObjectPtr func;
+								_CHECK_IO(rabbit::FunctionProto::load(_vm, _up, _read, func));
+								_protos.pushBack(func);
+							} else if(idx < 0 || idx > (int64_t)_protos.size()) {
+								return corrupted();
+							}
+							//the root is read with the content of the closure
+							o = rabbit::Closure::create(_ss, _protos[idx].toFunctionProto(), _vm->_roottable.toTable()->getWeakRef(_ss, rabbit::OT_TABLE));
+						}
+						return true;
+					case rabbit::OT_NATIVECLOSURE:
+						{
+							rabbit::ObjectPtr name;
+							int64_t nouters;
+							_CHECK_IO(typed(name, rabbit::OT_STRING));
+							_CHECK_IO(count(nouters));
+							//the free variables of sq_newclosure come from the stack
+							if(nouters > SQ_STACK_RESERVE) {
+								return corrupted();
+							}
+							SQFUNCTION func = _ss->getNative(name);
+							if(func == NULL) {
+								_vm->raise_error("the native function '%s' of the snapshot is not registered", name.getStringValue());
+								return false;
+							}
+							o = rabbit::NativeClosure::create(_ss, func, nouters);
+						}
+						return true;
+					case rabbit::OT_OUTER:
+						{
+							rabbit::Outer *outer = rabbit::Outer::create(_ss, NULL);
+							outer->_valptr = &outer->_value;
+							o = outer;
+						}
+						return true;
+					default:
+						return corrupted();
+				}
+			}
+			bool content(rabbit::ObjectPtr &o, int64_t size) {
+				switch(o.getType()) {
+					case rabbit::OT_TABLE:
+						{
+							rabbit::Table *t = o.toTable();
+							rabbit::ObjectPtr delegate;
+							_CHECK_IO(value(delegate));
+							if(delegate.isTable()) {
+								if(!t->setDelegate(delegate.toTable())) {
+									return corrupted();
+								}
+							} else if(!delegate.isNull()) {
+								return corrupted();
+							}
+							_CHECK_IO(count(size));
+							for(int64_t i = 0; i < size; i++) {
+								rabbit::ObjectPtr key, val;
+								_CHECK_IO(value(key));
+								_CHECK_IO(value(val));
+								if(key.isNull()) {
+									return corrupted();
+								}
+								t->newSlot(key, val);
+							}
+						}
+						return true;
+					case rabbit::OT_ARRAY:
+						{
+							rabbit::Array *a = o.toArray();
+							for(int64_t i = 0; i < size; i++) {
+								rabbit::ObjectPtr val;
+								_CHECK_IO(value(val));
+								a->append(val);
+							}
+						}
+						return true;
+					case rabbit::OT_CLASS:
+						{
+							rabbit::Class *c = o.toClass();
+							_CHECK_IO(count(size));
+							for(int64_t i = 0; i < size; i++) {
+								rabbit::ObjectPtr key;
+								int64_t member;
+								_CHECK_IO(value(key));
+								_CHECK_IO(integer(member));
+								if(key.isNull()) {
+									return corrupted();
+								}
+								c->_members->newSlot(key, rabbit::ObjectPtr(member));
+							}
+							_CHECK_IO(members(c->_defaultvalues));
+							_CHECK_IO(count(size));
+							for(int64_t i = 0; i < size; i++) {
+								rabbit::ClassMember method;
+								_CHECK_IO(value(method.val));
+								_CHECK_IO(value(method.attrs));
+								c->_methods.pushBack(method);
+							}
+							for(int64_t i = 0; i < rabbit::MT_LAST; i++) {
+								_CHECK_IO(value(c->_metamethods[i]));
+							}
+							_CHECK_IO(value(c->_attributes));
+							int64_t typetag, locked;
+							_CHECK_IO(integer(typetag));
+							c->_typetag = (rabbit::UserPointer)(intptr_t)typetag;
+							_CHECK_IO(integer(locked));
+							c->_locked = locked != 0;
+							_CHECK_IO(integer(c->_constructoridx));
+							if(c->_constructoridx >= (int64_t)c->_methods.size()) {
+								return corrupted();
+							}
+							_CHECK_IO(count(c->_udsize));
+						}
+						return true;
+					case rabbit::OT_INSTANCE:
+						{
+							rabbit::Instance *inst = o.toInstance();
+							for(uint64_t i = 0; i < inst->_class->_defaultvalues.size(); i++) {
+								_CHECK_IO(value(inst->_values[i]));
+							}
+						}
+						return true;
+					case rabbit::OT_CLOSURE:
+						{
+							rabbit::Closure *c = o.toClosure();
+							rabbit::ObjectPtr base;
+							rabbit::ObjectPtr root;
+							_CHECK_IO(env(c->_env));
+							_CHECK_IO(weak(root));
+							if(!root.isNull()) {
+								c->setRoot(root.toWeakRef());
+							}
+							_CHECK_IO(value(base));
+							if(base.isClass()) {
+								c->_base = base.toClass();
+								__ObjaddRef(c->_base);
+								_ss->gcBarrier(c->_base);
+							} else if(!base.isNull()) {
+								return corrupted();
+							}
+							for(int64_t i = 0; i < c->_function->_noutervalues; i++) {
+								_CHECK_IO(value(c->_outervalues[i]));
+							}
+							for(int64_t i = 0; i < c->_function->_ndefaultparams; i++) {
+								_CHECK_IO(value(c->_defaultparams[i]));
+							}
+						}
+						return true;
+					case rabbit::OT_NATIVECLOSURE:
+						{
+							rabbit::NativeClosure *nc = o.toNativeClosure();
+							_CHECK_IO(integer(nc->_nparamscheck));
+							_CHECK_IO(count(size));
+							for(int64_t i = 0; i < size; i++) {
+								int64_t mask;
+								_CHECK_IO(integer(mask));
+								nc->_typecheck.pushBack(mask);
+							}
+							_CHECK_IO(env(nc->_env));
+							_CHECK_IO(value(nc->_name));
+							for(uint64_t i = 0; i < nc->_noutervalues; i++) {
+								_CHECK_IO(value(nc->_outervalues[i]));
+							}
+						}
+						return true;
+					case rabbit::OT_OUTER:
+						return value(o.toOuter()->_value);
+					default:
+						return corrupted();
+				}
+			}
+			rabbit::VirtualMachine *_vm;
+			rabbit::SharedState *_ss;
+			SQREADFUNC _read;
+			rabbit::UserPointer _up;
+			etk::Vector<rabbit::ObjectPtr> _objects;
+			etk::Vector<int64_t> _sizes; //!< number of elements of each array of _objects
+			etk::Vector<rabbit::ObjectPtr> _strings;
+			etk::Vector<rabbit::ObjectPtr> _protos;
+	};
+}
+
+bool rabbit::Snapshot::write(rabbit::VirtualMachine *v, SQWRITEFUNC write, rabbit::UserPointer up) {
+	rabbit::ObjectPtr roots[] = {
+		v->_roottable,
+		v->_sharedstate->_registry,
+		v->_sharedstate->_consts
+	};
+	SnapshotWriter writer(v, write, up);
+	return writer.run(roots, sizeof(roots)/sizeof(roots[0]));
+}
+
+bool rabbit::Snapshot::read(rabbit::VirtualMachine *v, SQREADFUNC read, rabbit::UserPointer up) {
+	SnapshotReader reader(v, read, up);
+	return reader.run();
+}
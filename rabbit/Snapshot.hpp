@@ -0,0 +1,36 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <etk/types.hpp>
+#include <rabbit/rabbit.hpp>
+
+// first 4 bytes of a heap snapshot (see sq_writesnapshot)
+#define SQ_SNAPSHOT_TAG (('R'<<24)|('B'<<16)|('S'<<8)|('N'))
+#define SQ_SNAPSHOT_TAIL (('S'<<24)|('N'<<16)|('E'<<8)|('D'))
+//format of the snapshots, the functions inside also depend on SQ_CLOSURESTREAM_VERSION
+#define SQ_SNAPSHOT_VERSION 2
+
+namespace rabbit {
+	/**
+	 * @brief Heap snapshot: the root table of a VM, the registry and the const table with every object they reach
+	 * (tables, arrays, classes, instances, closures with their functions and outers, strings), to restore an
+	 * initialized state without running its startup scripts again.
+	 * The native closures are written by the key their function is registered with (see sq_bindnative), the state
+	 * that reads the snapshot must have registered the same keys (same std libraries), they are bound to its functions.
+	 * User data, user pointers, generators, threads and instances holding native data can not be part of a snapshot
+	 * (their addresses are only valid in the process that wrote it), the type tags of the classes are written as their
+	 * values.
+	 */
+	class Snapshot {
+		public:
+			static bool write(rabbit::VirtualMachine *v, SQWRITEFUNC write, rabbit::UserPointer up);
+			//replace the root table of 'v', the registry and the const table by the ones of the snapshot
+			static bool read(rabbit::VirtualMachine *v, SQREADFUNC read, rabbit::UserPointer up);
+	};
+}
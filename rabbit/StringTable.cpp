@@ -23,14 +23,14 @@ rabbit::StringTable::StringTable(rabbit::SharedState *ss)
 
 rabbit::StringTable::~StringTable()
 {
-	SQ_FREE(_strings,sizeof(rabbit::String*)*_numofslots);
+	SQ_FREE(_sharedstate, rabbit::MEM_STRING, _strings,sizeof(rabbit::String*)*_numofslots);
 	_strings = NULL;
 }
 
 void rabbit::StringTable::allocNodes(int64_t size)
 {
 	_numofslots = size;
-	_strings = (rabbit::String**)SQ_MALLOC(sizeof(rabbit::String*)*_numofslots);
+	_strings = (rabbit::String**)SQ_MALLOC(_sharedstate, rabbit::MEM_STRING, sizeof(rabbit::String*)*_numofslots);
 	memset(_strings,0,sizeof(rabbit::String*)*_numofslots);
 }
 
@@ -46,7 +46,7 @@ rabbit::String *rabbit::StringTable::add(const char *news,int64_t len)
 			return s; //found
 	}
 
-	rabbit::String *t = (rabbit::String *)SQ_MALLOC(sq_rsl(len)+sizeof(rabbit::String));
+	rabbit::String *t = (rabbit::String *)SQ_MALLOC(_sharedstate, rabbit::MEM_STRING, sq_rsl(len)+sizeof(rabbit::String));
 	new ((char*)t) rabbit::String;
 	t->_sharedstate = _sharedstate;
 	memcpy(t->_val,news,sq_rsl(len));
@@ -76,7 +76,7 @@ void rabbit::StringTable::resize(int64_t size)
 			p = next;
 		}
 	}
-	SQ_FREE(oldtable,oldsize*sizeof(rabbit::String*));
+	SQ_FREE(_sharedstate, rabbit::MEM_STRING, oldtable,oldsize*sizeof(rabbit::String*));
 }
 
 void rabbit::StringTable::remove(rabbit::String *bs)
@@ -94,7 +94,7 @@ void rabbit::StringTable::remove(rabbit::String *bs)
 			_slotused--;
 			int64_t slen = s->_len;
 			s->~String();
-			SQ_FREE(s,sizeof(rabbit::String) + sq_rsl(slen));
+			SQ_FREE(_sharedstate, rabbit::MEM_STRING, s,sizeof(rabbit::String) + sq_rsl(slen));
 			return;
 		}
 		prev = s;
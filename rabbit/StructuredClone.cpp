@@ -0,0 +1,591 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#include <rabbit/StructuredClone.hpp>
+#include <rabbit/VirtualMachine.hpp>
+#include <rabbit/SharedState.hpp>
+#include <rabbit/Closure.hpp>
+#include <rabbit/Table.hpp>
+#include <rabbit/Array.hpp>
+#include <rabbit/Class.hpp>
+#include <rabbit/Instance.hpp>
+#include <rabbit/String.hpp>
+#include <rabbit/squtils.hpp>
+#include <etk/Vector.hpp>
+
+namespace {
+	enum CloneValue {
+		CLONE_NULL,
+		CLONE_TRUE,
+		CLONE_FALSE,
+		CLONE_INTEGER, //!< zigzag varint
+		CLONE_FLOAT, //!< raw float_t
+		CLONE_STRING, //!< first use of a string: varint length and characters
+		CLONE_STRINGREF, //!< varint index of a string already read
+		CLONE_OBJECTREF, //!< varint index of an object already read
+		CLONE_TABLE, //!< varint (number of slots << 1 | shaped), the content follows the root value
+		CLONE_ARRAY, //!< varint size, the content follows the root value
+		CLONE_INSTANCE //!< name of the class (a string value), the content follows the root value
+	};
+	// entry of SharedState::_cloneclasses for a name
+	enum CloneClassEntry {
+		CLONE_ENTRY_CLASS,
+		CLONE_ENTRY_WRITE,
+		CLONE_ENTRY_READ,
+		CLONE_ENTRY_SIZE
+	};
+
+	class CloneWriter {
+		public:
+			CloneWriter(rabbit::VirtualMachine *v, bool transfer) :
+			  _vm(v),
+			  _transfer(transfer),
+			  _check(false),
+			  _nstrings(0) {
+				_index = rabbit::Table::create(v->_sharedstate, 0);
+				_strings = rabbit::Table::create(v->_sharedstate, 0);
+			}
+			bool run(const rabbit::ObjectPtr &root, SQWRITEFUNC write, rabbit::UserPointer up) {
+				//a transfer moves the native data: the whole graph is checked first, a failure leaves it untouched
+				if(_transfer) {
+					_check = true;
+					_CHECK_IO(payload(root));
+					_check = false;
+					reset();
+				}
+				_CHECK_IO(payload(root));
+				_CHECK_IO(rabbit::writeTag(_vm, write, up, SQ_CLONE_TAG));
+				_CHECK_IO(rabbit::writeTag(_vm, write, up, SQ_CLONE_VERSION));
+				_CHECK_IO(rabbit::writeTag(_vm, write, up, sizeof(float_t)));
+				_CHECK_IO(rabbit::writeTag(_vm, write, up, _transfer ? 1 : 0));
+				uint64_t size = _buffer.size();
+				_CHECK_IO(rabbit::safeWrite(_vm, write, up, &size, sizeof(size)));
+				if(size != 0) {
+					_CHECK_IO(rabbit::safeWrite(_vm, write, up, _buffer.dataPointer(), size));
+				}
+				return true;
+			}
+			//SQWRITEFUNC of the native data hooks
+			static int64_t hookWrite(rabbit::UserPointer up, rabbit::UserPointer data, int64_t size) {
+				((CloneWriter *)up)->raw(data, size);
+				return size;
+			}
+		private:
+			void reset() {
+				_buffer.resize(0);
+				_objects.resize(0);
+				_index = rabbit::Table::create(_vm->_sharedstate, 0);
+				_strings = rabbit::Table::create(_vm->_sharedstate, 0);
+				_nstrings = 0;
+			}
+			bool payload(const rabbit::ObjectPtr &root) {
+				_CHECK_IO(value(root));
+				//the objects found by the contents are appended to _objects
+				for(uint64_t i = 0; i < _objects.size(); i++) {
+					rabbit::ObjectPtr o = _objects[i];
+					_CHECK_IO(content(o));
+				}
+				return true;
+			}
+			//the check pass only walks the graph
+			void raw(const void *data, int64_t size) {
+				if(_check || size == 0) {
+					return;
+				}
+				uint64_t pos = _buffer.size();
+				_buffer.resize(pos + size);
+				memcpy(&_buffer[pos], data, size);
+			}
+			void byte(uint8_t val) {
+				if(!_check) {
+					_buffer.pushBack(val);
+				}
+			}
+			void varint(uint64_t val) {
+				while(val >= 0x80) {
+					byte((uint8_t)(val | 0x80));
+					val >>= 7;
+				}
+				byte((uint8_t)val);
+			}
+			//number 'o' and write its creation data, its content is written after the root value
+			bool object(rabbit::ObjectPtr o) {
+				rabbit::ObjectPtr idx;
+				if(_index.toTable()->get(o, idx)) {
+					byte(CLONE_OBJECTREF);
+					varint((uint64_t)idx.toInteger());
+					return true;
+				}
+				rabbit::ObjectPtr name;
+				if(o.isInstance()) {
+					_CHECK_IO(className(o.toInstance(), name));
+				}
+				_index.toTable()->newSlot(o, (int64_t)_objects.size());
+				_objects.pushBack(o);
+				switch(o.getType()) {
+					case rabbit::OT_TABLE:
+						byte(CLONE_TABLE);
+						varint(((uint64_t)o.toTable()->countUsed() << 1) | (o.toTable()->isShaped() ? 1 : 0));
+						return true;
+					case rabbit::OT_ARRAY:
+						byte(CLONE_ARRAY);
+						varint((uint64_t)o.toArray()->size());
+						return true;
+					default:
+						byte(CLONE_INSTANCE);
+						return value(name);
+				}
+			}
+			bool className(rabbit::Instance *inst, rabbit::ObjectPtr &name) {
+				if(!_vm->_sharedstate->_cloneclasses.toTable()->get(rabbit::ObjectPtr(inst->_class), name)) {
+					_vm->raise_error("cannot clone an instance of a class that is not registered (see sq_registercloneclass)");
+					return false;
+				}
+				return true;
+			}
+			bool value(const rabbit::ObjectPtr &o) {
+				switch(o.getType()) {
+					case rabbit::OT_NULL:
+						byte(CLONE_NULL);
+						return true;
+					case rabbit::OT_BOOL:
+						byte(o.toInteger() ? CLONE_TRUE : CLONE_FALSE);
+						return true;
+					case rabbit::OT_INTEGER:
+						{
+							int64_t val = o.toInteger();
+							byte(CLONE_INTEGER);
+							varint(((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+						}
+						return true;
+					case rabbit::OT_FLOAT:
+						{
+							float_t val = o.toFloat();
+							byte(CLONE_FLOAT);
+							raw(&val, sizeof(val));
+						}
+						return true;
+					case rabbit::OT_STRING:
+						{
+							rabbit::ObjectPtr idx;
+							if(_strings.toTable()->get(o, idx)) {
+								byte(CLONE_STRINGREF);
+								varint((uint64_t)idx.toInteger());
+								return true;
+							}
+							_strings.toTable()->newSlot(o, _nstrings++);
+							byte(CLONE_STRING);
+							varint((uint64_t)o.toString()->_len);
+							raw(o.getStringValue(), o.toString()->_len);
+						}
+						return true;
+					case rabbit::OT_TABLE:
+					case rabbit::OT_ARRAY:
+					case rabbit::OT_INSTANCE:
+						return object(o);
+					default:
+						_vm->raise_error("cannot clone a %s", getTypeName(o));
+						return false;
+				}
+			}
+			bool content(rabbit::ObjectPtr o) {
+				switch(o.getType()) {
+					case rabbit::OT_TABLE:
+						{
+							rabbit::Table *t = o.toTable();
+							rabbit::ObjectPtr delegate;
+							if(t->_delegate) {
+								delegate = t->_delegate;
+							}
+							_CHECK_IO(value(delegate));
+							rabbit::ObjectPtr refpos, key, val;
+							int64_t idx;
+							while((idx = t->next(false, refpos, key, val)) != -1) {
+								_CHECK_IO(value(key));
+								_CHECK_IO(value(val));
+								refpos = idx;
+							}
+						}
+						return true;
+					case rabbit::OT_ARRAY:
+						{
+							rabbit::Array *a = o.toArray();
+							for(int64_t i = 0; i < a->size(); i++) {
+								_CHECK_IO(value((*a)[i]));
+							}
+						}
+						return true;
+					default:
+						return instance(o.toInstance());
+				}
+			}
+			//native data (through the write hook of the class, prefixed by its size) then the fields
+			bool instance(rabbit::Instance *inst) {
+				rabbit::ObjectPtr name, entry;
+				className(inst, name);
+				_vm->_sharedstate->_cloneclasses.toTable()->get(name, entry);
+				SQCLONEWRITE hook = (SQCLONEWRITE)(*entry.toArray())[CLONE_ENTRY_WRITE].toUserPointer();
+				if(hook == NULL) {
+					if(    inst->_userpointer != NULL
+					    || inst->_class->_udsize != 0) {
+						_vm->raise_error("cannot clone the native data of a '%s', its class has no clone hooks", name.getStringValue());
+						return false;
+					}
+					byte(0);
+				} else {
+					byte(1);
+					uint64_t pos = _buffer.size();
+					uint64_t size = 0;
+					raw(&size, sizeof(size));
+					if(!_check) {
+						if(SQ_FAILED(hook(inst->_userpointer, _transfer ? SQTrue : SQFalse, hookWrite, this))) {
+							_vm->raise_error("cannot clone the native data of a '%s'", name.getStringValue());
+							return false;
+						}
+						size = _buffer.size() - pos - sizeof(size);
+						memcpy(&_buffer[pos], &size, sizeof(size));
+					}
+				}
+				uint64_t nfields = inst->_class->_defaultvalues.size();
+				varint(nfields);
+				for(uint64_t i = 0; i < nfields; i++) {
+					_CHECK_IO(value(inst->_values[i]));
+				}
+				return true;
+			}
+			rabbit::VirtualMachine *_vm;
+			bool _transfer;
+			bool _check; //!< first pass of a transfer: only check that everything can be cloned
+			etk::Vector<uint8_t> _buffer; //!< payload
+			etk::Vector<rabbit::ObjectPtr> _objects;
+			rabbit::ObjectPtr _index; //!< object -> index in _objects
+			rabbit::ObjectPtr _strings; //!< string -> index
+			int64_t _nstrings;
+	};
+
+	class CloneReader {
+		public:
+			CloneReader(rabbit::VirtualMachine *v, bool transfer) :
+			  _vm(v),
+			  _transfer(transfer),
+			  _ss(v->_sharedstate),
+			  _data(NULL),
+			  _pos(0),
+			  _size(0),
+			  _hookend(0),
+			  _content(0) {
+
+			}
+			~CloneReader() {
+				if(_data != NULL) {
+					rabbit::sq_free(_data, _size);
+				}
+			}
+			bool run(SQREADFUNC read, rabbit::UserPointer up, rabbit::ObjectPtr &o) {
+				_CHECK_IO(rabbit::checkTag(_vm, read, up, SQ_CLONE_TAG));
+				uint32_t version;
+				_CHECK_IO(rabbit::safeRead(_vm, read, up, &version, sizeof(version)));
+				if(version != SQ_CLONE_VERSION) {
+					_vm->raise_error("structured clone version %d, expected %d", (int)version, (int)SQ_CLONE_VERSION);
+					return false;
+				}
+				_CHECK_IO(rabbit::checkTag(_vm, read, up, sizeof(float_t)));
+				//the moved native data is only trusted when the caller allows it
+				uint32_t transfer;
+				_CHECK_IO(rabbit::safeRead(_vm, read, up, &transfer, sizeof(transfer)));
+				if(transfer > 1) {
+					return corrupted();
+				}
+				if(transfer == 1 && !_transfer) {
+					_vm->raise_error("the structured clone was written with transfer");
+					return false;
+				}
+				_transfer = transfer == 1;
+				uint64_t size;
+				_CHECK_IO(rabbit::safeRead(_vm, read, up, &size, sizeof(size)));
+				if(size == 0 || size > (uint64_t)INT64_MAX) {
+					return corrupted();
+				}
+				//the payload is parsed in memory, the buffer grows with the bytes actually read: a corrupted size
+				//does not allocate it at once
+				while(_size < size) {
+					uint64_t n = size - _size;
+					if(n > _size + 4096) {
+						n = _size + 4096;
+					}
+					uint8_t *data = (uint8_t *)rabbit::sq_realloc(_data, _size, _size + n);
+					if(data == NULL) {
+						_vm->raise_error("cannot allocate the structured clone");
+						return false;
+					}
+					_data = data;
+					_size += n;
+					_CHECK_IO(rabbit::safeRead(_vm, read, up, _data + _size - n, n));
+				}
+				rabbit::ObjectPtr root;
+				_CHECK_IO(value(root));
+				for(uint64_t i = 0; i < _objects.size(); i++) {
+					rabbit::ObjectPtr obj = _objects[i];
+					_CHECK_IO(content(obj));
+				}
+				if(_pos != _size) {
+					return corrupted();
+				}
+				o = root;
+				return true;
+			}
+			//SQREADFUNC of the native data hooks, limited to the data of the instance
+			static int64_t hookRead(rabbit::UserPointer up, rabbit::UserPointer data, int64_t size) {
+				CloneReader *self = (CloneReader *)up;
+				if(size < 0 || (uint64_t)size > self->_hookend - self->_pos) {
+					return -1;
+				}
+				memcpy(data, self->_data + self->_pos, size);
+				self->_pos += size;
+				return size;
+			}
+		private:
+			bool corrupted() {
+				_vm->raise_error("invalid or corrupted structured clone");
+				return false;
+			}
+			bool byte(uint8_t &val) {
+				if(_pos >= _size) {
+					return corrupted();
+				}
+				val = _data[_pos++];
+				return true;
+			}
+			bool varint(uint64_t &val) {
+				val = 0;
+				for(int64_t shift = 0; shift < 64; shift += 7) {
+					uint8_t b;
+					_CHECK_IO(byte(b));
+					val |= (uint64_t)(b & 0x7F) << shift;
+					if((b & 0x80) == 0) {
+						return true;
+					}
+				}
+				return corrupted();
+			}
+			//a count of elements that take at least one byte each
+			bool count(uint64_t &val) {
+				_CHECK_IO(varint(val));
+				if(val > _size - _pos) {
+					return corrupted();
+				}
+				return true;
+			}
+			bool raw(void *dest, uint64_t size) {
+				if(size > _size - _pos) {
+					return corrupted();
+				}
+				memcpy(dest, _data + _pos, size);
+				_pos += size;
+				return true;
+			}
+			bool value(rabbit::ObjectPtr &o) {
+				uint8_t k;
+				_CHECK_IO(byte(k));
+				switch(k) {
+					case CLONE_NULL:
+						o.Null();
+						return true;
+					case CLONE_TRUE:
+						o = true;
+						return true;
+					case CLONE_FALSE:
+						o = false;
+						return true;
+					case CLONE_INTEGER:
+						{
+							uint64_t val;
+							_CHECK_IO(varint(val));
+							o = (int64_t)((val >> 1) ^ (~(val & 1) + 1));
+						}
+						return true;
+					case CLONE_FLOAT:
+						{
+							float_t val;
+							_CHECK_IO(raw(&val, sizeof(val)));
+							o = val;
+						}
+						return true;
+					case CLONE_STRING:
+						{
+							uint64_t len;
+							_CHECK_IO(varint(len));
+							if(len > _size - _pos) {
+								return corrupted();
+							}
+							o = rabbit::String::create(_ss, (const char *)_data + _pos, len);
+							_pos += len;
+							_strings.pushBack(o);
+						}
+						return true;
+					case CLONE_STRINGREF:
+						{
+							uint64_t idx;
+							_CHECK_IO(varint(idx));
+							if(idx >= _strings.size()) {
+								return corrupted();
+							}
+							o = _strings[idx];
+						}
+						return true;
+					case CLONE_OBJECTREF:
+						{
+							uint64_t idx;
+							_CHECK_IO(varint(idx));
+							if(idx >= _objects.size()) {
+								return corrupted();
+							}
+							o = _objects[idx];
+						}
+						return true;
+					case CLONE_TABLE:
+						{
+							uint64_t size;
+							_CHECK_IO(count(size));
+							int64_t nslots = (int64_t)(size >> 1);
+							if(size & 1) {
+								o = rabbit::Table::createShaped(_ss, nslots);
+							} else {
+								o = rabbit::Table::create(_ss, nslots);
+							}
+							_objects.pushBack(o);
+							_counts.pushBack(nslots);
+						}
+						return true;
+					case CLONE_ARRAY:
+						{
+							uint64_t size;
+							_CHECK_IO(count(size));
+							o = rabbit::Array::create(_ss, (int64_t)size);
+							_objects.pushBack(o);
+							_counts.pushBack((int64_t)size);
+						}
+						return true;
+					case CLONE_INSTANCE:
+						{
+							rabbit::ObjectPtr name, entry;
+							_CHECK_IO(value(name));
+							if(!name.isString()) {
+								return corrupted();
+							}
+							if(!_ss->_cloneclasses.toTable()->get(name, entry)) {
+								_vm->raise_error("the class '%s' of the structured clone is not registered", name.getStringValue());
+								return false;
+							}
+							o = rabbit::Instance::create(_ss, (*entry.toArray())[CLONE_ENTRY_CLASS].toClass());
+							_objects.pushBack(o);
+							_counts.pushBack(0);
+						}
+						return true;
+					default:
+						return corrupted();
+				}
+			}
+			bool content(rabbit::ObjectPtr &o) {
+				int64_t n = _counts[_content++];
+				switch(o.getType()) {
+					case rabbit::OT_TABLE:
+						{
+							rabbit::Table *t = o.toTable();
+							rabbit::ObjectPtr delegate;
+							_CHECK_IO(value(delegate));
+							if(delegate.isTable()) {
+								if(!t->setDelegate(delegate.toTable())) {
+									return corrupted();
+								}
+							} else if(!delegate.isNull()) {
+								return corrupted();
+							}
+							for(int64_t i = 0; i < n; i++) {
+								rabbit::ObjectPtr key, val;
+								_CHECK_IO(value(key));
+								_CHECK_IO(value(val));
+								if(key.isNull()) {
+									return corrupted();
+								}
+								t->newSlot(key, val);
+							}
+						}
+						return true;
+					case rabbit::OT_ARRAY:
+						{
+							rabbit::Array *a = o.toArray();
+							for(int64_t i = 0; i < n; i++) {
+								_CHECK_IO(value((*a)[i]));
+							}
+						}
+						return true;
+					default:
+						return instance(o);
+				}
+			}
+			bool instance(rabbit::ObjectPtr &o) {
+				rabbit::Instance *inst = o.toInstance();
+				rabbit::ObjectPtr name, entry;
+				_ss->_cloneclasses.toTable()->get(rabbit::ObjectPtr(inst->_class), name);
+				_ss->_cloneclasses.toTable()->get(name, entry);
+				uint8_t native;
+				_CHECK_IO(byte(native));
+				if(native != 0) {
+					uint64_t size;
+					_CHECK_IO(raw(&size, sizeof(size)));
+					if(size > _size - _pos) {
+						return corrupted();
+					}
+					SQCLONEREAD hook = (SQCLONEREAD)(*entry.toArray())[CLONE_ENTRY_READ].toUserPointer();
+					if(hook == NULL) {
+						_vm->raise_error("cannot read the native data of a '%s', its class has no clone hooks", name.getStringValue());
+						return false;
+					}
+					_hookend = _pos + size;
+					_vm->push(o);
+					rabbit::Result res = hook(_vm, -1, _transfer ? SQTrue : SQFalse, hookRead, this);
+					_vm->pop();
+					if(SQ_FAILED(res) || _pos != _hookend) {
+						_vm->raise_error("cannot read the native data of a '%s'", name.getStringValue());
+						return false;
+					}
+				}
+				uint64_t nfields;
+				_CHECK_IO(varint(nfields));
+				if(nfields != inst->_class->_defaultvalues.size()) {
+					_vm->raise_error("the class '%s' does not have the fields of the structured clone", name.getStringValue());
+					return false;
+				}
+				for(uint64_t i = 0; i < nfields; i++) {
+					_CHECK_IO(value(inst->_values[i]));
+				}
+				return true;
+			}
+			rabbit::VirtualMachine *_vm;
+			bool _transfer; //!< the stream was written with transfer
+			rabbit::SharedState *_ss;
+			uint8_t *_data; //!< payload, '_size' bytes
+			uint64_t _pos;
+			uint64_t _size;
+			uint64_t _hookend; //!< end of the native data given to a read hook
+			etk::Vector<rabbit::ObjectPtr> _objects;
+			etk::Vector<int64_t> _counts; //!< number of slots or elements of each object
+			uint64_t _content; //!< next object of _objects to fill
+			etk::Vector<rabbit::ObjectPtr> _strings;
+	};
+}
+
+bool rabbit::StructuredClone::write(rabbit::VirtualMachine *v, const rabbit::ObjectPtr &o, bool transfer, SQWRITEFUNC write, rabbit::UserPointer up) {
+	CloneWriter writer(v, transfer);
+	return writer.run(o, write, up);
+}
+
+bool rabbit::StructuredClone::read(rabbit::VirtualMachine *v, bool transfer, SQREADFUNC read, rabbit::UserPointer up, rabbit::ObjectPtr &o) {
+	CloneReader reader(v, transfer);
+	return reader.run(read, up, o);
+}
@@ -0,0 +1,35 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <etk/types.hpp>
+#include <rabbit/rabbit.hpp>
+#include <rabbit/ObjectPtr.hpp>
+
+// first 4 bytes of a structured clone (see sq_writeclone)
+#define SQ_CLONE_TAG (('R'<<24)|('B'<<16)|('C'<<8)|('L'))
+#define SQ_CLONE_VERSION 1
+
+namespace rabbit {
+	/**
+	 * @brief Structured clone: a value and the graph it reaches (null, bools, numbers, strings, tables with their
+	 * delegates, arrays, instances of the classes registered with sq_registercloneclass) in a compact binary form,
+	 * read back in the heap of any shared state: message passing between isolates and persistence of script state.
+	 * The shared objects and the cycles are kept. The instances are created without calling their constructor, their
+	 * fields are cloned and their native data goes through the hooks of their class. With 'transfer' the hooks can move
+	 * the native data instead of copying it (see the blobs): such a stream is only valid in the process that wrote it
+	 * and must be read once, the readers only accept it when they are told so.
+	 * The layout is the header, the size of the payload and the payload: the root value then the content of each
+	 * object in the order they appear, the recursion depth does not depend on the depth of the graph.
+	 */
+	class StructuredClone {
+		public:
+			static bool write(rabbit::VirtualMachine *v, const rabbit::ObjectPtr &o, bool transfer, SQWRITEFUNC write, rabbit::UserPointer up);
+			static bool read(rabbit::VirtualMachine *v, bool transfer, SQREADFUNC read, rabbit::UserPointer up, rabbit::ObjectPtr &o);
+	};
+}
@@ -8,6 +8,7 @@
 #include <rabbit/Table.hpp>
 #include <rabbit/String.hpp>
 #include <rabbit/WeakRef.hpp>
+#include <rabbit/SharedState.hpp>
 #include <etk/Allocator.hpp>
 
 rabbit::Hash rabbit::HashObj(const rabbit::ObjectPtr &key) {
@@ -20,22 +21,49 @@ rabbit::Hash rabbit::HashObj(const rabbit::ObjectPtr &key) {
 		case rabbit::OT_INTEGER:
 			return (rabbit::Hash)((int64_t)key.toInteger());
 		default:
-			return hashptr(key._unVal.pRefCounted);
+			return hashptr(key.toRefCounted());
 	}
 }
 
 
 #define MINPOWER2 4
 
-rabbit::Table::Table(rabbit::SharedState *ss,int64_t ninitialsize) {
+rabbit::Table::Table(rabbit::SharedState *ss,int64_t ninitialsize) :
+	rabbit::Delegable(ss) {
 	int64_t pow2size=MINPOWER2;
 	while(ninitialsize>pow2size)pow2size=pow2size<<1;
 	allocNodes(pow2size);
 	_usednodes = 0;
+	_shape = NULL;
+	_values = NULL;
+	_numofvalues = 0;
+	_delegate = NULL;
+}
+
+rabbit::Table::Table(rabbit::Shape *shape,int64_t ninitialsize) :
+	rabbit::Delegable(shape->_sharedstate) {
+	_nodes = NULL;
+	_firstfree = NULL;
+	_numofnodes = 0;
+	_usednodes = 0;
+	_shape = shape;
+	__ObjaddRef(_shape);
+	_values = NULL;
+	_numofvalues = 0;
+	if(ninitialsize > 0) {
+		allocValues(ninitialsize);
+	}
 	_delegate = NULL;
 }
 
 void rabbit::Table::remove(const rabbit::ObjectPtr &key) const {
+	if(_shape) {
+		if(_shape->find(key) == -1) {
+			return;
+		}
+		//deleting a slot means the table is used as a dictionary
+		toDictionary();
+	}
 	_HashNode *n = _get(key, HashObj(key) & (_numofnodes - 1));
 	if (n) {
 		n->val.Null();
@@ -47,7 +75,7 @@ void rabbit::Table::remove(const rabbit::ObjectPtr &key) const {
 
 void rabbit::Table::allocNodes(int64_t nsize) const
 {
-	_HashNode *nodes=(_HashNode *)SQ_MALLOC(sizeof(_HashNode)*nsize);
+	_HashNode *nodes=(_HashNode *)SQ_MALLOC(_sharedstate, rabbit::MEM_TABLE, sizeof(_HashNode)*nsize);
 	for(int64_t i=0;i<nsize;i++){
 		_HashNode &n = nodes[i];
 		new ((char*)&n) _HashNode;
@@ -58,6 +86,43 @@ void rabbit::Table::allocNodes(int64_t nsize) const
 	_firstfree=&_nodes[_numofnodes-1];
 }
 
+void rabbit::Table::allocValues(int64_t nsize) const
+{
+	rabbit::ObjectPtr *values = (rabbit::ObjectPtr *)SQ_MALLOC(_sharedstate, rabbit::MEM_TABLE, sizeof(rabbit::ObjectPtr)*nsize);
+	_CONSTRUCT_VECTOR(ObjectPtr, nsize, values);
+	if(_values) {
+		for(int64_t i=0;i<_numofvalues && i<nsize;i++) {
+			values[i].swap(_values[i]);
+		}
+		_DESTRUCT_VECTOR(ObjectPtr, _numofvalues, _values);
+		SQ_FREE(_sharedstate, rabbit::MEM_TABLE, _values, _numofvalues*sizeof(rabbit::ObjectPtr));
+	}
+	_values = values;
+	_numofvalues = nsize;
+}
+
+void rabbit::Table::toDictionary() const
+{
+	rabbit::Shape *shape = _shape;
+	rabbit::ObjectPtr *values = _values;
+	int64_t nvalues = _numofvalues;
+	_shape = NULL;
+	_values = NULL;
+	_numofvalues = 0;
+	int64_t pow2size=MINPOWER2;
+	while(shape->_nkeys>pow2size)pow2size=pow2size<<1;
+	allocNodes(pow2size);
+	_usednodes = 0;
+	for(int64_t i=0;i<shape->_nkeys;i++) {
+		newSlot(shape->_keys[i], values[i]);
+	}
+	if(values) {
+		_DESTRUCT_VECTOR(ObjectPtr, nvalues, values);
+		SQ_FREE(_sharedstate, rabbit::MEM_TABLE, values, nvalues*sizeof(rabbit::ObjectPtr));
+	}
+	__Objrelease(shape);
+}
+
 void rabbit::Table::Rehash(bool force) const
 {
 	int64_t oldsize=_numofnodes;
@@ -87,12 +152,22 @@ void rabbit::Table::Rehash(bool force) const
 	}
 	for(int64_t k=0;k<oldsize;k++)
 		nold[k].~_HashNode();
-	SQ_FREE(nold,oldsize*sizeof(_HashNode));
+	SQ_FREE(_sharedstate, rabbit::MEM_TABLE, nold,oldsize*sizeof(_HashNode));
 }
 
 rabbit::Table *rabbit::Table::clone() const
 {
-	rabbit::Table *nt=create(NULL,_numofnodes);
+	if(_shape) {
+		//same keys: the clone shares the shape
+		char* tmp = (char*)SQ_MALLOC(_sharedstate, rabbit::MEM_TABLE, sizeof(rabbit::Table));
+		rabbit::Table *nt = new (tmp) rabbit::Table(_shape, _shape->_nkeys);
+		for(int64_t i=0;i<_shape->_nkeys;i++) {
+			nt->_values[i] = _values[i];
+		}
+		nt->setDelegate(_delegate);
+		return nt;
+	}
+	rabbit::Table *nt=create(_sharedstate,_numofnodes);
 #ifdef _FAST_CLONE
 	_HashNode *basesrc = _nodes;
 	_HashNode *basedst = nt->_nodes;
@@ -129,6 +204,14 @@ bool rabbit::Table::get(const rabbit::ObjectPtr &key,rabbit::ObjectPtr &val) con
 {
 	if(key.isNull() == true)
 		return false;
+	if(_shape) {
+		int64_t idx = _shape->find(key);
+		if(idx == -1) {
+			return false;
+		}
+		val = _values[idx].getRealObject();
+		return true;
+	}
 	_HashNode *n = _get(key, HashObj(key) & (_numofnodes - 1));
 	if (n) {
 		val = n->val.getRealObject();
@@ -136,9 +219,49 @@ bool rabbit::Table::get(const rabbit::ObjectPtr &key,rabbit::ObjectPtr &val) con
 	}
 	return false;
 }
+
+bool rabbit::Table::getCached(const rabbit::ObjectPtr &key,rabbit::ObjectPtr &val,rabbit::InlineCache &cache) const
+{
+	if(_shape == NULL) {
+		return get(key,val);
+	}
+	int64_t idx;
+	if(cache.find(_shape->_cachetag, idx) == false) {
+		idx = _shape->find(key);
+		if(idx == -1) {
+			return false;
+		}
+		cache.add(_shape->_cachetag, idx);
+	}
+	val = _values[idx].getRealObject();
+	return true;
+}
+
 bool rabbit::Table::newSlot(const rabbit::ObjectPtr &key,const rabbit::ObjectPtr &val) const
 {
 	assert(key.isNull() == false);
+	if(_shape) {
+		int64_t idx = _shape->find(key);
+		if(idx != -1) {
+			_values[idx] = val;
+			return false;
+		}
+		if(    key.isString() == true
+		    && _shape->_nkeys < SQ_SHAPE_MAX_KEYS) {
+			rabbit::Shape *shape = _shape->addKey(key);
+			if(shape->_nkeys > _numofvalues) {
+				int64_t nsize = _numofvalues == 0 ? 4 : _numofvalues * 2;
+				allocValues(nsize < SQ_SHAPE_MAX_KEYS ? nsize : SQ_SHAPE_MAX_KEYS);
+			}
+			__ObjaddRef(shape);
+			__Objrelease(_shape);
+			_shape = shape;
+			_values[_shape->_nkeys-1] = val;
+			return true;
+		}
+		//too many keys or not a string key
+		toDictionary();
+	}
 	rabbit::Hash h = HashObj(key) & (_numofnodes - 1);
 	_HashNode *n = _get(key, h);
 	if (n) {
@@ -199,6 +322,14 @@ bool rabbit::Table::newSlot(const rabbit::ObjectPtr &key,const rabbit::ObjectPtr
 int64_t rabbit::Table::next(bool getweakrefs,const rabbit::ObjectPtr &refpos, rabbit::ObjectPtr &outkey, rabbit::ObjectPtr &outval) const
 {
 	int64_t idx = (int64_t)translateIndex(refpos);
+	if(_shape) {
+		if(idx < _shape->_nkeys) {
+			outkey = _shape->_keys[idx];
+			outval = getweakrefs?(rabbit::Object)_values[idx]:_values[idx].getRealObject();
+			return ++idx;
+		}
+		return -1;
+	}
 	while (idx < _numofnodes) {
 		if(_nodes[idx].key.isNull() == false) {
 			//first found
@@ -217,6 +348,14 @@ int64_t rabbit::Table::next(bool getweakrefs,const rabbit::ObjectPtr &refpos, ra
 
 bool rabbit::Table::set(const rabbit::ObjectPtr &key, const rabbit::ObjectPtr &val) const
 {
+	if(_shape) {
+		int64_t idx = _shape->find(key);
+		if(idx == -1) {
+			return false;
+		}
+		_values[idx] = val;
+		return true;
+	}
 	_HashNode *n = _get(key, HashObj(key) & (_numofnodes - 1));
 	if (n) {
 		n->val = val;
@@ -227,9 +366,30 @@ bool rabbit::Table::set(const rabbit::ObjectPtr &key, const rabbit::ObjectPtr &v
 
 void rabbit::Table::_clearNodes() const
 {
+	if(_shape) {
+		_NULL_SQOBJECT_VECTOR(_values, _numofvalues);
+		return;
+	}
 	for(int64_t i = 0;i < _numofnodes; i++) { _HashNode &n = _nodes[i]; n.key.Null(); n.val.Null(); }
 }
 
+void rabbit::Table::mark(rabbit::Collectable **chain)
+{
+	if(_delegate) {
+		_delegate->setReachable(chain);
+	}
+	if(_shape) {
+		for(int64_t i = 0; i < _numofvalues; i++) {
+			rabbit::SharedState::markObject(_values[i], chain);
+		}
+		return;
+	}
+	for(int64_t i = 0; i < _numofnodes; i++) {
+		rabbit::SharedState::markObject(_nodes[i].key, chain);
+		rabbit::SharedState::markObject(_nodes[i].val, chain);
+	}
+}
+
 void rabbit::Table::finalize()
 {
 	_clearNodes();
@@ -239,6 +399,13 @@ void rabbit::Table::finalize()
 void rabbit::Table::clear() const
 {
 	_clearNodes();
+	if(_shape) {
+		rabbit::Shape *root = _shape->getRoot();
+		__ObjaddRef(root);
+		__Objrelease(_shape);
+		_shape = root;
+		return;
+	}
 	_usednodes = 0;
 	Rehash(true);
 }
@@ -246,16 +413,36 @@ void rabbit::Table::clear() const
 
 rabbit::Table* rabbit::Table::create(rabbit::SharedState *ss,int64_t ninitialsize)
 {
-	char* tmp = (char*)SQ_MALLOC(sizeof(rabbit::Table));
+	char* tmp = (char*)SQ_MALLOC(ss, rabbit::MEM_TABLE, sizeof(rabbit::Table));
 	rabbit::Table *newtable = new (tmp) rabbit::Table(ss, ninitialsize);
 	newtable->_delegate = NULL;
 	return newtable;
 }
 
+rabbit::Table* rabbit::Table::createShaped(rabbit::SharedState *ss,int64_t ninitialsize)
+{
+#ifndef SQ_NO_TABLE_SHAPE
+	if(    ss != NULL
+	    && ninitialsize <= SQ_SHAPE_MAX_KEYS) {
+		char* tmp = (char*)SQ_MALLOC(ss, rabbit::MEM_TABLE, sizeof(rabbit::Table));
+		return new (tmp) rabbit::Table(ss->_rootshape, ninitialsize);
+	}
+#endif
+	return create(ss, ninitialsize);
+}
+
 rabbit::Table::~Table() {
 	setDelegate(NULL);
+	if(_shape) {
+		if(_values) {
+			_DESTRUCT_VECTOR(ObjectPtr, _numofvalues, _values);
+			SQ_FREE(_sharedstate, rabbit::MEM_TABLE, _values, _numofvalues*sizeof(rabbit::ObjectPtr));
+		}
+		__Objrelease(_shape);
+		return;
+	}
 	for (int64_t i = 0; i < _numofnodes; i++) _nodes[i].~_HashNode();
-	SQ_FREE(_nodes, _numofnodes * sizeof(_HashNode));
+	SQ_FREE(_sharedstate, rabbit::MEM_TABLE, _nodes, _numofnodes * sizeof(_HashNode));
 }
 
 rabbit::Table::_HashNode* rabbit::Table::_get(const rabbit::ObjectPtr &key,rabbit::Hash hash) const{
@@ -269,14 +456,25 @@ rabbit::Table::_HashNode* rabbit::Table::_get(const rabbit::ObjectPtr &key,rabbi
 	return NULL;
 }
 
-//for compiler use
+//for compiler use ('key' does not need to be terminated)
 bool rabbit::Table::getStr(const char* key,int64_t keylen,rabbit::ObjectPtr &val) const{
+	if(_shape) {
+		for(int64_t i=0;i<_shape->_nkeys;i++) {
+			if(    _shape->_keys[i].toString()->_len == keylen
+			    && memcmp(_shape->_keys[i].getStringValue(), key, keylen) == 0) {
+				val = _values[i].getRealObject();
+				return true;
+			}
+		}
+		return false;
+	}
 	rabbit::Hash hash = _hashstr(key,keylen);
 	_HashNode *n = &_nodes[hash & (_numofnodes - 1)];
 	_HashNode *res = NULL;
 	do {
 		if (    n->key.isString() == true
-		     && strcmp(n->key.getStringValue(), key) == 0) {
+		     && n->key.toString()->_len == keylen
+		     && memcmp(n->key.getStringValue(), key, keylen) == 0) {
 			res = n;
 			break;
 		}
@@ -289,9 +487,12 @@ bool rabbit::Table::getStr(const char* key,int64_t keylen,rabbit::ObjectPtr &val
 }
 
 int64_t rabbit::Table::countUsed() const {
+	if(_shape) {
+		return _shape->_nkeys;
+	}
 	return _usednodes;
 }
 
 void rabbit::Table::release() {
-	sq_delete(this, Table);
+	sq_delete(_sharedstate, rabbit::MEM_TABLE, this, Table);
 }
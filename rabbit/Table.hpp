@@ -9,6 +9,8 @@
 
 #include <etk/types.hpp>
 #include <rabbit/Delegable.hpp>
+#include <rabbit/Shape.hpp>
+#include <rabbit/InlineCache.hpp>
 
 namespace rabbit {
 	class SharedState;
@@ -29,19 +31,37 @@ namespace rabbit {
 			mutable _HashNode *_nodes;
 			mutable int64_t _numofnodes;
 			mutable int64_t _usednodes;
+			// shape layout (_shape != NULL): the keys are in the shape, the values in _values (_nodes is NULL)
+			mutable rabbit::Shape *_shape;
+			mutable rabbit::ObjectPtr *_values;
+			mutable int64_t _numofvalues;
 			void allocNodes(int64_t nsize) const;
+			void allocValues(int64_t nsize) const;
 			void Rehash(bool force) const;
+			void toDictionary() const;
 			Table(rabbit::SharedState *ss, int64_t ninitialsize);
+			Table(rabbit::Shape *shape, int64_t ninitialsize);
 			void _clearNodes() const;
 		public:
 			static rabbit::Table* create(rabbit::SharedState *ss,int64_t ninitialsize);
+			//create a table that starts with the shape layout (record like table), fall back to the hash layout if needed
+			static rabbit::Table* createShaped(rabbit::SharedState *ss,int64_t ninitialsize);
+			void mark(rabbit::Collectable **chain);
 			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_TABLE;
+			}
 			Table *clone() const;
 			~Table();
 			_HashNode *_get(const rabbit::ObjectPtr &key,rabbit::Hash hash) const;
 			//for compiler use
 			bool getStr(const char* key,int64_t keylen,rabbit::ObjectPtr &val) const;
 			bool get(const rabbit::ObjectPtr &key,rabbit::ObjectPtr &val) const ;
+			//same as get() but remember the slot of the key per shape in 'cache'
+			bool getCached(const rabbit::ObjectPtr &key,rabbit::ObjectPtr &val,rabbit::InlineCache &cache) const;
+			bool isShaped() const {
+				return _shape != NULL;
+			}
 			void remove(const rabbit::ObjectPtr &key) const;
 			bool set(const rabbit::ObjectPtr &key, const rabbit::ObjectPtr &val) const ;
 			//returns true if a new slot has been created false if it was already present
@@ -7,8 +7,11 @@
  */
 #include <rabbit/UserData.hpp>
 #include <etk/Allocator.hpp>
+#include <rabbit/SharedState.hpp>
+#include <rabbit/Table.hpp>
 
-rabbit::UserData::UserData(rabbit::SharedState *ss) {
+rabbit::UserData::UserData(rabbit::SharedState *ss) :
+	rabbit::Delegable(ss) {
 	_delegate = 0;
 	m_hook = NULL;
 }
@@ -16,8 +19,18 @@ rabbit::UserData::~UserData() {
 	setDelegate(NULL);
 }
 
+void rabbit::UserData::mark(rabbit::Collectable **chain) {
+	if(_delegate) {
+		_delegate->setReachable(chain);
+	}
+}
+
+void rabbit::UserData::finalize() {
+	setDelegate(NULL);
+}
+
 rabbit::UserData* rabbit::UserData::create(rabbit::SharedState *ss, int64_t size) {
-	UserData* ud = (UserData*)SQ_MALLOC(sq_aligning(sizeof(UserData))+size);
+	UserData* ud = (UserData*)SQ_MALLOC(ss, rabbit::MEM_USERDATA, sq_aligning(sizeof(UserData))+size);
 	new ((char*)ud) UserData(ss);
 	ud->m_size = size;
 	ud->m_typetag = 0;
@@ -29,8 +42,9 @@ void rabbit::UserData::release() {
 		m_hook((rabbit::UserPointer)sq_aligning(this + 1),m_size);
 	}
 	int64_t tsize = m_size;
+	rabbit::SharedState *ss = _sharedstate;
 	this->~UserData();
-	SQ_FREE(this, sq_aligning(sizeof(UserData)) + tsize);
+	SQ_FREE(ss, rabbit::MEM_USERDATA, this, sq_aligning(sizeof(UserData)) + tsize);
 }
 
 const int64_t& rabbit::UserData::getsize() const {
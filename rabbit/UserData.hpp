@@ -16,6 +16,11 @@ namespace rabbit {
 			~UserData();
 			static UserData* create(rabbit::SharedState *ss, int64_t size);
 			void release();
+			void mark(rabbit::Collectable **chain);
+			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_USERDATA;
+			}
 			const int64_t& getsize() const;
 			const rabbit::UserPointer& getTypeTag() const;
 			void setTypeTag(const rabbit::UserPointer& _value);
@@ -63,19 +63,50 @@ bool rabbit::VirtualMachine::BW_OP(uint64_t op,rabbit::ObjectPtr &trg,const rabb
 		}
 	}
 	else { raise_error("bitwise op between '%s' and '%s'",getTypeName(o1),getTypeName(o2)); return false;}
+	//the shifts can leave the range of the SQ_TAGGED_OBJECT integers
+	if(rabbit::Object::integerFits(res) == false) {
+		raise_error("integer overflow (the integers are limited to 56 bits)");
+		return false;
+	}
 	trg = res;
 	return true;
 }
 
 void rabbit::VirtualMachine::release() {
-	sq_delete(this,VirtualMachine);
+	sq_delete(_sharedstate, rabbit::MEM_THREAD, this, VirtualMachine);
 }
 
+// integer result of the arithmetic instructions. the SQ_TAGGED_OBJECT layout stores 56 bits integers: a result out of
+// that range raises an error instead of being truncated
+#ifdef SQ_TAGGED_OBJECT
+	#define SQ_INTEGER_OVERFLOW "integer overflow (the integers are limited to 56 bits)"
+	namespace {
+		bool integerOp(int64_t op, int64_t i1, int64_t i2, int64_t &res) {
+			switch(op) {
+				case '+': res = i1 + i2; break;
+				case '-': res = i1 - i2; break;
+				case '*':
+					res = int64_t(uint64_t(i1) * uint64_t(i2));
+					if(i1 != 0 && res / i1 != i2) {
+						return false;
+					}
+					break;
+				case '/': res = i1 / i2; break;
+				default: res = i1 % i2; break;
+			}
+			return rabbit::Object::integerFits(res);
+		}
+	}
+	#define SQ_INTEGER_OP(op,res,i1,i2) { if(!integerOp((#op)[0],(i1),(i2),(res))) { raise_error(SQ_INTEGER_OVERFLOW); SQ_THROW(); } }
+#else
+	#define SQ_INTEGER_OP(op,res,i1,i2) { (res) = (i1) op (i2); }
+#endif
+
 #define _ARITH_(op,trg,o1,o2) \
 { \
 	int64_t tmask = o1.getType()|o2.getType(); \
 	switch(tmask) { \
-		case rabbit::OT_INTEGER: trg = o1.toInteger() op o2.toInteger();break; \
+		case rabbit::OT_INTEGER: { int64_t ires; SQ_INTEGER_OP(op,ires,o1.toInteger(),o2.toInteger()); trg = ires; } break; \
 		case (rabbit::OT_FLOAT|OT_INTEGER): \
 		case (rabbit::OT_FLOAT): trg = o1.toFloatValue() op o2.toFloatValue(); break;\
 		default: _GUARD(ARITH_OP((#op)[0],trg,o1,o2)); break;\
@@ -86,7 +117,7 @@ void rabbit::VirtualMachine::release() {
 { \
 	int64_t tmask = o1.getType()|o2.getType(); \
 	switch(tmask) { \
-		case rabbit::OT_INTEGER: { int64_t i2 = o2.toInteger(); if(i2 == 0) { raise_error(err); SQ_THROW(); } trg = o1.toInteger() op i2; } break;\
+		case rabbit::OT_INTEGER: { int64_t i2 = o2.toInteger(); if(i2 == 0) { raise_error(err); SQ_THROW(); } int64_t ires; SQ_INTEGER_OP(op,ires,o1.toInteger(),i2); trg = ires; } break;\
 		case (rabbit::OT_FLOAT|OT_INTEGER): \
 		case (rabbit::OT_FLOAT): trg = o1.toFloatValue() op o2.toFloatValue(); break;\
 		default: _GUARD(ARITH_OP((#op)[0],trg,o1,o2)); break;\
@@ -113,6 +144,13 @@ bool rabbit::VirtualMachine::ARITH_OP(uint64_t op,rabbit::ObjectPtr &trg,const r
 					break;
 			default: res = 0xDEADBEEF;
 			}
+#ifdef SQ_TAGGED_OBJECT
+			if(    (op == '+' || op == '-' || op == '*' || op == '/')
+			    && integerOp(op, i1, i2, res) == false) {
+				raise_error(SQ_INTEGER_OVERFLOW);
+				return false;
+			}
+#endif
 			trg = res; }
 			break;
 		case (rabbit::OT_FLOAT|OT_INTEGER):
@@ -139,17 +177,20 @@ bool rabbit::VirtualMachine::ARITH_OP(uint64_t op,rabbit::ObjectPtr &trg,const r
 	return true;
 }
 
-rabbit::VirtualMachine::VirtualMachine(rabbit::SharedState *ss)
+rabbit::VirtualMachine::VirtualMachine(rabbit::SharedState *ss) :
+	rabbit::Collectable(ss)
 {
-	_stack.resize(4096);
-	_sharedstate = ss;
+	resizeStack(4096);
 	_suspended = SQFalse;
 	_suspended_target = -1;
 	_suspended_root = SQFalse;
 	_suspended_traps = -1;
+	_budget = INT64_MAX;
+	_budgetlimited = false;
+	_budgetmode = SQ_BUDGET_ERROR;
+	_interrupted.store(false);
 	_foreignptr = NULL;
 	_nnativecalls = 0;
-	_nmetamethodscall = 0;
 	_lasterror.Null();
 	_errorhandler.Null();
 	_debughook = false;
@@ -161,6 +202,10 @@ rabbit::VirtualMachine::VirtualMachine(rabbit::SharedState *ss)
 }
 
 bool rabbit::VirtualMachine::init(rabbit::VirtualMachine *friendvm) {
+	//the address space of the stack could not be reserved (see the constructor)
+	if(_stack.size() == 0) {
+		return false;
+	}
 	_alloccallsstacksize = 4;
 	_callstackdata.resize(_alloccallsstacksize);
 	_callsstacksize = 0;
@@ -181,6 +226,21 @@ bool rabbit::VirtualMachine::init(rabbit::VirtualMachine *friendvm) {
 	return true;
 }
 
+void rabbit::VirtualMachine::mark(rabbit::Collectable **chain)
+{
+	rabbit::SharedState::markObject(_lasterror, chain);
+	rabbit::SharedState::markObject(_errorhandler, chain);
+	rabbit::SharedState::markObject(_debughook_closure, chain);
+	rabbit::SharedState::markObject(_roottable, chain);
+	rabbit::SharedState::markObject(temp_reg, chain);
+	for(uint64_t i = 0; i < _stack.size(); i++) {
+		rabbit::SharedState::markObject(_stack[i], chain);
+	}
+	for(int64_t k = 0; k < _callsstacksize; k++) {
+		rabbit::SharedState::markObject(_callsstack[k]._closure, chain);
+	}
+}
+
 void rabbit::VirtualMachine::finalize()
 {
 	if(_releasehook) { _releasehook(_foreignptr,0); _releasehook = NULL; }
@@ -201,6 +261,19 @@ void rabbit::VirtualMachine::finalize()
 rabbit::VirtualMachine::~VirtualMachine()
 {
 	finalize();
+	_sharedstate->memAccount(rabbit::MEM_THREAD, -_stack.committed());
+}
+
+bool rabbit::VirtualMachine::resizeStack(int64_t newsize)
+{
+	int64_t oldcommitted = _stack.committed();
+	if(!_stack.resize(newsize)) {
+		return false;
+	}
+	if(_stack.committed() != oldcommitted) {
+		_sharedstate->memAccount(rabbit::MEM_THREAD, _stack.committed() - oldcommitted);
+	}
+	return true;
 }
 
 bool rabbit::VirtualMachine::arithMetaMethod(int64_t op,const rabbit::ObjectPtr &o1,const rabbit::ObjectPtr &o2,rabbit::ObjectPtr &dest)
@@ -245,6 +318,10 @@ bool rabbit::VirtualMachine::NEG_OP(rabbit::ObjectPtr &trg,const rabbit::ObjectP
 
 	switch(o.getType()) {
 		case rabbit::OT_INTEGER:
+			if(rabbit::Object::integerFits(-o.toInteger()) == false) {
+				raise_error("integer overflow (the integers are limited to 56 bits)");
+				return false;
+			}
 			trg = -o.toInteger();
 			return true;
 		case rabbit::OT_FLOAT:
@@ -542,13 +619,13 @@ bool rabbit::VirtualMachine::derefInc(int64_t op,rabbit::ObjectPtr &target, rabb
 	return true;
 }
 
-#define arg0 (_i_._arg0)
-#define sarg0 ((int64_t)*((const signed char *)&_i_._arg0))
-#define arg1 (_i_._arg1)
-#define sarg1 (*((const int32_t *)&_i_._arg1))
-#define arg2 (_i_._arg2)
-#define arg3 (_i_._arg3)
-#define sarg3 ((int64_t)*((const signed char *)&_i_._arg3))
+#define arg0 (_i_->_arg0)
+#define sarg0 ((int64_t)*((const signed char *)&_i_->_arg0))
+#define arg1 (_i_->_arg1)
+#define sarg1 (*((const int32_t *)&_i_->_arg1))
+#define arg2 (_i_->_arg2)
+#define arg3 (_i_->_arg3)
+#define sarg3 ((int64_t)*((const signed char *)&_i_->_arg3))
 
 rabbit::Result rabbit::VirtualMachine::Suspend()
 {
@@ -559,6 +636,23 @@ rabbit::Result rabbit::VirtualMachine::Suspend()
 	return SQ_SUSPEND_FLAG;
 }
 
+rabbit::Result rabbit::VirtualMachine::budgetExhausted()
+{
+	bool interrupted = _interrupted.load();
+	if(_budgetlimited == false && interrupted == false) {
+		_budget = INT64_MAX;
+		return SQ_OK;
+	}
+	// stays exhausted: every following safe point stops again until the host gives a new budget
+	_budget = 0;
+	// only the outermost execute() can return to the host (same rule as Suspend())
+	if(_budgetmode == SQ_BUDGET_SUSPEND && _nnativecalls == 1 && !_suspended) {
+		return SQ_SUSPEND_FLAG;
+	}
+	raise_error(interrupted ? "execution interrupted" : "execution budget exceeded");
+	return SQ_ERROR;
+}
+
 
 #define _FINISH(howmuchtojump) \
 	{ \
@@ -636,10 +730,147 @@ bool rabbit::VirtualMachine::FOREACH_OP(rabbit::ObjectPtr &o1,rabbit::ObjectPtr
 
 #define _GUARD(exp) { if(!exp) { SQ_THROW();} }
 
+// Quickening: the generic arithmetic/compare instructions rewrite themselves in place to the variant specialized for
+// the operand types they met, the variant goes back to the generic opcode when the types change. The functions read
+// in place from a bytecode image are not rewritten (read only memory).
+#define SQ_QUICKEN(newop) { if(ci->_closure.toClosure()->_function->_image == NULL) { const_cast<rabbit::Instruction *>(_i_)->op = (newop); } }
+
+#define _ARITH_QUICKEN(op,iop,fop,trg,o1,o2) \
+{ \
+	int64_t tmask = o1.getType()|o2.getType(); \
+	switch(tmask) { \
+		case rabbit::OT_INTEGER: { int64_t ires; SQ_INTEGER_OP(op,ires,o1.toInteger(),o2.toInteger()); trg = ires; } SQ_QUICKEN(iop); break; \
+		case (rabbit::OT_FLOAT|OT_INTEGER): \
+		case (rabbit::OT_FLOAT): trg = o1.toFloatValue() op o2.toFloatValue(); SQ_QUICKEN(fop); break;\
+		default: _GUARD(ARITH_OP((#op)[0],trg,o1,o2)); break;\
+	} \
+}
+
+// the result type of a quickened instruction is known: it is stored in place when the target holds no reference
+#define SQ_SET_SCALAR(trg,setter,value) { if(trg.isRefCounted() == false) { trg.setter(value); } else { trg = (value); } }
+
+#define _ARITH_INT(op,baseop,trg,o1,o2) \
+{ \
+	if((o1.getType()|o2.getType()) == rabbit::OT_INTEGER) { int64_t ires; SQ_INTEGER_OP(op,ires,o1.toInteger(),o2.toInteger()); SQ_SET_SCALAR(trg,setInteger,ires); } \
+	else { SQ_QUICKEN(baseop); _ARITH_(op,trg,o1,o2); } \
+}
+
+#define _ARITH_FLOAT(op,baseop,trg,o1,o2) \
+{ \
+	int64_t tmask = o1.getType()|o2.getType(); \
+	if(tmask == rabbit::OT_FLOAT) { SQ_SET_SCALAR(trg,setFloat,o1.toFloat() op o2.toFloat()); } \
+	else if(tmask == (rabbit::OT_FLOAT|OT_INTEGER)) { SQ_SET_SCALAR(trg,setFloat,o1.toFloatValue() op o2.toFloatValue()); } \
+	else { SQ_QUICKEN(baseop); _ARITH_(op,trg,o1,o2); } \
+}
+
+namespace {
+	// result of CMP_OP for the -1/0/1 value of objCmp
+	bool cmpResult(CmpOP op, int64_t r) {
+		switch(op) {
+			case CMP_G: return r > 0;
+			case CMP_GE: return r >= 0;
+			case CMP_L: return r < 0;
+			case CMP_LE: return r <= 0;
+			case CMP_3W: return r != 0;
+		}
+		return false;
+	}
+	// objCmp of two integers or of two floats (same raw value first, as objCmp)
+	int64_t cmpInteger(const rabbit::ObjectPtr &o1, const rabbit::ObjectPtr &o2) {
+		return o1.toRaw() == o2.toRaw() ? 0 : (o1.toInteger() < o2.toInteger() ? -1 : 1);
+	}
+	int64_t cmpFloat(const rabbit::ObjectPtr &o1, const rabbit::ObjectPtr &o2) {
+		return o1.toRaw() == o2.toRaw() ? 0 : (o1.toFloat() < o2.toFloat() ? -1 : 1);
+	}
+}
+
+// the memory limit (sq_setmemorylimit) is checked at the calls and at the backward jumps: the error is catchable by the script
+#define SQ_CHECK_MEMORY() { if(_sharedstate->_mem_exceeded && _sharedstate->memLimitReached()) { raise_error("memory limit exceeded"); SQ_THROW(); } }
+
+// safe point of the calls and of the backward jumps: memory limit then execution budget (sq_setexecutionbudget) and
+// interrupt request (sq_interruptvm). Must be the first action of the instruction: a suspended VM executes it again
+#define SQ_SAFE_POINT() { \
+	SQ_CHECK_MEMORY(); \
+	if(_budget-- <= 0 || _interrupted.load(::std::memory_order_relaxed) == true) { \
+		rabbit::Result budget_res = budgetExhausted(); \
+		if(budget_res == SQ_SUSPEND_FLAG) { \
+			ci->_ip--; \
+			_suspended = SQTrue; \
+			_suspended_target = -1; \
+			_suspended_root = ci->_root; \
+			_suspended_traps = traps; \
+			outres.Null(); \
+			return true; \
+		} \
+		if(budget_res == SQ_ERROR) { SQ_THROW(); } \
+	} \
+}
+
+// Opcode dispatch of execute(): with SQ_COMPUTED_GOTO every handler jumps directly to the next one
+// through a label table (one indirect branch per opcode), otherwise a portable switch is used.
+#ifdef SQ_PROFILE_OPCODES
+	// the pairs only count the instructions that follow the previous one in the code (the sequences a superinstruction can replace)
+	#define SQ_VM_PROFILE(opcode) { \
+		_sharedstate->_opcodecounts[(opcode)]++; \
+		if(_i_ == _sharedstate->_opcodeprev + 1) { _sharedstate->_opcodepairs[_sharedstate->_opcodeprev->op][(opcode)]++; } \
+		_sharedstate->_opcodeprev = _i_; \
+	}
+#else
+	#define SQ_VM_PROFILE(op)
+#endif
+#ifdef SQ_COMPUTED_GOTO
+	#define SQ_VM_SWITCH(op) SQ_VM_PROFILE(op) goto *s_dispatch[(op)];
+	#define SQ_VM_CASE(op) label##op
+	#define SQ_VM_NEXT() { _i_ = ci->_ip++; SQ_VM_PROFILE(_i_->op) goto *s_dispatch[_i_->op]; }
+#else
+	#define SQ_VM_SWITCH(op) SQ_VM_PROFILE(op) switch(op)
+	#define SQ_VM_CASE(op) case op
+	#define SQ_VM_NEXT() continue
+#endif
+
+#ifdef SQ_COMPUTED_GOTO
+// Opcodes in the order of the enum: the dispatch table of execute() is built from this list
+#define SQ_VM_OPCODES(X) \
+	X(_OP_LINE) X(_OP_LOAD) X(_OP_LOADINT) X(_OP_LOADFLOAT) \
+	X(_OP_DLOAD) X(_OP_TAILCALL) X(_OP_CALL) X(_OP_PREPCALL) \
+	X(_OP_PREPCALLK) X(_OP_GETK) X(_OP_MOVE) X(_OP_NEWSLOT) \
+	X(_OP_DELETE) X(_OP_SET) X(_OP_GET) X(_OP_EQ) \
+	X(_OP_NE) X(_OP_ADD) X(_OP_SUB) X(_OP_MUL) \
+	X(_OP_DIV) X(_OP_MOD) X(_OP_BITW) X(_OP_RETURN) \
+	X(_OP_LOADNULLS) X(_OP_LOADROOT) X(_OP_LOADBOOL) X(_OP_DMOVE) \
+	X(_OP_JMP) X(_OP_JCMP) X(_OP_JZ) X(_OP_SETOUTER) \
+	X(_OP_GETOUTER) X(_OP_NEWOBJ) X(_OP_APPENDARRAY) X(_OP_COMPARITH) \
+	X(_OP_INC) X(_OP_INCL) X(_OP_PINC) X(_OP_PINCL) \
+	X(_OP_CMP) X(_OP_EXISTS) X(_OP_INSTANCEOF) X(_OP_AND) \
+	X(_OP_OR) X(_OP_NEG) X(_OP_NOT) X(_OP_BWNOT) \
+	X(_OP_CLOSURE) X(_OP_YIELD) X(_OP_RESUME) X(_OP_FOREACH) \
+	X(_OP_POSTFOREACH) X(_OP_CLONE) X(_OP_TYPEOF) X(_OP_PUSHTRAP) \
+	X(_OP_POPTRAP) X(_OP_THROW) X(_OP_NEWSLOTA) X(_OP_GETBASE) \
+	X(_OP_CLOSE) X(_OP_ADDINT) X(_OP_SUBINT) X(_OP_JCMPK) \
+	X(_OP_GETGET) X(_OP_FORPREP) X(_OP_FORLOOP) X(_OP_ADDI) \
+	X(_OP_ADDF) X(_OP_ADDS) X(_OP_SUBI) X(_OP_SUBF) \
+	X(_OP_MULI) X(_OP_MULF) X(_OP_DIVF) X(_OP_JCMPI) \
+	X(_OP_JCMPF) X(_OP_EQI) X(_OP_NEI)
+
+namespace {
+	#define SQ_VM_OPCODE(op) op,
+	constexpr SQOpcode g_dispatchorder[] = {
+		SQ_VM_OPCODES(SQ_VM_OPCODE)
+	};
+	#undef SQ_VM_OPCODE
+	// every entry of the table is at the position of its opcode
+	constexpr bool dispatchInOrder(int64_t idx) {
+		return    idx == SQ_OPCODE_COUNT
+		       || (    (int64_t)g_dispatchorder[idx] == idx
+		            && dispatchInOrder(idx + 1));
+	}
+}
+#endif
+
 bool rabbit::VirtualMachine::CLOSURE_OP(rabbit::ObjectPtr &target, rabbit::FunctionProto *func)
 {
 	int64_t nouters;
-	rabbit::Closure *closure = rabbit::Closure::create(_get_shared_state(this), func,_roottable.toTable()->getWeakRef(rabbit::OT_TABLE));
+	rabbit::Closure *closure = rabbit::Closure::create(_get_shared_state(this), func,_roottable.toTable()->getWeakRef(_get_shared_state(this), rabbit::OT_TABLE));
 	if((nouters = func->_noutervalues)) {
 		for(int64_t i = 0; i<nouters; i++) {
 			rabbit::OuterVar &v = func->_outervalues[i];
@@ -734,6 +965,16 @@ bool rabbit::VirtualMachine::execute(rabbit::ObjectPtr &closure, int64_t nargs,
 	AutoDec ad(&_nnativecalls);
 	int64_t traps = 0;
 	callInfo *prevci = ci;
+	const rabbit::Instruction *_i_ = NULL;
+#ifdef SQ_COMPUTED_GOTO
+	#define SQ_VM_LABEL(op) &&label##op,
+	static const void * const s_dispatch[] = {
+		SQ_VM_OPCODES(SQ_VM_LABEL)
+	};
+	#undef SQ_VM_LABEL
+	static_assert(sizeof(s_dispatch)/sizeof(s_dispatch[0]) == SQ_OPCODE_COUNT, "dispatch table does not cover all opcodes");
+	static_assert(dispatchInOrder(0), "the dispatch table is not in the order of the opcodes");
+#endif
 
 	switch(et) {
 		case ET_CALL: {
@@ -765,45 +1006,51 @@ exception_restore:
 	{
 		for(;;)
 		{
-			const rabbit::Instruction &_i_ = *ci->_ip++;
+			_i_ = ci->_ip++;
 			//dumpstack(_stackbase);
-			//printf("\n[%d] %s %d %d %d %d\n",ci->_ip-ci->_closure.toClosure()->_function->_instructions,g_InstrDesc[_i_.op].name,arg0,arg1,arg2,arg3);
-			switch(_i_.op)
+			//printf("\n[%d] %s %d %d %d %d\n",ci->_ip-ci->_closure.toClosure()->_function->_instructions,g_InstrDesc[_i_->op].name,arg0,arg1,arg2,arg3);
+			SQ_VM_SWITCH(_i_->op)
 			{
-			case _OP_LINE:
+			SQ_VM_CASE(_OP_LINE):
 				if (_debughook) {
 					callDebugHook('l',arg1);
 				}
-				continue;
-			case _OP_LOAD:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_LOAD):
 				TARGET = ci->_literals[arg1];
-				continue;
-			case _OP_LOADINT:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_LOADINT):
 				TARGET = (int64_t)((int32_t)arg1);
-				continue;
-			case _OP_LOADFLOAT: TARGET = *((const float_t *)&arg1); continue;
-			case _OP_DLOAD: TARGET = ci->_literals[arg1]; STK(arg2) = ci->_literals[arg3];continue;
-			case _OP_TAILCALL:{
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_LOADFLOAT): TARGET = *((const float_t *)&arg1); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_DLOAD): TARGET = ci->_literals[arg1]; STK(arg2) = ci->_literals[arg3];SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_TAILCALL):{
 				rabbit::ObjectPtr &t = STK(arg1);
 				if (    t.isClosure() == true
 				     && !t.toClosure()->_function->_bgenerator ){
-					rabbit::ObjectPtr clo = t;
-					int64_t last_top = _top;
-					if(_openouters) closeOuters(&(_stack[_stackbase]));
-					for (int64_t i = 0; i < arg3; i++) STK(i) = STK(arg2 + i);
-					_GUARD(startcall(clo.toClosure(), ci->_target, arg3, _stackbase, true));
-					if (last_top >= _top) {
-						_top = last_top;
+					SQ_SAFE_POINT();
+					// scoped: a computed goto leaving the block would not release 'clo'
+					{
+						rabbit::ObjectPtr clo = t;
+						int64_t last_top = _top;
+						if(_openouters) closeOuters(&(_stack[_stackbase]));
+						for (int64_t i = 0; i < arg3; i++) STK(i) = STK(arg2 + i);
+						_GUARD(startcall(clo.toClosure(), ci->_target, arg3, _stackbase, true));
+						if (last_top >= _top) {
+							_top = last_top;
+						}
 					}
-					continue;
+					SQ_VM_NEXT();
 				}
 							  }
-			case _OP_CALL: {
+			SQ_VM_CASE(_OP_CALL): {
+					SQ_SAFE_POINT();
 					rabbit::ObjectPtr clo = STK(arg1);
 					switch (clo.getType()) {
 						case rabbit::OT_CLOSURE:
 							_GUARD(startcall(clo.toClosure(), sarg0, arg3, _stackbase+arg2, false));
-							continue;
+							// break instead of SQ_VM_NEXT(): 'clo' must be released before the dispatch
+							break;
 						case rabbit::OT_NATIVECLOSURE:
 							{
 								bool suspend;
@@ -821,7 +1068,7 @@ exception_restore:
 									STK(arg0) = clo;
 								}
 							}
-							continue;
+							break;
 						case rabbit::OT_CLASS:
 							{
 								rabbit::ObjectPtr inst;
@@ -869,57 +1116,152 @@ exception_restore:
 							SQ_THROW();
 					}
 				}
-				  continue;
-			case _OP_PREPCALL:
-			case _OP_PREPCALLK: {
-					rabbit::ObjectPtr &key = _i_.op == _OP_PREPCALLK?(ci->_literals)[arg1]:STK(arg1);
+				  SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_PREPCALL): {
 					rabbit::ObjectPtr &o = STK(arg2);
-					if (!get(o, key, temp_reg,0,arg2)) {
+					if (!get(o, STK(arg1), temp_reg,0,arg2)) {
 						SQ_THROW();
 					}
 					STK(arg3) = o;
 					TARGET.swap(temp_reg);
 				}
-				continue;
-			case _OP_GETK:
-				if (!get(STK(arg2), ci->_literals[arg1], temp_reg, 0,arg2)) {
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_PREPCALLK): {
+					// arg3 is the inline cache slot, 'this' goes right after the closure
+					rabbit::ObjectPtr &o = STK(arg2);
+					if (!getCached(o, ci->_literals[arg1], temp_reg, arg3, arg2)) {
+						SQ_THROW();
+					}
+					STK(arg0+1) = o;
+					TARGET.swap(temp_reg);
+				}
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_GETK):
+				if (!getCached(STK(arg2), ci->_literals[arg1], temp_reg, arg3, arg2)) {
 					SQ_THROW();
 				}
 				TARGET.swap(temp_reg);
-				continue;
-			case _OP_MOVE: TARGET = STK(arg1); continue;
-			case _OP_NEWSLOT:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_MOVE): TARGET = STK(arg1); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_NEWSLOT):
 				_GUARD(newSlot(STK(arg1), STK(arg2), STK(arg3),false));
 				if(arg0 != 0xFF) {
 					TARGET = STK(arg3);
 				}
-				continue;
-			case _OP_DELETE: _GUARD(deleteSlot(STK(arg1), STK(arg2), TARGET)); continue;
-			case _OP_SET:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_DELETE): _GUARD(deleteSlot(STK(arg1), STK(arg2), TARGET)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_SET):
 				if (!set(STK(arg1), STK(arg2), STK(arg3),arg1)) { SQ_THROW(); }
 				if (arg0 != 0xFF) TARGET = STK(arg3);
-				continue;
-			case _OP_GET:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_GET):
 				if (!get(STK(arg1), STK(arg2), temp_reg, 0,arg1)) { SQ_THROW(); }
 				TARGET.swap(temp_reg);
-				continue;
-			case _OP_EQ:{
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_GETGET): {
+				// STK(arg1)[STK(arg2)][STK(arg3)]
+				if (!get(STK(arg1), STK(arg2), temp_reg, 0,arg1)) { SQ_THROW(); }
+				rabbit::ObjectPtr container;
+				container.swap(temp_reg);
+				if (!get(container, STK(arg3), temp_reg, 0,arg0)) { SQ_THROW(); }
+				TARGET.swap(temp_reg);
+				}
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_EQ):{
 				bool res;
+				if((STK(arg2).getType()|COND_LITERAL.getType()) == rabbit::OT_INTEGER) { SQ_QUICKEN(_OP_EQI); }
 				if(!isEqual(STK(arg2),COND_LITERAL,res)) { SQ_THROW(); }
 				TARGET = res?true:false;
-				}continue;
-			case _OP_NE:{
+				}SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_NE):{
 				bool res;
+				if((STK(arg2).getType()|COND_LITERAL.getType()) == rabbit::OT_INTEGER) { SQ_QUICKEN(_OP_NEI); }
 				if(!isEqual(STK(arg2),COND_LITERAL,res)) { SQ_THROW(); }
 				TARGET = (!res)?true:false;
-				} continue;
-			case _OP_ADD: _ARITH_(+,TARGET,STK(arg2),STK(arg1)); continue;
-			case _OP_SUB: _ARITH_(-,TARGET,STK(arg2),STK(arg1)); continue;
-			case _OP_MUL: _ARITH_(*,TARGET,STK(arg2),STK(arg1)); continue;
-			case _OP_DIV: _ARITH_NOZERO(/,TARGET,STK(arg2),STK(arg1),"division by zero"); continue;
-			case _OP_MOD: ARITH_OP('%',TARGET,STK(arg2),STK(arg1)); continue;
-			case _OP_BITW:  _GUARD(BW_OP( arg3,TARGET,STK(arg2),STK(arg1))); continue;
-			case _OP_RETURN:
+				} SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_EQI):{
+				const rabbit::ObjectPtr &o1 = STK(arg2), &o2 = COND_LITERAL;
+				bool res;
+				if((o1.getType()|o2.getType()) == rabbit::OT_INTEGER) {
+					res = o1.toInteger() == o2.toInteger();
+				} else {
+					SQ_QUICKEN(_OP_EQ);
+					if(!isEqual(o1,o2,res)) { SQ_THROW(); }
+				}
+				SQ_SET_SCALAR(TARGET,setBoolean,res);
+				}SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_NEI):{
+				const rabbit::ObjectPtr &o1 = STK(arg2), &o2 = COND_LITERAL;
+				bool res;
+				if((o1.getType()|o2.getType()) == rabbit::OT_INTEGER) {
+					res = o1.toInteger() == o2.toInteger();
+				} else {
+					SQ_QUICKEN(_OP_NE);
+					if(!isEqual(o1,o2,res)) { SQ_THROW(); }
+				}
+				SQ_SET_SCALAR(TARGET,setBoolean,!res);
+				}SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_ADD):
+				if((STK(arg2).getType()|STK(arg1).getType()) == rabbit::OT_STRING) { SQ_QUICKEN(_OP_ADDS); }
+				_ARITH_QUICKEN(+,_OP_ADDI,_OP_ADDF,TARGET,STK(arg2),STK(arg1));
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_SUB): _ARITH_QUICKEN(-,_OP_SUBI,_OP_SUBF,TARGET,STK(arg2),STK(arg1)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_MUL): _ARITH_QUICKEN(*,_OP_MULI,_OP_MULF,TARGET,STK(arg2),STK(arg1)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_DIV):
+				if((STK(arg2).getType()|STK(arg1).getType()) == rabbit::OT_FLOAT) { SQ_QUICKEN(_OP_DIVF); }
+				_ARITH_NOZERO(/,TARGET,STK(arg2),STK(arg1),"division by zero");
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_ADDINT): {
+				// STK(arg2) + arg1
+				rabbit::ObjectPtr &o1 = STK(arg2);
+				if(o1.isInteger() == true) {
+					int64_t ires;
+					SQ_INTEGER_OP(+,ires,o1.toInteger(),(int64_t)arg1);
+					SQ_SET_SCALAR(TARGET,setInteger,ires);
+				} else {
+					rabbit::ObjectPtr o2((int64_t)arg1);
+					_ARITH_(+,TARGET,o1,o2);
+				}
+				}
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_SUBINT): {
+				// STK(arg2) - arg1
+				rabbit::ObjectPtr &o1 = STK(arg2);
+				if(o1.isInteger() == true) {
+					int64_t ires;
+					SQ_INTEGER_OP(-,ires,o1.toInteger(),(int64_t)arg1);
+					SQ_SET_SCALAR(TARGET,setInteger,ires);
+				} else {
+					rabbit::ObjectPtr o2((int64_t)arg1);
+					_ARITH_(-,TARGET,o1,o2);
+				}
+				}
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_ADDI): _ARITH_INT(+,_OP_ADD,TARGET,STK(arg2),STK(arg1)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_ADDF): _ARITH_FLOAT(+,_OP_ADD,TARGET,STK(arg2),STK(arg1)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_ADDS):
+				if((STK(arg2).getType()|STK(arg1).getType()) == rabbit::OT_STRING) {
+					_GUARD(stringCat(STK(arg2),STK(arg1),TARGET));
+				} else {
+					SQ_QUICKEN(_OP_ADD);
+					_ARITH_(+,TARGET,STK(arg2),STK(arg1));
+				}
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_SUBI): _ARITH_INT(-,_OP_SUB,TARGET,STK(arg2),STK(arg1)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_SUBF): _ARITH_FLOAT(-,_OP_SUB,TARGET,STK(arg2),STK(arg1)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_MULI): _ARITH_INT(*,_OP_MUL,TARGET,STK(arg2),STK(arg1)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_MULF): _ARITH_FLOAT(*,_OP_MUL,TARGET,STK(arg2),STK(arg1)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_DIVF):
+				if((STK(arg2).getType()|STK(arg1).getType()) == rabbit::OT_FLOAT) {
+					SQ_SET_SCALAR(TARGET,setFloat,STK(arg2).toFloat() / STK(arg1).toFloat());
+				} else {
+					SQ_QUICKEN(_OP_DIV);
+					_ARITH_NOZERO(/,TARGET,STK(arg2),STK(arg1),"division by zero");
+				}
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_MOD): ARITH_OP('%',TARGET,STK(arg2),STK(arg1)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_BITW):  _GUARD(BW_OP( arg3,TARGET,STK(arg2),STK(arg1))); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_RETURN):
 				if((ci)->_generator) {
 					(ci)->_generator->kill();
 				}
@@ -929,9 +1271,9 @@ exception_restore:
 					outres.swap(temp_reg);
 					return true;
 				}
-				continue;
-			case _OP_LOADNULLS:{ for(int32_t n=0; n < arg1; n++) STK(arg0+n).Null(); }continue;
-			case _OP_LOADROOT:  {
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_LOADNULLS):{ for(int32_t n=0; n < arg1; n++) STK(arg0+n).Null(); }SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_LOADROOT):  {
 				rabbit::WeakRef *w = ci->_closure.toClosure()->_root;
 				if(w->_obj.isNull() == false) {
 					TARGET = w->_obj;
@@ -939,23 +1281,118 @@ exception_restore:
 					TARGET = _roottable; //shoud this be like this? or null
 				}
 								}
-				continue;
-			case _OP_LOADBOOL: TARGET = arg1?true:false; continue;
-			case _OP_DMOVE: STK(arg0) = STK(arg1); STK(arg2) = STK(arg3); continue;
-			case _OP_JMP: ci->_ip += (sarg1); continue;
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_LOADBOOL): TARGET = arg1?true:false; SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_DMOVE): STK(arg0) = STK(arg1); STK(arg2) = STK(arg3); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_JMP):
+				if(sarg1 < 0) {
+					SQ_SAFE_POINT();
+				}
+				ci->_ip += (sarg1);
+				SQ_VM_NEXT();
 			//case _OP_JNZ: if(!IsFalse(STK(arg0))) ci->_ip+=(sarg1); continue;
-			case _OP_JCMP:
+			SQ_VM_CASE(_OP_JCMP):
+				//every backward jump is a safe point (the peephole pass can thread a conditional jump to a loop start)
+				if(sarg1 < 0) {
+					SQ_SAFE_POINT();
+				}
+				switch(STK(arg2).getType()|STK(arg0).getType()) {
+					case rabbit::OT_INTEGER: SQ_QUICKEN(_OP_JCMPI); break;
+					case rabbit::OT_FLOAT: SQ_QUICKEN(_OP_JCMPF); break;
+					default: break;
+				}
+				_GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg0),temp_reg));
+				if(IsFalse(temp_reg)) ci->_ip+=(sarg1);
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_JCMPK): {
+				// _OP_JCMP with the literal arg0 as second operand
+				if(sarg1 < 0) {
+					SQ_SAFE_POINT();
+				}
+				const rabbit::ObjectPtr &o1 = STK(arg2), &o2 = ci->_literals[arg0];
+				if((o1.getType()|o2.getType()) == rabbit::OT_INTEGER) {
+					if(!cmpResult((CmpOP)arg3, cmpInteger(o1,o2))) ci->_ip+=(sarg1);
+				} else {
+					_GUARD(CMP_OP((CmpOP)arg3,o1,o2,temp_reg));
+					if(IsFalse(temp_reg)) ci->_ip+=(sarg1);
+				}
+				}
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_JCMPI):
+				if(sarg1 < 0) {
+					SQ_SAFE_POINT();
+				}
+				if((STK(arg2).getType()|STK(arg0).getType()) == rabbit::OT_INTEGER) {
+					if(!cmpResult((CmpOP)arg3, cmpInteger(STK(arg2),STK(arg0)))) ci->_ip+=(sarg1);
+					SQ_VM_NEXT();
+				}
+				SQ_QUICKEN(_OP_JCMP);
 				_GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg0),temp_reg));
 				if(IsFalse(temp_reg)) ci->_ip+=(sarg1);
-				continue;
-			case _OP_JZ: if(IsFalse(STK(arg0))) ci->_ip+=(sarg1); continue;
-			case _OP_GETOUTER: {
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_JCMPF):
+				if(sarg1 < 0) {
+					SQ_SAFE_POINT();
+				}
+				if((STK(arg2).getType()|STK(arg0).getType()) == rabbit::OT_FLOAT) {
+					if(!cmpResult((CmpOP)arg3, cmpFloat(STK(arg2),STK(arg0)))) ci->_ip+=(sarg1);
+					SQ_VM_NEXT();
+				}
+				SQ_QUICKEN(_OP_JCMP);
+				_GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg0),temp_reg));
+				if(IsFalse(temp_reg)) ci->_ip+=(sarg1);
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_FORPREP):
+				// first test of the loop: jumps after it if 'STK(arg0) cmp STK(arg2)' is false
+				if(sarg1 < 0) {
+					SQ_SAFE_POINT();
+				}
+				if((STK(arg0).getType()|STK(arg2).getType()) == rabbit::OT_INTEGER) {
+					if(!cmpResult(SQ_FORLOOP_CMP(arg3), cmpInteger(STK(arg0),STK(arg2)))) ci->_ip+=(sarg1);
+					SQ_VM_NEXT();
+				}
+				_GUARD(CMP_OP(SQ_FORLOOP_CMP(arg3),STK(arg0),STK(arg2),temp_reg));
+				if(IsFalse(temp_reg)) ci->_ip+=(sarg1);
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_FORLOOP): {
+				// steps the counter STK(arg0) and jumps back to the body while 'STK(arg0) cmp STK(arg2)' is true
+				SQ_SAFE_POINT();
+				rabbit::ObjectPtr &counter = STK(arg0);
+				int64_t step = SQ_FORLOOP_STEP(arg3);
+				bool loop;
+				if((counter.getType()|STK(arg2).getType()) == rabbit::OT_INTEGER) {
+					int64_t ires;
+					SQ_INTEGER_OP(+,ires,counter.toInteger(),((arg3&SQ_FORLOOP_SUB) ? -step : step));
+					counter.setInteger(ires);
+					loop = cmpResult(SQ_FORLOOP_CMP(arg3), cmpInteger(counter,STK(arg2)));
+				} else {
+					rabbit::ObjectPtr o(step);
+					if(arg3&SQ_FORLOOP_SUB) {
+						_ARITH_(-,counter,counter,o);
+					} else {
+						_ARITH_(+,counter,counter,o);
+					}
+					_GUARD(CMP_OP(SQ_FORLOOP_CMP(arg3),STK(arg0),STK(arg2),temp_reg));
+					loop = !IsFalse(temp_reg);
+				}
+				if(loop) {
+					ci->_ip += (sarg1);
+				}
+				}
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_JZ):
+				if(sarg1 < 0) {
+					SQ_SAFE_POINT();
+				}
+				if(IsFalse(STK(arg0))) ci->_ip+=(sarg1);
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_GETOUTER): {
 				rabbit::Closure *cur_cls = ci->_closure.toClosure();
 				rabbit::Outer *otr = cur_cls->_outervalues[arg1].toOuter();
 				TARGET = *(otr->_valptr);
 				}
-			continue;
-			case _OP_SETOUTER: {
+			SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_SETOUTER): {
 				rabbit::Closure *cur_cls = ci->_closure.toClosure();
 				rabbit::Outer   *otr = cur_cls->_outervalues[arg1].toOuter();
 				*(otr->_valptr) = STK(arg2);
@@ -963,106 +1400,113 @@ exception_restore:
 					TARGET = STK(arg2);
 				}
 				}
-			continue;
-			case _OP_NEWOBJ:
+			SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_NEWOBJ):
 				switch(arg3) {
-					case NOT_TABLE: TARGET = rabbit::Table::create(_get_shared_state(this), arg1); continue;
-					case NOT_ARRAY: TARGET = rabbit::Array::create(_get_shared_state(this), 0); TARGET.toArray()->reserve(arg1); continue;
-					case NOT_CLASS: _GUARD(CLASS_OP(TARGET,arg1,arg2)); continue;
-					default: assert(0); continue;
+					case NOT_TABLE: TARGET = rabbit::Table::createShaped(_get_shared_state(this), arg1); SQ_VM_NEXT();
+					case NOT_ARRAY: TARGET = rabbit::Array::create(_get_shared_state(this), 0); TARGET.toArray()->reserve(arg1); SQ_VM_NEXT();
+					case NOT_CLASS: _GUARD(CLASS_OP(TARGET,arg1,arg2)); SQ_VM_NEXT();
+					default: assert(0); SQ_VM_NEXT();
 				}
-			case _OP_APPENDARRAY:
+			SQ_VM_CASE(_OP_APPENDARRAY):
 				{
 					rabbit::Object val;
-					val._unVal.raw = 0;
+					val.setNull();
 				switch(arg2) {
 				case AAT_STACK:
 					val = STK(arg1); break;
 				case AAT_LITERAL:
 					val = ci->_literals[arg1]; break;
 				case AAT_INT:
-					val._type = rabbit::OT_INTEGER;
-					val._unVal.nInteger = (int64_t)((int32_t)arg1);
+					val.setInteger((int64_t)((int32_t)arg1));
 					break;
 				case AAT_FLOAT:
-					val._type = rabbit::OT_FLOAT;
-					val._unVal.fFloat = *((const float_t *)&arg1);
+					val.setFloat(*((const float_t *)&arg1));
 					break;
 				case AAT_BOOL:
-					val._type = rabbit::OT_BOOL;
-					val._unVal.nInteger = arg1;
+					val.setBoolean(arg1 != 0);
 					break;
-				default: val._type = rabbit::OT_INTEGER; assert(0); break;
+				default: val.setInteger(0); assert(0); break;
 
 				}
-				STK(arg0).toArray()->append(val); continue;
+				STK(arg0).toArray()->append(val); SQ_VM_NEXT();
 				}
-			case _OP_COMPARITH:
+			SQ_VM_CASE(_OP_COMPARITH):
 				{
 					int64_t selfidx = (((uint64_t)arg1&0xFFFF0000)>>16);
 					_GUARD(derefInc(arg3, TARGET, STK(selfidx), STK(arg2), STK(arg1&0x0000FFFF), false, selfidx));
 				}
-				continue;
-			case _OP_INC: {rabbit::ObjectPtr o(sarg3); _GUARD(derefInc('+',TARGET, STK(arg1), STK(arg2), o, false, arg1));} continue;
-			case _OP_INCL:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_INC): {rabbit::ObjectPtr o(sarg3); _GUARD(derefInc('+',TARGET, STK(arg1), STK(arg2), o, false, arg1));} SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_INCL):
 				{
 					rabbit::ObjectPtr &a = STK(arg1);
 					if(a.isInteger() == true) {
-						a._unVal.nInteger = a.toInteger() + sarg3;
+						int64_t ires;
+						SQ_INTEGER_OP(+,ires,a.toInteger(),sarg3);
+						a.setInteger(ires);
 					} else {
 						rabbit::ObjectPtr o(sarg3); //_GUARD(LOCAL_INC('+',TARGET, STK(arg1), o));
 						_ARITH_(+,a,a,o);
 					}
 				}
-				continue;
-			case _OP_PINC: {rabbit::ObjectPtr o(sarg3); _GUARD(derefInc('+',TARGET, STK(arg1), STK(arg2), o, true, arg1));} continue;
-			case _OP_PINCL:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_PINC): {rabbit::ObjectPtr o(sarg3); _GUARD(derefInc('+',TARGET, STK(arg1), STK(arg2), o, true, arg1));} SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_PINCL):
 				{
 					rabbit::ObjectPtr &a = STK(arg1);
 					if(a.isInteger() == true) {
+						int64_t ires;
+						SQ_INTEGER_OP(+,ires,a.toInteger(),sarg3);
 						TARGET = a;
-						a._unVal.nInteger = a.toInteger() + sarg3;
+						a.setInteger(ires);
 					} else {
 						rabbit::ObjectPtr o(sarg3); _GUARD(PLOCAL_INC('+',TARGET, STK(arg1), o));
 					}
 				}
-				continue;
-			case _OP_CMP:   _GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg1),TARGET))  continue;
-			case _OP_EXISTS: TARGET = get(STK(arg1), STK(arg2), temp_reg, GET_FLAG_DO_NOT_RAISE_ERROR | GET_FLAG_RAW, DONT_FALL_BACK) ? true : false; continue;
-			case _OP_INSTANCEOF:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_CMP):   _GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg1),TARGET))  SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_EXISTS): TARGET = get(STK(arg1), STK(arg2), temp_reg, GET_FLAG_DO_NOT_RAISE_ERROR | GET_FLAG_RAW, DONT_FALL_BACK) ? true : false; SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_INSTANCEOF):
 				if(STK(arg1).isClass() == false)
 				{raise_error("cannot apply instanceof between a %s and a %s",getTypeName(STK(arg1)),getTypeName(STK(arg2))); SQ_THROW();}
 				TARGET = (STK(arg2).isInstance() == true) ? (STK(arg2).toInstance()->instanceOf(STK(arg1).toClass())?true:false) : false;
-				continue;
-			case _OP_AND:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_AND):
+				if(sarg1 < 0) {
+					SQ_SAFE_POINT();
+				}
 				if(IsFalse(STK(arg2))) {
 					TARGET = STK(arg2);
 					ci->_ip += (sarg1);
 				}
-				continue;
-			case _OP_OR:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_OR):
+				if(sarg1 < 0) {
+					SQ_SAFE_POINT();
+				}
 				if(!IsFalse(STK(arg2))) {
 					TARGET = STK(arg2);
 					ci->_ip += (sarg1);
 				}
-				continue;
-			case _OP_NEG: _GUARD(NEG_OP(TARGET,STK(arg1))); continue;
-			case _OP_NOT: TARGET = IsFalse(STK(arg1)); continue;
-			case _OP_BWNOT:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_NEG): _GUARD(NEG_OP(TARGET,STK(arg1))); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_NOT): TARGET = IsFalse(STK(arg1)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_BWNOT):
 				if(STK(arg1).isInteger() == true) {
 					int64_t t = STK(arg1).toInteger();
 					TARGET = int64_t(~t);
-					continue;
+					SQ_VM_NEXT();
 				}
 				raise_error("attempt to perform a bitwise op on a %s", getTypeName(STK(arg1)));
 				SQ_THROW();
-			case _OP_CLOSURE: {
-				rabbit::Closure *c = ci->_closure._unVal.pClosure;
+			SQ_VM_CASE(_OP_CLOSURE): {
+				rabbit::Closure *c = ci->_closure.toClosure();
 				rabbit::FunctionProto *fp = c->_function;
-				if(!CLOSURE_OP(TARGET,fp->_functions[arg1]._unVal.pFunctionProto)) { SQ_THROW(); }
-				continue;
+				if(!CLOSURE_OP(TARGET,fp->_functions[arg1].toFunctionProto())) { SQ_THROW(); }
+				SQ_VM_NEXT();
 			}
-			case _OP_YIELD:{
+			SQ_VM_CASE(_OP_YIELD):{
 				if(ci->_generator) {
 					if(sarg1 != MAX_FUNC_STACKSIZE) temp_reg = STK(arg1);
 					_GUARD(ci->_generator->yield(this,arg2));
@@ -1079,44 +1523,76 @@ exception_restore:
 				}
 
 				}
-				continue;
-			case _OP_RESUME:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_RESUME):
 				if(STK(arg1).isGenerator() == false) {
 					raise_error("trying to resume a '%s',only genenerator can be resumed", getTypeName(STK(arg1)));
 					SQ_THROW();
 				}
 				_GUARD(STK(arg1).toGenerator()->resume(this, TARGET));
 				traps += ci->_etraps;
-				continue;
-			case _OP_FOREACH:{ int tojump;
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_FOREACH):{ int tojump;
+				// arrays and strings: the iterator is a raw index, the key and the scalar values are written in place
+				rabbit::ObjectPtr &container = STK(arg0), &itr = STK(arg2+2);
+				if(container.isArray() == true || container.isString() == true) {
+					int64_t idx = itr.isInteger() == true ? itr.toInteger() : 0;
+					rabbit::ObjectPtr &val = STK(arg2+1);
+					if(container.isArray() == true) {
+						rabbit::Array *a = container.toArray();
+						//the size is read again at each iteration, the body can resize the array
+						if(idx >= a->size()) {
+							ci->_ip += (sarg1);
+							SQ_VM_NEXT();
+						}
+						const rabbit::ObjectPtr &o = (*a)[idx];
+						if(o.isRefCounted() == false && val.isRefCounted() == false) {
+							static_cast<rabbit::Object&>(val) = o;
+						} else {
+							val = o.getRealObject();
+						}
+					} else {
+						rabbit::String *s = container.toString();
+						if(idx >= s->_len) {
+							ci->_ip += (sarg1);
+							SQ_VM_NEXT();
+						}
+						SQ_SET_SCALAR(val,setInteger,(int64_t)((uint64_t)s->_val[idx]));
+					}
+					SQ_SET_SCALAR(STK(arg2),setInteger,idx);
+					SQ_SET_SCALAR(itr,setInteger,idx + 1);
+					//skips the _OP_POSTFOREACH
+					ci->_ip += 1;
+					SQ_VM_NEXT();
+				}
 				_GUARD(FOREACH_OP(STK(arg0),STK(arg2),STK(arg2+1),STK(arg2+2),arg2,sarg1,tojump));
 				ci->_ip += tojump; }
-				continue;
-			case _OP_POSTFOREACH:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_POSTFOREACH):
 				assert(STK(arg0).isGenerator() == true);
 				if(STK(arg0).toGenerator()->_state == rabbit::Generator::eDead)
 					ci->_ip += (sarg1 - 1);
-				continue;
-			case _OP_CLONE: _GUARD(clone(STK(arg1), TARGET)); continue;
-			case _OP_TYPEOF: _GUARD(typeOf(STK(arg1), TARGET)) continue;
-			case _OP_PUSHTRAP:{
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_CLONE): _GUARD(clone(STK(arg1), TARGET)); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_TYPEOF): _GUARD(typeOf(STK(arg1), TARGET)) SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_PUSHTRAP):{
 				rabbit::Instruction *_iv = ci->_closure.toClosure()->_function->_instructions;
 				_etraps.pushBack(rabbit::ExceptionTrap(_top,_stackbase, &_iv[(ci->_ip-_iv)+arg1], arg0)); traps++;
 				ci->_etraps++;
 							  }
-				continue;
-			case _OP_POPTRAP: {
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_POPTRAP): {
 				for(int64_t i = 0; i < arg0; i++) {
 					_etraps.popBack(); traps--;
 					ci->_etraps--;
 				}
 							  }
-				continue;
-			case _OP_THROW: raise_error(TARGET); SQ_THROW(); continue;
-			case _OP_NEWSLOTA:
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_THROW): raise_error(TARGET); SQ_THROW(); SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_NEWSLOTA):
 				_GUARD(newSlotA(STK(arg1),STK(arg2),STK(arg3),(arg0&NEW_SLOT_ATTRIBUTES_FLAG) ? STK(arg2-1) : rabbit::ObjectPtr(),(arg0&NEW_SLOT_STATIC_FLAG)?true:false,false));
-				continue;
-			case _OP_GETBASE:{
+				SQ_VM_NEXT();
+			SQ_VM_CASE(_OP_GETBASE):{
 				rabbit::Closure *clo = ci->_closure.toClosure();
 				if(clo->_base) {
 					TARGET = clo->_base;
@@ -1124,11 +1600,11 @@ exception_restore:
 				else {
 					TARGET.Null();
 				}
-				continue;
+				SQ_VM_NEXT();
 			}
-			case _OP_CLOSE:
+			SQ_VM_CASE(_OP_CLOSE):
 				if(_openouters) closeOuters(&(STK(arg1)));
-				continue;
+				SQ_VM_NEXT();
 			}
 
 		}
@@ -1383,6 +1859,56 @@ bool rabbit::VirtualMachine::get(const rabbit::ObjectPtr &self, const rabbit::Ob
 	return false;
 }
 
+bool rabbit::VirtualMachine::getCached(const rabbit::ObjectPtr &self, const rabbit::ObjectPtr &key, rabbit::ObjectPtr &dest, int64_t cacheidx, int64_t selfidx) {
+	rabbit::Class *theclass;
+	uint64_t tag;
+	switch(self.getType()) {
+		case rabbit::OT_INSTANCE:
+			theclass = self.toInstance()->_class;
+			tag = theclass->_cachetag;
+			break;
+		case rabbit::OT_CLASS:
+			theclass = const_cast<rabbit::Class*>(self.toClass());
+			tag = theclass->_cachetag + 1;
+			break;
+		case rabbit::OT_TABLE:
+			// own slots of a shaped table are cached on the shape, the delegates are not cached
+			if (    cacheidx != SQ_NO_INLINE_CACHE
+			     && self.toTable()->getCached(key, dest, ci->_closure.toClosure()->_function->_inlinecaches[cacheidx])) {
+				return true;
+			}
+			return get(self, key, dest, 0, selfidx);
+		default:
+			return get(self, key, dest, 0, selfidx);
+	}
+	if (cacheidx == SQ_NO_INLINE_CACHE) {
+		return get(self, key, dest, 0, selfidx);
+	}
+	rabbit::InlineCache &cache = ci->_closure.toClosure()->_function->_inlinecaches[cacheidx];
+	int64_t member;
+	if (cache.find(tag, member) == false) {
+		rabbit::ObjectPtr idx;
+		if (theclass->_members->get(key, idx) == false) {
+			// not a member: delegation, metamethods and default delegate are not cached
+			return get(self, key, dest, 0, selfidx);
+		}
+		member = idx.toInteger();
+		cache.add(tag, member);
+	}
+	// same result as Instance::get() / Class::get() without the hash lookup
+	int64_t memberidx = member & 0x00FFFFFF;
+	if (member & MEMBER_TYPE_FIELD) {
+		if (self.isInstance() == true) {
+			dest = self.toInstance()->_values[memberidx].getRealObject();
+		} else {
+			dest = theclass->_defaultvalues[memberidx].val.getRealObject();
+		}
+	} else {
+		dest = theclass->_methods[memberidx].val;
+	}
+	return true;
+}
+
 bool rabbit::VirtualMachine::invokeDefaultDelegate(const rabbit::ObjectPtr &self,const rabbit::ObjectPtr &key,rabbit::ObjectPtr &dest)
 {
 	rabbit::Table *ddel = NULL;
@@ -1420,8 +1946,6 @@ int64_t rabbit::VirtualMachine::fallBackGet(const rabbit::ObjectPtr &self,const
 		rabbit::ObjectPtr closure;
 		if(self.toDelegable()->getMetaMethod(this, MT_GET, closure)) {
 			push(self);push(key);
-			_nmetamethodscall++;
-			AutoDec ad(&_nmetamethodscall);
 			if(call(closure, 2, _top - 2, dest, SQFalse)) {
 				pop(2);
 				return FALLBACK_OK;
@@ -1491,8 +2015,6 @@ int64_t rabbit::VirtualMachine::fallBackSet(const rabbit::ObjectPtr &self,const
 		rabbit::ObjectPtr t;
 		if(self.toDelegable()->getMetaMethod(this, MT_SET, closure)) {
 			push(self);push(key);push(val);
-			_nmetamethodscall++;
-			AutoDec ad(&_nmetamethodscall);
 			if(call(closure, 3, _top - 3, t, SQFalse)) {
 				pop(3);
 				return FALLBACK_OK;
@@ -1716,13 +2238,10 @@ bool rabbit::VirtualMachine::callMetaMethod(rabbit::ObjectPtr &closure,rabbit::M
 {
 	//rabbit::ObjectPtr closure;
 
-	_nmetamethodscall++;
 	if(call(closure, nparams, _top - nparams, outres, SQFalse)) {
-		_nmetamethodscall--;
 		pop(nparams);
 		return true;
 	}
-	_nmetamethodscall--;
 	//}
 	pop(nparams);
 	return false;
@@ -1770,13 +2289,11 @@ bool rabbit::VirtualMachine::enterFrame(int64_t newbase, int64_t newtop, bool ta
 
 	_stackbase = newbase;
 	_top = newtop;
-	if(newtop + MIN_STACK_OVERHEAD > (int64_t)_stack.size()) {
-		if(_nmetamethodscall) {
-			raise_error("stack overflow, cannot resize stack while in a metamethod");
-			return false;
-		}
-		_stack.resize(newtop + (MIN_STACK_OVERHEAD << 2));
-		relocateOuters();
+	//the stack does not move when it grows: the open outers and the references to the slots stay valid
+	if(    newtop + MIN_STACK_OVERHEAD > (int64_t)_stack.size()
+	    && !resizeStack(newtop + (MIN_STACK_OVERHEAD << 2))) {
+		raise_error("stack overflow");
+		return false;
 	}
 	return true;
 }
@@ -1798,15 +2315,6 @@ void rabbit::VirtualMachine::leaveFrame() {
 	}
 }
 
-void rabbit::VirtualMachine::relocateOuters()
-{
-	rabbit::Outer *p = _openouters;
-	while (p) {
-		p->_valptr = &_stack[p->_idx];
-		p = p->_next;
-	}
-}
-
 void rabbit::VirtualMachine::closeOuters(rabbit::ObjectPtr *stackindex) {
   rabbit::Outer *p;
   while ((p = _openouters) != NULL && p->_valptr >= stackindex) {
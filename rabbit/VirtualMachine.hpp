@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include <atomic>
 #include <etk/Vector.hpp>
 #include <rabbit/sqopcodes.hpp>
 
@@ -15,7 +16,8 @@
 #include <rabbit/ExceptionTrap.hpp>
 #include <rabbit/MetaMethod.hpp>
 #include <rabbit/ObjectPtr.hpp>
-#include <rabbit/RefCounted.hpp>
+#include <rabbit/Collectable.hpp>
+#include <rabbit/VirtualStack.hpp>
 
 
 #define MAX_NATIVE_CALLS 100
@@ -36,7 +38,7 @@ void sq_base_register(rabbit::VirtualMachine* v);
 #define _INLINE
 
 namespace rabbit {
-	class VirtualMachine : public rabbit::RefCounted {
+	class VirtualMachine : public rabbit::Collectable {
 		public:
 			struct callInfo{
 				rabbit::Instruction *_ip;
@@ -72,10 +74,14 @@ namespace rabbit {
 			//call a generic closure pure RABBIT or NATIVE
 			bool call(rabbit::ObjectPtr &closure, int64_t nparams, int64_t stackbase, rabbit::ObjectPtr &outres,rabbit::Bool raiseerror);
 			rabbit::Result Suspend();
+			//called by the safe points of execute() when the budget is spent or the VM interrupted: SQ_OK (no limit),
+			//SQ_SUSPEND_FLAG (suspend the VM) or SQ_ERROR (error raised)
+			rabbit::Result budgetExhausted();
 		
 			void callDebugHook(int64_t type,int64_t forcedline=0);
 			void callerrorHandler(rabbit::ObjectPtr &e);
 			bool get(const rabbit::ObjectPtr &self, const rabbit::ObjectPtr &key, rabbit::ObjectPtr &dest, uint64_t getflags, int64_t selfidx);
+			bool getCached(const rabbit::ObjectPtr &self, const rabbit::ObjectPtr &key, rabbit::ObjectPtr &dest, int64_t cacheidx, int64_t selfidx);
 			int64_t fallBackGet(const rabbit::ObjectPtr &self,const rabbit::ObjectPtr &key,rabbit::ObjectPtr &dest);
 			bool invokeDefaultDelegate(const rabbit::ObjectPtr &self,const rabbit::ObjectPtr &key,rabbit::ObjectPtr &dest);
 			bool set(const rabbit::ObjectPtr &self, const rabbit::ObjectPtr &key, const rabbit::ObjectPtr &val, int64_t selfidx);
@@ -98,7 +104,6 @@ namespace rabbit {
 			void raise_ParamTypeerror(int64_t nparam,int64_t typemask,int64_t type);
 		
 			void findOuter(rabbit::ObjectPtr &target, rabbit::ObjectPtr *stackindex);
-			void relocateOuters();
 			void closeOuters(rabbit::ObjectPtr *stackindex);
 		
 			bool typeOf(const rabbit::ObjectPtr &obj1, rabbit::ObjectPtr &dest);
@@ -121,7 +126,11 @@ namespace rabbit {
 			void dumpstack(int64_t stackbase=-1, bool dumpall = false);
 		#endif
 		
+			void mark(rabbit::Collectable **chain);
 			void finalize();
+			rabbit::ObjectType getType() {
+				return rabbit::OT_THREAD;
+			}
 			void GrowcallStack() {
 				int64_t newsize = _alloccallsstacksize*2;
 				_callstackdata.resize(newsize);
@@ -145,7 +154,9 @@ namespace rabbit {
 			rabbit::ObjectPtr& getUp(int64_t n);
 			rabbit::ObjectPtr& getAt(int64_t n);
 		
-			etk::Vector<rabbit::ObjectPtr> _stack;
+			//resize _stack and report it to the memory accounting of the shared state, false over SQ_STACK_RESERVE
+			bool resizeStack(int64_t newsize);
+			rabbit::VirtualStack _stack;
 		
 			int64_t _top;
 			int64_t _stackbase;
@@ -169,16 +180,18 @@ namespace rabbit {
 			etk::Vector<rabbit::ExceptionTrap> _etraps;
 			callInfo *ci;
 			rabbit::UserPointer _foreignptr;
-			//VMs sharing the same state
-			rabbit::SharedState *_sharedstate;
 			int64_t _nnativecalls;
-			int64_t _nmetamethodscall;
 			SQRELEASEHOOK _releasehook;
 			//suspend infos
 			rabbit::Bool _suspended;
 			rabbit::Bool _suspended_root;
 			int64_t _suspended_target;
 			int64_t _suspended_traps;
+			//execution budget (see sq_setexecutionbudget)
+			int64_t _budget; //!< safe points left before budgetExhausted(), INT64_MAX without limit
+			bool _budgetlimited; //!< false: _budget is only a counter
+			int64_t _budgetmode; //!< SQ_BUDGET_ERROR or SQ_BUDGET_SUSPEND
+			::std::atomic<bool> _interrupted; //!< set by sq_interruptvm (any thread)
 	};
 	
 	
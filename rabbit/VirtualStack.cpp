@@ -0,0 +1,91 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#include <rabbit/VirtualStack.hpp>
+#include <etk/Allocator.hpp>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+#endif
+
+namespace {
+	const int64_t s_reservedBytes = (int64_t)SQ_STACK_RESERVE * (int64_t)sizeof(rabbit::ObjectPtr);
+
+	void* reserveMemory(int64_t size) {
+		#ifdef _WIN32
+			return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+		#else
+			void *ptr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			return ptr == MAP_FAILED ? NULL : ptr;
+		#endif
+	}
+	bool commitMemory(void *ptr, int64_t size) {
+		#ifdef _WIN32
+			return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+		#else
+			return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+		#endif
+	}
+	void releaseMemory(void *ptr, int64_t size) {
+		#ifdef _WIN32
+			VirtualFree(ptr, 0, MEM_RELEASE);
+		#else
+			munmap(ptr, size);
+		#endif
+	}
+}
+
+rabbit::VirtualStack::VirtualStack() :
+  _data(NULL),
+  _size(0),
+  _committed(0) {
+
+}
+
+rabbit::VirtualStack::~VirtualStack() {
+	if(_data == NULL) {
+		return;
+	}
+	for(int64_t i=0; i<_size; ++i) {
+		_data[i].~ObjectPtr();
+	}
+	releaseMemory(_data, s_reservedBytes);
+}
+
+bool rabbit::VirtualStack::resize(int64_t newsize) {
+	if(newsize > SQ_STACK_RESERVE) {
+		return false;
+	}
+	if(_data == NULL) {
+		_data = (rabbit::ObjectPtr*)reserveMemory(s_reservedBytes);
+		if(_data == NULL) {
+			return false;
+		}
+	}
+	int64_t needed = newsize * (int64_t)sizeof(rabbit::ObjectPtr);
+	if(needed > _committed) {
+		int64_t commit = ((needed + SQ_STACK_COMMIT - 1) / SQ_STACK_COMMIT) * SQ_STACK_COMMIT;
+		if(commit > s_reservedBytes) {
+			commit = s_reservedBytes;
+		}
+		if(commitMemory((char*)_data + _committed, commit - _committed) == false) {
+			return false;
+		}
+		_committed = commit;
+	}
+	// the committed pages are kept when the stack shrinks
+	for(int64_t i=_size; i<newsize; ++i) {
+		new ((char*)&_data[i]) rabbit::ObjectPtr();
+	}
+	for(int64_t i=newsize; i<_size; ++i) {
+		_data[i].~ObjectPtr();
+	}
+	_size = newsize;
+	return true;
+}
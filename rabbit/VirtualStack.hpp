@@ -0,0 +1,53 @@
+/**
+ * @author Alberto DEMICHELIS
+ * @author Edouard DUPIN
+ * @copyright 2018, Edouard DUPIN, all right reserved
+ * @copyright 2003-2017, Alberto DEMICHELIS, all right reserved
+ * @license MPL-2 (see license file)
+ */
+#pragma once
+
+#include <etk/types.hpp>
+#include <rabbit/ObjectPtr.hpp>
+
+// maximum number of slots of the stack of a virtual machine: the address space is reserved when the VM is created
+// and the memory is committed on demand, the slots never move
+#ifndef SQ_STACK_RESERVE
+	#define SQ_STACK_RESERVE (1024*1024)
+#endif
+// granularity of the commit (bytes, multiple of the page size)
+#define SQ_STACK_COMMIT (64*1024)
+
+namespace rabbit {
+	/**
+	 * Stack of a virtual machine in a reserved range of virtual memory.
+	 * resize() commits the pages and constructs the new slots in place: the address of a slot stays valid for the life
+	 * of the stack (open outers, references held by the native calls and the metamethods).
+	 */
+	class VirtualStack {
+		public:
+			VirtualStack();
+			~VirtualStack();
+			//false when 'newsize' is over SQ_STACK_RESERVE or when the memory can not be committed
+			bool resize(int64_t newsize);
+			uint64_t size() const {
+				return _size;
+			}
+			//bytes of memory committed for the slots
+			int64_t committed() const {
+				return _committed;
+			}
+			rabbit::ObjectPtr& operator[] (const size_t _pos) {
+				return _data[_pos];
+			}
+			const rabbit::ObjectPtr& operator[] (const size_t _pos) const {
+				return _data[_pos];
+			}
+		private:
+			VirtualStack(const VirtualStack&) = delete;
+			VirtualStack& operator=(const VirtualStack&) = delete;
+			rabbit::ObjectPtr *_data; //!< start of the reserved range (NULL before the first resize)
+			int64_t _size; //!< constructed slots
+			int64_t _committed; //!< bytes committed at the start of the range
+	};
+}
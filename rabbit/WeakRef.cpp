@@ -10,10 +10,11 @@
 #include <rabbit/WeakRef.hpp>
 #include <rabbit/rabbit.hpp>
 #include <rabbit/squtils.hpp>
+#include <rabbit/SharedState.hpp>
 
 void rabbit::WeakRef::release() {
 	if(_obj.isRefCounted() == true) {
-		_obj._unVal.pRefCounted->_weakref = null;
+		_obj.toRefCounted()->_weakref = null;
 	}
-	sq_delete(this, WeakRef);
+	sq_delete(_sharedstate, rabbit::MEM_WEAKREF, this, WeakRef);
 }
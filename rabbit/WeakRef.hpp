@@ -17,6 +17,7 @@ namespace rabbit {
 			void release();
 		public:
 			rabbit::Object _obj;
+			rabbit::SharedState *_sharedstate;
 		protected:
 			friend RefCounted;
 	};
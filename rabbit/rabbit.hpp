@@ -22,6 +22,9 @@
 #define SQ_VMSTATE_RUNNING    1
 #define SQ_VMSTATE_SUSPENDED  2
 
+#define SQ_BUDGET_ERROR       0
+#define SQ_BUDGET_SUSPEND     1
+
 #define RABBIT_EOB 0
 #define SQ_BYTECODE_STREAM_TAG  0xFAFA
 
@@ -38,12 +41,15 @@ typedef void (*SQPRINTFUNCTION)(rabbit::VirtualMachine*,const char * ,...);
 typedef void (*SQDEBUGHOOK)(rabbit::VirtualMachine* /*v*/, int64_t /*type*/, const char * /*sourcename*/, int64_t /*line*/, const char * /*funcname*/);
 typedef int64_t (*SQWRITEFUNC)(rabbit::UserPointer,rabbit::UserPointer,int64_t);
 typedef int64_t (*SQREADFUNC)(rabbit::UserPointer,rabbit::UserPointer,int64_t);
+//native data of the instances of a class in the structured clones (see sq_registercloneclass)
+typedef rabbit::Result (*SQCLONEWRITE)(rabbit::UserPointer /*instance user pointer*/,rabbit::Bool /*transfer*/,SQWRITEFUNC,rabbit::UserPointer);
+typedef rabbit::Result (*SQCLONEREAD)(rabbit::VirtualMachine* /*v*/,int64_t /*idx of the new instance*/,rabbit::Bool /*transfer*/,SQREADFUNC,rabbit::UserPointer);
 
 typedef int64_t (*SQLEXREADFUNC)(rabbit::UserPointer);
 
 namespace rabbit {
 /*vm*/
-rabbit::VirtualMachine* sq_open();
+rabbit::VirtualMachine* sq_open(rabbit::Allocator *alloc=NULL);
 rabbit::VirtualMachine* sq_newthread(rabbit::VirtualMachine* friendvm);
 void sq_seterrorhandler(rabbit::VirtualMachine* v);
 void sq_close(rabbit::VirtualMachine* v);
@@ -61,15 +67,46 @@ SQPRINTFUNCTION sq_geterrorfunc(rabbit::VirtualMachine* v);
 rabbit::Result sq_suspendvm(rabbit::VirtualMachine* v);
 rabbit::Result sq_wakeupvm(rabbit::VirtualMachine* v,rabbit::Bool resumedret,rabbit::Bool retval,rabbit::Bool raiseerror,rabbit::Bool throwerror);
 int64_t sq_getvmstate(rabbit::VirtualMachine* v);
+//budget: number of safe points (calls and backward jumps) the VM can pass, <0: no limit; at 0 the VM raises a catchable
+//error (SQ_BUDGET_ERROR) or suspends (SQ_BUDGET_SUSPEND, continued by sq_wakeupvm) until it gets a new budget
+void sq_setexecutionbudget(rabbit::VirtualMachine* v,int64_t budget,int64_t mode);
+int64_t sq_getexecutionbudget(rabbit::VirtualMachine* v);
+//can be called from any thread: the VM stops at its next safe point as if its budget was exhausted (cleared by sq_setexecutionbudget)
+void sq_interruptvm(rabbit::VirtualMachine* v);
 int64_t sq_getversion();
 
 /*compiler*/
 rabbit::Result sq_compile(rabbit::VirtualMachine* v,SQLEXREADFUNC read,rabbit::UserPointer p,const char *sourcename,rabbit::Bool raiseerror);
+//the source is scanned in place (no copy of the identifiers and of the plain string literals)
 rabbit::Result sq_compilebuffer(rabbit::VirtualMachine* v,const char *s,int64_t size,const char *sourcename,rabbit::Bool raiseerror);
 void sq_enabledebuginfo(rabbit::VirtualMachine* v, rabbit::Bool enable);
+//peephole pass over the bytecode of the functions compiled after the call (on by default)
+void sq_enableoptimizer(rabbit::VirtualMachine* v, rabbit::Bool enable);
+//fused opcodes for the frequent instruction pairs in the functions compiled after the call (needs the optimizer, off by default)
+void sq_enablesuperinstructions(rabbit::VirtualMachine* v, rabbit::Bool enable);
 void sq_notifyallexceptions(rabbit::VirtualMachine* v, rabbit::Bool enable);
 void sq_setcompilererrorhandler(rabbit::VirtualMachine* v,SQCOMPILERERROR f);
 
+/*serialization*/
+rabbit::Result sq_writeclosure(rabbit::VirtualMachine* vm,SQWRITEFUNC writef,rabbit::UserPointer up);
+rabbit::Result sq_readclosure(rabbit::VirtualMachine* vm,SQREADFUNC readf,rabbit::UserPointer up);
+//bytecode images are used in place (see rabbit::BytecodeImage): 'data' must stay valid until 'release' is
+//called with it (also when the load fails), 'sourcehash' identifies the source the image was built from
+rabbit::Result sq_writeimage(rabbit::VirtualMachine* vm,SQWRITEFUNC writef,rabbit::UserPointer up,uint64_t sourcehash);
+rabbit::Result sq_readimage(rabbit::VirtualMachine* vm,const rabbit::UserPointer data,int64_t size,uint64_t sourcehash,SQRELEASEHOOK release);
+//heap snapshot of the root table, the registry and the const table (see rabbit::Snapshot), the state that reads it
+//must have registered the same native functions, its root table, registry and const table are replaced
+rabbit::Result sq_writesnapshot(rabbit::VirtualMachine* vm,SQWRITEFUNC writef,rabbit::UserPointer up);
+rabbit::Result sq_readsnapshot(rabbit::VirtualMachine* vm,SQREADFUNC readf,rabbit::UserPointer up);
+//structured clone of the value at 'idx' (see rabbit::StructuredClone), pushed back by sq_readclone in any shared state;
+//'transfer' lets the hooks move the native data (blobs) instead of copying it, the stream is then only valid in this process
+//and sq_readclone refuses it unless 'transfer' is set (never for data from outside the process)
+rabbit::Result sq_writeclone(rabbit::VirtualMachine* vm,int64_t idx,rabbit::Bool transfer,SQWRITEFUNC writef,rabbit::UserPointer up);
+rabbit::Result sq_readclone(rabbit::VirtualMachine* vm,rabbit::Bool transfer,SQREADFUNC readf,rabbit::UserPointer up);
+//the instances of the class at 'idx' can be cloned, they are found again by 'name' in the state that reads the clone;
+//the hooks copy their native data, NULL for the classes that only have script fields
+rabbit::Result sq_registercloneclass(rabbit::VirtualMachine* vm,int64_t idx,const char *name,SQCLONEWRITE writef,SQCLONEREAD readf);
+
 /*stack operations*/
 void sq_push(rabbit::VirtualMachine* v,int64_t idx);
 void sq_pop(rabbit::VirtualMachine* v,int64_t nelemstopop);
@@ -123,6 +160,9 @@ rabbit::Result sq_getfunctioninfo(rabbit::VirtualMachine* v,int64_t level,rabbit
 rabbit::Result sq_getclosureinfo(rabbit::VirtualMachine* v,int64_t idx,uint64_t *nparams,uint64_t *nfreevars);
 rabbit::Result sq_getclosurename(rabbit::VirtualMachine* v,int64_t idx);
 rabbit::Result sq_setnativeclosurename(rabbit::VirtualMachine* v,int64_t idx,const char *name);
+//registers the function of a native closure with the key "scope.name" for the heap snapshots (see sq_writesnapshot),
+//fails when the key is given to another function
+rabbit::Result sq_bindnative(rabbit::VirtualMachine* v,int64_t idx,const char *scope,const char *name);
 rabbit::Result sq_setinstanceup(rabbit::VirtualMachine* v, int64_t idx, rabbit::UserPointer p);
 rabbit::Result sq_getinstanceup(rabbit::VirtualMachine* v, int64_t idx, rabbit::UserPointer *p,rabbit::UserPointer typetag);
 rabbit::Result sq_setclassudsize(rabbit::VirtualMachine* v, int64_t idx, int64_t udsize);
@@ -197,6 +237,19 @@ uint64_t sq_getvmrefcount(rabbit::VirtualMachine* v, const rabbit::Object *po);
 /*GC*/
 int64_t sq_collectgarbage(rabbit::VirtualMachine* v);
 rabbit::Result sq_resurrectunreachable(rabbit::VirtualMachine* v);
+rabbit::Bool sq_gcstep(rabbit::VirtualMachine* v,int64_t budget_us);
+rabbit::Result sq_getgcstats(rabbit::VirtualMachine* v,rabbit::GcStats *stats);
+
+/*memory accounting*/
+void sq_setmemorylimit(rabbit::VirtualMachine* v,int64_t bytes);
+rabbit::Result sq_getmemorystats(rabbit::VirtualMachine* v,rabbit::MemoryStats *stats);
+
+/*opcode statistics (only with SQ_PROFILE_OPCODES)*/
+//push a table opcode name -> number of executions
+rabbit::Result sq_getopcodestats(rabbit::VirtualMachine* v);
+//push a table "opcode opcode" -> number of executions of the second right after the first (sequences of the code only)
+rabbit::Result sq_getopcodepairstats(rabbit::VirtualMachine* v);
+void sq_resetopcodestats(rabbit::VirtualMachine* v);
 
 /*mem allocation*/
 void *sq_malloc(uint64_t size);
@@ -29,6 +29,13 @@
 #include <rabbit/SharedState.hpp>
 #include <rabbit/Outer.hpp>
 #include <rabbit/Closure.hpp>
+#include <rabbit/BytecodeImage.hpp>
+#include <rabbit/Snapshot.hpp>
+#include <rabbit/StructuredClone.hpp>
+
+#ifdef SQ_PROFILE_OPCODES
+extern rabbit::InstructionDesc g_InstrDesc[];
+#endif
 
 static bool sq_aux_gettypedarg(rabbit::VirtualMachine* v,int64_t idx,rabbit::ObjectType type,rabbit::ObjectPtr **o)
 {
@@ -56,13 +63,17 @@ namespace rabbit {
 		return sq_throwerror(v, _get_shared_state(v)->getScratchPad(-1));
 	}
 }
-rabbit::VirtualMachine* rabbit::sq_open()
+rabbit::VirtualMachine* rabbit::sq_open(rabbit::Allocator *alloc)
 {
-	rabbit::SharedState *ss;
-	sq_new(ss, rabbit::SharedState);
+	if(alloc == NULL) {
+		alloc = rabbit::Allocator::getDefault();
+	}
+	//the shared state itself lives in its allocator
+	rabbit::SharedState *ss = (rabbit::SharedState*)alloc->malloc(sizeof(rabbit::SharedState));
+	new ((char*)ss) rabbit::SharedState(alloc);
 	ss->init();
 	
-	char* allocatedData = (char*)SQ_MALLOC(sizeof(rabbit::VirtualMachine));
+	char* allocatedData = (char*)SQ_MALLOC(ss, rabbit::MEM_THREAD, sizeof(rabbit::VirtualMachine));
 	rabbit::VirtualMachine *v = new (allocatedData) rabbit::VirtualMachine(ss);
 	ss->_root_vm = v;
 	
@@ -70,7 +81,7 @@ rabbit::VirtualMachine* rabbit::sq_open()
 		return v;
 	} else {
 		v->~VirtualMachine();
-		SQ_FREE(allocatedData,sizeof(rabbit::VirtualMachine));
+		SQ_FREE(ss, rabbit::MEM_THREAD, allocatedData,sizeof(rabbit::VirtualMachine));
 		return NULL;
 	}
 	return v;
@@ -81,16 +92,15 @@ rabbit::VirtualMachine* rabbit::sq_newthread(rabbit::VirtualMachine* friendvm)
 	rabbit::SharedState *ss;
 	ss=_get_shared_state(friendvm);
 	
-	char* allocatedData = (char*)SQ_MALLOC(sizeof(rabbit::VirtualMachine));
+	char* allocatedData = (char*)SQ_MALLOC(ss, rabbit::MEM_THREAD, sizeof(rabbit::VirtualMachine));
 	rabbit::VirtualMachine *v = new (allocatedData) rabbit::VirtualMachine(ss);
-	ss->_root_vm = v;
 	
 	if(v->init(friendvm)) {
 		friendvm->push(v);
 		return v;
 	} else {
 		v->~VirtualMachine();
-		SQ_FREE(allocatedData,sizeof(rabbit::VirtualMachine));
+		SQ_FREE(ss, rabbit::MEM_THREAD, allocatedData,sizeof(rabbit::VirtualMachine));
 		return NULL;
 	}
 }
@@ -140,7 +150,10 @@ void rabbit::sq_close(rabbit::VirtualMachine* v)
 {
 	rabbit::SharedState *ss = _get_shared_state(v);
 	ss->_root_vm.toVirtualMachine()->finalize();
-	sq_delete(ss, SharedState);
+	// the state owns the accounting, release it through its allocator directly
+	rabbit::Allocator *alloc = ss->_alloc;
+	ss->~SharedState();
+	alloc->free(ss, sizeof(rabbit::SharedState));
 }
 
 int64_t rabbit::sq_getversion()
@@ -152,17 +165,146 @@ rabbit::Result rabbit::sq_compile(rabbit::VirtualMachine* v,SQLEXREADFUNC read,r
 {
 	rabbit::ObjectPtr o;
 	if(compile(v, read, p, sourcename, o, raiseerror?true:false, _get_shared_state(v)->_debuginfo)) {
-		v->push(rabbit::Closure::create(_get_shared_state(v), o.toFunctionProto(), v->_roottable.toTable()->getWeakRef(rabbit::OT_TABLE)));
+		v->push(rabbit::Closure::create(_get_shared_state(v), o.toFunctionProto(), v->_roottable.toTable()->getWeakRef(_get_shared_state(v), rabbit::OT_TABLE)));
 		return SQ_OK;
 	}
 	return SQ_ERROR;
 }
 
+rabbit::Result rabbit::sq_writeclosure(rabbit::VirtualMachine* v,SQWRITEFUNC w,rabbit::UserPointer up)
+{
+	rabbit::ObjectPtr *o = NULL;
+	_GETSAFE_OBJ(v, -1, rabbit::OT_CLOSURE,o);
+	unsigned short tag = SQ_BYTECODE_STREAM_TAG;
+	if(o->toClosure()->_function->_noutervalues) {
+		return sq_throwerror(v,"a closure with free variables bound cannot be serialized");
+	}
+	if(w(up,&tag,2) != 2) {
+		return sq_throwerror(v,"io error");
+	}
+	if(!o->toClosure()->save(v,up,w)) {
+		return SQ_ERROR;
+	}
+	return SQ_OK;
+}
+
+rabbit::Result rabbit::sq_readclosure(rabbit::VirtualMachine* v,SQREADFUNC r,rabbit::UserPointer up)
+{
+	rabbit::ObjectPtr closure;
+	unsigned short tag;
+	if(r(up,&tag,2) != 2) {
+		return sq_throwerror(v,"io error");
+	}
+	if(tag != SQ_BYTECODE_STREAM_TAG) {
+		return sq_throwerror(v,"invalid stream");
+	}
+	if(!rabbit::Closure::load(v,up,r,closure)) {
+		return SQ_ERROR;
+	}
+	v->push(closure);
+	return SQ_OK;
+}
+
+rabbit::Result rabbit::sq_writeimage(rabbit::VirtualMachine* v,SQWRITEFUNC w,rabbit::UserPointer up,uint64_t sourcehash)
+{
+	rabbit::ObjectPtr *o = NULL;
+	_GETSAFE_OBJ(v, -1, rabbit::OT_CLOSURE,o);
+	if(o->toClosure()->_function->_noutervalues) {
+		return sq_throwerror(v,"a closure with free variables bound cannot be serialized");
+	}
+	if(!rabbit::BytecodeImage::write(v,o->toClosure()->_function,sourcehash,w,up)) {
+		return SQ_ERROR;
+	}
+	return SQ_OK;
+}
+
+rabbit::Result rabbit::sq_readimage(rabbit::VirtualMachine* v,const rabbit::UserPointer data,int64_t size,uint64_t sourcehash,SQRELEASEHOOK release)
+{
+	rabbit::SharedState *ss = _get_shared_state(v);
+	rabbit::BytecodeImage *image = rabbit::BytecodeImage::create(ss,(const uint8_t *)data,size,release);
+	rabbit::ObjectPtr func;
+	__ObjaddRef(image);
+	bool ok = image->load(v,sourcehash,func);
+	//the loaded functions keep the image alive, without them it is released here
+	__Objrelease(image);
+	if(!ok) {
+		return SQ_ERROR;
+	}
+	v->push(rabbit::Closure::create(ss,func.toFunctionProto(),v->_roottable.toTable()->getWeakRef(ss, rabbit::OT_TABLE)));
+	return SQ_OK;
+}
+
+rabbit::Result rabbit::sq_writesnapshot(rabbit::VirtualMachine* v,SQWRITEFUNC w,rabbit::UserPointer up)
+{
+	if(!rabbit::Snapshot::write(v,w,up)) {
+		return SQ_ERROR;
+	}
+	return SQ_OK;
+}
+
+rabbit::Result rabbit::sq_readsnapshot(rabbit::VirtualMachine* v,SQREADFUNC r,rabbit::UserPointer up)
+{
+	if(!rabbit::Snapshot::read(v,r,up)) {
+		return SQ_ERROR;
+	}
+	return SQ_OK;
+}
+
+rabbit::Result rabbit::sq_writeclone(rabbit::VirtualMachine* v,int64_t idx,rabbit::Bool transfer,SQWRITEFUNC w,rabbit::UserPointer up)
+{
+	rabbit::ObjectPtr o = stack_get(v,idx);
+	if(!rabbit::StructuredClone::write(v,o,transfer?true:false,w,up)) {
+		return SQ_ERROR;
+	}
+	return SQ_OK;
+}
+
+rabbit::Result rabbit::sq_readclone(rabbit::VirtualMachine* v,rabbit::Bool transfer,SQREADFUNC r,rabbit::UserPointer up)
+{
+	rabbit::ObjectPtr o;
+	if(!rabbit::StructuredClone::read(v,transfer?true:false,r,up,o)) {
+		return SQ_ERROR;
+	}
+	v->push(o);
+	return SQ_OK;
+}
+
+rabbit::Result rabbit::sq_registercloneclass(rabbit::VirtualMachine* v,int64_t idx,const char *name,SQCLONEWRITE writef,SQCLONEREAD readf)
+{
+	rabbit::ObjectPtr *o = NULL;
+	_GETSAFE_OBJ(v, idx, rabbit::OT_CLASS,o);
+	rabbit::SharedState *ss = _get_shared_state(v);
+	rabbit::Table *classes = ss->_cloneclasses.toTable();
+	rabbit::ObjectPtr key = rabbit::String::create(ss,name);
+	rabbit::ObjectPtr other;
+	if(    classes->get(key,other)
+	    && (*other.toArray())[0].toClass() != o->toClass()) {
+		return sq_throwerror(v,"another class is registered with this name");
+	}
+	rabbit::Array *entry = rabbit::Array::create(ss,0);
+	entry->append(*o);
+	entry->append(rabbit::ObjectPtr((rabbit::UserPointer)writef));
+	entry->append(rabbit::ObjectPtr((rabbit::UserPointer)readf));
+	classes->newSlot(key,rabbit::ObjectPtr(entry));
+	classes->newSlot(*o,key);
+	return SQ_OK;
+}
+
 void rabbit::sq_enabledebuginfo(rabbit::VirtualMachine* v, rabbit::Bool enable)
 {
 	_get_shared_state(v)->_debuginfo = enable?true:false;
 }
 
+void rabbit::sq_enableoptimizer(rabbit::VirtualMachine* v, rabbit::Bool enable)
+{
+	_get_shared_state(v)->_optimizebytecode = enable?true:false;
+}
+
+void rabbit::sq_enablesuperinstructions(rabbit::VirtualMachine* v, rabbit::Bool enable)
+{
+	_get_shared_state(v)->_superinstructions = enable?true:false;
+}
+
 void rabbit::sq_notifyallexceptions(rabbit::VirtualMachine* v, rabbit::Bool enable)
 {
 	_get_shared_state(v)->_notifyallexceptions = enable?true:false;
@@ -181,7 +323,7 @@ uint64_t rabbit::sq_getrefcount(rabbit::VirtualMachine* v,rabbit::Object *po)
 	if(po->isRefCounted() == false) {
 		return 0;
 	}
-	return po->_unVal.pRefCounted->refCountget();
+	return po->toRefCounted()->refCountget();
 }
 
 rabbit::Bool rabbit::sq_release(rabbit::VirtualMachine* v,rabbit::Object *po)
@@ -189,7 +331,7 @@ rabbit::Bool rabbit::sq_release(rabbit::VirtualMachine* v,rabbit::Object *po)
 	if(po->isRefCounted() == false) {
 		return SQTrue;
 	}
-	bool ret = (po->_unVal.pRefCounted->refCountget() <= 1) ? SQTrue : SQFalse;
+	bool ret = (po->toRefCounted()->refCountget() <= 1) ? SQTrue : SQFalse;
 	po->releaseRef();
 	return ret; //the ret val doesn't work(and cannot be fixed)
 }
@@ -199,7 +341,7 @@ uint64_t rabbit::sq_getvmrefcount(rabbit::VirtualMachine* SQ_UNUSED_ARG(v), cons
 	if(po->isRefCounted() == false) {
 		return 0;
 	}
-	return po->_unVal.pRefCounted->refCountget();
+	return po->toRefCounted()->refCountget();
 }
 
 const char * rabbit::sq_objtostring(const rabbit::Object *o)
@@ -288,7 +430,7 @@ rabbit::UserPointer rabbit::sq_newuserdata(rabbit::VirtualMachine* v,uint64_t si
 
 void rabbit::sq_newtable(rabbit::VirtualMachine* v)
 {
-	v->push(rabbit::Table::create(_get_shared_state(v), 0));
+	v->push(rabbit::Table::createShaped(_get_shared_state(v), 0));
 }
 
 void rabbit::sq_newtableex(rabbit::VirtualMachine* v,int64_t initialcapacity)
@@ -444,6 +586,19 @@ rabbit::Result rabbit::sq_setnativeclosurename(rabbit::VirtualMachine* v,int64_t
 	return sq_throwerror(v,"the object is not a nativeclosure");
 }
 
+rabbit::Result rabbit::sq_bindnative(rabbit::VirtualMachine* v,int64_t idx,const char *scope,const char *name)
+{
+	rabbit::Object o = stack_get(v, idx);
+	if(o.isNativeClosure() == false) {
+		return sq_throwerror(v,"the object is not a nativeclosure");
+	}
+	if(!_get_shared_state(v)->bindNative(scope,name,o.toNativeClosure()->_function)) {
+		v->raise_error("the native key '%s.%s' is already bound to another function",scope,name);
+		return SQ_ERROR;
+	}
+	return SQ_OK;
+}
+
 rabbit::Result rabbit::sq_setparamscheck(rabbit::VirtualMachine* v,int64_t nparamscheck,const char *typemask)
 {
 	rabbit::Object o = stack_get(v, -1);
@@ -480,7 +635,7 @@ rabbit::Result rabbit::sq_bindenv(rabbit::VirtualMachine* v,int64_t idx)
 	     && env.isInstance() == false) {
 		return sq_throwerror(v,"invalid environment");
 	}
-	rabbit::WeakRef *w = env.toRefCounted()->getWeakRef(env.getType());
+	rabbit::WeakRef *w = env.toRefCounted()->getWeakRef(_get_shared_state(v), env.getType());
 	rabbit::ObjectPtr ret;
 	if(o.isClosure() == true) {
 		rabbit::Closure *c = o.toClosure()->clone();
@@ -490,6 +645,7 @@ rabbit::Result rabbit::sq_bindenv(rabbit::VirtualMachine* v,int64_t idx)
 		if(o.toClosure()->_base) {
 			c->_base = o.toClosure()->_base;
 			__ObjaddRef(c->_base);
+			_get_shared_state(v)->gcBarrier(c->_base);
 		}
 		ret = c;
 	}
@@ -529,7 +685,7 @@ rabbit::Result rabbit::sq_setclosureroot(rabbit::VirtualMachine* v,int64_t idx)
 		return sq_throwerror(v, "closure expected");
 	}
 	if(o.isTable() == true) {
-		c.toClosure()->setRoot(o.toTable()->getWeakRef(rabbit::OT_TABLE));
+		c.toClosure()->setRoot(o.toTable()->getWeakRef(_get_shared_state(v), rabbit::OT_TABLE));
 		v->pop();
 		return SQ_OK;
 	}
@@ -1182,8 +1338,7 @@ void rabbit::sq_pushobject(rabbit::VirtualMachine* v,rabbit::Object obj)
 
 void rabbit::sq_resetobject(rabbit::Object *po)
 {
-	po->_unVal.pUserPointer = NULL;
-	po->_type = rabbit::OT_NULL;
+	po->setNull();
 }
 
 rabbit::Result rabbit::sq_throwerror(rabbit::VirtualMachine* v,const char *err)
@@ -1213,10 +1368,9 @@ void rabbit::sq_getlasterror(rabbit::VirtualMachine* v)
 rabbit::Result rabbit::sq_reservestack(rabbit::VirtualMachine* v,int64_t nsize)
 {
 	if (((uint64_t)v->_top + nsize) > v->_stack.size()) {
-		if(v->_nmetamethodscall) {
-			return sq_throwerror(v,"cannot resize stack while in a metamethod");
+		if(!v->resizeStack(v->_top + nsize)) {
+			return sq_throwerror(v,"stack overflow");
 		}
-		v->_stack.resize(v->_stack.size() + ((v->_top + nsize) - v->_stack.size()));
 	}
 	return SQ_OK;
 }
@@ -1305,6 +1459,27 @@ rabbit::Result rabbit::sq_wakeupvm(rabbit::VirtualMachine* v,rabbit::Bool wakeup
 	return SQ_OK;
 }
 
+void rabbit::sq_setexecutionbudget(rabbit::VirtualMachine* v,int64_t budget,int64_t mode)
+{
+	v->_budgetlimited = budget >= 0;
+	v->_budget = budget >= 0 ? budget : INT64_MAX;
+	v->_budgetmode = mode;
+	v->_interrupted.store(false);
+}
+
+int64_t rabbit::sq_getexecutionbudget(rabbit::VirtualMachine* v)
+{
+	if(!v->_budgetlimited) {
+		return -1;
+	}
+	return v->_budget > 0 ? v->_budget : 0;
+}
+
+void rabbit::sq_interruptvm(rabbit::VirtualMachine* v)
+{
+	v->_interrupted.store(true);
+}
+
 void rabbit::sq_setreleasehook(rabbit::VirtualMachine* v,int64_t idx,SQRELEASEHOOK hook)
 {
 	rabbit::ObjectPtr &ud=stack_get(v,idx);
@@ -1353,13 +1528,87 @@ char * rabbit::sq_getscratchpad(rabbit::VirtualMachine* v,int64_t minsize)
 
 rabbit::Result rabbit::sq_resurrectunreachable(rabbit::VirtualMachine* v)
 {
-	return sq_throwerror(v,"sq_resurrectunreachable requires a garbage collector build");
+	_get_shared_state(v)->resurrectUnreachable(v);
+	return SQ_OK;
 }
 
-// TODO: remove this...
 int64_t rabbit::sq_collectgarbage(rabbit::VirtualMachine* v)
 {
-	return -1;
+	return _get_shared_state(v)->collectGarbage(v);
+}
+
+rabbit::Bool rabbit::sq_gcstep(rabbit::VirtualMachine* v,int64_t budget_us)
+{
+	return _get_shared_state(v)->gcStep(v, budget_us)?SQTrue:SQFalse;
+}
+
+rabbit::Result rabbit::sq_getgcstats(rabbit::VirtualMachine* v,rabbit::GcStats *stats)
+{
+	*stats = _get_shared_state(v)->_gc_stats;
+	return SQ_OK;
+}
+
+void rabbit::sq_setmemorylimit(rabbit::VirtualMachine* v,int64_t bytes)
+{
+	rabbit::SharedState *ss = _get_shared_state(v);
+	ss->_mem_stats.limit = bytes > 0 ? bytes : 0;
+	ss->_mem_threshold = ss->_mem_stats.limit;
+	ss->_mem_exceeded = ss->_mem_stats.limit != 0 && ss->_mem_stats.used > ss->_mem_stats.limit;
+}
+
+rabbit::Result rabbit::sq_getmemorystats(rabbit::VirtualMachine* v,rabbit::MemoryStats *stats)
+{
+	*stats = _get_shared_state(v)->_mem_stats;
+	return SQ_OK;
+}
+
+rabbit::Result rabbit::sq_getopcodestats(rabbit::VirtualMachine* v)
+{
+#ifdef SQ_PROFILE_OPCODES
+	rabbit::SharedState *ss = _get_shared_state(v);
+	sq_newtable(v);
+	for(int64_t iii=0; iii<SQ_OPCODE_COUNT; ++iii) {
+		sq_pushstring(v, g_InstrDesc[iii].name, -1);
+		sq_pushinteger(v, (int64_t)ss->_opcodecounts[iii]);
+		sq_newslot(v, -3, SQFalse);
+	}
+	return SQ_OK;
+#else
+	return sq_throwerror(v,"opcode statistics are not compiled in (SQ_PROFILE_OPCODES)");
+#endif
+}
+
+rabbit::Result rabbit::sq_getopcodepairstats(rabbit::VirtualMachine* v)
+{
+#ifdef SQ_PROFILE_OPCODES
+	rabbit::SharedState *ss = _get_shared_state(v);
+	char name[64];
+	sq_newtable(v);
+	for(int64_t iii=0; iii<SQ_OPCODE_COUNT; ++iii) {
+		for(int64_t jjj=0; jjj<SQ_OPCODE_COUNT; ++jjj) {
+			if(ss->_opcodepairs[iii][jjj] == 0) {
+				continue;
+			}
+			snprintf(name, sizeof(name), "%s %s", g_InstrDesc[iii].name, g_InstrDesc[jjj].name);
+			sq_pushstring(v, name, -1);
+			sq_pushinteger(v, (int64_t)ss->_opcodepairs[iii][jjj]);
+			sq_newslot(v, -3, SQFalse);
+		}
+	}
+	return SQ_OK;
+#else
+	return sq_throwerror(v,"opcode statistics are not compiled in (SQ_PROFILE_OPCODES)");
+#endif
+}
+
+void rabbit::sq_resetopcodestats(rabbit::VirtualMachine* v)
+{
+#ifdef SQ_PROFILE_OPCODES
+	rabbit::SharedState *ss = _get_shared_state(v);
+	memset(ss->_opcodecounts, 0, sizeof(ss->_opcodecounts));
+	memset(ss->_opcodepairs, 0, sizeof(ss->_opcodepairs));
+	ss->_opcodeprev = NULL;
+#endif
 }
 
 rabbit::Result rabbit::sq_getcallee(rabbit::VirtualMachine* v)
@@ -1574,7 +1823,7 @@ void rabbit::sq_weakref(rabbit::VirtualMachine* v,int64_t idx)
 {
 	rabbit::Object &o=stack_get(v,idx);
 	if (o.isRefCounted() == true) {
-		v->push(o.toRefCounted()->getWeakRef(o.getType()));
+		v->push(o.toRefCounted()->getWeakRef(_get_shared_state(v), o.getType()));
 		return;
 	}
 	v->push(o);
@@ -1627,27 +1876,14 @@ rabbit::Result rabbit::sq_next(rabbit::VirtualMachine* v,int64_t idx)
 	return SQ_ERROR;
 }
 
-namespace rabbit {
-	struct BufState{
-		const char *buf;
-		int64_t ptr;
-		int64_t size;
-	};
-	
-	int64_t buf_lexfeed(rabbit::UserPointer file)
-	{
-		BufState *buf=(BufState*)file;
-		if(buf->size<(buf->ptr+1))
-			return 0;
-		return buf->buf[buf->ptr++];
-	}
-}
 rabbit::Result rabbit::sq_compilebuffer(rabbit::VirtualMachine* v,const char *s,int64_t size,const char *sourcename,rabbit::Bool raiseerror) {
-	BufState buf;
-	buf.buf = s;
-	buf.size = size;
-	buf.ptr = 0;
-	return sq_compile(v, buf_lexfeed, &buf, sourcename, raiseerror);
+	rabbit::ObjectPtr o;
+	//the lexer scans 's' in place
+	if(compile(v, s, size, sourcename, o, raiseerror?true:false, _get_shared_state(v)->_debuginfo)) {
+		v->push(rabbit::Closure::create(_get_shared_state(v), o.toFunctionProto(), v->_roottable.toTable()->getWeakRef(_get_shared_state(v), rabbit::OT_TABLE)));
+		return SQ_OK;
+	}
+	return SQ_ERROR;
 }
 
 void rabbit::sq_move(rabbit::VirtualMachine* dest,rabbit::VirtualMachine* src,int64_t idx)
@@ -1673,15 +1909,15 @@ SQPRINTFUNCTION rabbit::sq_geterrorfunc(rabbit::VirtualMachine* v)
 
 void * rabbit::sq_malloc(uint64_t size)
 {
-	return SQ_MALLOC(size);
+	return sq_vm_malloc(size);
 }
 
 void * rabbit::sq_realloc(void* p,uint64_t oldsize,uint64_t newsize)
 {
-	return SQ_REALLOC(p,oldsize,newsize);
+	return sq_vm_realloc(p,oldsize,newsize);
 }
 
 void rabbit::sq_free(void *p,uint64_t size)
 {
-	SQ_FREE(p,size);
+	sq_vm_free(p,size);
 }
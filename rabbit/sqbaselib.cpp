@@ -23,10 +23,13 @@
 
 #include <stdlib.h>
 #include <stdarg.h>
+#include <errno.h>
 #include <ctype.h>
 #include <rabbit/StackInfos.hpp>
 
-static bool str2num(const char *s,rabbit::ObjectPtr &res,int64_t base)
+//'res' receives the number written in 's', false when it is not a number. An integer out of SQ_INTEGER_MIN..
+//SQ_INTEGER_MAX sets 'overflow' and is given as a float (the value of tofloat(), tointeger() raises an error)
+static bool str2num(const char *s,rabbit::ObjectPtr &res,int64_t base,bool &overflow)
 {
 	char *end;
 	const char *e = s;
@@ -47,8 +50,14 @@ static bool str2num(const char *s,rabbit::ObjectPtr &res,int64_t base)
 		res = r;
 	}
 	else{
-		int64_t r = int64_t(strtol(s,&end,(int)base));
+		errno = 0;
+		int64_t r = int64_t(strtoll(s,&end,(int)base));
 		if(s == end) return false;
+		if(errno == ERANGE || rabbit::Object::integerFits(r) == false) {
+			overflow = true;
+			res = base == 10 ? float_t(strtod(s,&end)) : float_t(r);
+			return true;
+		}
 		res = r;
 	}
 	return true;
@@ -108,6 +117,22 @@ static int64_t base_enabledebuginfo(rabbit::VirtualMachine* v)
 	return 0;
 }
 
+static int64_t base_enableoptimizer(rabbit::VirtualMachine* v)
+{
+	rabbit::ObjectPtr &o=stack_get(v,2);
+
+	sq_enableoptimizer(v,rabbit::VirtualMachine::IsFalse(o)?SQFalse:SQTrue);
+	return 0;
+}
+
+static int64_t base_enablesuperinstructions(rabbit::VirtualMachine* v)
+{
+	rabbit::ObjectPtr &o=stack_get(v,2);
+
+	sq_enablesuperinstructions(v,rabbit::VirtualMachine::IsFalse(o)?SQFalse:SQTrue);
+	return 0;
+}
+
 static int64_t __getcallstackinfos(rabbit::VirtualMachine* v,int64_t level)
 {
 	rabbit::StackInfos si;
@@ -248,10 +273,26 @@ static int64_t base_suspend(rabbit::VirtualMachine* v)
 	return sq_suspendvm(v);
 }
 
+//registercloneclass(class, name): the instances of a script class can be cloned (see sq_registercloneclass)
+static int64_t base_registercloneclass(rabbit::VirtualMachine* v)
+{
+	const char *name;
+	sq_getstring(v,3,&name);
+	if(SQ_FAILED(sq_registercloneclass(v,2,name,NULL,NULL)))
+		return SQ_ERROR;
+	return 0;
+}
+
 static int64_t base_array(rabbit::VirtualMachine* v)
 {
 	rabbit::Array *a;
 	rabbit::Object &size = stack_get(v,2);
+	if(size.toIntegerValue() < 0) {
+		return sq_throwerror(v, "negative size");
+	}
+	if(!_get_shared_state(v)->memAvailable(size.toIntegerValue() * sizeof(rabbit::ObjectPtr))) {
+		return sq_throwerror(v, "memory limit exceeded");
+	}
 	if(sq_gettop(v) > 2) {
 		a = rabbit::Array::create(_get_shared_state(v),0);
 		a->resize(size.toIntegerValue(),stack_get(v,3));
@@ -280,11 +321,98 @@ static int64_t base_callee(rabbit::VirtualMachine* v)
 	return sq_throwerror(v,"no closure in the calls stack");
 }
 
+static int64_t base_collectgarbage(rabbit::VirtualMachine* v)
+{
+	sq_pushinteger(v, sq_collectgarbage(v));
+	return 1;
+}
+
+static int64_t base_gcstep(rabbit::VirtualMachine* v)
+{
+	int64_t budget;
+	sq_getinteger(v, 2, &budget);
+	sq_pushbool(v, sq_gcstep(v, budget));
+	return 1;
+}
+
+static int64_t base_setmemorylimit(rabbit::VirtualMachine* v)
+{
+	int64_t bytes;
+	sq_getinteger(v, 2, &bytes);
+	sq_setmemorylimit(v, bytes);
+	return 0;
+}
+
+//budget of safe points of the calling thread, the exhausted budget raises a catchable error (SQ_BUDGET_ERROR)
+static int64_t base_setexecutionbudget(rabbit::VirtualMachine* v)
+{
+	int64_t budget;
+	sq_getinteger(v, 2, &budget);
+	sq_setexecutionbudget(v, budget, SQ_BUDGET_ERROR);
+	return 0;
+}
+
+static int64_t base_getmemorystats(rabbit::VirtualMachine* v)
+{
+	rabbit::MemoryStats stats;
+	sq_getmemorystats(v, &stats);
+	sq_newtable(v);
+	sq_pushstring(v, "used", -1);
+	sq_pushinteger(v, stats.used);
+	sq_newslot(v, -3, SQFalse);
+	sq_pushstring(v, "peak", -1);
+	sq_pushinteger(v, stats.peak);
+	sq_newslot(v, -3, SQFalse);
+	sq_pushstring(v, "limit", -1);
+	sq_pushinteger(v, stats.limit);
+	sq_newslot(v, -3, SQFalse);
+	sq_pushstring(v, "types", -1);
+	sq_newtable(v);
+	for(int64_t iii=0; iii<rabbit::MEM_LAST; ++iii) {
+		sq_pushstring(v, rabbit::memoryTypeName((rabbit::MemoryType)iii), -1);
+		sq_pushinteger(v, stats.typeused[iii]);
+		sq_newslot(v, -3, SQFalse);
+	}
+	sq_newslot(v, -3, SQFalse);
+	return 1;
+}
+
+// null when the opcodes are not counted (build without SQ_PROFILE_OPCODES)
+static int64_t base_getopcodestats(rabbit::VirtualMachine* v)
+{
+	if(SQ_FAILED(sq_getopcodestats(v))) {
+		return 0;
+	}
+	return 1;
+}
+
+static int64_t base_getopcodepairstats(rabbit::VirtualMachine* v)
+{
+	if(SQ_FAILED(sq_getopcodepairstats(v))) {
+		return 0;
+	}
+	return 1;
+}
+
+static int64_t base_resetopcodestats(rabbit::VirtualMachine* v)
+{
+	sq_resetopcodestats(v);
+	return 0;
+}
+
+static int64_t base_resurrectunreachable(rabbit::VirtualMachine* v)
+{
+	sq_resurrectunreachable(v);
+	return 1;
+}
+
 static const rabbit::RegFunction base_funcs[]={
 	//generic
 	{"seterrorhandler",base_seterrorhandler,2, NULL},
 	{"setdebughook",base_setdebughook,2, NULL},
 	{"enabledebuginfo",base_enabledebuginfo,2, NULL},
+	{"enableoptimizer",base_enableoptimizer,2, NULL},
+	{"enablesuperinstructions",base_enablesuperinstructions,2, NULL},
 	{"getstackinfos",base_getstackinfos,2, ".n"},
 	{"getroottable",base_getroottable,1, NULL},
 	{"setroottable",base_setroottable,2, NULL},
@@ -296,9 +424,19 @@ static const rabbit::RegFunction base_funcs[]={
 	{"compilestring",base_compilestring,-2, ".ss"},
 	{"newthread",base_newthread,2, ".c"},
 	{"suspend",base_suspend,-1, NULL},
+	{"registercloneclass",base_registercloneclass,3, ".ys"},
 	{"array",base_array,-2, ".n"},
 	{"type",base_type,2, NULL},
 	{"callee",base_callee,0,NULL},
+	{"collectgarbage",base_collectgarbage,0, NULL},
+	{"resurrectunreachable",base_resurrectunreachable,0, NULL},
+	{"gcstep",base_gcstep,2, ".n"},
+	{"setmemorylimit",base_setmemorylimit,2, ".n"},
+	{"setexecutionbudget",base_setexecutionbudget,2, ".n"},
+	{"getmemorystats",base_getmemorystats,1, NULL},
+	{"getopcodestats",base_getopcodestats,1, NULL},
+	{"getopcodepairstats",base_getopcodepairstats,1, NULL},
+	{"resetopcodestats",base_resetopcodestats,1, NULL},
 	{"dummy",base_dummy,0,NULL},
 	{NULL,(SQFUNCTION)0,0,NULL}
 };
@@ -311,6 +449,7 @@ void sq_base_register(rabbit::VirtualMachine* v)
 		sq_pushstring(v,base_funcs[i].name,-1);
 		sq_newclosure(v,base_funcs[i].f,0);
 		sq_setnativeclosurename(v,-1,base_funcs[i].name);
+		sq_bindnative(v,-1,"base",base_funcs[i].name);
 		sq_setparamscheck(v,base_funcs[i].nparamscheck,base_funcs[i].typemask);
 		sq_newslot(v,-3, SQFalse);
 		i++;
@@ -346,7 +485,8 @@ static int64_t default_delegate_tofloat(rabbit::VirtualMachine* v)
 	switch(o.getType()){
 	case rabbit::OT_STRING:{
 		rabbit::ObjectPtr res;
-		if(str2num(o.getStringValue(),res,10)){
+		bool overflow = false;
+		if(str2num(o.getStringValue(),res,10,overflow)){
 			v->push(rabbit::ObjectPtr(res.toFloatValue()));
 			break;
 		}}
@@ -376,7 +516,11 @@ static int64_t default_delegate_tointeger(rabbit::VirtualMachine* v)
 	switch(o.getType()){
 	case rabbit::OT_STRING:{
 		rabbit::ObjectPtr res;
-		if(str2num(o.getStringValue(),res,base)){
+		bool overflow = false;
+		if(str2num(o.getStringValue(),res,base,overflow)){
+			if(overflow == true) {
+				return sq_throwerror(v, "integer out of range");
+			}
 			v->push(rabbit::ObjectPtr(res.toIntegerValue()));
 			break;
 		}}
@@ -384,6 +528,9 @@ static int64_t default_delegate_tointeger(rabbit::VirtualMachine* v)
 		break;
 	case rabbit::OT_INTEGER:
 	case rabbit::OT_FLOAT:
+		if(rabbit::Object::integerFits(o.toIntegerValue()) == false) {
+			return sq_throwerror(v, "integer out of range");
+		}
 		v->push(rabbit::ObjectPtr(o.toIntegerValue()));
 		break;
 	case rabbit::OT_BOOL:
@@ -586,6 +733,9 @@ static int64_t array_resize(rabbit::VirtualMachine* v)
 
 		if(sq_gettop(v) > 2)
 			fill = stack_get(v, 3);
+		if(!_get_shared_state(v)->memAvailable((sz - o.toArray()->size()) * (int64_t)sizeof(rabbit::ObjectPtr))) {
+			return sq_throwerror(v, "memory limit exceeded");
+		}
 		o.toArray()->resize(sz,fill);
 		sq_settop(v, 1);
 		return 1;
@@ -19,6 +19,30 @@ typedef float float_t;
 	#define SQ_ALIGNMENT 8
 #endif
 
+// threaded-code dispatch of the virtual machine (labels as values), define SQ_NO_COMPUTED_GOTO to force the portable switch
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(SQ_NO_COMPUTED_GOTO) && !defined(SQ_COMPUTED_GOTO)
+	#define SQ_COMPUTED_GOTO
+#endif
+
+// SQ_PROFILE_OPCODES counts the executed instructions per opcode in the shared state (see sq_getopcodestats),
+// it costs an increment per instruction and is off by default
+
+// SQ_TAGGED_OBJECT packs rabbit::Object in 64 bits (type tag in the top byte, value in the 56 low bits) instead of
+// the 16 bytes of the type + union layout. the accessors return values instead of references (no in place update).
+// integers are limited to SQ_INTEGER_MIN..SQ_INTEGER_MAX (56 bits): an arithmetic result, a literal or a conversion
+// (tointeger()) out of that range raises an error instead of wrapping, rabbit::Object::integerFits() tells if a value
+// is in range. the values given by the host (sq_pushinteger...) must be in range, they are truncated otherwise.
+#if defined(SQ_TAGGED_OBJECT) && defined(SQUSEDOUBLE)
+	#error "SQ_TAGGED_OBJECT can not store a double in the 56 bits payload, SQUSEDOUBLE is not supported"
+#endif
+#ifdef SQ_TAGGED_OBJECT
+	#define SQ_INTEGER_MIN (-(int64_t(1)<<55))
+	#define SQ_INTEGER_MAX ((int64_t(1)<<55)-1)
+#else
+	#define SQ_INTEGER_MIN INT64_MIN
+	#define SQ_INTEGER_MAX INT64_MAX
+#endif
+
 //max number of character for a printed number
 #define NUMBER_UINT8_MAX 50
 
@@ -46,6 +70,8 @@ namespace rabbit {
 	class VirtualMachine;
 	class Delegable;
 	class FunctionInfo;
+	class GcStats;
+	class MemoryStats;
 	class StackInfos;
 	class MemberHandle;
 	class Instance;
@@ -53,6 +79,7 @@ namespace rabbit {
 	class Table;
 	class String;
 	class SharedState;
+	class Allocator;
 	class Closure;
 	class Generator;
 	class NativeClosure;
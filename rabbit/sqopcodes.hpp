@@ -104,8 +104,54 @@ enum SQOpcode
 	_OP_THROW=              0x39,
 	_OP_NEWSLOTA=           0x3A,
 	_OP_GETBASE=            0x3B,
-	_OP_CLOSE=              0x3C
+	_OP_CLOSE=              0x3C,
+	// superinstructions (see FuncState::optimize and SharedState::_superinstructions)
+	_OP_ADDINT=             0x3D,
+	_OP_SUBINT=             0x3E,
+	_OP_JCMPK=              0x3F,
+	_OP_GETGET=             0x40,
+	// numeric for loop (see Compiler::ForStatement)
+	_OP_FORPREP=            0x41,
+	_OP_FORLOOP=            0x42,
+	// quickened variants: written in place of the generic opcode by the virtual machine for the operand types it met,
+	// never part of a closure stream or of a bytecode image (see FunctionProto::dequicken)
+	_OP_ADDI=               0x43,
+	_OP_ADDF=               0x44,
+	_OP_ADDS=               0x45,
+	_OP_SUBI=               0x46,
+	_OP_SUBF=               0x47,
+	_OP_MULI=               0x48,
+	_OP_MULF=               0x49,
+	_OP_DIVF=               0x4A,
+	_OP_JCMPI=              0x4B,
+	_OP_JCMPF=              0x4C,
+	_OP_EQI=                0x4D,
+	_OP_NEI=                0x4E
 };
+//first quickened opcode
+#define SQ_OPCODE_QUICKENED _OP_ADDI
+//number of opcodes: the dispatch table and the bytecode streams (SQ_CLOSURESTREAM_VERSION) depend on it
+#define SQ_OPCODE_COUNT (_OP_NEI+1)
+
+//generic opcode of a quickened one
+inline SQOpcode sq_basicopcode(SQOpcode op) {
+	switch(op) {
+		case _OP_ADDI: case _OP_ADDF: case _OP_ADDS: return _OP_ADD;
+		case _OP_SUBI: case _OP_SUBF: return _OP_SUB;
+		case _OP_MULI: case _OP_MULF: return _OP_MUL;
+		case _OP_DIVF: return _OP_DIV;
+		case _OP_JCMPI: case _OP_JCMPF: return _OP_JCMP;
+		case _OP_EQI: return _OP_EQ;
+		case _OP_NEI: return _OP_NE;
+		default: return op;
+	}
+}
+
+//_arg3 of _OP_FORPREP/_OP_FORLOOP: the CmpOP of the condition in the low bits, the step of the counter (-8..7) in
+//the high bits, SQ_FORLOOP_SUB when the step is subtracted (i -= k) instead of added (i++, i += k)
+#define SQ_FORLOOP_CMP(arg3) ((CmpOP)((arg3)&0x07))
+#define SQ_FORLOOP_SUB 0x08
+#define SQ_FORLOOP_STEP(arg3) ((int64_t)(((signed char)(arg3))>>4))
 
 #define NEW_SLOT_ATTRIBUTES_FLAG	0x01
 #define NEW_SLOT_STATIC_FLAG		0x02
@@ -12,12 +12,14 @@ void *sq_vm_malloc(uint64_t size);
 void *sq_vm_realloc(void *p,uint64_t oldsize,uint64_t size);
 void sq_vm_free(void *p,uint64_t size);
 
-#define sq_new(__ptr,__type) {__ptr=(__type *)sq_vm_malloc(sizeof(__type));new ((char*)__ptr) __type;}
-#define sq_delete(__ptr,__type) {((__type*)__ptr)->~__type();sq_vm_free(__ptr,sizeof(__type));}
-
-#define SQ_MALLOC(__size) sq_vm_malloc((__size));
-#define SQ_FREE(__ptr,__size) sq_vm_free((__ptr),(__size));
-#define SQ_REALLOC(__ptr,__oldsize,__size) sq_vm_realloc((__ptr),(__oldsize),(__size));
+// allocations of a shared state go through its allocator (SharedState::_alloc, see rabbit::Allocator)
+// and are accounted in the rabbit::MemoryType '__memtype' (see SharedState::memAlloc)
+#define sq_new(__ss,__memtype,__ptr,__type) {__ptr=(__type *)(__ss)->memAlloc((__memtype),sizeof(__type));new ((char*)__ptr) __type;}
+#define sq_delete(__ss,__memtype,__ptr,__type) {rabbit::SharedState *__sstate=(__ss);((__type*)__ptr)->~__type();__sstate->memFree((__memtype),__ptr,sizeof(__type));}
+
+#define SQ_MALLOC(__ss,__memtype,__size) (__ss)->memAlloc((__memtype),(__size));
+#define SQ_FREE(__ss,__memtype,__ptr,__size) (__ss)->memFree((__memtype),(__ptr),(__size));
+#define SQ_REALLOC(__ss,__memtype,__ptr,__oldsize,__size) (__ss)->memRealloc((__memtype),(__ptr),(__oldsize),(__size));
 
 #define sq_aligning(v) (((size_t)(v) + (SQ_ALIGNMENT-1)) & (~(SQ_ALIGNMENT-1)))
 